@@ -0,0 +1,65 @@
+; application processor entry. smp.c copies everything between
+; ap_trampoline_start and ap_trampoline_end to AP_TRAMPOLINE (0x8000) and
+; points the SIPI there, so the code below runs at that address, not at
+; the one it was linked for; every absolute reference goes through AP().
+
+AP_BASE equ 0x8000
+%define AP(x) (AP_BASE + ((x) - ap_trampoline_start))
+
+section .text
+
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_stack_slot
+global ap_entry_slot
+
+bits 16
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    o32 lgdt [AP(ap_gdt_ptr)]
+
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:AP(ap_protected)
+
+bits 32
+ap_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    mov esp, [AP(ap_stack_slot)]
+    mov eax, [AP(ap_entry_slot)]
+    call eax                        ; ap_main(), never returns
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; temporary flat GDT, same layout as the first three entries of gdt.c's,
+; until ap_main() loads the real one
+align 8
+ap_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF           ; code
+    dq 0x00CF92000000FFFF           ; data
+ap_gdt_ptr:
+    dw 3 * 8 - 1
+    dd AP(ap_gdt)
+
+; filled in by smp_init() before each SIPI
+align 4
+ap_stack_slot:
+    dd 0
+ap_entry_slot:
+    dd 0
+ap_trampoline_end:
+
+section .note.GNU-stack noalloc noexec nowrite progbits
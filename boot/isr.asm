@@ -0,0 +1,188 @@
+bits 32
+
+; interrupt entry stubs, every vector funnels into isr_dispatch(regs_t*)
+
+section .text
+extern isr_dispatch
+extern sysenter_dispatch
+
+%macro ISR_NOERR 1
+global isr%1
+isr%1:
+    push dword 0
+    push dword %1
+    jmp isr_common
+%endmacro
+
+%macro ISR_ERR 1
+global isr%1
+isr%1:
+    push dword %1
+    jmp isr_common
+%endmacro
+
+; CPU exceptions (8, 10-14, 17, 21, 29, 30 push an error code)
+ISR_NOERR 0
+ISR_NOERR 1
+ISR_NOERR 2
+ISR_NOERR 3
+ISR_NOERR 4
+ISR_NOERR 5
+ISR_NOERR 6
+ISR_NOERR 7
+ISR_ERR   8
+ISR_NOERR 9
+ISR_ERR   10
+ISR_ERR   11
+ISR_ERR   12
+ISR_ERR   13
+ISR_ERR   14
+ISR_NOERR 15
+ISR_NOERR 16
+ISR_ERR   17
+ISR_NOERR 18
+ISR_NOERR 19
+ISR_NOERR 20
+ISR_ERR   21
+ISR_NOERR 22
+ISR_NOERR 23
+ISR_NOERR 24
+ISR_NOERR 25
+ISR_NOERR 26
+ISR_NOERR 27
+ISR_NOERR 28
+ISR_ERR   29
+ISR_ERR   30
+ISR_NOERR 31
+
+; legacy PIC IRQs 0-15, remapped to 32-47
+ISR_NOERR 32
+ISR_NOERR 33
+ISR_NOERR 34
+ISR_NOERR 35
+ISR_NOERR 36
+ISR_NOERR 37
+ISR_NOERR 38
+ISR_NOERR 39
+ISR_NOERR 40
+ISR_NOERR 41
+ISR_NOERR 42
+ISR_NOERR 43
+ISR_NOERR 44
+ISR_NOERR 45
+ISR_NOERR 46
+ISR_NOERR 47
+
+; local APIC: timer and reschedule IPI
+ISR_NOERR 48
+ISR_NOERR 49
+
+; int 0x80, the only gate user code may call
+global isr_syscall
+isr_syscall:
+    push dword 0
+    push dword 0x80
+    jmp isr_common
+
+; the local APIC's spurious vector must not be EOI'd, just return
+global isr_spurious
+isr_spurious:
+    iret
+
+; GDT layout from idt.h: each CPU's per-CPU segment is MAX_CPUS entries
+; after its TSS, so TR tells us which %gs to load
+PERCPU_FROM_TSS equ 8 * 8   ; 8 * MAX_CPUS
+REGS_CS         equ 60      ; offsetof(regs_t, cs)
+
+isr_common:
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    cld
+    test dword [esp + REGS_CS], 3
+    jz .from_kernel         ; gs already selects this CPU's per-CPU data
+    str ax
+    add ax, PERCPU_FROM_TSS
+    mov gs, ax
+.from_kernel:
+
+    push esp                ; regs_t*
+    call isr_dispatch
+    add esp, 4
+
+    test dword [esp + REGS_CS], 3
+    jz .to_kernel
+    pop gs                  ; the user's own
+    jmp .restore
+.to_kernel:
+    add esp, 4              ; gs: the task may have moved to another CPU
+.restore:
+    pop fs
+    pop es
+    pop ds
+    popa
+    add esp, 8              ; int_no + err_code
+    iret
+
+; SYSENTER lands here with IF clear and esp = MSR_SYSENTER_ESP, which
+; syscall.c points at this CPU's tss.esp0. build the same regs_t frame
+; an int 0x80 from ring 3 would, the caller's esp coming in ebp (see
+; include/syscall.h), and leave by SYSEXIT: eip in edx, esp in ecx.
+global sysenter_entry
+sysenter_entry:
+    mov esp, [esp]          ; the running task's kernel stack
+    push dword 0x23         ; ss
+    push ebp                ; useresp
+    push dword 0x202        ; eflags: what SYSEXIT after sti leaves
+    push dword 0x1B         ; cs
+    push dword 0            ; eip, read off the user stack by sysenter_dispatch
+    push dword 0            ; err_code
+    push dword 0x80         ; int_no
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    str ax
+    add ax, PERCPU_FROM_TSS
+    mov gs, ax
+    cld
+
+    push esp                ; regs_t*
+    call sysenter_dispatch
+    add esp, 4
+
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    popa
+    add esp, 8              ; int_no + err_code
+    mov edx, [esp]          ; eip
+    mov ecx, [esp + 12]     ; useresp
+    sti                     ; takes effect after the next instruction,
+    sysexit                 ; so no interrupt sees a half-exited frame
+
+section .data
+align 4
+global isr_stub_table
+isr_stub_table:
+%assign i 0
+%rep 50
+    dd isr%+i
+%assign i i+1
+%endrep
+
+section .note.GNU-stack noalloc noexec nowrite progbits
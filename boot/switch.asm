@@ -0,0 +1,30 @@
+bits 32
+
+section .text
+
+; void switch_to(u32* prev_esp, u32 next_esp)
+;
+; saves the callee-saved registers on the current kernel stack, stores the
+; stack pointer in *prev_esp and resumes whatever was saved on next_esp.
+; a fresh task's stack is laid out by proc_build_frame() in process.c so the
+; final ret lands in proc_trampoline.
+global switch_to
+switch_to:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+
+    push ebp
+    push ebx
+    push esi
+    push edi
+
+    mov [eax], esp
+    mov esp, edx
+
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+section .note.GNU-stack noalloc noexec nowrite progbits
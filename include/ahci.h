@@ -0,0 +1,86 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include "kernel.h"
+
+/* ---------------------------------------------------------------
+ * AHCI: a SATA controller whose registers are memory in BAR5 (ABAR).
+ * each port has a command list of up to 32 slots in RAM, each slot
+ * pointing at a command table (the command FIS and a PRD list), and a
+ * buffer the HBA copies the drive's FISes into. a command is started
+ * by setting its bit in PxCI; with NCQ (FPDMA QUEUED) its bit is set
+ * in PxSACT first and stays set until the drive reports it done, so
+ * the drive holds up to 32 at once and finishes them in its own order.
+ * --------------------------------------------------------------- */
+
+/* HBA registers */
+#define AHCI_CAP            0x00
+#define AHCI_GHC            0x04
+#define AHCI_IS             0x08
+#define AHCI_PI             0x0C
+#define AHCI_VS             0x10
+
+#define AHCI_CAP_NCS(cap)   ((((cap) >> 8) & 31) + 1)   /* command slots */
+#define AHCI_CAP_SSS        (1u << 27)                  /* staggered spin-up */
+#define AHCI_CAP_SNCQ       (1u << 30)
+#define AHCI_GHC_HR         (1u << 0)
+#define AHCI_GHC_IE         (1u << 1)
+#define AHCI_GHC_AE         (1u << 31)
+
+/* port registers, 0x80 apart from 0x100 */
+#define AHCI_PORT(n)        (0x100 + (n) * 0x80)
+#define AHCI_PxCLB          0x00
+#define AHCI_PxCLBU         0x04
+#define AHCI_PxFB           0x08
+#define AHCI_PxFBU          0x0C
+#define AHCI_PxIS           0x10
+#define AHCI_PxIE           0x14
+#define AHCI_PxCMD          0x18
+#define AHCI_PxTFD          0x20
+#define AHCI_PxSIG          0x24
+#define AHCI_PxSSTS         0x28
+#define AHCI_PxSERR         0x30
+#define AHCI_PxSACT         0x34
+#define AHCI_PxCI           0x38
+
+#define AHCI_PxCMD_ST       (1u << 0)
+#define AHCI_PxCMD_SUD      (1u << 1)
+#define AHCI_PxCMD_POD      (1u << 2)
+#define AHCI_PxCMD_FRE      (1u << 4)
+#define AHCI_PxCMD_FR       (1u << 14)
+#define AHCI_PxCMD_CR       (1u << 15)
+
+#define AHCI_PxIS_DHRS      (1u << 0)   /* D2H register FIS: a non-queued command ended */
+#define AHCI_PxIS_PSS       (1u << 1)
+#define AHCI_PxIS_DSS       (1u << 2)
+#define AHCI_PxIS_SDBS      (1u << 3)   /* set device bits: queued commands ended */
+#define AHCI_PxIS_IFS       (1u << 27)
+#define AHCI_PxIS_HBDS      (1u << 28)
+#define AHCI_PxIS_HBFS      (1u << 29)
+#define AHCI_PxIS_TFES      (1u << 30)  /* the drive said ERR */
+#define AHCI_PxIS_ERR       (AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_SSTS_DET_OK    3           /* device there, link up */
+#define AHCI_SIG_ATA        0x00000101
+
+/* in RAM: the command list, 32 headers of 32 bytes, 1 KiB aligned, and
+ * the received-FIS area after it in the same page */
+#define AHCI_MAX_SLOTS      32
+#define AHCI_CL_SIZE        1024
+#define AHCI_HDR_WRITE      (1u << 6)
+#define AHCI_HDR_PRDTL(n)   ((u32)(n) << 16)
+#define AHCI_CT_PRDT        0x80        /* the PRD list's offset in a command table */
+#define AHCI_PRDS           ((PAGE_SIZE - AHCI_CT_PRDT) / 16)   /* a table is one page */
+#define AHCI_PRD_MAX_BYTES  0x400000    /* 4 MiB a PRD */
+
+#define AHCI_FIS_H2D        0x27
+#define AHCI_FIS_CMD        0x80        /* the C bit: a command, not control */
+
+/* ATA commands on top of ata.h's */
+#define AHCI_CMD_READ_FPDMA   0x60
+#define AHCI_CMD_WRITE_FPDMA  0x61
+
+#define AHCI_TIMEOUT        5000        /* ms for polled commands and port stops */
+#define AHCI_LINK_TIMEOUT   20          /* ms for a link to come up */
+
+#endif /* AHCI_H */
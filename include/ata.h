@@ -24,6 +24,21 @@
 /* ATA commands */
 #define ATA_CMD_READ_PIO    0x20
 #define ATA_CMD_WRITE_PIO   0x30
+#define ATA_CMD_READ_PIO_EXT   0x24     /* the _EXT ones are 48-bit */
+#define ATA_CMD_WRITE_PIO_EXT  0x34
+#define ATA_CMD_READ_DMA_EXT   0x25
+#define ATA_CMD_WRITE_DMA_EXT  0x35
+#define ATA_CMD_READ_MULTIPLE_EXT  0x29
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_FLUSH_EXT   0xEA
+#define ATA_CMD_READ_MULTIPLE  0xC4
+#define ATA_CMD_WRITE_MULTIPLE 0xC5
+#define ATA_CMD_SET_MULTIPLE   0xC6
+#define ATA_CMD_WRITE_MULTIPLE_FUA 0xCE /* 48-bit */
+#define ATA_CMD_READ_DMA    0xC8
+#define ATA_CMD_WRITE_DMA   0xCA
+#define ATA_CMD_WRITE_DMA_FUA  0x3D     /* 48-bit */
+#define ATA_CMD_SET_FEATURES   0xEF
 #define ATA_CMD_IDENTIFY    0xEC
 #define ATA_CMD_FLUSH       0xE7
 
@@ -35,17 +50,48 @@
 #define ATA_STATUS_RDY      0x40
 #define ATA_STATUS_BSY      0x80
 
+/* bus-master IDE: the controller's BAR4, eight ports per channel */
+#define ATA_BM_COMMAND      0x00
+#define ATA_BM_STATUS       0x02
+#define ATA_BM_PRDT         0x04
+#define ATA_BM_CMD_START    0x01
+#define ATA_BM_CMD_READ     0x08        /* device to memory */
+#define ATA_BM_ST_ACTIVE    0x01
+#define ATA_BM_ST_ERR       0x02
+#define ATA_BM_ST_IRQ       0x04
+#define ATA_BM_ST_CAPABLE   0x20        /* master; << 1 for the slave */
+#define ATA_PRD_EOT         0x80000000
+#define ATA_PRD_MAX         1024        /* a 32 MiB transfer at any alignment */
+
+#define ATA_IRQ_PRIMARY     14
+#define ATA_IRQ_SECONDARY   15
+
 /* disk geometry */
 #define ATA_SECTOR_SIZE     512
-#define ATA_MAX_SECTORS     256
-#define ATA_TIMEOUT         100000
+#define ATA_MAX_SECTORS     256         /* per command with 28-bit LBA */
+#define ATA_MAX_SECTORS48   65536       /* and with 48-bit LBA: 32 MiB */
+#define ATA_LBA28_LIMIT     0x10000000  /* sectors a 28-bit command can reach */
+#define ATA_TIMEOUT         5000        /* ms for a drive to finish a step */
+#define ATA_DETECT_TIMEOUT  200         /* ms, IDENTIFY on what may be an empty channel */
+#define ATA_POLL_SPINS      2000        /* busy polls before ata_wait() sleeps */
+#define ATA_MULTIPLE_MAX    128         /* sectors per DRQ block we ask for at most */
 
 /* function prototypes */
 int ata_init(void);
-int ata_read_sectors(ata_disk_t* disk, u32 lba, u8 count, void* buffer);
-int ata_write_sectors(ata_disk_t* disk, u32 lba, u8 count, const void* buffer);
+int ata_read_sectors(ata_disk_t* disk, u32 lba, u32 count, void* buffer);
+int ata_write_sectors(ata_disk_t* disk, u32 lba, u32 count, const void* buffer);
+int ata_write_sectors_fua(ata_disk_t* disk, u32 lba, u32 count, const void* buffer);
+int ata_flush(ata_disk_t* disk);
+int ata_has_fua(ata_disk_t* disk);
 ata_disk_t* ata_get_primary(void);
 ata_disk_t* ata_get_secondary(void);
 void ata_reset(ata_disk_t* disk);
+u32  ata_sector_count(ata_disk_t* disk);
+u32  ata_max_sectors(ata_disk_t* disk);         /* the most one command moves */
+u8   ata_get_multiple(ata_disk_t* disk);
+u8   ata_set_multiple(ata_disk_t* disk, u8 sectors);
+int  ata_has_dma(ata_disk_t* disk);
+int  ata_set_dma(ata_disk_t* disk, int on);
+int  ata_set_irq(ata_disk_t* disk, int on);
 
 #endif /* ATA_H */
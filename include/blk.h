@@ -0,0 +1,144 @@
+#ifndef BLK_H
+#define BLK_H
+
+#include "kernel.h"
+#include "spinlock.h"
+#include "wait.h"
+
+/* ---------------------------------------------------------------
+ * the block layer: what a filesystem calls instead of a driver.
+ *
+ * a block_device is a disk some driver registered. I/O goes to it as
+ * bios (a run of sectors and the buffer they go to or come from),
+ * which queue as requests. a bio that continues a queued request in
+ * the same direction joins it, so the driver sees one command where
+ * the caller asked for several. the queue is dispatched in elevator
+ * order (LBA upward from where the last request ended, then back to
+ * the lowest), except that a request past its deadline goes first.
+ * blk_plug() holds dispatch back while a caller submits a batch.
+ *
+ * the drive's write cache stays on, so a write that has completed may
+ * only have reached the cache; a caller that needs ordering asks:
+ *   BLK_FUA      this write is on media when it completes
+ *   blk_flush()  a barrier: every write submitted before it is on
+ *                media once it completes, nothing after it is started
+ *                before that
+ * --------------------------------------------------------------- */
+
+#define BLK_FUA          0x1
+#define BIO_WRITE        0x2
+#define BIO_FLUSH        0x4            /* no data, count 0 */
+
+#define BLK_BUSY         1              /* from ops->submit */
+
+#define BLK_NAME_MAX     16
+#define BLK_MAX_SECTORS  65536          /* per request: 32 MiB */
+#define BLK_MAX_BIOS     128            /* per request, at most */
+#define BLK_READ_EXPIRE  (TIMER_HZ / 20)   /* ticks a read may wait out of order */
+#define BLK_WRITE_EXPIRE (TIMER_HZ / 2)
+#define BLK_SHOW_MAX     2048           /* text from blk_show() */
+
+typedef struct bio {
+    u32          lba;
+    u32          count;                 /* sectors */
+    void*        buf;                   /* kernel address */
+    u32          flags;                 /* BIO_WRITE, BLK_FUA, BIO_FLUSH */
+    int          error;
+    completion_t done;
+    volatile u32 released;              /* the layer is done touching it */
+    block_device_t* dev;
+    struct bio*  next;                  /* within its request, in LBA order */
+} bio_t;
+
+typedef struct blk_request {
+    u32    lba, count;
+    u32    flags;                       /* of its bios, which all agree */
+    u32    seq;                         /* submission order, for barriers */
+    u32    deadline;                    /* system_uptime */
+    u32    nbios;
+    bio_t* bios;
+    bio_t* last;
+    struct blk_request* next;
+} blk_request_t;
+
+/* submit starts rq and the driver calls blk_end_request() once it is
+ * done, before returning (a driver that sleeps in here) or later from
+ * its interrupt. a driver that says async may not sleep in submit,
+ * which can then run in that interrupt to start the next request.
+ * BLK_BUSY from submit is "no room just now": rq goes back on the
+ * queue until one of the driver's requests in flight ends, or the
+ * driver calls blk_kick() once it can take more.
+ * poll, if there is one, ends whatever has finished without the
+ * interrupt: blk_wait() spins on it with interrupts off (the boot-time
+ * mount) or on a device that has no interrupt.
+ * commit, if there is one, is called once the queue has handed over all
+ * it can: a driver that only queues commands in submit tells the device
+ * about the whole batch here, with one doorbell write */
+typedef struct {
+    int  (*submit)(block_device_t* dev, blk_request_t* rq);
+    void (*poll)(block_device_t* dev);
+    u8   async;
+    void (*commit)(block_device_t* dev);
+} blk_ops_t;
+
+typedef struct {
+    u32 reads, writes, flushes;         /* bios */
+    u32 read_sectors, write_sectors;
+    u32 requests;                       /* handed to the driver */
+    u32 merges;                         /* bios that joined a queued request */
+    u32 expired;                        /* went ahead of the elevator for their deadline */
+    u32 errors;
+    u32 max_depth;                      /* requests queued and in flight at once */
+    u64 depth_sum;                      /* the same as each bio arrived; / bios */
+} blk_stat_t;
+
+struct block_device {
+    char             name[BLK_NAME_MAX];
+    u32              sectors;
+    u32              max_sectors;       /* per request, at most BLK_MAX_SECTORS */
+    u32              max_bios;          /* per request, at most BLK_MAX_BIOS */
+    u32              boundary;          /* mask: bios of a request whose buffers are apart
+                                           meet only at addresses aligned to it, 0: anywhere */
+    u32              depth;             /* requests the driver takes at once */
+    const blk_ops_t* ops;
+    void*            driver_data;
+    u8               polled;            /* no interrupt: waiters call ops->poll */
+    u8               fua;               /* takes BLK_FUA; else blk_write() flushes after */
+
+    spinlock_t       lock;              /* irqsave: requests end in IRQs */
+    blk_request_t*   queue;             /* by LBA */
+    u32              queued;
+    u32              inflight;
+    u32              plugged;
+    u8               dispatching;       /* somebody is running the queue */
+    u8               rerun;             /* and it was kicked meanwhile */
+    u8               barrier;           /* a flush is in flight */
+    u32              head;              /* where the last request ended */
+    u32              seq;
+    u32              flush_seq;         /* 1 + seq of the newest flush queued, 0: none */
+    blk_stat_t       stat;
+    struct block_device* next;
+};
+
+/* drivers */
+int  blk_register(block_device_t* dev);
+void blk_end_request(block_device_t* dev, blk_request_t* rq, int error);
+void blk_kick(block_device_t* dev);     /* start what is queued */
+
+/* users */
+block_device_t* blk_lookup(const char* name);
+block_device_t* blk_first(void);        /* in registration order, then ->next */
+void blk_submit(block_device_t* dev, bio_t* bio);
+int  blk_wait(bio_t* bio);              /* 0 or -1 */
+void blk_plug(block_device_t* dev);
+void blk_unplug(block_device_t* dev);
+
+/* synchronous: bytes moved, or -1 */
+int  blk_read(block_device_t* dev, u32 lba, u32 count, void* buf);
+int  blk_write(block_device_t* dev, u32 lba, u32 count, const void* buf, u32 flags);
+int  blk_flush(block_device_t* dev);
+
+void blk_show(int fd);                  /* iostat */
+void blk_reset_stats(void);
+
+#endif /* BLK_H */
@@ -0,0 +1,59 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include "kernel.h"
+
+struct mm;
+
+#define ELF_MAGIC      0x464C457F      /* "\x7fELF" little endian */
+#define ELFCLASS32     1
+#define ELFDATA2LSB    1
+#define ET_EXEC        2
+#define EM_386         3
+
+#define PT_LOAD        1
+
+#define PF_X           0x1
+#define PF_W           0x2
+#define PF_R           0x4
+
+#define ELF_MAX_PHDRS  16
+
+typedef struct {
+    u32 magic;
+    u8  class;
+    u8  data;
+    u8  version;
+    u8  pad[9];
+    u16 type;
+    u16 machine;
+    u32 version2;
+    u32 entry;
+    u32 phoff;
+    u32 shoff;
+    u32 flags;
+    u16 ehsize;
+    u16 phentsize;
+    u16 phnum;
+    u16 shentsize;
+    u16 shnum;
+    u16 shstrndx;
+} __attribute__((packed)) elf32_ehdr_t;
+
+typedef struct {
+    u32 type;
+    u32 offset;
+    u32 vaddr;
+    u32 paddr;
+    u32 filesz;
+    u32 memsz;
+    u32 flags;
+    u32 align;
+} __attribute__((packed)) elf32_phdr_t;
+
+/* check the headers of the executable at inode and describe its
+ * PT_LOAD segments in mm; nothing is read beyond the headers until the
+ * program touches a page */
+int elf_load(struct mm* mm, int inode, u32* entry);
+
+#endif /* ELF_H */
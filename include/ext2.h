@@ -70,8 +70,9 @@ typedef struct {
     char name[255];
 } ext2_dirent_t;
 
-int ext2_mount(ata_disk_t* disk, u32 partition_start, ext2_fs_t** out_fs);
-int ext2_format(ata_disk_t* disk, u32 partition_start, u32 total_sectors);
+int ext2_probe(block_device_t* disk, u32 partition_start);
+int ext2_mount(block_device_t* disk, u32 partition_start, ext2_fs_t** out_fs);
+int ext2_format(block_device_t* disk, u32 partition_start, u32 total_sectors);
 int ext2_read_inode(ext2_fs_t* fs, u32 inode_num, ext2_inode_t* inode);
 int ext2_write_inode(ext2_fs_t* fs, u32 inode_num, ext2_inode_t* inode);
 int ext2_read_block(ext2_fs_t* fs, u32 block_num, void* buffer);
@@ -82,6 +83,7 @@ int ext2_find_inode(ext2_fs_t* fs, u32 dir_inode, const char* name, ext2_inode_t
 int ext2_create_file(ext2_fs_t* fs, u32 dir_inode, const char* name, u16 mode);
 int ext2_mkdir(ext2_fs_t* fs, u32 parent_inode, const char* name);
 int ext2_unlink(ext2_fs_t* fs, u32 dir_inode, const char* name);
+int ext2_sync(ext2_fs_t* fs);
 void ext2_close(ext2_fs_t* fs);
 
 #endif
@@ -2,7 +2,7 @@
 #define EXT2_PRIVATE_H
 
 typedef struct {
-    ata_disk_t* disk;
+    block_device_t* disk;
     u32 partition_start;
 
     ext2_superblock_t sb;
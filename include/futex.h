@@ -0,0 +1,38 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "kernel.h"
+#include "syscall.h"
+
+/* ---------------------------------------------------------------
+ * futexes: sleep on a 32-bit word until someone wakes that word.
+ * the uncontended path of a lock built on one never enters the
+ * kernel; only a thread that has to wait calls futex_wait(), and the
+ * unlocker calls futex_wake() only if it saw waiters. waiters are
+ * hashed by the physical address of the word, so two mappings of the
+ * same page meet in the same queue. kernel threads pass kernel
+ * addresses, which are their own physical addresses.
+ * --------------------------------------------------------------- */
+
+typedef struct {
+    u32 waits;                  /* futex_wait() calls that blocked */
+    u32 again;                  /* ... that returned FUTEX_AGAIN at once */
+    u32 timeouts;
+    u32 wakes;                  /* waiters woken */
+} futex_stat_t;
+
+void futex_init(void);
+
+/* block while *addr == expected, until futex_wake() on the same word
+ * or timeout_ms (0: forever). 0 once woken, FUTEX_AGAIN if *addr had
+ * already changed, FUTEX_TIMEOUT, or -1 for a bad address. callers
+ * recheck their condition either way */
+int  futex_wait(u32* addr, u32 expected, u32 timeout_ms);
+
+/* wake up to n waiters on addr, oldest first; returns how many */
+int  futex_wake(u32* addr, int n);
+
+void futex_stats(futex_stat_t* st);
+void futex_stats_reset(void);
+
+#endif /* FUTEX_H */
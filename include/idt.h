@@ -0,0 +1,72 @@
+#ifndef IDT_H
+#define IDT_H
+
+#include "kernel.h"
+#include "percpu.h"
+
+/* GDT selectors. the user pair sits right after the kernel pair, the
+ * order SYSEXIT expects; user selectors are used with RPL 3 */
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE   0x18
+#define GDT_USER_DATA   0x20
+#define GDT_TSS_FIRST    5              /* one TSS per CPU from here */
+#define GDT_TSS(cpu)     ((u16)((GDT_TSS_FIRST + (cpu)) << 3))
+#define GDT_PERCPU_FIRST (GDT_TSS_FIRST + MAX_CPUS)  /* then one %gs segment per CPU */
+#define GDT_PERCPU(cpu)  ((u16)((GDT_PERCPU_FIRST + (cpu)) << 3))
+
+/* vectors 0-31 are CPU exceptions, the PIC is remapped right above them */
+#define IRQ_BASE        32
+#define IRQ_TIMER       0
+#define IRQ_KEYBOARD    1
+#define IRQ_COUNT       16
+
+/* local APIC vectors, right above the PIC's */
+#define VEC_LOCAL_BASE  48
+#define VEC_LAPIC_TIMER 48
+#define VEC_RESCHED     49
+#define VEC_LOCAL_COUNT 2
+#define VEC_SPURIOUS    0xFF
+#define VEC_SYSCALL     0x80            /* int 0x80, callable from ring 3 */
+
+/* register frame pushed by isr_common in boot/isr.asm */
+typedef struct {
+    u32 gs, fs, es, ds;
+    u32 edi, esi, ebp, esp_dummy, ebx, edx, ecx, eax;
+    u32 int_no, err_code;
+    u32 eip, cs, eflags;
+    u32 useresp, ss;        /* only valid when coming from ring 3 */
+} regs_t;
+
+typedef void (*irq_handler_t)(regs_t* r);
+
+void gdt_init(void);
+void idt_init(void);
+void irq_register(u8 irq, irq_handler_t handler);
+void irq_unmask(u8 irq);
+void irq_mask(u8 irq);
+void isr_dispatch(regs_t* r);
+void local_vector_register(u8 vector, irq_handler_t handler);
+void syscall_handle(regs_t* r);         /* syscall.c */
+
+static inline void interrupts_enable(void)  { __asm__ volatile ("sti"); }
+static inline void interrupts_disable(void) { __asm__ volatile ("cli"); }
+
+static inline int irqs_enabled(void) {
+    u32 flags;
+    __asm__ volatile ("pushfl; popl %0" : "=r"(flags));
+    return (flags >> 9) & 1;
+}
+
+/* save EFLAGS and disable interrupts, returns the old flags */
+static inline u32 irq_save(void) {
+    u32 flags;
+    __asm__ volatile ("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(u32 flags) {
+    __asm__ volatile ("pushl %0; popfl" : : "r"(flags) : "memory", "cc");
+}
+
+#endif /* IDT_H */
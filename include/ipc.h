@@ -0,0 +1,90 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include "kernel.h"
+#include "syscall.h"
+#include "spinlock.h"
+#include "wait.h"
+
+/* ---------------------------------------------------------------
+ * named shared memory and message queues. both live in a flat
+ * namespace of their own, outside ext2, and stay around until they
+ * are unlinked and the last user lets go, so a writer can go away
+ * before its reader has started.
+ *
+ * shared memory: a run of page frames that shm_map() puts into the
+ * caller's address space between SHM_BASE and SHM_END. every mapping
+ * sees the same frames, so once mapped nothing is copied at all.
+ *
+ * message queues: a bounded FIFO of whole messages behind an fd.
+ * write() sends a copy, read() receives one; SYS_MQ_SEND_PAGES gives
+ * the queue the pages themselves, and SYS_MQ_RECEIVE maps them into
+ * the receiver where the buffer allows, so large messages move
+ * without being copied.
+ * --------------------------------------------------------------- */
+
+#define IPC_NAME_MAX       32
+#define SHM_BASE           0x80000000
+#define SHM_END            0xB0000000   /* RING_BASE */
+#define SHM_MAX_SIZE       (4 * 1024 * 1024)
+#define MQ_DEFAULT_DEPTH   16
+#define MQ_MAX_DEPTH       256
+#define IPC_SHOW_MAX       4096         /* text from shm_show() or mq_show() */
+
+typedef struct shm {
+    char         name[IPC_NAME_MAX];
+    u32          npages;
+    u32*         frames;
+    volatile u32 refs;          /* mappings, plus one while it has a name */
+    u8           linked;
+    u32          maps;          /* shm_map() calls, for ipcs */
+    struct shm*  next;
+} shm_t;
+
+/* one queued message: a kmalloc'd copy, or pages taken out of the
+ * sender's address space */
+typedef struct {
+    u32   len;
+    u32   npages;               /* 0: data holds a copy */
+    void* data;
+    u32   pages[MQ_MAX_PAGES];
+} mq_msg_t;
+
+typedef struct mq {
+    char         name[IPC_NAME_MAX];
+    spinlock_t   lock;
+    u32          depth;
+    volatile u32 head;          /* messages ever received */
+    volatile u32 tail;          /* messages ever sent */
+    mq_msg_t*    msgs;          /* depth of them */
+    wait_queue_t rd_wait;       /* a message */
+    wait_queue_t wr_wait;       /* a free slot */
+    volatile u32 refs;          /* open fds, plus one while it has a name */
+    u8           linked;
+    u32          copied;        /* messages sent each way, for ipcs */
+    u32          gifted;
+    struct mq*   next;
+} mq_t;
+
+/* shm.c */
+shm_t* shm_get(const char* name, u32 size, int create);    /* a reference */
+void   shm_put(shm_t* s);
+u32    shm_frame(shm_t* s, u32 index);
+int    shm_unlink(const char* name);
+int    shm_map(const char* name, u32 size, int flags);     /* address or -1 */
+int    shm_unmap(u32 addr);
+
+/* mq.c */
+mq_t* mq_get(const char* name, u32 depth, int create);     /* a reference */
+void  mq_put(mq_t* q);
+int   mq_unlink(const char* name);
+int   mq_send(mq_t* q, const void* buf, usize len);
+int   mq_send_pages(mq_t* q, u32 addr, u32 npages);
+int   mq_receive(mq_t* q, void* buf, usize len, int remap);
+u32   mq_count(mq_t* q);        /* messages waiting */
+
+/* a line per object to fd, for ipcs */
+void  shm_show(int fd);
+void  mq_show(int fd);
+
+#endif /* IPC_H */
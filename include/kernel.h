@@ -57,6 +57,9 @@ typedef size_t   usize;
 struct ata_disk_s;
 typedef struct ata_disk_s ata_disk_t;
 
+struct block_device;
+typedef struct block_device block_device_t;
+
 struct ext2_fs_s;
 typedef struct ext2_fs_s ext2_fs_t;
 
@@ -122,10 +125,30 @@ int  fd_read(int fd, void* buf, usize count);
 int  fd_write(int fd, const void* buf, usize count);
 int  fd_seek(int fd, int offset, int whence);
 int  fd_fstat(int fd, kstat_t* st);
+void fd_close_all(void);
+int  fd_pipe(int fds[2]);
+int  fd_puts(int fd, const char* s, u8 colour);     /* colour if it is the screen */
+int  fd_mq_open(const char* name, int flags, u32 depth);
+struct mq;
+struct mq* fd_mq(int fd);                           /* no reference taken */
+
+/* open files themselves, for handing them to another task */
+struct file;
+struct file* fd_file(int fd);                       /* takes a reference */
+int  fd_install_file(int fd, struct file* f);       /* consumes one */
+int  file_pipe(struct file** rd, struct file** wr);
+struct file* file_get(struct file* f);
+int  file_put(struct file* f);
 
 /* ====================== syscalls =========================== */
-void syscall_init(void);
+void syscall_init(void);               /* per CPU: SYSENTER MSRs */
 int  syscall_dispatch(u32 num, u32 a, u32 b, u32 c, u32 d, u32 e);
+int  syscall_sysenter_ok(void);
+void syscall_stat(u32 num, u32* calls, u64* cycles);
+void syscall_stats_show(void);
+void syscall_stats_reset(void);
+int  ring_setup(u32 entries);
+int  ring_enter(u32 to_submit, u32 min_complete);
 void keyboard_init(void);
 int  read_key(void);
 int  key_available(void);
@@ -145,11 +168,21 @@ int get_alt_state(void);
 
 /* ==================== ATA ========================== */
 int       ata_init(void);
-int       ata_read_sectors(ata_disk_t* disk, u32 lba, u8 count, void* buffer);
-int       ata_write_sectors(ata_disk_t* disk, u32 lba, u8 count, const void* buffer);
+int       ata_read_sectors(ata_disk_t* disk, u32 lba, u32 count, void* buffer);
+int       ata_write_sectors(ata_disk_t* disk, u32 lba, u32 count, const void* buffer);
+int       ata_write_sectors_fua(ata_disk_t* disk, u32 lba, u32 count, const void* buffer);
+int       ata_flush(ata_disk_t* disk);
+int       ata_has_fua(ata_disk_t* disk);
 ata_disk_t* ata_get_primary(void);
 ata_disk_t* ata_get_secondary(void);
 void      ata_reset(ata_disk_t* disk);
+u32       ata_sector_count(ata_disk_t* disk);
+u32       ata_max_sectors(ata_disk_t* disk);
+u8        ata_get_multiple(ata_disk_t* disk);
+u8        ata_set_multiple(ata_disk_t* disk, u8 sectors);
+int       ata_has_dma(ata_disk_t* disk);
+int       ata_set_dma(ata_disk_t* disk, int on);
+int       ata_set_irq(ata_disk_t* disk, int on);
 
 /* ==================== ext2 ========================= */
 #include "ext2.h"
@@ -161,6 +194,7 @@ int         fs_delete(const char* name);
 int         fs_list(char* buffer, usize size);
 int         fs_read(const char* name, char* buffer, usize size);
 int         fs_write(const char* name, const char* data, usize size);
+int         fs_sync(void);
 int         fs_chdir(const char* dir);
 const char* fs_getcwd(void);
 int         fs_exists(const char* name);
@@ -173,8 +207,10 @@ int         fs_chmod(const char* name, u16 mode);
 int         fs_is_executable(const char* name);
 int         fs_get_inode(const char* path);
 int         fs_read_inode(int inode_num, char* buf, usize size);
+int         fs_read_inode_at(int inode_num, u32 offset, char* buf, usize size);
 int         fs_write_inode(int inode_num, const char* buf, usize size);
 int         fs_size_inode(int inode_num);
+int         fs_mode_inode(int inode_num);
 
 /* ==================== shell ======================== */
 void shell_init(void);
@@ -224,12 +260,54 @@ int  proc_create(const char* name, u64 entry);
 int  proc_create_user(const char* name, u32 entry, u8 is_user);
 void proc_yield(void);
 void proc_exit(int code);
+int  proc_wait(int pid, int* status);
 int  proc_get_list(char* buffer, usize size);
+usize proc_list_size(void);
 u32  proc_get_pid(void);
 void timer_handler(void);
+int  kthread_create(const char* name, void (*fn)(void*), void* arg);
+int  kthread_create_joinable(const char* name, void (*fn)(void*), void* arg);
+int  proc_create_task(const char* name, void (*fn)(void*), void* arg);
+void proc_block(void);
+void proc_unblock(u32 pid);
+void proc_sleep(u32 ticks);
+void proc_block_timeout(u32 ticks);
+
+#define NICE_MIN -16
+#define NICE_MAX  15
+int  proc_set_nice(u32 pid, int nice);
+int  proc_get_nice(u32 pid);
+
+#define SCHED_PRIO 0   /* O(1) priority run queues */
+#define SCHED_FAIR 1   /* weighted fair share by vruntime */
+int  proc_set_class(u32 pid, int cls);
+int  proc_get_class(u32 pid);
+u64  proc_get_runtime_us(u32 pid);
+u32  sched_nice_weight(int nice);
+
+/* ==================== exec ========================= */
+int  proc_exec(const char* path, int argc, char** argv);   /* pid of the new task */
+/* the same with fds 0-2 on io[0..2] instead of the console where set */
+int  proc_exec_io(const char* path, int argc, char** argv, struct file* io[3]);
+void userbin_install(void);
+
+/* ==================== timer ======================== */
+#define TIMER_HZ 100
+extern u32 tsc_khz;
+void tsc_calibrate(void);               /* before anything times out by the TSC */
+void timer_init(void);
+u64  tsc_to_us(u64 cycles);
+u64  tsc_to_ns(u64 cycles);
+void vvar_init(void);
+void vvar_tick(u64 tsc);
+u32  vvar_phys(void);
+u64  clock_ns(void);                /* since boot, the same clock as user space's */
+
+/* ==================== benchmarks =================== */
+void bench_run(int argc, char** argv);
+void latency_run(int argc, char** argv);
 
 /* ==================== syscall ====================== */
-u64  syscall(u64 num, u64 a1, u64 a2, u64 a3, u64 a4, u64 a5);
 void kprint(const char* str);
 
 /* ==================== editor ======================= */
@@ -248,8 +326,34 @@ static inline u16 inw(u16 port) {
 static inline void outw(u16 port, u16 v) {
     __asm__ volatile ("outw %0, %1" : : "a"(v), "Nd"(port));
 }
+static inline u32 inl(u16 port) {
+    u32 v; __asm__ volatile ("inl %1, %0" : "=a"(v) : "Nd"(port)); return v;
+}
+static inline void outl(u16 port, u32 v) {
+    __asm__ volatile ("outl %0, %1" : : "a"(v), "Nd"(port));
+}
+/* count words between port and buf in one rep string instruction */
+static inline void insw(u16 port, void* buf, u32 count) {
+    __asm__ volatile ("rep insw" : "+D"(buf), "+c"(count) : "d"(port) : "memory");
+}
+static inline void outsw(u16 port, const void* buf, u32 count) {
+    __asm__ volatile ("rep outsw" : "+S"(buf), "+c"(count) : "d"(port) : "memory");
+}
 static inline void io_wait(void) { outb(0x80, 0); }
 
+static inline u64 rdtsc(void) {
+    u32 lo, hi; __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)hi << 32) | lo;
+}
+
+/* 64/32 division without pulling __udivdi3 out of libgcc */
+static inline u64 div64_u32(u64 n, u32 d) {
+    u32 hi = (u32)(n >> 32), lo = (u32)n;
+    u32 q_hi = hi / d, r = hi % d, q_lo;
+    __asm__ ("divl %4" : "=a"(q_lo), "=d"(r) : "0"(lo), "1"(r), "rm"(d));
+    return ((u64)q_hi << 32) | q_lo;
+}
+
 /* ==================== globals ====================== */
 extern u32 system_uptime;
 
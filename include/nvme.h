@@ -0,0 +1,93 @@
+#ifndef NVME_H
+#define NVME_H
+
+#include "kernel.h"
+
+/* ---------------------------------------------------------------
+ * NVMe: the controller's registers are memory in BAR0, and commands
+ * go through queue pairs in RAM. the driver writes 64-byte commands
+ * into a submission queue (SQ) and then the SQ's tail doorbell; the
+ * controller writes 16-byte entries into the paired completion queue
+ * (CQ), each with a phase bit that flips every time round the ring,
+ * and the driver writes the CQ's head doorbell to give them back.
+ * queue 0 is the admin queue, set up through registers; the I/O
+ * queues are created with admin commands. data is described by PRPs:
+ * a first address that may start inside a page, and either a second
+ * page or a page listing all the rest.
+ * --------------------------------------------------------------- */
+
+/* controller registers */
+#define NVME_CAP            0x00        /* 64 bits */
+#define NVME_VS             0x08
+#define NVME_INTMS          0x0C
+#define NVME_INTMC          0x10
+#define NVME_CC             0x14
+#define NVME_CSTS           0x1C
+#define NVME_AQA            0x24
+#define NVME_ASQ            0x28        /* 64 bits */
+#define NVME_ACQ            0x30        /* 64 bits */
+#define NVME_DOORBELLS      0x1000
+
+/* from the two halves of CAP */
+#define NVME_CAP_MQES(lo)   (((lo) & 0xFFFF) + 1)      /* entries a queue may have */
+#define NVME_CAP_TO(lo)     ((((lo) >> 24) & 0xFF) * 500)   /* ms to become ready */
+#define NVME_CAP_DSTRD(hi)  ((hi) & 0xF)                /* doorbells 4 << this apart */
+#define NVME_CAP_CSS_NVM(hi) ((hi) & (1u << 5))
+#define NVME_CAP_MPSMIN(hi) (((hi) >> 16) & 0xF)        /* 4 KiB << this */
+
+#define NVME_CC_EN          (1u << 0)
+#define NVME_CC_IOSQES      (6u << 16)  /* 64-byte commands */
+#define NVME_CC_IOCQES      (4u << 20)  /* 16-byte completions */
+#define NVME_CSTS_RDY       (1u << 0)
+#define NVME_CSTS_CFS       (1u << 1)   /* fatal status */
+
+/* admin commands */
+#define NVME_ADMIN_CREATE_SQ    0x01
+#define NVME_ADMIN_CREATE_CQ    0x05
+#define NVME_ADMIN_IDENTIFY     0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+
+#define NVME_CNS_NAMESPACE      0
+#define NVME_CNS_CONTROLLER     1
+#define NVME_FEAT_NUM_QUEUES    0x07
+
+#define NVME_QUEUE_PHYS_CONTIG  (1u << 0)   /* CREATE SQ/CQ: one block, no PRP list */
+#define NVME_CQ_IRQ_ENABLED     (1u << 1)
+
+/* I/O commands */
+#define NVME_CMD_FLUSH      0x00
+#define NVME_CMD_WRITE      0x01
+#define NVME_CMD_READ       0x02
+#define NVME_RW_FUA         (1u << 30)
+
+typedef struct {
+    u8  opcode;
+    u8  flags;
+    u16 cid;
+    u32 nsid;
+    u64 reserved;
+    u64 mptr;
+    u64 prp1;
+    u64 prp2;
+    u32 cdw10, cdw11, cdw12, cdw13, cdw14, cdw15;
+} nvme_cmd_t;
+
+typedef struct {
+    u32 result;
+    u32 reserved;
+    u16 sq_head;
+    u16 sq_id;
+    u16 cid;
+    u16 status;                         /* bit 0 is the phase */
+} nvme_cqe_t;
+
+/* a queue is a page: 64 commands, or 256 completions of which we use
+ * as many */
+#define NVME_QSIZE          (PAGE_SIZE / sizeof(nvme_cmd_t))
+#define NVME_QDEPTH         32          /* commands in flight per queue, a bit each in a u32 */
+#define NVME_PRPS           (PAGE_SIZE / 8)     /* entries in a PRP list page */
+#define NVME_MAX_SECTORS    (NVME_PRPS * (PAGE_SIZE / 512))  /* what a list page covers */
+
+#define NVME_TIMEOUT        5000        /* ms for an admin command */
+
+#endif /* NVME_H */
@@ -0,0 +1,120 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "kernel.h"
+
+/* ---------------------------------------------------------------
+ * PCI: config space through mechanism #1 (ports 0xCF8/0xCFC), one
+ * scan of the buses behind bus 0 at boot, and drivers that say which
+ * devices they want. a driver is a PCI_DRIVER() anywhere in the
+ * kernel; the linker collects them (see boot/linker.ld) and pci_init()
+ * offers every device found to each in turn until a probe claims it.
+ * --------------------------------------------------------------- */
+
+#define PCI_CONFIG_ADDR     0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+/* type 0 header */
+#define PCI_VENDOR_ID       0x00
+#define PCI_DEVICE_ID       0x02
+#define PCI_COMMAND         0x04
+#define PCI_STATUS          0x06
+#define PCI_REVISION        0x08
+#define PCI_PROG_IF         0x09
+#define PCI_SUBCLASS        0x0A
+#define PCI_CLASS           0x0B
+#define PCI_HEADER_TYPE     0x0E
+#define PCI_BAR0            0x10
+#define PCI_SECONDARY_BUS   0x19        /* type 1, bridges */
+#define PCI_CAP_PTR         0x34
+#define PCI_INTERRUPT_LINE  0x3C
+#define PCI_INTERRUPT_PIN   0x3D
+
+#define PCI_CMD_IO          0x0001
+#define PCI_CMD_MEMORY      0x0002
+#define PCI_CMD_MASTER      0x0004
+#define PCI_CMD_INTX_OFF    0x0400
+
+#define PCI_STATUS_CAPS     0x0010
+
+#define PCI_ANY             0xFFFF
+#define PCI_MAX_DEVICES     64
+#define PCI_NR_BARS         6
+#define PCI_IRQ_SHARE       4           /* devices on one INTx line */
+
+/* class codes as class << 16 | subclass << 8 | prog_if */
+#define PCI_CLASS_IDE       0x010100
+#define PCI_CLASS_AHCI      0x010601
+#define PCI_CLASS_NVME      0x010802
+#define PCI_CLASS_BRIDGE_PCI 0x060400
+
+typedef struct {
+    u32 base;                   /* address or port, flag bits cleared */
+    u32 size;                   /* 0: not implemented */
+    u8  io;                     /* port space rather than memory */
+    u8  prefetch;
+    u8  is64;                   /* takes the next BAR as its high half */
+} pci_bar_t;
+
+struct pci_driver;
+
+typedef struct pci_dev {
+    u8  bus, slot, fn;
+    u16 vendor, device;
+    u32 class;                  /* class << 16 | subclass << 8 | prog_if */
+    u8  revision;
+    u8  header;                 /* header type, multi-function bit cleared */
+    u8  irq_line;               /* what the firmware routed INTx to, 0xFF: none */
+    u8  irq_pin;                /* 1-4: INTA-INTD, 0: no INTx */
+    pci_bar_t bar[PCI_NR_BARS];
+    const struct pci_driver* driver;
+    void* driver_data;
+} pci_dev_t;
+
+/* one device a driver handles. vendor and device may be PCI_ANY; only
+ * the bits of class set in class_mask have to match. a table ends with
+ * a zero vendor */
+typedef struct {
+    u16 vendor, device;
+    u32 class, class_mask;
+} pci_id_t;
+
+typedef struct pci_driver {
+    const char*     name;
+    const pci_id_t* ids;
+    int (*probe)(pci_dev_t* dev, const pci_id_t* id);  /* 0: claimed */
+    void (*start)(pci_dev_t* dev);      /* once tasks can be created; may be NULL */
+} pci_driver_t;
+
+/* called for every interrupt on the device's line, which it may share:
+ * the handler checks its own status and returns quietly if not its */
+typedef void (*pci_irq_handler_t)(pci_dev_t* dev);
+
+#define PCI_DRIVER(dname, idtable, probefn)                                   \
+    PCI_DRIVER_START(dname, idtable, probefn, NULL)
+
+/* the same, for a driver that wants kernel threads: probe runs before
+ * the process table is up, startfn for each device it claimed after */
+#define PCI_DRIVER_START(dname, idtable, probefn, startfn)                    \
+    const pci_driver_t pci_driver_##dname                                     \
+    __attribute__((section("pci_drivers"), used, aligned(4))) = { #dname, idtable, probefn, startfn }
+
+void pci_init(void);
+void pci_start(void);                               /* after proc_init() */
+int  pci_count(void);
+pci_dev_t* pci_get(int index);
+
+u32  pci_read32(pci_dev_t* d, u8 off);
+u16  pci_read16(pci_dev_t* d, u8 off);
+u8   pci_read8(pci_dev_t* d, u8 off);
+void pci_write32(pci_dev_t* d, u8 off, u32 v);
+void pci_write16(pci_dev_t* d, u8 off, u16 v);
+void pci_write8(pci_dev_t* d, u8 off, u8 v);
+
+void pci_enable(pci_dev_t* d, u16 cmd_bits);       /* PCI_CMD_* on */
+u8   pci_find_cap(pci_dev_t* d, u8 id);             /* config offset, 0: none */
+int  pci_irq_register(pci_dev_t* d, pci_irq_handler_t handler);  /* INTx; -1: none routed */
+
+void pci_show(int fd, int verbose);                 /* lspci */
+
+#endif /* PCI_H */
@@ -0,0 +1,24 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include "kernel.h"
+
+#define MAX_CPUS 8                 /* power of two */
+
+/* fixed offsets into cpu_t (smp.h) for %gs-relative loads; smp.c
+ * checks them against the struct */
+#define PERCPU_SELF    0
+#define PERCPU_CURRENT 4
+#define PERCPU_ID      8
+#define PERCPU_PREEMPT 12
+#define PERCPU_RESCHED 16
+
+/* index of the CPU we are running on. one instruction, so it is right
+ * at the moment it executes even if we are preempted and moved after */
+static inline u32 this_cpu_id(void) {
+    u32 id;
+    __asm__ volatile ("movl %%gs:%c1, %0" : "=r"(id) : "i"(PERCPU_ID));
+    return id & (MAX_CPUS - 1);
+}
+
+#endif /* PERCPU_H */
@@ -0,0 +1,35 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include "kernel.h"
+#include "wait.h"
+
+/* ---------------------------------------------------------------
+ * pipes: a one page ring between a writing end and a reading end.
+ * readers block while it is empty and see EOF once every writer has
+ * gone; writers block while it is full and fail once every reader
+ * has gone. each end is used by one task at a time (the shell hands
+ * every pipeline stage its own), so the ring itself needs no lock:
+ * the writer only moves head and the reader only moves tail.
+ * --------------------------------------------------------------- */
+
+#define PIPE_SIZE 4096              /* one page frame */
+
+typedef struct pipe {
+    u8*          buf;
+    volatile u32 head;              /* bytes ever written */
+    volatile u32 tail;              /* bytes ever read */
+    volatile u32 readers;           /* open ends of each kind */
+    volatile u32 writers;
+    volatile u32 refs;              /* readers + writers, dropped after the wakeups */
+    wait_queue_t rd_wait;           /* data or EOF */
+    wait_queue_t wr_wait;           /* space or no readers left */
+} pipe_t;
+
+pipe_t* pipe_create(void);          /* one reader and one writer open */
+int     pipe_read(pipe_t* p, void* buf, usize count);
+int     pipe_write(pipe_t* p, const void* buf, usize count);
+void    pipe_close(pipe_t* p, int write_end);
+u32     pipe_count(pipe_t* p);      /* bytes waiting */
+
+#endif /* PIPE_H */
@@ -0,0 +1,49 @@
+#ifndef PREEMPT_H
+#define PREEMPT_H
+
+#include "kernel.h"
+#include "idt.h"
+#include "percpu.h"
+
+/* ---------------------------------------------------------------
+ * preemption control. the count lives in cpu_t and is only touched
+ * with single %gs-relative instructions, so an interrupt never sees it
+ * half updated. while it is non-zero the task keeps its CPU: holding
+ * any spinlock raises it. every switch happens with exactly the run
+ * queue lock held, i.e. with a count of one, so the count carries over
+ * from one task to the next unchanged.
+ * --------------------------------------------------------------- */
+
+/* process.c */
+void preempt_schedule(void);
+void preempt_schedule_irq(void);
+
+static inline u32 preempt_count(void) {
+    u32 n;
+    __asm__ volatile ("movl %%gs:%c1, %0" : "=r"(n) : "i"(PERCPU_PREEMPT));
+    return n;
+}
+
+static inline u32 need_resched_pending(void) {
+    u32 n;
+    __asm__ volatile ("movl %%gs:%c1, %0" : "=r"(n) : "i"(PERCPU_RESCHED));
+    return n;
+}
+
+static inline void preempt_disable(void) {
+    __asm__ volatile ("incl %%gs:%c0" : : "i"(PERCPU_PREEMPT) : "memory");
+}
+
+static inline void preempt_enable_no_resched(void) {
+    __asm__ volatile ("decl %%gs:%c0" : : "i"(PERCPU_PREEMPT) : "memory");
+}
+
+/* drop the count and, if it hit zero with a reschedule pending, take
+ * the switch now rather than at the next interrupt */
+static inline void preempt_enable(void) {
+    preempt_enable_no_resched();
+    if (__builtin_expect(need_resched_pending(), 0) && !preempt_count())
+        preempt_schedule();
+}
+
+#endif /* PREEMPT_H */
@@ -0,0 +1,119 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include "kernel.h"
+#include "rbtree.h"
+#include "spinlock.h"
+
+#ifndef PID_MAX
+#define PID_MAX            1024        /* override with make PID_MAX=n */
+#endif
+#if PID_MAX % 32 || PID_MAX < 64
+#error "PID_MAX must be a multiple of 32 and at least 64"
+#endif
+#define PROCESS_STACK_SIZE 8192        /* room for a page fault that reads ext2 */
+#define TIME_SLICE         10
+#define MAX_FDS            16          /* open files per task */
+#define NR_PRIO            32          /* 0 is the highest priority */
+#define PRIO_DEFAULT       16          /* static priority for nice 0 */
+#define MAX_BONUS          5           /* dynamic boost/penalty, +-levels */
+#define MAX_SLEEP_AVG      TIMER_HZ    /* 1 s of recent sleep earns the full boost */
+
+typedef enum {
+    PROC_UNUSED,
+    PROC_READY,
+    PROC_RUNNING,
+    PROC_WAITING,
+    PROC_ZOMBIE
+} process_state_t;
+
+struct mm;
+struct file;
+
+typedef struct process {
+    u32            pid;
+    u32            ppid;
+    process_state_t state;
+    char           name[32];
+    u32            esp;         /* saved kernel stack pointer while switched out */
+    u32            ebp;
+    u32            eip;         /* entry point, run by proc_trampoline */
+    void*          arg;
+    u32*           stack;       /* PROCESS_STACK_SIZE bytes, kmalloc'd */
+    u32            time_used;
+    u32            priority;    /* static priority, PRIO_DEFAULT + nice */
+    u32            prio;        /* dynamic priority the run queues use */
+    u32            sleep_avg;   /* ticks of recent sleep, decays while running */
+    u32            sleep_start;
+    u32            wake_tick;
+    u64            wake_tsc;    /* timer expiry that last woke us from proc_sleep() */
+    u8             sleeping;    /* on its run queue's sleep_list */
+    u8             wake_pending; /* proc_unblock() came before proc_block() */
+    u8             sched_class; /* SCHED_PRIO or SCHED_FAIR */
+    struct process* rq_next;
+    struct process* rq_prev;
+    struct process* sleep_next;
+    rb_node_t      fair_node;   /* SCHED_FAIR: keyed by vruntime */
+    u64            vruntime;    /* weighted ns of CPU, SCHED_FAIR only */
+    u64            exec_start;  /* TSC when last put on the CPU */
+    u64            sum_exec;    /* total TSC cycles on the CPU */
+    u32            uid;
+    u32            gid;
+    u8             is_user;
+    u8             detached;      /* freed on exit, nobody will proc_wait() */
+    int            exit_code;
+    u32            cpu;         /* run queue the task is on or last ran from */
+    struct mm*     mm;          /* user address space, NULL for kernel-only tasks */
+    struct file*   fds[MAX_FDS]; /* fd.c, only ever touched by the task itself */
+} process_t;
+
+/* SCHED_FAIR tasks waiting for a CPU, leftmost is the next to run */
+typedef struct {
+    rb_root_t  tree;
+    rb_node_t* leftmost;
+    u64        min_vruntime;
+    u32        nr_running;
+} fair_rq_t;
+
+/* one per CPU. lock covers everything here plus the state of the tasks
+ * queued on it, and is held across switch_to() */
+typedef struct {
+    ticket_lock_t lock;
+    process_t* head[NR_PRIO];
+    process_t* tail[NR_PRIO];
+    u32        bitmap;          /* bit n set while head[n] is non-empty */
+    u32        nr_running;      /* queued tasks of both classes */
+    fair_rq_t  fair;
+    process_t* sleep_list;      /* proc_sleep() sleepers, by wake_tick */
+    u32        nr_switches;
+    u32        nr_steals;       /* tasks pulled from other CPUs */
+} rq_t;
+
+/* class new tasks get; build with SCHED=fair to make it the fair class */
+#ifdef SCHED_DEFAULT_FAIR
+#define SCHED_DEFAULT SCHED_FAIR
+#else
+#define SCHED_DEFAULT SCHED_PRIO
+#endif
+
+/* sched_fair.c — weighted fair share, only runs when no SCHED_PRIO
+ * task is runnable */
+void       fair_enqueue(fair_rq_t* fq, process_t* p, int wakeup);
+void       fair_dequeue(fair_rq_t* fq, process_t* p);
+process_t* fair_pick(fair_rq_t* fq);
+void       fair_charge(fair_rq_t* fq, process_t* p, u64 delta);
+void       fair_place_new(fair_rq_t* fq, process_t* p);
+void       fair_migrate(fair_rq_t* from, fair_rq_t* to, process_t* p);
+int        fair_should_preempt(fair_rq_t* fq, process_t* curr);
+u32        fair_weight(const process_t* p);
+
+/* process.c */
+DECLARE_LOCK_CLASS(runqueue);
+process_t* proc_create_idle(u32 cpu);
+void       proc_free_idle(u32 cpu);
+void       cpu_idle(void);
+void       sched_tick(void);
+void       sched_resched_ipi(void);
+void       proc_wake(process_t* p);
+
+#endif /* PROCESS_H */
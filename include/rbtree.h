@@ -0,0 +1,40 @@
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include "kernel.h"
+
+/* intrusive red-black tree: embed an rb_node in your struct, walk the
+ * tree yourself to find the insertion point, then rb_link_node() and
+ * rb_insert_color() to rebalance */
+
+#define RB_RED   0
+#define RB_BLACK 1
+
+typedef struct rb_node {
+    struct rb_node* parent;
+    struct rb_node* left;
+    struct rb_node* right;
+    int             color;
+} rb_node_t;
+
+typedef struct {
+    rb_node_t* root;
+} rb_root_t;
+
+#define rb_entry(ptr, type, member) \
+    ((type*)((u8*)(ptr) - offsetof(type, member)))
+
+static inline void rb_link_node(rb_node_t* node, rb_node_t* parent, rb_node_t** link) {
+    node->parent = parent;
+    node->left   = NULL;
+    node->right  = NULL;
+    node->color  = RB_RED;
+    *link = node;
+}
+
+void       rb_insert_color(rb_node_t* node, rb_root_t* root);
+void       rb_erase(rb_node_t* node, rb_root_t* root);
+rb_node_t* rb_first(const rb_root_t* root);
+rb_node_t* rb_next(const rb_node_t* node);
+
+#endif /* RBTREE_H */
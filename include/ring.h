@@ -0,0 +1,43 @@
+#ifndef RING_H
+#define RING_H
+
+/* ---------------------------------------------------------------
+ * batched system calls, io_uring style. SYS_RING_SETUP maps a
+ * submission queue and a completion queue into the caller's address
+ * space at RING_BASE; the program fills in SQEs, bumps sq_tail and
+ * makes one SYS_RING_ENTER for the lot. the kernel runs them in order
+ * and posts a CQE for each. shared with user/, so no kernel types.
+ *
+ * an SQE is just a system call: a SYS_* number and its arguments.
+ * only SYS_READ, SYS_WRITE, SYS_OPEN, SYS_CLOSE, SYS_FSTAT and
+ * SYS_GETPID may be queued; anything else completes with -1.
+ * --------------------------------------------------------------- */
+
+#define RING_BASE         0xB0000000
+#define RING_MAX_ENTRIES  256           /* power of two */
+
+typedef struct {
+    unsigned op;                /* SYS_* */
+    unsigned arg[3];
+    unsigned user_data;         /* copied to the CQE untouched */
+} ring_sqe_t;
+
+typedef struct {
+    unsigned user_data;
+    int      res;               /* what the system call returned */
+} ring_cqe_t;
+
+/* at RING_BASE; the SQE and CQE arrays follow at the given offsets.
+ * each side only ever writes its own index of each queue */
+typedef struct {
+    volatile unsigned sq_head;  /* kernel: next SQE it will take */
+    volatile unsigned sq_tail;  /* user: one past the last SQE queued */
+    volatile unsigned cq_head;  /* user: next CQE it will reap */
+    volatile unsigned cq_tail;  /* kernel: one past the last CQE posted */
+    unsigned entries;           /* of each queue */
+    unsigned sq_off;
+    unsigned cq_off;
+    unsigned pad;
+} ring_hdr_t;
+
+#endif /* RING_H */
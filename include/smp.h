@@ -0,0 +1,80 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "kernel.h"
+#include "process.h"
+#include "percpu.h"
+
+#define LAPIC_DEFAULT    0xFEE00000
+#define AP_TRAMPOLINE    0x8000      /* real-mode entry for the APs, below 1 MiB */
+
+/* hardware task state segment. we never task-switch through it, the
+ * CPU only reads ss0:esp0 from it when an interrupt or int 0x80 comes
+ * in from ring 3, so esp0 follows whichever task is running */
+typedef struct {
+    u32 link;
+    u32 esp0, ss0;
+    u32 esp1, ss1;
+    u32 esp2, ss2;
+    u32 cr3, eip, eflags;
+    u32 eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    u32 es, cs, ss, ds, fs, gs;
+    u32 ldt;
+    u16 trap, iomap_base;
+} __attribute__((packed)) tss_t;
+
+/* per-CPU data. each CPU's %gs selects a GDT segment whose base is its
+ * own cpu_t, so self and current are one %gs-relative load away and
+ * stay correct even if the task migrates right after reading them */
+typedef struct cpu {
+    struct cpu*  self;          /* %gs:PERCPU_SELF */
+    process_t*   current;       /* %gs:PERCPU_CURRENT */
+    u32          id;            /* %gs:PERCPU_ID, index into cpus[], 0 is the BSP */
+    u32          preempt_count; /* %gs:PERCPU_PREEMPT, see preempt.h */
+    u32          need_resched;  /* %gs:PERCPU_RESCHED, switch on the way out of the IRQ */
+    u32          apic_id;
+    process_t*   idle;
+    process_t*   prev;          /* task switch_to() just left */
+    process_t*   dead;          /* exited here, freed by the next task */
+    rq_t         rq;
+    u32          ticks;
+    u64          tick_tsc;      /* TSC when the timer behind the last tick expired */
+    volatile u32 online;
+    tss_t        tss;
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+extern u32   nr_cpus;
+
+static inline cpu_t* this_cpu(void) {
+    cpu_t* c;
+    __asm__ volatile ("movl %%gs:%c1, %0" : "=r"(c) : "i"(PERCPU_SELF));
+    return c;
+}
+
+static inline process_t* get_current(void) {
+    process_t* p;
+    __asm__ volatile ("movl %%gs:%c1, %0" : "=r"(p) : "i"(PERCPU_CURRENT));
+    return p;
+}
+
+/* acpi.c */
+int  madt_parse(u8* apic_ids, int max, u32* lapic_base);
+
+/* smp.c */
+void smp_early_init(void);
+void smp_init(void);
+u32  lapic_id(void);
+void lapic_eoi(void);
+void lapic_send_ipi(u32 apic_id, u8 vector);
+void smp_kick(u32 cpu);
+
+/* gdt.c */
+void gdt_set_percpu(u32 cpu, u32 base);
+void gdt_set_tss(u32 cpu, u32 base);
+void gdt_load_cpu(u32 cpu);
+
+/* idt.c */
+void idt_load(void);
+
+#endif /* SMP_H */
@@ -0,0 +1,234 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "kernel.h"
+#include "idt.h"
+#include "percpu.h"
+#include "preempt.h"
+
+/* ---------------------------------------------------------------
+ * lock classes: every lock names one, and lockstat prints a line per
+ * class. counters are per CPU so taking a lock never writes a cache
+ * line another CPU is also counting into.
+ * --------------------------------------------------------------- */
+
+typedef struct {
+    u32 acquisitions;
+    u32 contentions;            /* acquisitions that had to wait */
+    u64 spin_cycles;            /* TSC cycles spent waiting */
+    u64 max_spin;
+} lock_stat_t;
+
+typedef struct lock_class {
+    const char* name;
+    const char* type;           /* "spin", "ticket" or "mcs" */
+    lock_stat_t stat[MAX_CPUS];
+} __attribute__((aligned(8))) lock_class_t;
+
+/* classes are collected in their own section so lockstat can find them
+ * without a registry; see boot/linker.ld */
+#define DEFINE_LOCK_CLASS(cname, ltype)                                   \
+    lock_class_t lock_class_##cname                                       \
+    __attribute__((section("lock_classes"), used)) = { #cname, ltype, {{0, 0, 0, 0}} }
+
+#define DECLARE_LOCK_CLASS(cname) extern lock_class_t lock_class_##cname
+
+static inline void cpu_relax(void) {
+    __asm__ volatile ("pause" : : : "memory");
+}
+
+/* not atomic: a count can be lost if we are preempted right here,
+ * which is fine for statistics */
+static inline void lock_stat_acquired(lock_class_t* c) {
+    c->stat[this_cpu_id()].acquisitions++;
+}
+
+/* lock.c */
+void lock_stat_contended(lock_class_t* c, u64 cycles);
+void lockstat_show(void);
+void lockstat_reset(void);
+
+/* ---------------------------------------------------------------
+ * spinlock: test-and-test-and-set, for short sections with little
+ * contention. waiters spin on a plain read so they don't keep bouncing
+ * the cache line with locked xchgs. unfair.
+ * --------------------------------------------------------------- */
+
+typedef struct {
+    volatile u32  locked;
+    lock_class_t* cls;
+} spinlock_t;
+
+#define SPINLOCK_INIT(cname) { 0, &lock_class_##cname }
+
+void spin_lock_slow(spinlock_t* l);
+
+static inline void spin_lock_init(spinlock_t* l, lock_class_t* cls) {
+    l->locked = 0;
+    l->cls    = cls;
+}
+
+static inline void spin_lock(spinlock_t* l) {
+    preempt_disable();
+    if (__builtin_expect(__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE), 0))
+        spin_lock_slow(l);
+    lock_stat_acquired(l->cls);
+}
+
+static inline int spin_trylock(spinlock_t* l) {
+    preempt_disable();
+    if (__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE)) {
+        preempt_enable_no_resched();
+        return 0;
+    }
+    lock_stat_acquired(l->cls);
+    return 1;
+}
+
+static inline void __spin_unlock(spinlock_t* l) {
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline void spin_unlock(spinlock_t* l) {
+    __spin_unlock(l);
+    preempt_enable();
+}
+
+/* for locks also taken from interrupt handlers */
+static inline u32 spin_lock_irqsave(spinlock_t* l) {
+    u32 flags = irq_save();
+    spin_lock(l);
+    return flags;
+}
+
+/* interrupts come back on before the count drops, so a reschedule
+ * asked for while we held the lock can happen right here */
+static inline void spin_unlock_irqrestore(spinlock_t* l, u32 flags) {
+    __spin_unlock(l);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+/* ---------------------------------------------------------------
+ * ticket lock: FIFO, so no CPU starves under contention. low half of
+ * val is the ticket being served, high half the next one to hand out.
+ * --------------------------------------------------------------- */
+
+typedef struct {
+    volatile u32  val;
+    lock_class_t* cls;
+} ticket_lock_t;
+
+#define TICKET_LOCK_INIT(cname) { 0, &lock_class_##cname }
+
+void ticket_lock_slow(ticket_lock_t* l, u16 ticket);
+
+static inline void ticket_lock_init(ticket_lock_t* l, lock_class_t* cls) {
+    l->val = 0;
+    l->cls = cls;
+}
+
+static inline void ticket_lock(ticket_lock_t* l) {
+    preempt_disable();
+    u32 old = __atomic_fetch_add(&l->val, 1u << 16, __ATOMIC_ACQUIRE);
+    if (__builtin_expect((u16)old != (u16)(old >> 16), 0))
+        ticket_lock_slow(l, (u16)(old >> 16));
+    lock_stat_acquired(l->cls);
+}
+
+static inline int ticket_trylock(ticket_lock_t* l) {
+    u32 old = l->val;
+    if ((u16)old != (u16)(old >> 16)) return 0;
+    preempt_disable();
+    if (!__atomic_compare_exchange_n(&l->val, &old, old + (1u << 16), 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        preempt_enable_no_resched();
+        return 0;
+    }
+    lock_stat_acquired(l->cls);
+    return 1;
+}
+
+/* only the holder writes the owner half, a 16-bit store is enough */
+static inline void __ticket_unlock(ticket_lock_t* l) {
+    volatile u16* owner = (volatile u16*)&l->val;
+    __atomic_store_n(owner, (u16)(*owner + 1), __ATOMIC_RELEASE);
+}
+
+static inline void ticket_unlock(ticket_lock_t* l) {
+    __ticket_unlock(l);
+    preempt_enable();
+}
+
+static inline u32 ticket_lock_irqsave(ticket_lock_t* l) {
+    u32 flags = irq_save();
+    ticket_lock(l);
+    return flags;
+}
+
+static inline void ticket_unlock_irqrestore(ticket_lock_t* l, u32 flags) {
+    __ticket_unlock(l);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+/* ---------------------------------------------------------------
+ * MCS lock: FIFO like the ticket lock, but each waiter spins on its own
+ * node, so a heavily contended lock costs one cache-line transfer per
+ * handoff instead of one per waiter. the caller supplies the node and
+ * must pass the same one to unlock.
+ * --------------------------------------------------------------- */
+
+typedef struct mcs_node {
+    struct mcs_node* volatile next;
+    volatile u32              locked;
+} mcs_node_t;
+
+typedef struct {
+    mcs_node_t* volatile tail;
+    lock_class_t*        cls;
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT(cname) { NULL, &lock_class_##cname }
+
+void mcs_lock_slow(mcs_lock_t* l, mcs_node_t* node, mcs_node_t* prev);
+void mcs_unlock_slow(mcs_node_t* node);
+
+static inline void mcs_lock(mcs_lock_t* l, mcs_node_t* node) {
+    preempt_disable();
+    node->next   = NULL;
+    node->locked = 1;
+    mcs_node_t* prev = __atomic_exchange_n(&l->tail, node, __ATOMIC_ACQ_REL);
+    if (__builtin_expect(prev != NULL, 0))
+        mcs_lock_slow(l, node, prev);
+    lock_stat_acquired(l->cls);
+}
+
+static inline void __mcs_unlock(mcs_lock_t* l, mcs_node_t* node) {
+    if (!node->next) {
+        mcs_node_t* expect = node;
+        if (__atomic_compare_exchange_n(&l->tail, &expect, NULL, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+    }
+    mcs_unlock_slow(node);
+}
+
+static inline void mcs_unlock(mcs_lock_t* l, mcs_node_t* node) {
+    __mcs_unlock(l, node);
+    preempt_enable();
+}
+
+static inline u32 mcs_lock_irqsave(mcs_lock_t* l, mcs_node_t* node) {
+    u32 flags = irq_save();
+    mcs_lock(l, node);
+    return flags;
+}
+
+static inline void mcs_unlock_irqrestore(mcs_lock_t* l, mcs_node_t* node, u32 flags) {
+    __mcs_unlock(l, node);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+#endif /* SPINLOCK_H */
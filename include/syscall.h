@@ -0,0 +1,64 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+/* ---------------------------------------------------------------
+ * the user/kernel system call ABI, shared with the programs in
+ * user/, so no kernel types here.
+ *
+ * int 0x80:  eax = number, ebx ecx edx esi edi = arguments,
+ *            result in eax, every other register preserved.
+ * sysenter:  the same, except that ebp holds the user stack pointer
+ *            with the address to return to on top of it; ecx and edx
+ *            come back clobbered (SYSEXIT takes esp and eip in them).
+ * a negative result is an error, except from SYS_RING_SETUP and
+ * SYS_SHM_MAP, which return an address above 2 GiB and only -1 for
+ * an error.
+ * --------------------------------------------------------------- */
+
+#define SYS_EXIT      0
+#define SYS_READ      1
+#define SYS_WRITE     2
+#define SYS_OPEN      3
+#define SYS_CLOSE     4
+#define SYS_YIELD     5
+#define SYS_SLEEP     6         /* milliseconds */
+#define SYS_GETPID    7
+#define SYS_FSTAT     8
+#define SYS_RING_SETUP 9        /* entries -> address of the ring, see ring.h */
+#define SYS_RING_ENTER 10       /* to_submit, min_complete -> SQEs taken */
+#define SYS_CLOCK_NS  11        /* unsigned long long* <- ns since boot; vvar.h has it trap free */
+#define SYS_FUTEX_WAIT 12       /* addr, expected, timeout ms (0: none) */
+#define SYS_FUTEX_WAKE 13       /* addr, n -> how many woke */
+#define SYS_PIPE      14        /* int fds[2] <- read end, write end */
+#define SYS_SHM_MAP   15        /* name, size, flags -> address, see ipc.h */
+#define SYS_SHM_UNMAP 16        /* address */
+#define SYS_SHM_UNLINK 17       /* name */
+#define SYS_MQ_OPEN   18        /* name, flags, depth -> fd; write() sends, read() receives */
+#define SYS_MQ_SEND_PAGES 19    /* fd, page aligned buf, npages; the pages go with it */
+#define SYS_MQ_RECEIVE 20       /* fd, buf, len -> message length; remaps given pages */
+#define SYS_MQ_UNLINK 21        /* name */
+#define NR_SYSCALLS   22
+
+/* fd_open() flags */
+#define O_RDONLY      0x000
+#define O_WRONLY      0x001
+#define O_RDWR        0x002
+#define O_ACCMODE     0x003
+#define O_CREAT       0x040
+#define O_TRUNC       0x200
+#define O_APPEND      0x400
+
+/* the largest message: copied, and given as pages */
+#define MQ_MAX_MSG    (16 * 1024)
+#define MQ_MAX_PAGES  16
+
+/* futex_wait() results besides 0 (woken) and -1 (bad address) */
+#define FUTEX_AGAIN   (-2)      /* the word no longer held the expected value */
+#define FUTEX_TIMEOUT (-3)
+
+/* fd_seek() whence */
+#define SEEK_SET      0
+#define SEEK_CUR      1
+#define SEEK_END      2
+
+#endif /* SYSCALL_H */
@@ -2,6 +2,8 @@
 #define TTY_H
 
 #include "kernel.h"
+#include "spinlock.h"
+#include "wait.h"
 
 #define MAX_TTYS 4
 #define TTY_BUF_SIZE 1024
@@ -11,6 +13,8 @@ struct tty {
     int id;
     char input_buf[TTY_BUF_SIZE];
     int in_head, in_tail;
+    spinlock_t in_lock;     /* input ring, fed from the keyboard IRQ */
+    wait_queue_t in_wait;   /* tty_read() sleepers */
     uint16_t screen_buf[SCREEN_SIZE / 2];
     int cursor_x, cursor_y;
     int active;
@@ -0,0 +1,120 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include "kernel.h"
+#include "pci.h"
+
+/* ---------------------------------------------------------------
+ * virtio over the legacy PCI transport: the device's registers are
+ * I/O ports in BAR0, and each queue is one physically contiguous,
+ * page-aligned block the device is told the frame number of.
+ *
+ * a split virtqueue is three rings in that block. the driver puts a
+ * chain of descriptors (buffers, device-readable ones first) in the
+ * descriptor table and its head in the available ring; the device
+ * puts the head back in the used ring when it is done. with
+ * VIRTIO_RING_F_EVENT_IDX each side tells the other which index it
+ * next wants to hear about, so a driver that keeps the queue busy is
+ * rarely interrupted and rarely has to notify.
+ * --------------------------------------------------------------- */
+
+#define VIRTIO_VENDOR           0x1AF4
+#define VIRTIO_DEV_BLK_LEGACY   0x1001  /* transitional virtio-blk */
+
+/* legacy registers, from BAR0 */
+#define VIRTIO_PCI_HOST_FEATURES  0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+#define VIRTIO_PCI_QUEUE_PFN      0x08
+#define VIRTIO_PCI_QUEUE_SIZE     0x0C
+#define VIRTIO_PCI_QUEUE_SEL      0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY   0x10
+#define VIRTIO_PCI_STATUS         0x12
+#define VIRTIO_PCI_ISR            0x13
+#define VIRTIO_PCI_CONFIG         0x14  /* device config, with MSI-X off */
+
+#define VIRTIO_STATUS_ACK         0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FAILED      0x80
+
+#define VIRTIO_ISR_QUEUE          0x01
+
+#define VIRTIO_RING_F_INDIRECT_DESC (1u << 28)
+#define VIRTIO_RING_F_EVENT_IDX     (1u << 29)
+
+#define VRING_DESC_F_NEXT         1
+#define VRING_DESC_F_WRITE        2     /* device writes this buffer */
+#define VRING_USED_F_NO_NOTIFY    1
+#define VRING_ALIGN               4096
+#define VIRTQ_MAX_SIZE            1024
+
+typedef struct {
+    u64 addr;
+    u32 len;
+    u16 flags;
+    u16 next;
+} vring_desc_t;
+
+typedef struct {
+    u16 flags;
+    u16 idx;
+    u16 ring[];                         /* then used_event */
+} vring_avail_t;
+
+typedef struct {
+    u32 id;                             /* head of the chain */
+    u32 len;                            /* bytes the device wrote */
+} vring_used_elem_t;
+
+typedef struct {
+    u16 flags;
+    u16 idx;
+    vring_used_elem_t ring[];           /* then avail_event */
+} vring_used_t;
+
+typedef struct {
+    pci_dev_t* pci;
+    u16        io;                      /* BAR0 */
+    u32        features;                /* what both sides agreed */
+} virtio_dev_t;
+
+/* one buffer of a chain, a kernel address */
+typedef struct {
+    void* addr;
+    u32   len;
+} virtq_buf_t;
+
+/* not locked: the driver holds its own lock around every call */
+typedef struct {
+    virtio_dev_t*  vdev;
+    u16            index;
+    u16            size;
+    vring_desc_t*  desc;
+    vring_avail_t* avail;
+    vring_used_t*  used;
+    void*          raw;                 /* the allocation the rings are aligned in */
+    void**         cookies;             /* per head, what virtq_get() returns */
+    u16            free_head;
+    u16            nfree;
+    u16            last_used;           /* used ring entries consumed */
+    u16            kicked;              /* avail->idx at the last notify */
+} virtq_t;
+
+/* transport */
+int  virtio_pci_init(virtio_dev_t* vdev, pci_dev_t* pci);   /* reset, ACK, DRIVER */
+u32  virtio_negotiate(virtio_dev_t* vdev, u32 wanted);      /* the subset both have */
+void virtio_ready(virtio_dev_t* vdev);
+void virtio_fail(virtio_dev_t* vdev);
+void virtio_reset(virtio_dev_t* vdev);                     /* stops it using any queue */
+u8   virtio_isr(virtio_dev_t* vdev);                        /* reading it acknowledges */
+u32  virtio_config32(virtio_dev_t* vdev, u32 off);
+
+/* split virtqueues */
+int   virtq_init(virtq_t* vq, virtio_dev_t* vdev, u16 index);
+void  virtq_free(virtq_t* vq);          /* after virtio_reset() */
+int   virtq_add(virtq_t* vq, const virtq_buf_t* bufs, u32 nout, u32 nin, void* cookie);
+void  virtq_kick(virtq_t* vq);
+void* virtq_get(virtq_t* vq, u32* len);
+int   virtq_enable_cb(virtq_t* vq);     /* 1: more came in meanwhile, get again */
+
+#endif /* VIRTIO_H */
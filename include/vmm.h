@@ -0,0 +1,103 @@
+#ifndef VMM_H
+#define VMM_H
+
+#include "kernel.h"
+#include "idt.h"
+
+/* ---------------------------------------------------------------
+ * address space layout, the same in every page directory:
+ *   0          - 1 GiB    RAM, identity mapped with 4 MiB pages,
+ *                         supervisor only. the kernel and its heap
+ *                         live here and use physical addresses.
+ *   1 GiB      - 3 GiB    user space, 4 KiB pages, per process
+ *   3 GiB      - 4 GiB    identity mapped uncached, for MMIO (LAPIC)
+ * --------------------------------------------------------------- */
+#define PAGE_SIZE         4096
+#define PAGE_MASK         (~(PAGE_SIZE - 1))
+#define KERNEL_SPACE_END  0x40000000
+#define USER_BASE         0x40000000
+#define USER_END          0xC0000000
+#define MMIO_BASE         0xC0000000
+#define USER_STACK_TOP    USER_END
+#define USER_STACK_SIZE   (64 * 1024)
+#define FRAMES_START      0x2000000     /* memory.c's heap ends here */
+
+#define PTE_PRESENT  0x001
+#define PTE_WRITE    0x002
+#define PTE_USER     0x004
+#define PTE_PWT      0x008
+#define PTE_PCD      0x010
+#define PTE_PS       0x080              /* 4 MiB page, in a PDE */
+#define PTE_SHARED   0x200              /* one of the bits left to us: not this mm's frame to free */
+
+/* page fault error code */
+#define PF_PRESENT   0x1                /* protection, not a missing page */
+#define PF_WRITE     0x2
+#define PF_USER      0x4
+
+#define VMA_WRITE    0x1
+#define VMA_EXEC     0x2
+
+struct shm;
+
+/* a run of user pages, filled in on first touch. file-backed areas
+ * copy their part of [seg_vaddr, seg_vaddr + seg_filesz) from the
+ * inode and leave the rest zero, anonymous ones (inode < 0) are all
+ * zero, and shared memory areas map the segment's own frames */
+typedef struct vm_area {
+    u32 start, end;             /* page aligned, [start, end) */
+    u32 flags;                  /* VMA_* */
+    int inode;
+    u32 seg_vaddr;
+    u32 seg_off;                /* file offset of seg_vaddr */
+    u32 seg_filesz;
+    struct shm* shm;            /* ipc.h, holds a reference; NULL for private areas */
+    struct vm_area* next;
+} vm_area_t;
+
+typedef struct mm {
+    u32*       pgdir;           /* physical, which is also where we see it */
+    vm_area_t* areas;
+    u32        rss;             /* user pages present */
+    u32        pt_pages;        /* page tables under user space */
+    u32        faults;
+    u32        vsize;           /* bytes covered by areas */
+    u32        ring_entries;    /* ring.c, 0 until SYS_RING_SETUP */
+} mm_t;
+
+/* what the last address space to go away had mapped, for bench exec */
+typedef struct {
+    u32 rss;
+    u32 pt_pages;
+    u32 faults;
+    u32 vsize;
+} mm_stat_t;
+
+extern mm_stat_t mm_last_exit;
+
+void  vmm_init(u32 mem_upper_kb);
+void  vmm_init_cpu(void);
+u32   page_alloc(void);
+void  page_free(u32 phys);
+u32   page_free_count(void);
+
+mm_t* mm_create(void);
+void  mm_destroy(mm_t* mm);
+int   mm_add_area(mm_t* mm, u32 start, u32 end, u32 flags,
+                  int inode, u32 seg_vaddr, u32 seg_off, u32 seg_filesz);
+int   mm_add_shm(mm_t* mm, u32 start, u32 end, u32 flags, struct shm* shm);
+int   mm_remove_area(mm_t* mm, u32 start);
+u32   mm_find_gap(mm_t* mm, u32 lo, u32 hi, u32 size);
+void  mm_switch(mm_t* mm);
+int   page_fault(regs_t* r);
+int   user_range_ok(u32 addr, u32 len, int write);
+int   user_strncpy(char* dst, u32 src, usize size);
+u32   user_phys(u32 addr);
+
+/* moving whole private pages out of and into the current task's
+ * address space, for message queues that hand over pages */
+int   user_pages_ok(u32 addr, u32 npages);
+u32   user_take_page(u32 addr);
+int   user_give_page(u32 addr, u32 phys);
+
+#endif /* VMM_H */
@@ -0,0 +1,67 @@
+#ifndef VVAR_H
+#define VVAR_H
+
+/* ---------------------------------------------------------------
+ * the vvar page: one page of kernel data mapped read-only into every
+ * address space at VVAR_BASE, so a program can read the clock without
+ * a system call. the timer interrupt is its only writer; a reader
+ * retries while seq is odd or changed under it. shared with user/, so
+ * no kernel types, and everything here must work on both sides.
+ * --------------------------------------------------------------- */
+
+#define VVAR_BASE  0xBFFE0000           /* below the user stack, with a gap */
+
+typedef struct {
+    volatile unsigned seq;          /* odd while an update is in flight */
+    unsigned hz;                    /* ticks per second */
+    unsigned tsc_khz;
+    unsigned tick_ns;               /* 1e9 / hz */
+    unsigned tick_cycles;           /* TSC cycles per tick */
+    volatile unsigned ticks;        /* system_uptime */
+    volatile unsigned tick_tsc_lo;  /* TSC at the last tick, on the BSP */
+    volatile unsigned tick_tsc_hi;
+} vvar_t;
+
+static inline unsigned vvar_read_begin(const vvar_t* v) {
+    unsigned s;
+    while ((s = __atomic_load_n(&v->seq, __ATOMIC_ACQUIRE)) & 1)
+        __asm__ volatile ("pause");
+    return s;
+}
+
+static inline int vvar_read_retry(const vvar_t* v, unsigned s) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return v->seq != s;
+}
+
+/* nanoseconds since boot: the last tick plus the TSC since then. the
+ * TSC part is capped at one tick so a CPU whose TSC runs ahead of the
+ * BSP's never reads past the next tick, and a late tick never makes
+ * the clock go backwards */
+static inline unsigned long long vvar_clock_ns(const vvar_t* v) {
+    unsigned s, ticks, khz, tick_ns, cap, lo, hi, now_lo, now_hi;
+    do {
+        s       = vvar_read_begin(v);
+        ticks   = v->ticks;
+        khz     = v->tsc_khz;
+        tick_ns = v->tick_ns;
+        cap     = v->tick_cycles;
+        lo      = v->tick_tsc_lo;
+        hi      = v->tick_tsc_hi;
+    } while (vvar_read_retry(v, s));
+
+    __asm__ volatile ("rdtsc" : "=a"(now_lo), "=d"(now_hi));
+    unsigned long long since = (((unsigned long long)now_hi << 32) | now_lo) -
+                               (((unsigned long long)hi << 32) | lo);
+    unsigned delta = (long long)since < 0 ? 0 : since > cap ? cap : (unsigned)since;
+
+    /* delta * 1e6 / khz stays below one tick in ns, so one divl does it
+     * without libgcc's 64-bit division */
+    unsigned long long prod = (unsigned long long)delta * 1000000u;
+    unsigned ns;
+    __asm__ ("divl %3" : "=a"(ns), "=d"(lo)
+             : "A"(prod), "rm"(khz ? khz : 1));
+    return (unsigned long long)ticks * tick_ns + ns;
+}
+
+#endif /* VVAR_H */
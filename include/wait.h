@@ -0,0 +1,90 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include "kernel.h"
+#include "spinlock.h"
+
+struct process;
+
+/* ---------------------------------------------------------------
+ * wait queues: a task that cannot make progress puts itself on one
+ * and blocks; whoever changes the condition calls wake_up(). a waiter
+ * is off every run queue while it sleeps, so it costs no CPU at all.
+ * --------------------------------------------------------------- */
+
+typedef struct wait_entry {
+    struct process*    task;
+    struct wait_entry* next;
+    u8                 queued;
+} wait_entry_t;
+
+typedef struct {
+    spinlock_t    lock;         /* irqsave: wake_up() may run in an IRQ */
+    wait_entry_t* head;
+    wait_entry_t* tail;
+} wait_queue_t;
+
+DECLARE_LOCK_CLASS(waitqueue);
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT(waitqueue), NULL, NULL }
+
+void wait_queue_init(wait_queue_t* wq);
+void prepare_to_wait(wait_queue_t* wq, wait_entry_t* w);
+void finish_wait(wait_queue_t* wq, wait_entry_t* w);
+int  wake_up(wait_queue_t* wq);         /* first waiter, returns how many woke */
+int  wake_up_all(wait_queue_t* wq);
+
+/* sleep until cond is true. cond is rechecked after queueing so a
+ * wake_up() between the check and the block is not lost: it leaves the
+ * task's wake_pending set and proc_block() returns straight away */
+#define wait_event(wq, cond)                                    \
+    do {                                                        \
+        if (cond) break;                                        \
+        wait_entry_t __we = { NULL, NULL, 0 };                  \
+        for (;;) {                                              \
+            prepare_to_wait((wq), &__we);                       \
+            if (cond) break;                                    \
+            proc_block();                                       \
+        }                                                       \
+        finish_wait((wq), &__we);                               \
+    } while (0)
+
+/* as wait_event, but give up after ticks timer ticks. evaluates to
+ * nonzero if cond came true, 0 on timeout */
+#define wait_event_timeout(wq, cond, ticks)                     \
+    ({                                                          \
+        int __ok = (cond);                                      \
+        if (!__ok) {                                            \
+            u32 __end = system_uptime + (ticks);                \
+            wait_entry_t __we = { NULL, NULL, 0 };              \
+            for (;;) {                                          \
+                prepare_to_wait((wq), &__we);                   \
+                if ((__ok = (cond))) break;                     \
+                int __left = (int)(__end - system_uptime);      \
+                if (__left <= 0) break;                         \
+                proc_block_timeout((u32)__left);                \
+            }                                                   \
+            finish_wait((wq), &__we);                           \
+        }                                                       \
+        __ok;                                                   \
+    })
+
+/* ---------------------------------------------------------------
+ * completions: a one-shot "this has happened" with a count, so a
+ * complete() that lands before the wait is not lost either.
+ * --------------------------------------------------------------- */
+
+typedef struct {
+    volatile u32 done;
+    wait_queue_t wait;
+} completion_t;
+
+#define COMPLETION_INIT { 0, WAIT_QUEUE_INIT }
+
+void init_completion(completion_t* c);
+void complete(completion_t* c);          /* release one waiter */
+void complete_all(completion_t* c);      /* release everyone, now and later */
+void wait_for_completion(completion_t* c);
+int  wait_for_completion_timeout(completion_t* c, u32 ticks);
+
+#endif /* WAIT_H */
@@ -0,0 +1,104 @@
+#include "kernel.h"
+#include "smp.h"
+
+/* just enough ACPI to find the MADT and list the processors in it */
+
+#define EBDA_SEG_PTR   0x40E
+#define BIOS_ROM_START 0xE0000
+#define BIOS_ROM_END   0x100000
+
+#define MADT_LAPIC          0
+#define MADT_LAPIC_ENABLED  0x1
+#define MADT_LAPIC_ONLINE   0x2     /* ACPI 6.3 online-capable */
+
+typedef struct {
+    char signature[8];          /* "RSD PTR " */
+    u8   checksum;
+    char oem_id[6];
+    u8   revision;
+    u32  rsdt_addr;
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    u32  length;
+    u8   revision;
+    u8   checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    u32  oem_revision;
+    u32  creator_id;
+    u32  creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+typedef struct {
+    acpi_header_t header;
+    u32 lapic_addr;
+    u32 flags;
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct {
+    u8  type;
+    u8  length;
+    u8  acpi_id;
+    u8  apic_id;
+    u32 flags;
+} __attribute__((packed)) madt_lapic_t;
+
+static int acpi_checksum(const void* p, u32 len) {
+    const u8* b = p;
+    u8 sum = 0;
+    for (u32 i = 0; i < len; i++) sum += b[i];
+    return sum == 0;
+}
+
+static acpi_rsdp_t* rsdp_scan(u32 start, u32 end) {
+    for (u32 a = start; a + sizeof(acpi_rsdp_t) <= end; a += 16) {
+        acpi_rsdp_t* r = (acpi_rsdp_t*)a;
+        if (memcmp(r->signature, "RSD PTR ", 8) == 0 && acpi_checksum(r, sizeof(*r)))
+            return r;
+    }
+    return NULL;
+}
+
+/* the RSDP lives in the first KiB of the EBDA or in the BIOS ROM area */
+static acpi_rsdp_t* rsdp_find(void) {
+    u32 ebda = (u32)(*(volatile u16*)EBDA_SEG_PTR) << 4;
+    acpi_rsdp_t* r = NULL;
+    if (ebda) r = rsdp_scan(ebda, ebda + 1024);
+    if (!r)   r = rsdp_scan(BIOS_ROM_START, BIOS_ROM_END);
+    return r;
+}
+
+/* fill apic_ids with the local APIC id of every usable CPU; returns how
+ * many, 0 if there is no ACPI at all */
+int madt_parse(u8* apic_ids, int max, u32* lapic_base) {
+    acpi_rsdp_t* rsdp = rsdp_find();
+    if (!rsdp) return 0;
+
+    acpi_header_t* rsdt = (acpi_header_t*)rsdp->rsdt_addr;
+    if (memcmp(rsdt->signature, "RSDT", 4) != 0 || !acpi_checksum(rsdt, rsdt->length))
+        return 0;
+
+    u32  entries = (rsdt->length - sizeof(acpi_header_t)) / 4;
+    u32* tables  = (u32*)(rsdt + 1);
+    for (u32 i = 0; i < entries; i++) {
+        acpi_madt_t* madt = (acpi_madt_t*)tables[i];
+        if (memcmp(madt->header.signature, "APIC", 4) != 0) continue;
+        if (!acpi_checksum(madt, madt->header.length)) continue;
+
+        *lapic_base = madt->lapic_addr;
+        int n = 0;
+        u8* p   = (u8*)(madt + 1);
+        u8* end = (u8*)madt + madt->header.length;
+        while (p + 2 <= end && p[1] >= 2) {
+            madt_lapic_t* e = (madt_lapic_t*)p;
+            if (e->type == MADT_LAPIC && n < max &&
+                (e->flags & (MADT_LAPIC_ENABLED | MADT_LAPIC_ONLINE)))
+                apic_ids[n++] = e->apic_id;
+            p += p[1];
+        }
+        return n;
+    }
+    return 0;
+}
@@ -0,0 +1,431 @@
+#include "kernel.h"
+#include "vmm.h"
+#include "spinlock.h"
+#include "wait.h"
+#include "pci.h"
+#include "ata.h"
+#include "blk.h"
+#include "ahci.h"
+
+/* one per port with a disk behind it. the lock covers busy, the slots
+ * and the command list; it is taken in submit and in the interrupt,
+ * and never held across blk_end_request(), which may submit again */
+
+typedef struct ahci_port {
+    volatile u32*  regs;
+    u32            no;
+    u32*           cl;                      /* command list, then the FIS area */
+    u8*            tables[AHCI_MAX_SLOTS];  /* a page each */
+    blk_request_t* rq[AHCI_MAX_SLOTS];
+    u32            slots;                   /* mask of the ones we use */
+    u32            busy;                    /* issued and not yet ended */
+    u8             ncq;
+    u8             lba48;
+    u8             fua;                     /* WRITE DMA FUA EXT */
+    volatile u8    recover;                 /* AHCI_RECOVER_* */
+    wait_queue_t   recover_wq;              /* the port's recovery thread sleeps here */
+    spinlock_t     lock;
+    struct ahci_hba* hba;
+    block_device_t blk;
+    char           model[41];
+} ahci_port_t;
+
+typedef struct ahci_hba {
+    volatile u32* abar;
+    u32           nslots;
+    u8            ncq;                      /* CAP.SNCQ */
+    ahci_port_t*  ports[32];
+} ahci_hba_t;
+
+#define AHCI_RECOVER_NEEDED  1               /* halted on an error */
+#define AHCI_RECOVER_RUNNING 2               /* being restarted */
+
+DEFINE_LOCK_CLASS(ahci_port, "spin");
+static int ahci_ndisks;                     /* sda, sdb, ... across controllers */
+
+#define HBA(h, reg)   ((h)->abar[(reg) / 4])
+#define PORT(p, reg)  ((p)->regs[(reg) / 4])
+
+/* poll reg until (reg & mask) == want, up to ms */
+static int ahci_spin(volatile u32* reg, u32 mask, u32 want, u32 ms) {
+    u64 end = rdtsc() + (u64)ms * tsc_khz;
+    while ((*reg & mask) != want)
+        if (rdtsc() > end) return -1;
+    return 0;
+}
+
+/* ============================================================
+ * commands
+ * ============================================================ */
+
+/* register host to device FIS; count and features are 16 bits wide
+ * (the EXT registers), LBA 48 */
+static void ahci_fis(u8* cfis, u8 cmd, u32 lba, u32 count, u8 device, u32 features) {
+    memset(cfis, 0, 20);
+    cfis[0]  = AHCI_FIS_H2D;
+    cfis[1]  = AHCI_FIS_CMD;
+    cfis[2]  = cmd;
+    cfis[3]  = (u8)features;
+    cfis[4]  = (u8)lba;
+    cfis[5]  = (u8)(lba >> 8);
+    cfis[6]  = (u8)(lba >> 16);
+    cfis[7]  = device;
+    cfis[8]  = (u8)(lba >> 24);
+    cfis[11] = (u8)(features >> 8);
+    cfis[12] = (u8)count;
+    cfis[13] = (u8)(count >> 8);
+}
+
+/* a PRD per physically contiguous run of the request's bios, none over
+ * 4 MiB; the prd count, or -1 if it will not fit or a buffer is not a
+ * kernel address (and so not its own physical address) */
+static int ahci_prd_fill(u8* table, bio_t* bios) {
+    u32* prd = (u32*)(table + AHCI_CT_PRDT);
+    int  n   = 0;
+    for (bio_t* bio = bios; bio; bio = bio->next) {
+        u32 addr  = (u32)bio->buf;
+        u32 bytes = bio->count * ATA_SECTOR_SIZE;
+        if (addr + bytes > KERNEL_SPACE_END) return -1;
+        while (bytes) {
+            if (n == (int)AHCI_PRDS) return -1;
+            u32 run = bytes < AHCI_PRD_MAX_BYTES ? bytes : AHCI_PRD_MAX_BYTES;
+            prd[n * 4]     = addr;
+            prd[n * 4 + 1] = 0;
+            prd[n * 4 + 2] = 0;
+            prd[n * 4 + 3] = run - 1;
+            addr  += run;
+            bytes -= run;
+            n++;
+        }
+    }
+    return n;
+}
+
+/* fill slot for rq: FPDMA QUEUED with the slot as the tag where the
+ * drive queues, the plain DMA commands where it doesn't. returns
+ * whether it is a queued command, or -1 */
+static int ahci_build(ahci_port_t* p, u32 slot, blk_request_t* rq) {
+    u8* table = p->tables[slot];
+    int write = (rq->flags & BIO_WRITE) != 0;
+    int fua   = (rq->flags & BLK_FUA) != 0;
+    int nprd  = 0;
+    int ncq   = 0;
+
+    if (rq->flags & BIO_FLUSH) {
+        ahci_fis(table, p->lba48 ? ATA_CMD_FLUSH_EXT : ATA_CMD_FLUSH, 0, 0, 0x40, 0);
+    } else {
+        nprd = ahci_prd_fill(table, rq->bios);
+        if (nprd < 0) return -1;
+        if (p->ncq) {
+            ncq = 1;
+            ahci_fis(table, write ? AHCI_CMD_WRITE_FPDMA : AHCI_CMD_READ_FPDMA, rq->lba,
+                     slot << 3, (u8)(0x40 | (fua ? 0x80 : 0)), rq->count);
+        } else if (p->lba48 && (!fua || p->fua)) {
+            ahci_fis(table, fua ? ATA_CMD_WRITE_DMA_FUA : write ? ATA_CMD_WRITE_DMA_EXT
+                            : ATA_CMD_READ_DMA_EXT, rq->lba, rq->count, 0x40, 0);
+        } else {
+            /* blk.fua is off, so FUA writes never get here */
+            if (fua) return -1;
+            ahci_fis(table, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA, rq->lba & 0xFFFFFF,
+                     rq->count, (u8)(0xE0 | ((rq->lba >> 24) & 0x0F)), 0);
+        }
+    }
+
+    u32* hdr = p->cl + slot * 8;
+    hdr[0] = 5 | (write ? AHCI_HDR_WRITE : 0) | AHCI_HDR_PRDTL(nprd);   /* FIS: 5 dwords */
+    hdr[1] = 0;
+    hdr[2] = (u32)table;
+    hdr[3] = 0;
+    return ncq;
+}
+
+/* a command on slot 0 by polling, for setup before the port is a
+ * block device; 0 or -1 */
+static int ahci_exec_polled(ahci_port_t* p, u8 cmd, void* buf, u32 bytes) {
+    u8* table = p->tables[0];
+    ahci_fis(table, cmd, 0, 0, 0, 0);
+    u32* prd = (u32*)(table + AHCI_CT_PRDT);
+    prd[0] = (u32)buf;
+    prd[1] = prd[2] = 0;
+    prd[3] = bytes - 1;
+    p->cl[0] = 5 | AHCI_HDR_PRDTL(1);
+    p->cl[1] = 0;
+    p->cl[2] = (u32)table;
+    p->cl[3] = 0;
+
+    PORT(p, AHCI_PxIS) = ~0u;
+    PORT(p, AHCI_PxCI) = 1;
+    if (ahci_spin(&PORT(p, AHCI_PxCI), 1, 0, AHCI_TIMEOUT) < 0) return -1;
+    return (PORT(p, AHCI_PxIS) & AHCI_PxIS_TFES) || (PORT(p, AHCI_PxTFD) & ATA_STATUS_ERR) ? -1 : 0;
+}
+
+/* ============================================================
+ * the port
+ * ============================================================ */
+
+static int ahci_port_stop(ahci_port_t* p) {
+    PORT(p, AHCI_PxCMD) &= ~AHCI_PxCMD_ST;
+    if (ahci_spin(&PORT(p, AHCI_PxCMD), AHCI_PxCMD_CR, 0, AHCI_TIMEOUT) < 0) return -1;
+    PORT(p, AHCI_PxCMD) &= ~AHCI_PxCMD_FRE;
+    return ahci_spin(&PORT(p, AHCI_PxCMD), AHCI_PxCMD_FR, 0, AHCI_TIMEOUT);
+}
+
+static void ahci_port_start(ahci_port_t* p) {
+    PORT(p, AHCI_PxSERR) = ~0u;
+    PORT(p, AHCI_PxIS)   = ~0u;
+    PORT(p, AHCI_PxCMD) |= AHCI_PxCMD_FRE;
+    ahci_spin(&PORT(p, AHCI_PxTFD), ATA_STATUS_BSY | ATA_STATUS_DRQ, 0, AHCI_TIMEOUT);
+    PORT(p, AHCI_PxCMD) |= AHCI_PxCMD_ST;
+}
+
+/* end whatever has finished, from the interrupt or a poll. after an
+ * error the port has stopped taking commands: what it had finished
+ * ends well, the rest fails, and the restart, which may spin for
+ * seconds, is left to ahci_port_recover() in a task */
+static void ahci_port_reap(ahci_port_t* p) {
+    blk_request_t* done_rq[AHCI_MAX_SLOTS];
+    int done_err[AHCI_MAX_SLOTS];
+    int n = 0;
+
+    u32 flags = spin_lock_irqsave(&p->lock);
+    u32 is = PORT(p, AHCI_PxIS);
+    PORT(p, AHCI_PxIS) = is;
+    HBA(p->hba, AHCI_IS) = 1u << p->no;
+    u32 ok     = p->busy & ~(PORT(p, AHCI_PxSACT) | PORT(p, AHCI_PxCI));
+    u32 failed = 0;
+    if ((is & AHCI_PxIS_ERR) && !p->recover) {
+        failed     = p->busy & ~ok;
+        p->recover = AHCI_RECOVER_NEEDED;
+        wake_up(&p->recover_wq);
+    }
+    for (u32 slot = 0; slot < AHCI_MAX_SLOTS; slot++) {
+        if (!((ok | failed) & (1u << slot))) continue;
+        done_rq[n]    = p->rq[slot];
+        done_err[n++] = (failed & (1u << slot)) ? -1 : 0;
+    }
+    p->busy &= ~(ok | failed);
+    spin_unlock_irqrestore(&p->lock, flags);
+
+    for (int i = 0; i < n; i++)
+        blk_end_request(&p->blk, done_rq[i], done_err[i]);
+}
+
+/* restart a port reap found halted, then start what submit turned
+ * away meanwhile. process context only: from the port's thread, or
+ * from a poll while the boot-time mount waits with interrupts off,
+ * before there are threads; whichever gets there first does it */
+static void ahci_port_recover(ahci_port_t* p) {
+    u32 flags = spin_lock_irqsave(&p->lock);
+    int mine = p->recover == AHCI_RECOVER_NEEDED;
+    if (mine) p->recover = AHCI_RECOVER_RUNNING;
+    spin_unlock_irqrestore(&p->lock, flags);
+    if (!mine) return;
+
+    ahci_port_stop(p);
+    ahci_port_start(p);
+    flags = spin_lock_irqsave(&p->lock);
+    p->recover = 0;
+    spin_unlock_irqrestore(&p->lock, flags);
+    blk_kick(&p->blk);
+}
+
+static void ahci_recover_thread(void* arg) {
+    ahci_port_t* p = (ahci_port_t*)arg;
+    for (;;) {
+        wait_event(&p->recover_wq, p->recover == AHCI_RECOVER_NEEDED);
+        ahci_port_recover(p);
+    }
+}
+
+/* may run in the interrupt, so a halted port is not restarted here:
+ * the request waits on the queue until ahci_port_recover() kicks it */
+static int ahci_submit(block_device_t* dev, blk_request_t* rq) {
+    ahci_port_t* p = (ahci_port_t*)dev->driver_data;
+    u32 flags = spin_lock_irqsave(&p->lock);
+    if (p->recover) {
+        spin_unlock_irqrestore(&p->lock, flags);
+        return BLK_BUSY;
+    }
+    u32 free  = p->slots & ~p->busy;
+    int ncq   = free ? ahci_build(p, (u32)__builtin_ctz(free), rq) : -1;
+    if (ncq < 0) {
+        spin_unlock_irqrestore(&p->lock, flags);
+        return -1;
+    }
+    u32 slot = (u32)__builtin_ctz(free);
+    p->rq[slot] = rq;
+    p->busy    |= 1u << slot;
+    if (ncq) PORT(p, AHCI_PxSACT) = 1u << slot;
+    PORT(p, AHCI_PxCI) = 1u << slot;
+    spin_unlock_irqrestore(&p->lock, flags);
+    return 0;
+}
+
+static void ahci_poll(block_device_t* dev) {
+    ahci_port_t* p = (ahci_port_t*)dev->driver_data;
+    ahci_port_reap(p);
+    if (p->recover == AHCI_RECOVER_NEEDED) ahci_port_recover(p);
+}
+
+static const blk_ops_t ahci_blk_ops = { ahci_submit, ahci_poll, 1, NULL };
+
+static void ahci_irq(pci_dev_t* dev) {
+    ahci_hba_t* hba = (ahci_hba_t*)dev->driver_data;
+    u32 is = HBA(hba, AHCI_IS);
+    for (u32 i = 0; is; i++, is >>= 1)
+        if ((is & 1) && hba->ports[i]) ahci_port_reap(hba->ports[i]);
+}
+
+/* IDENTIFY the drive and size up what it can queue */
+static int ahci_identify(ahci_port_t* p) {
+    u16* id = (u16*)page_alloc();
+    if (!id) return -1;
+    if (ahci_exec_polled(p, ATA_CMD_IDENTIFY, id, 512) < 0) {
+        page_free((u32)id);
+        return -1;
+    }
+
+    p->lba48 = (id[83] & 0xC000) == 0x4000 && (id[83] & (1 << 10));
+    p->blk.sectors = *(u32*)&id[60];
+    if (p->lba48)
+        p->blk.sectors = (id[102] || id[103]) ? 0xFFFFFFFF : *(u32*)&id[100];
+
+    /* word 84 bit 6: WRITE DMA FUA EXT. FPDMA writes have a FUA bit
+     * of their own */
+    p->fua = p->lba48 && (id[84] & 0xC000) == 0x4000 && (id[84] & (1 << 6));
+
+    /* word 76 bit 8: NCQ, word 75: the queue depth less one */
+    u32 depth = 1;
+    if (p->hba->ncq && p->lba48 && id[76] != 0xFFFF && (id[76] & (1 << 8))) {
+        p->ncq = 1;
+        depth  = (id[75] & 31) + 1u;
+        if (depth > p->hba->nslots) depth = p->hba->nslots;
+    }
+    p->blk.depth       = depth;
+    p->blk.fua         = p->ncq || p->fua;
+    p->blk.max_sectors = p->lba48 ? ATA_MAX_SECTORS48 : ATA_MAX_SECTORS;
+    p->slots           = depth == 32 ? ~0u : (1u << depth) - 1;
+
+    for (int i = 0; i < 20; i++) {
+        p->model[i * 2]     = (char)(id[27 + i] >> 8);
+        p->model[i * 2 + 1] = (char)id[27 + i];
+    }
+    p->model[40] = '\0';
+    for (int i = 39; i >= 0 && p->model[i] == ' '; i--) p->model[i] = '\0';
+    page_free((u32)id);
+    return 0;
+}
+
+/* bring up port n if a SATA disk is on it: the command list and FIS
+ * area, a table per slot, the engine started, the drive identified */
+static ahci_port_t* ahci_port_init(ahci_hba_t* hba, u32 n) {
+    volatile u32* regs = hba->abar + AHCI_PORT(n) / 4;
+    if (HBA(hba, AHCI_CAP) & AHCI_CAP_SSS) regs[AHCI_PxCMD / 4] |= AHCI_PxCMD_SUD | AHCI_PxCMD_POD;
+    if (ahci_spin(&regs[AHCI_PxSSTS / 4], 0x0F, AHCI_SSTS_DET_OK, AHCI_LINK_TIMEOUT) < 0) return NULL;
+
+    ahci_port_t* p = (ahci_port_t*)kmalloc(sizeof(ahci_port_t));
+    if (!p) return NULL;
+    memset(p, 0, sizeof(*p));
+    p->regs = regs;
+    p->no   = n;
+    p->hba  = hba;
+    spin_lock_init(&p->lock, &lock_class_ahci_port);
+    wait_queue_init(&p->recover_wq);
+    if (ahci_port_stop(p) < 0) goto fail;
+
+    p->cl = (u32*)page_alloc();
+    if (!p->cl) goto fail;
+    for (u32 i = 0; i < hba->nslots; i++)
+        if (!(p->tables[i] = (u8*)page_alloc())) goto fail;
+    PORT(p, AHCI_PxCLB)  = (u32)p->cl;
+    PORT(p, AHCI_PxCLBU) = 0;
+    PORT(p, AHCI_PxFB)   = (u32)p->cl + AHCI_CL_SIZE;
+    PORT(p, AHCI_PxFBU)  = 0;
+    ahci_port_start(p);
+
+    /* the signature is the drive's first D2H FIS, which needs FRE on */
+    if (PORT(p, AHCI_PxSIG) != AHCI_SIG_ATA || ahci_identify(p) < 0) {
+        ahci_port_stop(p);
+        goto fail;
+    }
+    return p;
+
+fail:
+    for (u32 i = 0; i < hba->nslots; i++)
+        if (p->tables[i]) page_free((u32)p->tables[i]);
+    if (p->cl) page_free((u32)p->cl);
+    kfree(p);
+    return NULL;
+}
+
+/* ============================================================
+ * the controller
+ * ============================================================ */
+
+static const pci_id_t ahci_ids[] = {
+    { PCI_ANY, PCI_ANY, PCI_CLASS_AHCI, 0xFFFFFF },
+    { 0, 0, 0, 0 },
+};
+
+/* ABAR has to be in the uncached window the kernel maps for MMIO */
+static int ahci_probe(pci_dev_t* dev, const pci_id_t* id) {
+    (void)id;
+    pci_bar_t* bar = &dev->bar[5];
+    if (bar->io || !bar->size || bar->base < MMIO_BASE) return -1;
+
+    ahci_hba_t* hba = (ahci_hba_t*)kmalloc(sizeof(ahci_hba_t));
+    if (!hba) return -1;
+    memset(hba, 0, sizeof(*hba));
+    hba->abar = (volatile u32*)bar->base;
+    dev->driver_data = hba;
+    pci_enable(dev, PCI_CMD_MEMORY | PCI_CMD_MASTER);
+
+    /* a reset puts every port back to idle, whatever the firmware left */
+    HBA(hba, AHCI_GHC) |= AHCI_GHC_AE;
+    HBA(hba, AHCI_GHC) |= AHCI_GHC_HR;
+    if (ahci_spin(&HBA(hba, AHCI_GHC), AHCI_GHC_HR, 0, AHCI_TIMEOUT) < 0) {
+        kfree(hba);
+        return -1;
+    }
+    HBA(hba, AHCI_GHC) |= AHCI_GHC_AE;
+
+    u32 cap     = HBA(hba, AHCI_CAP);
+    hba->nslots = AHCI_CAP_NCS(cap);
+    hba->ncq    = (cap & AHCI_CAP_SNCQ) != 0;
+    int irq     = pci_irq_register(dev, ahci_irq) == 0;
+
+    u32 pi = HBA(hba, AHCI_PI);
+    for (u32 n = 0; n < 32; n++) {
+        if (!(pi & (1u << n))) continue;
+        ahci_port_t* p = ahci_port_init(hba, n);
+        if (!p) continue;
+        hba->ports[n] = p;
+
+        snprintf(p->blk.name, BLK_NAME_MAX, "sd%c", 'a' + ahci_ndisks++);
+        p->blk.ops         = &ahci_blk_ops;
+        p->blk.driver_data = p;
+        p->blk.polled      = !irq;
+        PORT(p, AHCI_PxIE) = AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_DSS |
+                             AHCI_PxIS_SDBS | AHCI_PxIS_ERR;
+        blk_register(&p->blk);
+
+        char line[96];
+        snprintf(line, sizeof(line), "ahci: %s port %u: %s, %u MiB, %s %u\n", p->blk.name, n,
+                 p->model, p->blk.sectors / 2048, p->ncq ? "NCQ depth" : "no NCQ, depth",
+                 p->blk.depth);
+        kprint(line);
+    }
+    HBA(hba, AHCI_IS)  = ~0u;
+    HBA(hba, AHCI_GHC) |= AHCI_GHC_IE;
+    return 0;
+}
+
+/* a recovery thread per port, which probe was too early to start */
+static void ahci_start(pci_dev_t* dev) {
+    ahci_hba_t* hba = (ahci_hba_t*)dev->driver_data;
+    for (u32 n = 0; n < 32; n++)
+        if (hba->ports[n] && kthread_create("ahci_eh", ahci_recover_thread, hba->ports[n]) < 0)
+            kprint("ahci: cannot start a recovery thread\n");
+}
+
+PCI_DRIVER_START(ahci, ahci_ids, ahci_probe, ahci_start);
@@ -0,0 +1,1182 @@
+#include "kernel.h"
+#include "idt.h"
+#include "smp.h"
+#include "vmm.h"
+#include "syscall.h"
+#include "wait.h"
+#include "futex.h"
+#include "pipe.h"
+#include "ipc.h"
+#include "blk.h"
+
+/* ---------------------------------------------------------------
+ * ctxsw: two kernel threads hand a token back and forth with
+ * proc_yield(), so every yield is exactly one switch_to().
+ * --------------------------------------------------------------- */
+#define CTXSW_ROUNDS 10000
+
+static volatile u32 pp_turn;
+static volatile u32 pp_left;
+static volatile u64 pp_end;
+static u32          pp_waiter;
+
+static void pingpong_thread(void* arg) {
+    u32 me = (u32)arg;
+    for (u32 i = 0; i < CTXSW_ROUNDS; i++) {
+        while (pp_turn != me) proc_yield();
+        pp_turn = !me;
+    }
+    if (__atomic_sub_fetch(&pp_left, 1, __ATOMIC_SEQ_CST) == 0) {
+        pp_end = rdtsc();
+        proc_unblock(pp_waiter);
+    }
+}
+
+static void bench_ctxsw(void) {
+    pp_turn   = 0;
+    pp_left   = 2;
+    pp_waiter = proc_get_pid();
+
+    /* keep the pair from running until we are safely blocked */
+    u32 flags = irq_save();
+    if (kthread_create("ping", pingpong_thread, (void*)0) < 0 ||
+        kthread_create("pong", pingpong_thread, (void*)1) < 0) {
+        irq_restore(flags);
+        vga_write("bench: cannot create threads\n", COLOUR_LIGHT_RED);
+        return;
+    }
+    u64 start = rdtsc();
+    while (pp_left) proc_block();
+    irq_restore(flags);
+
+    u64 cycles   = pp_end - start;
+    u32 switches = CTXSW_ROUNDS * 2;
+    u32 per      = (u32)div64_u32(cycles, switches);
+
+    char buf[96];
+    snprintf(buf, sizeof(buf), "ctxsw: %u switches in %u us\n",
+             switches, (u32)tsc_to_us(cycles));
+    vga_write(buf, COLOUR_WHITE);
+    snprintf(buf, sizeof(buf), "ctxsw: %u cycles (%u ns) per switch, %u ns round trip\n",
+             per, (u32)tsc_to_ns(per), (u32)tsc_to_ns((u64)per * 2));
+    vga_write(buf, COLOUR_LIGHT_GREEN);
+}
+
+/* ---------------------------------------------------------------
+ * fair: N CPU-bound SCHED_FAIR threads at nice 0, 1, 2, ... spin
+ * for two seconds; each one's CPU share should track its weight.
+ * --------------------------------------------------------------- */
+#define FAIR_MAX_THREADS 8
+#define FAIR_RUN_TICKS   (2 * TIMER_HZ)
+
+static volatile u32 fair_stop;
+static volatile u32 fair_left;
+static u32          fair_waiter;
+static u64          fair_runtime[FAIR_MAX_THREADS];
+
+static void fair_hog(void* arg) {
+    u32 slot = (u32)arg;
+    volatile u32 spin = 0;
+    while (!fair_stop) spin++;
+    fair_runtime[slot] = proc_get_runtime_us(proc_get_pid());
+
+    if (__atomic_sub_fetch(&fair_left, 1, __ATOMIC_SEQ_CST) == 0)
+        proc_unblock(fair_waiter);
+}
+
+static void bench_fair(int n) {
+    if (n < 1) n = 1;
+    if (n > FAIR_MAX_THREADS) n = FAIR_MAX_THREADS;
+
+    fair_stop   = 0;
+    fair_left   = 0;
+    fair_waiter = proc_get_pid();
+
+    u32 flags = irq_save();
+    int created = 0;
+    for (int i = 0; i < n; i++) {
+        int pid = kthread_create("hog", fair_hog, (void*)i);
+        if (pid < 0) break;
+        proc_set_class((u32)pid, SCHED_FAIR);
+        proc_set_nice((u32)pid, i);
+        fair_runtime[i] = 0;
+        fair_left++;
+        created++;
+    }
+    irq_restore(flags);
+    if (created == 0) {
+        vga_write("bench: cannot create threads\n", COLOUR_LIGHT_RED);
+        return;
+    }
+
+    proc_sleep(FAIR_RUN_TICKS);
+    fair_stop = 1;
+
+    flags = irq_save();
+    while (fair_left) proc_block();
+    irq_restore(flags);
+
+    u64 total = 0;
+    u32 wsum  = 0;
+    for (int i = 0; i < created; i++) {
+        total += fair_runtime[i];
+        wsum  += sched_nice_weight(i);
+    }
+    if (total == 0) total = 1;
+
+    char buf[96];
+    vga_write("thread nice weight  cpu ms  share  expected\n", COLOUR_YELLOW);
+    for (int i = 0; i < created; i++) {
+        u32 w      = sched_nice_weight(i);
+        u32 share  = (u32)div64_u32(fair_runtime[i] * 1000, (u32)total);
+        u32 expect = (u32)div64_u32((u64)w * 1000, wsum);
+        snprintf(buf, sizeof(buf), "%6d %4d %6u %7u %3u.%u%% %5u.%u%%\n",
+                 i, i, w, (u32)div64_u32(fair_runtime[i], 1000),
+                 share / 10, share % 10, expect / 10, expect % 10);
+        vga_write(buf, COLOUR_WHITE);
+    }
+}
+
+/* ---------------------------------------------------------------
+ * smp: a fixed amount of CPU-bound work split across 1, 2, 4, ...
+ * threads. with the run queues per CPU and idle CPUs stealing, wall
+ * time should drop close to 1/threads until we run out of CPUs.
+ * --------------------------------------------------------------- */
+#define SMP_WORK        (1u << 27)
+#define SMP_MAX_THREADS 16
+
+static volatile u32 smp_left;
+static volatile u64 smp_end;
+
+static void smp_worker(void* arg) {
+    u32 iters = (u32)arg;
+    volatile u32 sink = 0;
+    for (u32 i = 0; i < iters; i++) sink += i;
+    if (__atomic_sub_fetch(&smp_left, 1, __ATOMIC_SEQ_CST) == 0)
+        smp_end = rdtsc();
+}
+
+static u64 smp_run(u32 threads) {
+    smp_left = threads;
+    u64 start = rdtsc();
+    for (u32 i = 0; i < threads; i++) {
+        if (kthread_create("smpwork", smp_worker, (void*)(SMP_WORK / threads)) < 0) {
+            __atomic_sub_fetch(&smp_left, threads - i, __ATOMIC_SEQ_CST);
+            return 0;
+        }
+    }
+    while (smp_left) proc_sleep(1);
+    return smp_end - start;
+}
+
+static void bench_smp(u32 max_threads) {
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > SMP_MAX_THREADS) max_threads = SMP_MAX_THREADS;
+
+    char buf[96];
+    snprintf(buf, sizeof(buf), "smp: %u cpus, %u iterations split across threads\n",
+             nr_cpus, SMP_WORK);
+    vga_write(buf, COLOUR_WHITE);
+    vga_write("threads    ms  speedup  efficiency\n", COLOUR_YELLOW);
+
+    u64 base = 0;
+    for (u32 t = 1; t <= max_threads; t *= 2) {
+        u64 cycles = smp_run(t);
+        if (cycles == 0) {
+            vga_write("bench: cannot create threads\n", COLOUR_LIGHT_RED);
+            return;
+        }
+        if (t == 1) base = cycles;
+        u32 speedup = (u32)div64_u32(base * 100, (u32)cycles);   /* x100 */
+        snprintf(buf, sizeof(buf), "%7u %5u %5u.%02u %10u%%\n",
+                 t, (u32)div64_u32(tsc_to_us(cycles), 1000),
+                 speedup / 100, speedup % 100, speedup / t);
+        vga_write(buf, COLOUR_WHITE);
+    }
+}
+
+/* ---------------------------------------------------------------
+ * waitq: producers and consumers pass items through a small bounded
+ * buffer and block on wait queues while it is full or empty. each item
+ * carries the TSC it was produced at, so a consumer that had to sleep
+ * for it can tell how long the wakeup took to get it running.
+ * --------------------------------------------------------------- */
+#define WQ_SLOTS     8
+#define WQ_ITEMS     2000        /* per producer */
+#define WQ_MAX_PAIRS 8
+
+DEFINE_LOCK_CLASS(bench_waitq, "spin");
+
+typedef struct {
+    u32 seq;
+    u64 stamp;
+} wq_item_t;
+
+static struct {
+    spinlock_t   lock;          /* everything below except the queues */
+    wq_item_t    buf[WQ_SLOTS];
+    volatile u32 head, tail;    /* head - tail items queued */
+    volatile u32 consumed;
+    u32          total;
+    u64          seq_sum;
+    u32          sleeps;        /* items a consumer blocked for */
+    u64          lat_sum, lat_max;
+    wait_queue_t not_full;
+    wait_queue_t not_empty;
+    completion_t done;          /* one complete() per finished thread */
+} wq;
+
+static void wq_producer(void* arg) {
+    u32 first = (u32)arg * WQ_ITEMS;
+    for (u32 i = 0; i < WQ_ITEMS; i++) {
+        u32 flags;
+        for (;;) {
+            wait_event(&wq.not_full, wq.head - wq.tail < WQ_SLOTS);
+            flags = spin_lock_irqsave(&wq.lock);
+            if (wq.head - wq.tail < WQ_SLOTS) break;
+            spin_unlock_irqrestore(&wq.lock, flags);
+        }
+        wq_item_t* it = &wq.buf[wq.head % WQ_SLOTS];
+        it->seq   = first + i;
+        it->stamp = rdtsc();
+        wq.head++;
+        spin_unlock_irqrestore(&wq.lock, flags);
+        wake_up(&wq.not_empty);
+    }
+    complete(&wq.done);
+}
+
+static void wq_consumer(void* arg) {
+    (void)arg;
+    for (;;) {
+        u32 flags;
+        int slept = 0;
+        for (;;) {
+            if (wq.head == wq.tail && wq.consumed < wq.total) slept = 1;
+            wait_event(&wq.not_empty, wq.head != wq.tail || wq.consumed >= wq.total);
+            flags = spin_lock_irqsave(&wq.lock);
+            if (wq.head != wq.tail || wq.consumed >= wq.total) break;
+            spin_unlock_irqrestore(&wq.lock, flags);
+        }
+        if (wq.head == wq.tail) {           /* everything is consumed */
+            spin_unlock_irqrestore(&wq.lock, flags);
+            break;
+        }
+        wq_item_t it = wq.buf[wq.tail % WQ_SLOTS];
+        u64 now = rdtsc();
+        wq.tail++;
+        wq.consumed++;
+        wq.seq_sum += it.seq;
+        if (slept) {
+            u64 lat = now - it.stamp;
+            wq.sleeps++;
+            wq.lat_sum += lat;
+            if (lat > wq.lat_max) wq.lat_max = lat;
+        }
+        int last = (wq.consumed == wq.total);
+        spin_unlock_irqrestore(&wq.lock, flags);
+
+        wake_up(&wq.not_full);
+        if (last) wake_up_all(&wq.not_empty);
+    }
+    complete(&wq.done);
+}
+
+static void bench_waitq(int pairs) {
+    if (pairs < 1) pairs = 1;
+    if (pairs > WQ_MAX_PAIRS) pairs = WQ_MAX_PAIRS;
+
+    memset(&wq, 0, sizeof(wq));
+    spin_lock_init(&wq.lock, &lock_class_bench_waitq);
+    wait_queue_init(&wq.not_full);
+    wait_queue_init(&wq.not_empty);
+    init_completion(&wq.done);
+    wq.total = (u32)pairs * WQ_ITEMS;
+
+    u64 start = rdtsc();
+    int producers = 0, consumers = 0;
+    for (; producers < pairs; producers++) {
+        if (kthread_create("producer", wq_producer, (void*)producers) < 0) break;
+    }
+    if (producers == 0) {
+        vga_write("bench: cannot create threads\n", COLOUR_LIGHT_RED);
+        return;
+    }
+    if (producers < pairs) {
+        u32 flags = spin_lock_irqsave(&wq.lock);
+        wq.total = (u32)producers * WQ_ITEMS;
+        spin_unlock_irqrestore(&wq.lock, flags);
+    }
+    for (; consumers < pairs; consumers++) {
+        if (kthread_create("consumer", wq_consumer, NULL) < 0) break;
+    }
+    /* somebody has to drain the buffer or the producers never finish */
+    if (consumers == 0) {
+        wq_consumer(NULL);
+        consumers = 1;
+    }
+
+    for (int i = 0; i < producers + consumers; i++)
+        wait_for_completion(&wq.done);
+    u64 cycles = rdtsc() - start;
+
+    u64 n = wq.total;
+    char buf[96];
+    snprintf(buf, sizeof(buf), "waitq: %d producers, %d consumers, %u items through %u slots in %u us\n",
+             producers, consumers, wq.total, WQ_SLOTS, (u32)tsc_to_us(cycles));
+    vga_write(buf, COLOUR_WHITE);
+    if (wq.consumed == wq.total && wq.seq_sum == n * (n - 1) / 2)
+        vga_write("waitq: every item delivered exactly once\n", COLOUR_WHITE);
+    else
+        vga_write("waitq: items lost or delivered twice\n", COLOUR_LIGHT_RED);
+    u64 avg = wq.sleeps ? div64_u32(wq.lat_sum, wq.sleeps) : 0;
+    snprintf(buf, sizeof(buf), "waitq: %u blocking waits, wakeup latency avg %u ns, max %u ns\n",
+             wq.sleeps, (u32)tsc_to_ns(avg), (u32)tsc_to_ns(wq.lat_max));
+    vga_write(buf, COLOUR_LIGHT_GREEN);
+}
+
+/* ---------------------------------------------------------------
+ * futex: threads take turns on one lock around a short critical
+ * section, first as a spin lock that yields the CPU whenever it finds
+ * the lock taken, then as a futex mutex (0 free, 1 held, 2 held with
+ * waiters) that sleeps instead. a holder preempted mid-section costs
+ * the spinners a yield storm and the futex waiters nothing.
+ * --------------------------------------------------------------- */
+#define FX_ITERS        20000    /* per thread */
+#define FX_HOLD         64       /* loop iterations inside the lock */
+#define FX_MAX_THREADS  8
+
+static struct {
+    volatile u32 word;
+    volatile u32 counter;
+    volatile u32 yields;
+    int          use_futex;
+    completion_t done;
+} fx;
+
+static void fx_lock(void) {
+    if (!fx.use_futex) {
+        while (__atomic_exchange_n(&fx.word, 1, __ATOMIC_ACQUIRE)) {
+            __atomic_add_fetch(&fx.yields, 1, __ATOMIC_RELAXED);
+            proc_yield();
+        }
+        return;
+    }
+    u32 c = 0;
+    if (__atomic_compare_exchange_n(&fx.word, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    if (c != 2) c = __atomic_exchange_n(&fx.word, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        futex_wait((u32*)&fx.word, 2, 0);
+        c = __atomic_exchange_n(&fx.word, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void fx_unlock(void) {
+    if (!fx.use_futex) {
+        __atomic_store_n(&fx.word, 0, __ATOMIC_RELEASE);
+        return;
+    }
+    if (__atomic_fetch_sub(&fx.word, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&fx.word, 0, __ATOMIC_RELEASE);
+        futex_wake((u32*)&fx.word, 1);
+    }
+}
+
+static void fx_worker(void* arg) {
+    (void)arg;
+    volatile u32 sink = 0;
+    for (u32 i = 0; i < FX_ITERS; i++) {
+        fx_lock();
+        fx.counter++;
+        for (u32 j = 0; j < FX_HOLD; j++) sink += j;
+        fx_unlock();
+    }
+    complete(&fx.done);
+}
+
+/* cycles for threads workers to finish, 0 if none could start */
+static u64 fx_run(int threads, int use_futex) {
+    fx.word      = 0;
+    fx.counter   = 0;
+    fx.yields    = 0;
+    fx.use_futex = use_futex;
+    init_completion(&fx.done);
+    futex_stats_reset();
+
+    u64 start = rdtsc();
+    int started = 0;
+    for (; started < threads; started++)
+        if (kthread_create("fxlock", fx_worker, NULL) < 0) break;
+    for (int i = 0; i < started; i++) wait_for_completion(&fx.done);
+    return started == threads ? rdtsc() - start : 0;
+}
+
+static void fx_report(const char* name, int threads, u64 cycles, const char* extra) {
+    u32 ops = (u32)threads * FX_ITERS;
+    char buf[112];
+    snprintf(buf, sizeof(buf), "  %-10s %8u us %6u cycles per lock  %s\n", name,
+             (u32)tsc_to_us(cycles), (u32)div64_u32(cycles, ops), extra);
+    vga_write(buf, fx.counter == ops ? COLOUR_LIGHT_GREEN : COLOUR_LIGHT_RED);
+    if (fx.counter != ops) {
+        snprintf(buf, sizeof(buf), "futex: %s lost updates, counter %u of %u\n",
+                 name, fx.counter, ops);
+        vga_write(buf, COLOUR_LIGHT_RED);
+    }
+}
+
+static void bench_futex(int threads) {
+    if (threads < 2) threads = 2;
+    if (threads > FX_MAX_THREADS) threads = FX_MAX_THREADS;
+
+    char buf[80];
+    snprintf(buf, sizeof(buf), "futex: %d threads x %u lock/unlock on %u cpus\n",
+             threads, FX_ITERS, nr_cpus);
+    vga_write(buf, COLOUR_WHITE);
+
+    u64 cycles = fx_run(threads, 0);
+    if (!cycles) {
+        vga_write("bench: cannot create threads\n", COLOUR_LIGHT_RED);
+        return;
+    }
+    snprintf(buf, sizeof(buf), "%u yields", fx.yields);
+    fx_report("spin-yield", threads, cycles, buf);
+
+    cycles = fx_run(threads, 1);
+    if (!cycles) {
+        vga_write("bench: cannot create threads\n", COLOUR_LIGHT_RED);
+        return;
+    }
+    futex_stat_t st;
+    futex_stats(&st);
+    snprintf(buf, sizeof(buf), "%u waits, %u wakes", st.waits, st.wakes);
+    fx_report("futex", threads, cycles, buf);
+}
+
+/* ---------------------------------------------------------------
+ * pipe: source | relay | sink, three kernel threads joined by two
+ * pipes through the fd layer, moving a page per read or write. the
+ * sink checks every byte, so a lost or reordered chunk shows up.
+ * --------------------------------------------------------------- */
+#define PIPE_DEFAULT_KB 4096
+
+typedef struct {
+    struct file* in;
+    struct file* out;
+    u32          bytes;             /* source: to send; sink: received */
+    u32          bad;               /* sink: bytes that were not what was sent */
+} pb_stage_t;
+
+static void pb_source(void* arg) {
+    pb_stage_t* st = (pb_stage_t*)arg;
+    fd_install_file(1, st->out);
+    u8* buf = (u8*)kmalloc(PIPE_SIZE);
+    if (!buf) return;
+    for (u32 sent = 0; sent < st->bytes; ) {
+        u32 n = st->bytes - sent < PIPE_SIZE ? st->bytes - sent : PIPE_SIZE;
+        for (u32 i = 0; i < n; i++) buf[i] = (u8)(sent + i);
+        if (fd_write(1, buf, n) != (int)n) break;
+        sent += n;
+    }
+    kfree(buf);
+}
+
+static void pb_relay(void* arg) {
+    pb_stage_t* st = (pb_stage_t*)arg;
+    fd_install_file(0, st->in);
+    fd_install_file(1, st->out);
+    u8* buf = (u8*)kmalloc(PIPE_SIZE);
+    if (!buf) return;
+    int n;
+    while ((n = fd_read(0, buf, PIPE_SIZE)) > 0)
+        if (fd_write(1, buf, (usize)n) != n) break;
+    kfree(buf);
+}
+
+static void pb_sink(void* arg) {
+    pb_stage_t* st = (pb_stage_t*)arg;
+    fd_install_file(0, st->in);
+    u8* buf = (u8*)kmalloc(PIPE_SIZE);
+    if (!buf) return;
+    int n;
+    while ((n = fd_read(0, buf, PIPE_SIZE)) > 0) {
+        for (int i = 0; i < n; i++)
+            if (buf[i] != (u8)(st->bytes + (u32)i)) st->bad++;
+        st->bytes += (u32)n;
+    }
+    kfree(buf);
+}
+
+static void bench_pipe(int kb) {
+    if (kb < 1) kb = 1;
+    if (kb > 1024 * 1024) kb = 1024 * 1024;
+
+    struct file *rd[2], *wr[2];
+    if (file_pipe(&rd[0], &wr[0]) < 0) {
+        vga_write("bench: cannot create pipes\n", COLOUR_LIGHT_RED);
+        return;
+    }
+    if (file_pipe(&rd[1], &wr[1]) < 0) {
+        file_put(rd[0]);
+        file_put(wr[0]);
+        vga_write("bench: cannot create pipes\n", COLOUR_LIGHT_RED);
+        return;
+    }
+    /* each stage's thread takes over the references it is handed */
+    pb_stage_t src  = { NULL,  wr[0], (u32)kb * 1024, 0 };
+    pb_stage_t mid  = { rd[0], wr[1], 0, 0 };
+    pb_stage_t sink = { rd[1], NULL,  0, 0 };
+
+    u64 start = rdtsc();
+    int pids[3];
+    pids[0] = kthread_create_joinable("pipesrc", pb_source, &src);
+    pids[1] = kthread_create_joinable("piperelay", pb_relay, &mid);
+    pids[2] = kthread_create_joinable("pipesink", pb_sink, &sink);
+    int ok = 1;
+    for (int i = 0; i < 3; i++) {
+        if (pids[i] >= 0) proc_wait(pids[i], NULL);
+        else              ok = 0;
+    }
+    u64 cycles = rdtsc() - start;
+    if (!ok) {
+        /* a stage that never ran still holds its references */
+        if (pids[0] < 0) file_put(wr[0]);
+        if (pids[1] < 0) { file_put(rd[0]); file_put(wr[1]); }
+        if (pids[2] < 0) file_put(rd[1]);
+        vga_write("bench: cannot create threads\n", COLOUR_LIGHT_RED);
+        return;
+    }
+
+    u32 us = (u32)tsc_to_us(cycles);
+    u32 kbps = us ? (u32)div64_u32((u64)sink.bytes * 1000000 / 1024, us) : 0;
+    char buf[112];
+    snprintf(buf, sizeof(buf), "pipe: %u KiB through source | relay | sink in %u us, %u.%02u MiB/s\n",
+             sink.bytes / 1024, us, kbps / 1024, kbps % 1024 * 100 / 1024);
+    vga_write(buf, COLOUR_LIGHT_GREEN);
+    if (sink.bytes != src.bytes || sink.bad) {
+        snprintf(buf, sizeof(buf), "pipe: %u of %u bytes arrived, %u corrupt\n",
+                 sink.bytes, src.bytes, sink.bad);
+        vga_write(buf, COLOUR_LIGHT_RED);
+    }
+}
+
+/* ---------------------------------------------------------------
+ * exec: the cost of starting an ELF program from ext2 and waiting
+ * for it, end to end, then what a program's address space actually
+ * costs once pages only come in when touched.
+ * --------------------------------------------------------------- */
+#define EXEC_DEFAULT_RUNS 100
+
+static int exec_once(const char* path, u64* cycles) {
+    char* argv[] = { (char*)path };
+    u64 start = rdtsc();
+    int pid = proc_exec(path, 1, argv);
+    if (pid < 0) return -1;
+    int status = 0;
+    proc_wait(pid, &status);
+    *cycles = rdtsc() - start;
+    return status;
+}
+
+static void exec_footprint(const char* path) {
+    u64 cycles;
+    if (exec_once(path, &cycles) < 0) return;
+    char buf[112];
+    snprintf(buf, sizeof(buf), "exec: %-10s virtual %u KiB, resident %u KiB in %u faults, %u page tables\n",
+             path, mm_last_exit.vsize / 1024, mm_last_exit.rss * (PAGE_SIZE / 1024),
+             mm_last_exit.faults, mm_last_exit.pt_pages);
+    vga_write(buf, COLOUR_WHITE);
+}
+
+static void bench_exec(int runs) {
+    if (runs < 1) runs = 1;
+    u32 free_before = page_free_count();
+
+    u64 total = 0, best = ~0ULL, worst = 0;
+    for (int i = 0; i < runs; i++) {
+        u64 c;
+        if (exec_once("/bin/true", &c) != 0) {
+            vga_write("bench: cannot run /bin/true\n", COLOUR_LIGHT_RED);
+            return;
+        }
+        total += c;
+        if (c < best)  best = c;
+        if (c > worst) worst = c;
+    }
+    char buf[96];
+    snprintf(buf, sizeof(buf), "exec: %d runs of /bin/true, avg %u us, min %u us, max %u us\n",
+             runs, (u32)tsc_to_us(div64_u32(total, (u32)runs)),
+             (u32)tsc_to_us(best), (u32)tsc_to_us(worst));
+    vga_write(buf, COLOUR_LIGHT_GREEN);
+
+    exec_footprint("/bin/true");
+    exec_footprint("/bin/hello");
+
+    u32 free_after = page_free_count();
+    if (free_after == free_before)
+        vga_write("exec: every page frame given back\n", COLOUR_WHITE);
+    else {
+        snprintf(buf, sizeof(buf), "exec: %d page frames leaked\n", (int)(free_before - free_after));
+        vga_write(buf, COLOUR_LIGHT_RED);
+    }
+}
+
+/* ---------------------------------------------------------------
+ * syscall: null system call round trips from ring 3, through
+ * int 0x80 and through SYSENTER/SYSEXIT. /bin/nullsys times its own
+ * loop and exits with cycles per call; the kernel side of each call
+ * comes from the getpid line of the syscall stats.
+ * --------------------------------------------------------------- */
+#define SYSCALL_DEFAULT_CALLS 100000
+
+static void syscall_round_trip(const char* method, int calls) {
+    char count[12];
+    snprintf(count, sizeof(count), "%d", calls);
+    char* argv[] = { "/bin/nullsys", (char*)method, count };
+
+    u32 calls0;
+    u64 cycles0;
+    syscall_stat(SYS_GETPID, &calls0, &cycles0);
+    int pid = proc_exec("/bin/nullsys", 3, argv);
+    if (pid < 0) {
+        vga_write("bench: cannot run /bin/nullsys\n", COLOUR_LIGHT_RED);
+        return;
+    }
+    int per_call = 0;
+    proc_wait(pid, &per_call);
+    u32 calls1;
+    u64 cycles1;
+    syscall_stat(SYS_GETPID, &calls1, &cycles1);
+
+    u32 n = calls1 - calls0;
+    u32 inside = n ? (u32)div64_u32(cycles1 - cycles0, n) : 0;
+    char buf[112];
+    snprintf(buf, sizeof(buf), "syscall: %-8s %u calls, %u cycles (%u ns) round trip, %u in the handler\n",
+             method, n, (u32)per_call, (u32)tsc_to_ns((u64)(u32)per_call), inside);
+    vga_write(buf, COLOUR_LIGHT_GREEN);
+}
+
+static void bench_syscall(int calls) {
+    if (calls < 1) calls = 1;
+    syscall_round_trip("int", calls);
+    if (syscall_sysenter_ok()) syscall_round_trip("sysenter", calls);
+    else vga_write("syscall: this CPU has no SYSENTER\n", COLOUR_YELLOW);
+}
+
+/* run "path mode n", a user program that exits with its cycles per
+ * op, or with a negative status if it failed */
+static int user_per_op(const char* path, const char* mode, int n) {
+    char count[12];
+    snprintf(count, sizeof(count), "%d", n);
+    char* argv[] = { (char*)path, (char*)mode, count };
+    int pid = proc_exec(path, 3, argv);
+    char buf[80];
+    if (pid < 0) {
+        snprintf(buf, sizeof(buf), "bench: cannot run %s\n", path);
+        vga_write(buf, COLOUR_LIGHT_RED);
+        return -1;
+    }
+    int per_op = -1;
+    proc_wait(pid, &per_op);
+    if (per_op < 0) {
+        snprintf(buf, sizeof(buf), "bench: %s %s failed\n", path, mode);
+        vga_write(buf, COLOUR_LIGHT_RED);
+    }
+    return per_op;
+}
+
+/* ---------------------------------------------------------------
+ * ring: the same ops issued one system call each and in batches
+ * through the submission ring, so the difference is the per-call
+ * entry and exit that batching saves
+ * --------------------------------------------------------------- */
+
+#define RING_DEFAULT_OPS 100000
+
+static void bench_ring(int ops) {
+    if (ops < 1) ops = 1;
+    int sys  = user_per_op("/bin/ringbench", "sys", ops);
+    int ring = user_per_op("/bin/ringbench", "ring", ops);
+    if (sys < 0 || ring < 0) return;
+
+    u32 speedup = ring ? (u32)sys * 100 / (u32)ring : 0;     /* x100 */
+    char buf[96];
+    snprintf(buf, sizeof(buf), "ring: %u fstat ops\n", (u32)ops);
+    vga_write(buf, COLOUR_LIGHT_GREEN);
+    snprintf(buf, sizeof(buf), "  one call each  %6u cycles (%u ns) per op\n",
+             (u32)sys, (u32)tsc_to_ns((u64)(u32)sys));
+    vga_write(buf, COLOUR_LIGHT_GREEN);
+    snprintf(buf, sizeof(buf), "  ring, 32/enter %6u cycles (%u ns) per op, %u.%02ux\n",
+             (u32)ring, (u32)tsc_to_ns((u64)(u32)ring), speedup / 100, speedup % 100);
+    vga_write(buf, COLOUR_LIGHT_GREEN);
+}
+
+/* ---------------------------------------------------------------
+ * clock: the time since boot read from the vvar page and through
+ * SYS_CLOCK_NS; clockbench fails if it ever sees the clock go back
+ * --------------------------------------------------------------- */
+
+#define CLOCK_DEFAULT_READS 100000
+
+static void bench_clock(int reads) {
+    if (reads < 1) reads = 1;
+    int vvar = user_per_op("/bin/clockbench", "vvar", reads);
+    int sys  = user_per_op("/bin/clockbench", "sys", reads);
+    if (vvar < 0 || sys < 0) return;
+
+    u32 speedup = vvar ? (u32)sys * 100 / (u32)vvar : 0;    /* x100 */
+    char buf[96];
+    snprintf(buf, sizeof(buf), "clock: %u reads\n", (u32)reads);
+    vga_write(buf, COLOUR_LIGHT_GREEN);
+    snprintf(buf, sizeof(buf), "  syscall   %6u cycles (%u ns) per read\n",
+             (u32)sys, (u32)tsc_to_ns((u64)(u32)sys));
+    vga_write(buf, COLOUR_LIGHT_GREEN);
+    snprintf(buf, sizeof(buf), "  vvar page %6u cycles (%u ns) per read, %u.%02ux\n",
+             (u32)vvar, (u32)tsc_to_ns((u64)(u32)vvar), speedup / 100, speedup % 100);
+    vga_write(buf, COLOUR_LIGHT_GREEN);
+}
+
+/* ---------------------------------------------------------------
+ * ipc: the same byte stream from one process to another through a
+ * pipe, a message queue by copy, the queue by handing over pages and
+ * a ring in shared memory. the /bin/ipcbench receiver checks every
+ * byte and exits with how long the stream took, or -1.
+ * --------------------------------------------------------------- */
+#define IPC_DEFAULT_KB 4096
+#define IPC_SHM_SIZE   (4096 + 64 * 1024)   /* ipcbench's indices and ring */
+
+/* microseconds for the receiver to see kb KiB, or -1 */
+static int ipc_run(const char* mode, int kb) {
+    char count[12];
+    snprintf(count, sizeof(count), "%d", kb);
+    char* send_argv[] = { "/bin/ipcbench", (char*)mode, "send", count };
+    char* recv_argv[] = { "/bin/ipcbench", (char*)mode, "recv", count };
+    struct file* send_io[3] = { NULL, NULL, NULL };
+    struct file* recv_io[3] = { NULL, NULL, NULL };
+
+    /* the queue or segment outlives our reference only as long as the
+     * pair keeps theirs: unlinked below, it goes when they exit */
+    mq_t*  q = strcmp(mode, "mq") == 0 || strcmp(mode, "pages") == 0
+             ? mq_get("ipcbench", 0, 1) : NULL;
+    shm_t* s = strcmp(mode, "shm") == 0 ? shm_get("ipcbench", IPC_SHM_SIZE, 1) : NULL;
+    if (strcmp(mode, "pipe") == 0 && file_pipe(&recv_io[0], &send_io[1]) < 0) return -1;
+
+    int us = -1;
+    int rpid = proc_exec_io("/bin/ipcbench", 4, recv_argv, recv_io);
+    int spid = rpid < 0 ? -1 : proc_exec_io("/bin/ipcbench", 4, send_argv, send_io);
+    file_put(recv_io[0]);
+    file_put(send_io[1]);
+    /* a receiver left without a sender sees EOF on the pipe, an empty
+     * message on the queue, or a futex timeout */
+    if (spid < 0 && q) mq_send(q, "", 0);
+    if (spid >= 0) proc_wait(spid, NULL);
+    if (rpid >= 0) proc_wait(rpid, &us);
+    if (q) {
+        mq_unlink("ipcbench");
+        mq_put(q);
+    }
+    if (s) {
+        shm_unlink("ipcbench");
+        shm_put(s);
+    }
+    return spid < 0 ? -1 : us;
+}
+
+static void bench_ipc(int kb) {
+    static const char* const modes[] = { "pipe", "mq", "pages", "shm" };
+    static const char* const what[] = {
+        "pipe, copied in and out",
+        "mq, 16 KiB copied messages",
+        "mq, 4 pages handed over",
+        "shm ring, futex wakeups",
+    };
+    if (kb < 16) kb = 16;
+    if (kb > 256 * 1024) kb = 256 * 1024;
+    kb &= ~15;                          /* whole 16 KiB chunks */
+    u32 free_before = page_free_count();
+
+    char buf[96];
+    snprintf(buf, sizeof(buf), "ipc: %u KiB from one process to another\n", (u32)kb);
+    vga_write(buf, COLOUR_LIGHT_GREEN);
+    for (u32 i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        int us = ipc_run(modes[i], kb);
+        if (us < 0) {
+            snprintf(buf, sizeof(buf), "  %-28s failed\n", what[i]);
+            vga_write(buf, COLOUR_LIGHT_RED);
+            continue;
+        }
+        u32 kbps = us ? (u32)div64_u32((u64)(u32)kb * 1000000, (u32)us) : 0;
+        snprintf(buf, sizeof(buf), "  %-28s %8u us %6u.%02u MiB/s\n",
+                 what[i], (u32)us, kbps / 1024, kbps % 1024 * 100 / 1024);
+        vga_write(buf, COLOUR_LIGHT_GREEN);
+    }
+    if (page_free_count() != free_before) {
+        snprintf(buf, sizeof(buf), "ipc: %d page frames leaked\n",
+                 (int)(free_before - page_free_count()));
+        vga_write(buf, COLOUR_LIGHT_RED);
+    }
+}
+
+/* ---------------------------------------------------------------
+ * disk: sequential reads from the start of the primary disk,
+ * DISK_CHUNK sectors a command, first by PIO with a DRQ (and a status
+ * wait) per sector, then in READ MULTIPLE blocks, both polling the
+ * status register, then READ MULTIPLE sleeping on the drive's IRQ,
+ * then by bus-master DMA. each run shows the CPU time the reading task
+ * was charged, which is what the IRQ paths give back. the same reads
+ * again as the drive is normally driven, from 4 KiB to DISK_BIG_CHUNK
+ * a command, for the per-command overhead, and as 4 KiB bios through
+ * the block layer, one request each and plugged so they merge. then the last
+ * DISK_WRITE_SECTORS of the disk are read and written back unchanged,
+ * with the cache flushed after every sector as writes used to be,
+ * with each command FUA, and with one flush at the end. any other
+ * disk named gets just the block-layer runs, the bios and the writes
+ * --------------------------------------------------------------- */
+#define DISK_DEFAULT_MB    16
+#define DISK_CHUNK         128
+#define DISK_BIG_CHUNK     8192         /* 4 MiB; past 256 it takes LBA48 */
+#define DISK_WRITE_SECTORS 512
+#define DISK_BIO_SECTORS   8            /* an ext2 4 KiB run */
+#define DISK_BATCH         64
+
+/* microseconds to read sectors from LBA 0, or 0 if a read failed;
+ * cpu_us is how much of that this task spent on the CPU */
+static u32 disk_read_us(ata_disk_t* disk, u32 sectors, u32 chunk, void* buf, u32* cpu_us) {
+    u32 pid  = proc_get_pid();
+    u64 cpu0 = proc_get_runtime_us(pid);
+    u64 start = rdtsc();
+    for (u32 lba = 0; lba < sectors; lba += chunk) {
+        u32 n = sectors - lba < chunk ? sectors - lba : chunk;
+        if (ata_read_sectors(disk, lba, n, buf) != (int)(n * 512)) return 0;
+    }
+    u32 us = (u32)tsc_to_us(rdtsc() - start);
+    *cpu_us = (u32)(proc_get_runtime_us(pid) - cpu0);
+    return us ? us : 1;
+}
+
+#define DISK_W_SYNC   0                 /* a sector a command, then a flush */
+#define DISK_W_FUA    1
+#define DISK_W_CACHED 2                 /* one flush at the end */
+
+static u32 disk_write_us(block_device_t* disk, u32 lba0, const u8* data, int mode) {
+    u32 chunk = mode == DISK_W_SYNC ? 1 : DISK_CHUNK;
+    u64 start = rdtsc();
+    for (u32 i = 0; i < DISK_WRITE_SECTORS; i += chunk) {
+        const u8* p = data + i * 512;
+        int n = mode == DISK_W_FUA ? blk_write(disk, lba0 + i, chunk, p, BLK_FUA)
+                                   : blk_write(disk, lba0 + i, chunk, p, 0);
+        if (n < 0 || (mode == DISK_W_SYNC && blk_flush(disk) < 0)) return 0;
+    }
+    if (mode == DISK_W_CACHED && blk_flush(disk) < 0) return 0;
+    u32 us = (u32)tsc_to_us(rdtsc() - start);
+    return us ? us : 1;
+}
+
+/* cpu_us, if not 0, is shown as TSC cycles per MiB moved and as a
+ * share of the wall time */
+static void disk_report(const char* what, u32 kb, u32 us, u32 cpu_us) {
+    char line[112];
+    u32 kbps = (u32)div64_u32((u64)kb * 1000000, us);
+    int len = snprintf(line, sizeof(line), "  %-24s %8u us %5u.%02u MiB/s",
+                       what, us, kbps / 1024, kbps % 1024 * 100 / 1024);
+    if (cpu_us) {
+        u64 cycles = div64_u32((u64)cpu_us * tsc_khz, 1000);
+        u32 pct    = (u32)div64_u32((u64)cpu_us * 100, us);
+        snprintf(line + len, sizeof(line) - (usize)len, " %9u cyc/MiB %3u%%",
+                 (u32)div64_u32(cycles * 1024, kb), pct > 100 ? 100 : pct);
+    }
+    vga_write(line, COLOUR_LIGHT_GREEN);
+    vga_write("\n", COLOUR_LIGHT_GREEN);
+}
+
+static void bench_disk_write(block_device_t* disk, int native_fua) {
+    u32 total = disk->sectors;
+    u8* data = total >= DISK_WRITE_SECTORS ? (u8*)kmalloc(DISK_WRITE_SECTORS * 512) : NULL;
+    if (!data) return;
+    u32 lba0 = (total - DISK_WRITE_SECTORS) & ~(DISK_CHUNK - 1);
+    if (blk_read(disk, lba0, DISK_WRITE_SECTORS, data) < 0) {
+        vga_write("bench: disk read failed\n", COLOUR_LIGHT_RED);
+        kfree(data);
+        return;
+    }
+
+    char line[96];
+    snprintf(line, sizeof(line), "disk: %u KiB rewritten in place at LBA %u, FUA %s\n",
+             DISK_WRITE_SECTORS / 2, lba0, native_fua ? "native" : "by write and flush");
+    vga_write(line, COLOUR_LIGHT_GREEN);
+    static const char* const what[] = {
+        "flush after every sector",
+        "cache, FUA per command",
+        "cache, one flush",
+    };
+    for (int mode = DISK_W_SYNC; mode <= DISK_W_CACHED; mode++) {
+        u32 us = disk_write_us(disk, lba0, data, mode);
+        if (!us) {
+            vga_write("bench: disk write failed\n", COLOUR_LIGHT_RED);
+            break;
+        }
+        disk_report(what[mode], DISK_WRITE_SECTORS / 2, us, 0);
+    }
+    kfree(data);
+}
+
+/* microseconds for sectors as 4 KiB bios through the block layer,
+ * DISK_BATCH of them at a time; under a plug the queue gets to merge
+ * each batch before the driver sees any of it */
+static u32 disk_bio_us(block_device_t* dev, u32 sectors, u8* buf, bio_t* bios, int plug) {
+    u64 start = rdtsc();
+    for (u32 lba = 0; lba < sectors; ) {
+        u32 n = 0;
+        if (plug) blk_plug(dev);
+        for (; n < DISK_BATCH && lba < sectors; n++, lba += DISK_BIO_SECTORS) {
+            bios[n].lba   = lba;
+            bios[n].count = DISK_BIO_SECTORS;
+            bios[n].buf   = buf + n * DISK_BIO_SECTORS * 512;
+            bios[n].flags = 0;
+            blk_submit(dev, &bios[n]);
+        }
+        if (plug) blk_unplug(dev);
+        for (u32 i = 0; i < n; i++)
+            if (blk_wait(&bios[i]) < 0) return 0;
+    }
+    u32 us = (u32)tsc_to_us(rdtsc() - start);
+    return us ? us : 1;
+}
+
+static void bench_disk_merge(block_device_t* dev, u32 sectors) {
+    u8*    buf  = (u8*)kmalloc(DISK_BATCH * DISK_BIO_SECTORS * 512);
+    bio_t* bios = (bio_t*)kmalloc(DISK_BATCH * sizeof(bio_t));
+    sectors &= ~(DISK_BIO_SECTORS - 1);
+    if (buf && bios) {
+        char line[96];
+        snprintf(line, sizeof(line), "disk: the same reads as 4 KiB bios to %s, %u at a time\n",
+                 dev->name, DISK_BATCH);
+        vga_write(line, COLOUR_LIGHT_GREEN);
+        for (int plug = 0; plug <= 1; plug++) {
+            blk_stat_t before = dev->stat;
+            u32 us = disk_bio_us(dev, sectors, buf, bios, plug);
+            if (!us) {
+                vga_write("bench: disk read failed\n", COLOUR_LIGHT_RED);
+                break;
+            }
+            disk_report(plug ? "plugged, merged" : "one request each", sectors / 2, us, 0);
+            snprintf(line, sizeof(line), "    %u bios went as %u requests\n",
+                     dev->stat.reads - before.reads, dev->stat.requests - before.requests);
+            vga_write(line, COLOUR_LIGHT_GRAY);
+        }
+    }
+    kfree(buf);
+    kfree(bios);
+}
+
+static void bench_disk_sizes(ata_disk_t* disk, u32 sectors) {
+    static const u32 chunks[] = { 8, 128, 256, 2048, DISK_BIG_CHUNK };
+    void* buf = kmalloc(DISK_BIG_CHUNK * 512);
+    if (!buf) return;
+    char line[96];
+    snprintf(line, sizeof(line), "disk: the same reads by size of command, LBA48 %s\n",
+             ata_max_sectors(disk) > 256 ? "on" : "off, 256 sectors at most");
+    vga_write(line, COLOUR_LIGHT_GREEN);
+    for (u32 i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        if (chunks[i] > ata_max_sectors(disk)) break;
+        u32 cpu_us;
+        u32 us = disk_read_us(disk, sectors, chunks[i], buf, &cpu_us);
+        if (!us) {
+            vga_write("bench: disk read failed\n", COLOUR_LIGHT_RED);
+            break;
+        }
+        snprintf(line, sizeof(line), "%u KiB a command", chunks[i] / 2);
+        disk_report(line, sectors / 2, us, cpu_us ? cpu_us : 1);
+    }
+    kfree(buf);
+}
+
+static void bench_disk(int mb, const char* name) {
+    ata_disk_t* disk = ata_get_primary();
+    u32 sectors = (u32)(mb < 1 ? 1 : mb > 65536 ? 65536 : mb) * 2048;
+    if (name && strcmp(name, "hda") != 0) {
+        block_device_t* dev = blk_lookup(name);
+        if (!dev || dev->sectors < DISK_WRITE_SECTORS) {
+            vga_write("bench: no such disk\n", COLOUR_LIGHT_RED);
+            return;
+        }
+        if (sectors > dev->sectors) sectors = dev->sectors;
+        bench_disk_merge(dev, sectors);
+        bench_disk_write(dev, dev->fua);
+        return;
+    }
+    if (sectors > ata_sector_count(disk)) sectors = ata_sector_count(disk) & ~(DISK_CHUNK - 1);
+    void* buf = sectors ? kmalloc(DISK_CHUNK * 512) : NULL;
+    if (!buf) {
+        vga_write("bench: no disk to read\n", COLOUR_LIGHT_RED);
+        return;
+    }
+
+    char line[96];
+    snprintf(line, sizeof(line), "disk: %u KiB sequential reads, %u sectors a command\n",
+             sectors / 2, DISK_CHUNK);
+    vga_write(line, COLOUR_LIGHT_GREEN);
+    static const struct {
+        const char* what;
+        u8 multiple;                    /* 0: whatever the drive was set to */
+        u8 irq, dma;
+    } runs[] = {
+        { "PIO 1 sector, polled", 1, 0, 0 },
+        { "PIO multiple, polled", 0, 0, 0 },
+        { "PIO multiple, IRQ",    0, 1, 0 },
+        { "bus-master DMA, IRQ",  0, 1, 1 },
+    };
+    u8  multiple = ata_get_multiple(disk);
+    int irq      = ata_set_irq(disk, 0);
+    int dma      = ata_set_dma(disk, 0);
+    for (u32 i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        if (runs[i].dma && !ata_has_dma(disk)) {
+            vga_write("disk: no bus-master DMA\n", COLOUR_YELLOW);
+            continue;
+        }
+        ata_set_multiple(disk, runs[i].multiple ? runs[i].multiple : multiple);
+        ata_set_irq(disk, runs[i].irq);
+        ata_set_dma(disk, runs[i].dma);
+        u32 cpu_us;
+        u32 us = disk_read_us(disk, sectors, DISK_CHUNK, buf, &cpu_us);
+        if (!us) {
+            vga_write("bench: disk read failed\n", COLOUR_LIGHT_RED);
+            break;
+        }
+        disk_report(runs[i].what, sectors / 2, us, cpu_us ? cpu_us : 1);
+    }
+    ata_set_multiple(disk, multiple);
+    ata_set_irq(disk, irq);
+    ata_set_dma(disk, dma);
+    if (multiple <= 1) vga_write("disk: the drive has no READ MULTIPLE\n", COLOUR_YELLOW);
+    kfree(buf);
+
+    bench_disk_sizes(disk, sectors);
+
+    block_device_t* dev = blk_lookup("hda");
+    if (!dev) return;
+    bench_disk_merge(dev, sectors);
+    bench_disk_write(dev, ata_has_fua(disk));
+}
+
+/* ---------------------------------------------------------------
+ * iops: random 4 KiB reads from a block device, keeping 1 and then
+ * IOPS_DEPTH of them in flight from one task. each finished bio is
+ * sent straight back out to a new place, so the queue stays full; a
+ * device that takes one command at a time shows no gain, one that
+ * queues (NCQ) gets to pick its own order
+ * --------------------------------------------------------------- */
+#define IOPS_DEFAULT_OPS 4096
+#define IOPS_DEPTH       32
+#define IOPS_SECTORS     8
+
+static u32 iops_next(u32* seed, u32 span) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return (*seed % span) * IOPS_SECTORS;
+}
+
+/* microseconds for ops reads at depth, or 0 if one failed */
+static u32 iops_run(block_device_t* dev, bio_t* bios, u8* buf, u32 ops, u32 depth) {
+    u32 seed = 2463534242u;
+    u32 span = dev->sectors / IOPS_SECTORS;
+    u32 issued = 0, err = 0;
+    u64 start = rdtsc();
+    for (; issued < depth && issued < ops; issued++) {
+        bio_t* b = &bios[issued];
+        b->lba   = iops_next(&seed, span);
+        b->count = IOPS_SECTORS;
+        b->buf   = buf + issued * IOPS_SECTORS * 512;
+        b->flags = 0;
+        blk_submit(dev, b);
+    }
+    for (u32 done = 0; done < ops; done++) {
+        bio_t* b = &bios[done % depth];
+        if (blk_wait(b) < 0) err = 1;
+        if (issued < ops) {
+            b->lba = iops_next(&seed, span);
+            blk_submit(dev, b);
+            issued++;
+        }
+    }
+    u32 us = (u32)tsc_to_us(rdtsc() - start);
+    return err ? 0 : us ? us : 1;
+}
+
+static void iops_device(block_device_t* dev, bio_t* bios, u8* buf, u32 ops, const char* how) {
+    char line[96];
+    snprintf(line, sizeof(line), "iops: %u random 4 KiB reads from %s%s, which takes %u at once\n",
+             ops, dev->name, how, dev->depth);
+    vga_write(line, COLOUR_LIGHT_GREEN);
+    static const u32 depths[] = { 1, IOPS_DEPTH };
+    for (u32 i = 0; i < 2; i++) {
+        u32 us = iops_run(dev, bios, buf, ops, depths[i]);
+        if (!us) {
+            vga_write("bench: disk read failed\n", COLOUR_LIGHT_RED);
+            break;
+        }
+        snprintf(line, sizeof(line), "  depth %2u: %8u us %7u IOPS %6u us a read\n", depths[i], us,
+                 (u32)div64_u32((u64)ops * 1000000, us),
+                 (u32)div64_u32((u64)us * depths[i], ops));
+        vga_write(line, COLOUR_LIGHT_GREEN);
+    }
+}
+
+/* one disk, or every one; an IDE disk with DMA is run again in PIO,
+ * the baseline the queued and paravirtual drivers are measured from */
+static void bench_iops(const char* name, int ops) {
+    if (ops < 0) {
+        vga_write("bench: iops needs a positive count\n", COLOUR_LIGHT_RED);
+        return;
+    }
+    if (ops < 1) ops = 1;
+    block_device_t* dev = name ? blk_lookup(name) : blk_first();
+    if (!dev || dev->sectors < IOPS_SECTORS * 2) {
+        vga_write("bench: no such disk\n", COLOUR_LIGHT_RED);
+        return;
+    }
+    bio_t* bios = (bio_t*)kmalloc(IOPS_DEPTH * sizeof(bio_t));
+    u8*    buf  = (u8*)kmalloc(IOPS_DEPTH * IOPS_SECTORS * 512);
+    for (; bios && buf && dev; dev = name ? NULL : dev->next) {
+        if (dev->sectors < IOPS_SECTORS * 2) continue;
+        ata_disk_t* disk = (ata_disk_t*)dev->driver_data;
+        if (disk != ata_get_primary() && disk != ata_get_secondary()) disk = NULL;
+        int dma = disk ? ata_set_dma(disk, 1) : 0;
+        iops_device(dev, bios, buf, (u32)ops, "");
+        if (disk && ata_has_dma(disk)) {
+            ata_set_dma(disk, 0);
+            iops_device(dev, bios, buf, (u32)ops, " in PIO");
+        }
+        if (disk) ata_set_dma(disk, dma);
+    }
+    kfree(bios);
+    kfree(buf);
+}
+
+void bench_run(int argc, char** argv) {
+    if (argc < 2) {
+        vga_write("Usage: bench <ctxsw|fair [n]|smp [threads]|waitq [pairs]|exec [runs]|syscall [calls]|ring [ops]|clock [reads]|futex [threads]|pipe [KiB]|ipc [KiB]|disk [MiB] [disk]|iops [disk] [ops]>\n", COLOUR_LIGHT_RED);
+        return;
+    }
+    if (strcmp(argv[1], "ctxsw") == 0) bench_ctxsw();
+    else if (strcmp(argv[1], "fair") == 0) bench_fair(argc > 2 ? atoi(argv[2]) : 4);
+    else if (strcmp(argv[1], "smp") == 0) bench_smp(argc > 2 ? (u32)atoi(argv[2]) : nr_cpus);
+    else if (strcmp(argv[1], "waitq") == 0) bench_waitq(argc > 2 ? atoi(argv[2]) : 2);
+    else if (strcmp(argv[1], "exec") == 0) bench_exec(argc > 2 ? atoi(argv[2]) : EXEC_DEFAULT_RUNS);
+    else if (strcmp(argv[1], "syscall") == 0)
+        bench_syscall(argc > 2 ? atoi(argv[2]) : SYSCALL_DEFAULT_CALLS);
+    else if (strcmp(argv[1], "ring") == 0) bench_ring(argc > 2 ? atoi(argv[2]) : RING_DEFAULT_OPS);
+    else if (strcmp(argv[1], "clock") == 0) bench_clock(argc > 2 ? atoi(argv[2]) : CLOCK_DEFAULT_READS);
+    else if (strcmp(argv[1], "futex") == 0) bench_futex(argc > 2 ? atoi(argv[2]) : 4);
+    else if (strcmp(argv[1], "pipe") == 0) bench_pipe(argc > 2 ? atoi(argv[2]) : PIPE_DEFAULT_KB);
+    else if (strcmp(argv[1], "ipc") == 0) bench_ipc(argc > 2 ? atoi(argv[2]) : IPC_DEFAULT_KB);
+    else if (strcmp(argv[1], "disk") == 0) bench_disk(argc > 2 ? atoi(argv[2]) : DISK_DEFAULT_MB, argc > 3 ? argv[3] : NULL);
+    else if (strcmp(argv[1], "iops") == 0)
+        bench_iops(argc > 2 ? argv[2] : NULL, argc > 3 ? atoi(argv[3]) : IOPS_DEFAULT_OPS);
+    else {
+        char err[64];
+        snprintf(err, sizeof(err), "bench: unknown benchmark '%s'\n", argv[1]);
+        vga_write(err, COLOUR_LIGHT_RED);
+    }
+}
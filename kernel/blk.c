@@ -0,0 +1,369 @@
+#include "kernel.h"
+#include "idt.h"
+#include "spinlock.h"
+#include "wait.h"
+#include "blk.h"
+
+/* the devices are only ever added to, at boot, so walking the list
+ * needs no lock. each device's lock covers its queue and counters */
+
+DEFINE_LOCK_CLASS(blk_queue, "spin");
+static block_device_t* blk_devs;
+
+int blk_register(block_device_t* dev) {
+    if (!dev->max_sectors || dev->max_sectors > BLK_MAX_SECTORS) dev->max_sectors = BLK_MAX_SECTORS;
+    if (!dev->max_bios || dev->max_bios > BLK_MAX_BIOS) dev->max_bios = BLK_MAX_BIOS;
+    if (!dev->depth) dev->depth = 1;
+    spin_lock_init(&dev->lock, &lock_class_blk_queue);
+    dev->queue = NULL;
+    dev->next  = NULL;
+    block_device_t** pd = &blk_devs;
+    while (*pd) pd = &(*pd)->next;
+    *pd = dev;
+    return 0;
+}
+
+block_device_t* blk_lookup(const char* name) {
+    for (block_device_t* dev = blk_devs; dev; dev = dev->next)
+        if (strcmp(dev->name, name) == 0) return dev;
+    return NULL;
+}
+
+block_device_t* blk_first(void) {
+    return blk_devs;
+}
+
+/* ============================================================
+ * the queue
+ * ============================================================ */
+
+static int blk_mergeable(block_device_t* dev, blk_request_t* rq, bio_t* bio) {
+    if ((rq->flags | bio->flags) & (BLK_FUA | BIO_FLUSH)) return 0;
+    if ((rq->flags & BIO_WRITE) != (bio->flags & BIO_WRITE)) return 0;
+    return rq->nbios < dev->max_bios && rq->count + bio->count <= dev->max_sectors;
+}
+
+/* whether the driver can take after's buffer straight after before's */
+static int blk_joinable(block_device_t* dev, bio_t* before, bio_t* after) {
+    u32 end = (u32)before->buf + before->count * ATA_SECTOR_SIZE;
+    return end == (u32)after->buf || !((end | (u32)after->buf) & dev->boundary);
+}
+
+static void blk_insert(block_device_t* dev, blk_request_t* rq) {
+    blk_request_t** p = &dev->queue;
+    while (*p && (*p)->lba <= rq->lba) p = &(*p)->next;
+    rq->next = *p;
+    *p = rq;
+    dev->queued++;
+}
+
+static void blk_unlink(block_device_t* dev, blk_request_t* rq) {
+    blk_request_t** p = &dev->queue;
+    while (*p != rq) p = &(*p)->next;
+    *p = rq->next;
+    rq->next = NULL;
+    dev->queued--;
+}
+
+/* put bio on the end or the front of a queued request it continues.
+ * a request from before a queued flush is not joined, or the bio
+ * would go ahead of the barrier with it; one that now starts lower
+ * moves to keep the queue in LBA order */
+static int blk_merge(block_device_t* dev, bio_t* bio) {
+    for (blk_request_t* rq = dev->queue; rq; rq = rq->next) {
+        if (rq->seq < dev->flush_seq || !blk_mergeable(dev, rq, bio)) continue;
+        if (rq->lba + rq->count == bio->lba && blk_joinable(dev, rq->last, bio)) {
+            rq->last->next = bio;
+            rq->last = bio;
+        } else if (bio->lba + bio->count == rq->lba && blk_joinable(dev, bio, rq->bios)) {
+            bio->next = rq->bios;
+            rq->bios  = bio;
+            rq->lba   = bio->lba;
+            blk_unlink(dev, rq);
+            blk_insert(dev, rq);
+        } else {
+            continue;
+        }
+        rq->count += bio->count;
+        rq->nbios++;
+        return 1;
+    }
+    return 0;
+}
+
+/* the next request to start, taken off the queue; NULL if there is
+ * nothing that may go yet. a flush waits for what was submitted before
+ * it, and nothing submitted after it goes until it is done */
+static blk_request_t* blk_next(block_device_t* dev) {
+    if (dev->barrier) return NULL;
+    u32 barrier = ~0u;
+    blk_request_t* flush = NULL;
+    for (blk_request_t* rq = dev->queue; rq; rq = rq->next)
+        if ((rq->flags & BIO_FLUSH) && rq->seq < barrier) {
+            barrier = rq->seq;
+            flush   = rq;
+        }
+
+    blk_request_t *first = NULL, *ahead = NULL, *oldest = NULL;
+    for (blk_request_t* rq = dev->queue; rq; rq = rq->next) {
+        if (rq->seq >= barrier) continue;
+        if (!first) first = rq;
+        if (!ahead && rq->lba >= dev->head) ahead = rq;
+        if (!oldest || (int)(rq->deadline - oldest->deadline) < 0) oldest = rq;
+    }
+
+    blk_request_t* pick;
+    if (!first) {
+        if (!flush || dev->inflight) return NULL;
+        pick = flush;
+        dev->barrier = 1;
+    } else if ((int)(system_uptime - oldest->deadline) >= 0 && oldest != (ahead ? ahead : first)) {
+        pick = oldest;
+        dev->stat.expired++;
+    } else {
+        pick = ahead ? ahead : first;
+    }
+
+    blk_unlink(dev, pick);
+    if ((pick->flags & BIO_FLUSH) && dev->flush_seq == pick->seq + 1) dev->flush_seq = 0;
+    dev->inflight++;
+    dev->stat.requests++;
+    if (!(pick->flags & BIO_FLUSH)) dev->head = pick->lba + pick->count;
+    return pick;
+}
+
+/* a request the driver had no room for, back where it was */
+static void blk_requeue(block_device_t* dev, blk_request_t* rq) {
+    dev->inflight--;
+    dev->stat.requests--;
+    if (rq->flags & BIO_FLUSH) {
+        dev->barrier = 0;
+        if (dev->flush_seq < rq->seq + 1) dev->flush_seq = rq->seq + 1;
+    }
+    blk_insert(dev, rq);
+}
+
+/* start whatever may go. whoever finds the queue idle runs it, so a
+ * driver that sleeps in submit does the I/O of every task waiting
+ * behind it; one that doesn't is kicked again as each request ends.
+ * a driver that was full is tried again only if it was kicked
+ * meanwhile, since that kick found us in here */
+static void blk_run_queue(block_device_t* dev) {
+    u32 flags = spin_lock_irqsave(&dev->lock);
+    if (dev->dispatching) {
+        dev->rerun = 1;
+        spin_unlock_irqrestore(&dev->lock, flags);
+        return;
+    }
+    dev->dispatching = 1;
+    dev->rerun       = 0;
+    blk_request_t* rq;
+    u32 started = 0;
+    while (!dev->plugged && dev->inflight < dev->depth && (rq = blk_next(dev))) {
+        spin_unlock_irqrestore(&dev->lock, flags);
+        int r = dev->ops->submit(dev, rq);
+        started++;
+        if (r < 0) blk_end_request(dev, rq, -1);
+        flags = spin_lock_irqsave(&dev->lock);
+        if (r == BLK_BUSY) {
+            blk_requeue(dev, rq);
+            if (!dev->rerun) break;
+            dev->rerun = 0;
+        }
+    }
+    dev->dispatching = 0;
+    spin_unlock_irqrestore(&dev->lock, flags);
+    if (started && dev->ops->commit) dev->ops->commit(dev);
+}
+
+void blk_kick(block_device_t* dev) {
+    blk_run_queue(dev);
+}
+
+void blk_end_request(block_device_t* dev, blk_request_t* rq, int error) {
+    bio_t* bio = rq->bios;
+    u32 flags = spin_lock_irqsave(&dev->lock);
+    dev->inflight--;
+    if (rq->flags & BIO_FLUSH) dev->barrier = 0;
+    if (error) dev->stat.errors++;
+    spin_unlock_irqrestore(&dev->lock, flags);
+    kfree(rq);
+
+    while (bio) {
+        bio_t* next = bio->next;
+        bio->error = error;
+        complete(&bio->done);
+        __atomic_store_n(&bio->released, 1, __ATOMIC_RELEASE);
+        bio = next;
+    }
+    if (dev->ops->async) blk_run_queue(dev);
+}
+
+void blk_submit(block_device_t* dev, bio_t* bio) {
+    init_completion(&bio->done);
+    bio->error    = 0;
+    bio->released = 0;
+    bio->dev      = dev;
+    bio->next     = NULL;
+    if ((!bio->count && !(bio->flags & BIO_FLUSH)) || bio->count > dev->max_sectors ||
+        bio->lba > dev->sectors || bio->count > dev->sectors - bio->lba) {
+        bio->error    = -1;
+        bio->released = 1;
+        complete(&bio->done);
+        return;
+    }
+
+    /* allocated up front, since kmalloc is no business under the lock */
+    blk_request_t* rq = (blk_request_t*)kmalloc(sizeof(blk_request_t));
+    u32 flags = spin_lock_irqsave(&dev->lock);
+    if (bio->flags & BIO_FLUSH)      dev->stat.flushes++;
+    else if (bio->flags & BIO_WRITE) { dev->stat.writes++; dev->stat.write_sectors += bio->count; }
+    else                             { dev->stat.reads++;  dev->stat.read_sectors  += bio->count; }
+
+    int merged = blk_merge(dev, bio);
+    if (merged) {
+        dev->stat.merges++;
+    } else if (rq) {
+        memset(rq, 0, sizeof(*rq));
+        rq->lba      = bio->lba;
+        rq->count    = bio->count;
+        rq->flags    = bio->flags;
+        rq->seq      = dev->seq++;
+        rq->deadline = system_uptime + ((bio->flags & BIO_WRITE) ? BLK_WRITE_EXPIRE : BLK_READ_EXPIRE);
+        rq->nbios    = 1;
+        rq->bios     = rq->last = bio;
+        if (bio->flags & BIO_FLUSH) dev->flush_seq = rq->seq + 1;
+        blk_insert(dev, rq);
+    }
+    u32 depth = dev->queued + dev->inflight;
+    dev->stat.depth_sum += depth;
+    if (depth > dev->stat.max_depth) dev->stat.max_depth = depth;
+    spin_unlock_irqrestore(&dev->lock, flags);
+
+    if (merged) kfree(rq);
+    if (!merged && !rq) {
+        bio->error    = -1;
+        bio->released = 1;
+        complete(&bio->done);
+        return;
+    }
+    blk_run_queue(dev);
+}
+
+/* the completion may be on our stack, so wait until the layer has
+ * stopped touching it too before letting the caller return */
+int blk_wait(bio_t* bio) {
+    block_device_t* dev = bio->dev;
+    if (dev->ops->poll && (dev->polled || !irqs_enabled()))
+        while (!__atomic_load_n(&bio->released, __ATOMIC_ACQUIRE)) dev->ops->poll(dev);
+    wait_for_completion(&bio->done);
+    while (!__atomic_load_n(&bio->released, __ATOMIC_ACQUIRE)) cpu_relax();
+    return bio->error ? -1 : 0;
+}
+
+void blk_plug(block_device_t* dev) {
+    u32 flags = spin_lock_irqsave(&dev->lock);
+    dev->plugged++;
+    spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+void blk_unplug(block_device_t* dev) {
+    u32 flags = spin_lock_irqsave(&dev->lock);
+    if (dev->plugged) dev->plugged--;
+    spin_unlock_irqrestore(&dev->lock, flags);
+    blk_run_queue(dev);
+}
+
+/* ============================================================
+ * synchronous helpers
+ * ============================================================ */
+
+/* count split into bios the device takes, all submitted under a plug
+ * so they go back together as one request where they can */
+static int blk_rw(block_device_t* dev, u32 lba, u32 count, void* buf, u32 flags) {
+    if (!dev) return -1;
+    u32 nbios = (count + dev->max_sectors - 1) / dev->max_sectors;
+    bio_t  one;
+    bio_t* bios = nbios > 1 ? (bio_t*)kmalloc(nbios * sizeof(bio_t)) : &one;
+    if (!bios) return -1;
+
+    blk_plug(dev);
+    for (u32 i = 0, done = 0; i < nbios; i++) {
+        u32 n = count - done < dev->max_sectors ? count - done : dev->max_sectors;
+        bios[i].lba   = lba + done;
+        bios[i].count = n;
+        bios[i].buf   = (u8*)buf + done * ATA_SECTOR_SIZE;
+        bios[i].flags = flags;
+        blk_submit(dev, &bios[i]);
+        done += n;
+    }
+    blk_unplug(dev);
+
+    int err = 0;
+    for (u32 i = 0; i < nbios; i++)
+        if (blk_wait(&bios[i]) < 0) err = -1;
+    if (bios != &one) kfree(bios);
+    return err ? -1 : (int)(count * ATA_SECTOR_SIZE);
+}
+
+int blk_read(block_device_t* dev, u32 lba, u32 count, void* buf) {
+    return blk_rw(dev, lba, count, buf, 0);
+}
+
+int blk_write(block_device_t* dev, u32 lba, u32 count, const void* buf, u32 flags) {
+    if (dev && (flags & BLK_FUA) && !dev->fua) {
+        int n = blk_rw(dev, lba, count, (void*)buf, BIO_WRITE);
+        return n < 0 || blk_flush(dev) < 0 ? -1 : n;
+    }
+    return blk_rw(dev, lba, count, (void*)buf, BIO_WRITE | (flags & BLK_FUA));
+}
+
+int blk_flush(block_device_t* dev) {
+    if (!dev) return -1;
+    bio_t bio;
+    bio.lba   = 0;
+    bio.count = 0;
+    bio.buf   = NULL;
+    bio.flags = BIO_FLUSH;
+    blk_submit(dev, &bio);
+    return blk_wait(&bio);
+}
+
+/* ============================================================
+ * iostat
+ * ============================================================ */
+
+/* formatted under the locks and printed after them, since fd may be a
+ * pipe that blocks */
+void blk_show(int fd) {
+    char* text = (char*)kmalloc(BLK_SHOW_MAX);
+    if (!text) return;
+    usize len = 0;
+    for (block_device_t* dev = blk_devs; dev && len < BLK_SHOW_MAX - 1; dev = dev->next) {
+        u32 flags = spin_lock_irqsave(&dev->lock);
+        blk_stat_t s = dev->stat;
+        u32 now = dev->queued + dev->inflight;
+        spin_unlock_irqrestore(&dev->lock, flags);
+
+        u32 bios = s.reads + s.writes + s.flushes;
+        u32 avg10 = bios ? (u32)div64_u32(s.depth_sum * 10, bios) : 0;
+        len += (usize)snprintf(text + len, BLK_SHOW_MAX - len,
+                               "  %-7s %7u %7u %9u %9u %7u %7u %3u.%u %4u %4u %5u\n",
+                               dev->name, s.reads, s.writes,
+                               s.read_sectors / 2, s.write_sectors / 2,
+                               s.requests, s.merges, avg10 / 10, avg10 % 10,
+                               s.max_depth, now, s.expired);
+    }
+    fd_puts(fd, "  device    reads  writes   KiB read  KiB wrtn    reqs  merged   avg  max  now  late\n",
+            COLOUR_YELLOW);
+    if (len) fd_puts(fd, text, COLOUR_WHITE);
+    kfree(text);
+}
+
+void blk_reset_stats(void) {
+    for (block_device_t* dev = blk_devs; dev; dev = dev->next) {
+        u32 flags = spin_lock_irqsave(&dev->lock);
+        memset(&dev->stat, 0, sizeof(dev->stat));
+        spin_unlock_irqrestore(&dev->lock, flags);
+    }
+}
@@ -0,0 +1,173 @@
+#include "kernel.h"
+#include "idt.h"
+#include "smp.h"
+#include "vmm.h"
+#include "elf.h"
+#include "syscall.h"
+
+#define EXEC_MAX_ARGS  16
+#define EXEC_ARG_BYTES 512
+
+/* what proc_exec() hands the new task; it lives in the kernel heap
+ * because the shell's argv does not outlive the call */
+typedef struct {
+    char path[128];
+    int  argc;
+    char strs[EXEC_ARG_BYTES];      /* argv[0..argc) back to back */
+    struct file* io[3];             /* a reference each, NULL: the console */
+} exec_args_t;
+
+int elf_load(mm_t* mm, int inode, u32* entry) {
+    elf32_ehdr_t eh;
+    if (inode < 0) return -1;
+    if (fs_read_inode_at(inode, 0, (char*)&eh, sizeof(eh)) != (int)sizeof(eh)) return -1;
+    if (eh.magic != ELF_MAGIC || eh.class != ELFCLASS32 || eh.data != ELFDATA2LSB ||
+        eh.type != ET_EXEC || eh.machine != EM_386) return -1;
+    if (eh.phentsize != sizeof(elf32_phdr_t) || eh.phnum == 0 || eh.phnum > ELF_MAX_PHDRS)
+        return -1;
+
+    elf32_phdr_t ph[ELF_MAX_PHDRS];
+    int want = (int)(eh.phnum * sizeof(elf32_phdr_t));
+    if (fs_read_inode_at(inode, eh.phoff, (char*)ph, (usize)want) != want) return -1;
+
+    int loads = 0;
+    for (u32 i = 0; i < eh.phnum; i++) {
+        if (ph[i].type != PT_LOAD || ph[i].memsz == 0) continue;
+        u32 end = ph[i].vaddr + ph[i].memsz;
+        if (ph[i].filesz > ph[i].memsz || end < ph[i].vaddr ||
+            ph[i].vaddr < USER_BASE || end > USER_STACK_TOP - USER_STACK_SIZE)
+            return -1;
+        u32 flags = 0;
+        if (ph[i].flags & PF_W) flags |= VMA_WRITE;
+        if (ph[i].flags & PF_X) flags |= VMA_EXEC;
+        if (mm_add_area(mm, ph[i].vaddr, end, flags, inode,
+                        ph[i].vaddr, ph[i].offset, ph[i].filesz) < 0)
+            return -1;
+        loads++;
+    }
+    if (!loads || eh.entry < USER_BASE || eh.entry >= USER_END) return -1;
+    *entry = eh.entry;
+    return 0;
+}
+
+/* argc, argv[], NULL, an empty envp, and the strings above them, the
+ * way the i386 ABI lays out a new process's stack. runs on the new
+ * address space, so each store faults its stack page in */
+static u32 exec_push_args(const exec_args_t* ea) {
+    u32 uargv[EXEC_MAX_ARGS + 1];
+    u32 sp = USER_STACK_TOP;
+    const char* s = ea->strs;
+    for (int i = 0; i < ea->argc; i++) {
+        u32 len = (u32)strlen(s) + 1;
+        sp -= len;
+        memcpy((void*)sp, s, len);
+        uargv[i] = sp;
+        s += len;
+    }
+    uargv[ea->argc] = 0;
+
+    sp &= ~3u;
+    sp -= 4;
+    *(u32*)sp = 0;                                  /* envp terminator */
+    sp -= (u32)(ea->argc + 1) * 4;
+    memcpy((void*)sp, uargv, (usize)(ea->argc + 1) * 4);
+    sp -= 4;
+    *(u32*)sp = (u32)ea->argc;
+    return sp;
+}
+
+/* leave the kernel for good: iret to entry in ring 3 on the user stack */
+static void __attribute__((noreturn)) user_enter(u32 entry, u32 sp) {
+    __asm__ volatile (
+        "cli\n"
+        "movw %2, %%ax\n"
+        "movw %%ax, %%ds\n"
+        "movw %%ax, %%es\n"
+        "movw %%ax, %%fs\n"
+        "movw %%ax, %%gs\n"
+        "pushl %2\n"                /* ss */
+        "pushl %1\n"                /* esp */
+        "pushl $0x202\n"            /* eflags: IF */
+        "pushl %3\n"                /* cs */
+        "pushl %0\n"                /* eip */
+        "iret\n"
+        : : "r"(entry), "r"(sp), "i"(GDT_USER_DATA | 3), "i"(GDT_USER_CODE | 3)
+        : "eax", "memory");
+    __builtin_unreachable();
+}
+
+/* first code of an exec'd task, still in the kernel on its own stack */
+static void exec_start(void* arg) {
+    exec_args_t* ea = (exec_args_t*)arg;
+    process_t* self = get_current();
+    u32 entry = 0;
+
+    /* stdin, stdout, stderr first, so every way out below closes them */
+    for (int fd = 0; fd < 3; fd++) {
+        if (ea->io[fd]) fd_install_file(fd, ea->io[fd]);
+        else            fd_open("/dev/console", O_RDWR);
+    }
+
+    mm_t* mm = mm_create();
+    if (!mm) {
+        kfree(ea);
+        proc_exit(127);
+    }
+    int inode = fs_get_inode(ea->path);
+    if (elf_load(mm, inode, &entry) < 0 ||
+        mm_add_area(mm, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_TOP,
+                    VMA_WRITE, -1, 0, 0, 0) < 0) {
+        char buf[160];
+        snprintf(buf, sizeof(buf), "exec: %s: not a valid executable\n", ea->path);
+        vga_write(buf, COLOUR_LIGHT_RED);
+        mm_destroy(mm);
+        kfree(ea);
+        proc_exit(126);
+    }
+
+    u32 flags = irq_save();
+    self->mm = mm;
+    mm_switch(mm);
+    irq_restore(flags);
+
+    u32 sp = exec_push_args(ea);
+    kfree(ea);
+    user_enter(entry, sp);
+}
+
+/* run the ELF executable at path in a new task and address space.
+ * returns its pid for proc_wait(), or -1 */
+int proc_exec(const char* path, int argc, char** argv) {
+    return proc_exec_io(path, argc, argv, NULL);
+}
+
+/* the new task takes its own references on io; the caller keeps its */
+int proc_exec_io(const char* path, int argc, char** argv, struct file* io[3]) {
+    if (fs_get_inode(path) < 0) return -1;
+    exec_args_t* ea = (exec_args_t*)kmalloc(sizeof(exec_args_t));
+    if (!ea) return -1;
+    strncpy(ea->path, path, sizeof(ea->path) - 1);
+    ea->path[sizeof(ea->path) - 1] = '\0';
+
+    usize used = 0;
+    ea->argc = 0;
+    for (int i = 0; i < argc && i < EXEC_MAX_ARGS; i++) {
+        usize len = strlen(argv[i]) + 1;
+        if (used + len > sizeof(ea->strs)) break;
+        memcpy(ea->strs + used, argv[i], len);
+        used += len;
+        ea->argc++;
+    }
+
+    for (int fd = 0; fd < 3; fd++)
+        ea->io[fd] = io ? file_get(io[fd]) : NULL;
+
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    int pid = proc_create_task(name, exec_start, ea);
+    if (pid < 0) {
+        for (int fd = 0; fd < 3; fd++) file_put(ea->io[fd]);
+        kfree(ea);
+    }
+    return pid;
+}
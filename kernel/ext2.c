@@ -1,7 +1,9 @@
 #include "kernel.h"
 #include "ata.h"
+#include "blk.h"
 #include "ext2.h"
 #include "ext2_private.h"
+#include "spinlock.h"
 
 /* forward declarations for internal helpers */
 static int  ext2_alloc_block(ext2_fs_t* fs);
@@ -19,16 +21,59 @@ static u32 block_to_lba(ext2_fs_internal_t* fs, u32 block_num) {
 int ext2_read_block(ext2_fs_t* fs, u32 block_num, void* buffer) {
     ext2_fs_internal_t* internal = (ext2_fs_internal_t*)fs;
     u32 lba = block_to_lba(internal, block_num);
-    return ata_read_sectors(internal->disk, lba, internal->sectors_per_block, buffer);
+    return blk_read(internal->disk, lba, internal->sectors_per_block, buffer);
 }
 
 int ext2_write_block(ext2_fs_t* fs, u32 block_num, const void* buffer) {
     ext2_fs_internal_t* internal = (ext2_fs_internal_t*)fs;
     u32 lba = block_to_lba(internal, block_num);
-    return ata_write_sectors(internal->disk, lba, internal->sectors_per_block, buffer);
+    return blk_write(internal->disk, lba, internal->sectors_per_block, buffer, 0);
 }
 
-int ext2_mount(ata_disk_t* disk, u32 partition_start, ext2_fs_t** out_fs) {
+/* the superblock is the consistency point: whatever it describes has
+ * to be on media before it is, so flush first, then write it through */
+static int ext2_write_super(ext2_fs_internal_t* fs) {
+    u8 buf[1024];
+    if (blk_read(fs->disk, fs->partition_start + 2, 2, buf) < 0) return -1;
+    memcpy(buf + 512, &fs->sb, sizeof(ext2_superblock_t));
+    if (blk_flush(fs->disk) < 0) return -1;
+    return blk_write(fs->disk, fs->partition_start + 2, 2, buf, BLK_FUA) < 0 ? -1 : 0;
+}
+
+/* the blocks in one go: a bio each, submitted under a plug so the
+ * queue hands the runs that sit together on disk to the driver as one
+ * command. n is at most the 12 direct blocks */
+static int ext2_rw_blocks(ext2_fs_internal_t* fs, const u32* blocks, u32 n, void* buf, u32 flags) {
+    bio_t bios[12];
+    blk_plug(fs->disk);
+    for (u32 i = 0; i < n; i++) {
+        bios[i].lba   = block_to_lba(fs, blocks[i]);
+        bios[i].count = fs->sectors_per_block;
+        bios[i].buf   = (u8*)buf + i * fs->block_size;
+        bios[i].flags = flags;
+        blk_submit(fs->disk, &bios[i]);
+    }
+    blk_unplug(fs->disk);
+
+    int err = 0;
+    for (u32 i = 0; i < n; i++)
+        if (blk_wait(&bios[i]) < 0) err = -1;
+    return err;
+}
+
+/* 1 if there is an ext2 superblock at partition_start */
+int ext2_probe(block_device_t* disk, u32 partition_start) {
+    u8 sb_buf[1024];
+    if (blk_read(disk, partition_start + 2, 2, sb_buf) != 1024) return 0;
+    return ((ext2_superblock_t*)(sb_buf + 512))->magic == EXT2_SUPER_MAGIC;
+}
+
+/* every block written so far on media, then the superblock */
+int ext2_sync(ext2_fs_t* fs) {
+    return ext2_write_super((ext2_fs_internal_t*)fs);
+}
+
+int ext2_mount(block_device_t* disk, u32 partition_start, ext2_fs_t** out_fs) {
     ext2_fs_internal_t* fs = kmalloc(sizeof(ext2_fs_internal_t));
     if (!fs) return -1;
     memset(fs, 0, sizeof(*fs));
@@ -37,8 +82,8 @@ int ext2_mount(ata_disk_t* disk, u32 partition_start, ext2_fs_t** out_fs) {
     fs->partition_start = partition_start;
 
     u8 sb_buf[1024];
-    if (ata_read_sectors(disk, partition_start + 2, 2, sb_buf) != 1024) {
-        vga_write("ext2: ata_read_sectors failed\n", COLOUR_DEBUG_ERROR);
+    if (blk_read(disk, partition_start + 2, 2, sb_buf) != 1024) {
+        vga_write("ext2: blk_read failed\n", COLOUR_DEBUG_ERROR);
         kfree(fs); return -1;
     }
 
@@ -49,9 +94,11 @@ int ext2_mount(ata_disk_t* disk, u32 partition_start, ext2_fs_t** out_fs) {
             vga_write("ext2: format failed\n", COLOUR_DEBUG_ERROR);
             return -1;
         }
-        ata_read_sectors(disk, partition_start + 2, 2, sb_buf);
+        blk_read(disk, partition_start + 2, 2, sb_buf);
         memcpy(&fs->sb, sb_buf + 512, sizeof(ext2_superblock_t));
     }
+    fs->sb.mnt_count++;
+    ext2_write_super(fs);
 
     fs->block_size       = 1024u << fs->sb.log_block_size;
     fs->sectors_per_block = fs->block_size / ATA_SECTOR_SIZE;
@@ -73,8 +120,9 @@ int ext2_mount(ata_disk_t* disk, u32 partition_start, ext2_fs_t** out_fs) {
     return 0;
 }
 
-int ext2_format(ata_disk_t* disk, u32 partition_start, u32 total_sectors) {
+int ext2_format(block_device_t* disk, u32 partition_start, u32 total_sectors) {
     if (total_sectors == 0) total_sectors = 131072;
+    if (partition_start + total_sectors > disk->sectors) return -1;
     const u32 block_size      = 1024;
     const u32 blocks_per_group = 8192;
     const u32 inodes_per_group = 2048;
@@ -98,8 +146,7 @@ int ext2_format(ata_disk_t* disk, u32 partition_start, u32 total_sectors) {
 
     u8 buf[1024] = {0};
     memcpy(buf + 512, &sb, sizeof(sb));
-    ata_write_sectors(disk, partition_start + 2, 2, buf);
-    return 0;
+    return blk_write(disk, partition_start + 2, 2, buf, BLK_FUA) < 0 ? -1 : 0;
 }
 
 int ext2_read_inode(ext2_fs_t* fs, u32 inode_num, ext2_inode_t* inode) {
@@ -206,21 +253,24 @@ int ext2_create_file(ext2_fs_t* fs, u32 dir_inode, const char* name, u16 mode) {
 int ext2_read_file(ext2_fs_t* fs, ext2_inode_t* inode,
                    u32 offset, u32 size, void* buffer) {
     ext2_fs_internal_t* internal = (ext2_fs_internal_t*)fs;
-    u32 bytes_read = 0;
-    u32 block_num  = offset / internal->block_size;
-    u32 block_off  = offset % internal->block_size;
-
-    while (bytes_read < size && block_num < 12) {
-        if (inode->block[block_num] == 0) break;
-        u8 blk[1024];
-        ext2_read_block(fs, inode->block[block_num], blk);
-        u32 to_copy = internal->block_size - block_off;
-        if (to_copy > size - bytes_read) to_copy = size - bytes_read;
-        memcpy((u8*)buffer + bytes_read, blk + block_off, to_copy);
-        bytes_read += to_copy;
-        block_num++;
-        block_off = 0;
+    u32 first = offset / internal->block_size;
+    u32 end   = first;
+    while (end < 12 && end * internal->block_size < offset + size && inode->block[end]) end++;
+    if (end == first || size == 0) return 0;
+
+    u32 n   = end - first;
+    u8* blk = (u8*)kmalloc(n * internal->block_size);
+    if (!blk) return -1;
+    if (ext2_rw_blocks(internal, &inode->block[first], n, blk, 0) < 0) {
+        kfree(blk);
+        return -1;
     }
+
+    u32 block_off  = offset % internal->block_size;
+    u32 bytes_read = n * internal->block_size - block_off;
+    if (bytes_read > size) bytes_read = size;
+    memcpy(buffer, blk + block_off, bytes_read);
+    kfree(blk);
     return bytes_read;
 }
 
@@ -239,14 +289,21 @@ int ext2_write_file(ext2_fs_t* fs, ext2_inode_t* inode,
         int blk = ext2_alloc_block(fs);
         if (blk == 0) break;
         inode->block[b++] = blk;
-
-        u8 temp[1024] = {0};
         u32 todo = internal->block_size;
         if (todo > size - written) todo = size - written;
-        memcpy(temp, (const u8*)buffer + written, todo);
-        ext2_write_block(fs, blk, temp);
         written += todo;
     }
+
+    /* the blocks were handed out in a row, so mostly this is one write */
+    if (b) {
+        u8* temp = (u8*)kmalloc(b * internal->block_size);
+        if (!temp) return -1;
+        memset(temp, 0, b * internal->block_size);
+        memcpy(temp, buffer, written);
+        int r = ext2_rw_blocks(internal, inode->block, b, temp, BIO_WRITE);
+        kfree(temp);
+        if (r < 0) return -1;
+    }
     inode->size   = written;
     inode->blocks = b * (internal->block_size / 512);
     return written;
@@ -254,27 +311,39 @@ int ext2_write_file(ext2_fs_t* fs, ext2_inode_t* inode,
 
 int ext2_find_inode(ext2_fs_t* fs, u32 dir_inode,
                     const char* name, ext2_inode_t* out) {
+    ext2_fs_internal_t* internal = (ext2_fs_internal_t*)fs;
     ext2_inode_t dir;
     if (ext2_read_inode(fs, dir_inode, &dir) != 0) return -1;
 
-    u32 namelen = strlen(name);
-    u8  buf[1024];
+    u32 n = 0;
+    while (n < 12 && dir.block[n]) n++;
+    if (n == 0) return -1;
+    u8* buf = (u8*)kmalloc(n * internal->block_size);
+    if (!buf) return -1;
+    if (ext2_rw_blocks(internal, dir.block, n, buf, 0) < 0) {
+        kfree(buf);
+        return -1;
+    }
 
-    for (int i = 0; i < 12 && dir.block[i]; i++) {
-        ext2_read_block(fs, dir.block[i], buf);
+    u32 namelen = strlen(name);
+    int found   = -1;
+    for (u32 i = 0; i < n && found < 0; i++) {
+        u8* blk = buf + i * internal->block_size;
         u32 off = 0;
         while (off < 1024) {
-            ext2_dirent_t* de = (ext2_dirent_t*)(buf + off);
+            ext2_dirent_t* de = (ext2_dirent_t*)(blk + off);
             if (de->inode && de->name_len == (u8)namelen &&
                 memcmp(de->name, name, namelen) == 0) {
-                if (out) ext2_read_inode(fs, de->inode, out);
-                return (int)de->inode;
+                found = (int)de->inode;
+                break;
             }
             if (de->rec_len == 0) break;
             off += de->rec_len;
         }
     }
-    return -1;
+    kfree(buf);
+    if (found >= 0 && out) ext2_read_inode(fs, (u32)found, out);
+    return found;
 }
 
 int ext2_unlink(ext2_fs_t* fs, u32 dir_inode_num, const char* name) {
@@ -340,10 +409,17 @@ void ext2_close(ext2_fs_t* fs) {
     kfree(internal);
 }
 
+/* the allocators are plain counters shared by every mount */
+DEFINE_LOCK_CLASS(ext2_alloc, "spin");
+static spinlock_t alloc_lock = SPINLOCK_INIT(ext2_alloc);
+
 static int ext2_alloc_block(ext2_fs_t* fs) {
     (void)fs;
     static u32 next_block = 10;
-    return (int)(next_block++);
+    u32 flags = spin_lock_irqsave(&alloc_lock);
+    int block = (int)(next_block++);
+    spin_unlock_irqrestore(&alloc_lock, flags);
+    return block;
 }
 
 static void ext2_free_block(ext2_fs_t* fs, u32 block) {
@@ -353,7 +429,10 @@ static void ext2_free_block(ext2_fs_t* fs, u32 block) {
 static int ext2_alloc_inode(ext2_fs_t* fs) {
     (void)fs;
     static u32 next_inode = 11;
-    return (int)(next_inode++);
+    u32 flags = spin_lock_irqsave(&alloc_lock);
+    int inode = (int)(next_inode++);
+    spin_unlock_irqrestore(&alloc_lock, flags);
+    return inode;
 }
 
 static void ext2_free_inode(ext2_fs_t* fs, u32 inode_num) {
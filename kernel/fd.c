@@ -0,0 +1,370 @@
+#include "kernel.h"
+#include "smp.h"
+#include "syscall.h"
+#include "pipe.h"
+#include "ipc.h"
+
+/* ---------------------------------------------------------------
+ * file descriptors: each task has MAX_FDS slots pointing into one
+ * shared table of open files. ext2 can only rewrite a file whole, so
+ * a file opened for writing is staged in memory and written back by
+ * the last fd_close(); reads of a read-only file go straight to disk.
+ * an open file can sit behind fds of several tasks (a pipe end handed
+ * to a pipeline stage), so each one counts its references. a message
+ * queue fd reads and writes whole messages.
+ * --------------------------------------------------------------- */
+
+#define NR_FILES       128
+#define FILE_MAX_SIZE  (12 * 1024)      /* ext2 reads direct blocks only */
+#define FD_CHUNK       512              /* bounce buffer for console and disk reads */
+
+#define FILE_NONE      0
+#define FILE_CONSOLE   1
+#define FILE_INODE     2
+#define FILE_PIPE      3
+#define FILE_MQ        4
+
+typedef struct file {
+    u8    type;
+    u8    dirty;
+    u32   refs;                 /* fds and in-flight hand-offs */
+    int   flags;                /* O_* */
+    int   inode;
+    u32   pos;
+    u32   size;                 /* of data */
+    char* data;                 /* whole file while open for writing */
+    pipe_t* pipe;               /* FILE_PIPE: the write end if flags say so */
+    mq_t*   mq;                 /* FILE_MQ, holds a reference */
+} file_t;
+
+DEFINE_LOCK_CLASS(files, "spin");
+static spinlock_t files_lock = SPINLOCK_INIT(files);
+static file_t     files[NR_FILES];
+
+/* fds 0-2 of a new program; shared and never freed */
+static file_t console = { FILE_CONSOLE, 0, 1, O_RDWR, -1, 0, 0, NULL, NULL, NULL };
+
+void fd_init(void) {
+    memset(files, 0, sizeof(files));
+}
+
+static file_t* file_alloc(void) {
+    u32 flags = spin_lock_irqsave(&files_lock);
+    file_t* f = NULL;
+    for (int i = 0; i < NR_FILES && !f; i++) {
+        if (files[i].type == FILE_NONE) {
+            f = &files[i];
+            memset(f, 0, sizeof(*f));
+            f->type = FILE_INODE;
+            f->refs = 1;
+        }
+    }
+    spin_unlock_irqrestore(&files_lock, flags);
+    return f;
+}
+
+static void file_release(file_t* f) {
+    u32 flags = spin_lock_irqsave(&files_lock);
+    f->type = FILE_NONE;
+    spin_unlock_irqrestore(&files_lock, flags);
+}
+
+static file_t* fd_get(int fd) {
+    if (fd < 0 || fd >= MAX_FDS) return NULL;
+    return get_current()->fds[fd];
+}
+
+static int fd_install(file_t* f) {
+    process_t* self = get_current();
+    for (int fd = 0; fd < MAX_FDS; fd++) {
+        if (!self->fds[fd]) {
+            self->fds[fd] = f;
+            return fd;
+        }
+    }
+    return -1;
+}
+
+int fd_open(const char* path, int flags) {
+    if (!path) return -1;
+    if (strcmp(path, "/dev/console") == 0 || strcmp(path, "/dev/tty") == 0)
+        return fd_install(&console);
+
+    int inode = fs_get_inode(path);
+    if (inode < 0 && (flags & O_CREAT)) {
+        if (fs_create(path, 0) < 0) return -1;
+        inode = fs_get_inode(path);
+    }
+    if (inode < 0) return -1;
+    int mode = fs_mode_inode(inode);
+    if (mode < 0 || (mode & 0xF000) == 0x4000) return -1;   /* no directories */
+
+    file_t* f = file_alloc();
+    if (!f) return -1;
+    f->flags = flags;
+    f->inode = inode;
+    if ((flags & O_ACCMODE) != O_RDONLY) {
+        f->data = (char*)kmalloc(FILE_MAX_SIZE);
+        if (!f->data) {
+            file_release(f);
+            return -1;
+        }
+        if (flags & O_TRUNC) {
+            f->dirty = 1;
+        } else {
+            int n = fs_read_inode(inode, f->data, FILE_MAX_SIZE);
+            f->size = n > 0 ? (u32)n : 0;
+        }
+        if (flags & O_APPEND) f->pos = f->size;
+    }
+
+    int fd = fd_install(f);
+    if (fd < 0) {
+        kfree(f->data);
+        file_release(f);
+    }
+    return fd;
+}
+
+file_t* file_get(file_t* f) {
+    if (f && f != &console) __atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+    return f;
+}
+
+/* drop a reference; the last one writes back, closes the pipe end or
+ * lets go of the queue, and frees the slot */
+int file_put(file_t* f) {
+    if (!f || f == &console) return 0;
+    if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) != 0) return 0;
+
+    int ret = 0;
+    if (f->type == FILE_PIPE) {
+        pipe_close(f->pipe, (f->flags & O_ACCMODE) == O_WRONLY);
+    } else if (f->type == FILE_MQ) {
+        mq_put(f->mq);
+    } else if (f->data) {
+        if (f->dirty && fs_write_inode(f->inode, f->data, f->size) < 0) ret = -1;
+        kfree(f->data);
+    }
+    file_release(f);
+    return ret;
+}
+
+int fd_close(int fd) {
+    file_t* f = fd_get(fd);
+    if (!f) return -1;
+    get_current()->fds[fd] = NULL;
+    return file_put(f);
+}
+
+/* the file behind fd with a reference taken for the caller */
+file_t* fd_file(int fd) {
+    return file_get(fd_get(fd));
+}
+
+/* put f at fd, closing what was there; the fd takes over the caller's
+ * reference */
+int fd_install_file(int fd, file_t* f) {
+    if (fd < 0 || fd >= MAX_FDS || !f) return -1;
+    if (get_current()->fds[fd]) fd_close(fd);
+    get_current()->fds[fd] = f;
+    return fd;
+}
+
+/* both ends of a new pipe, one reference each, not on any fd yet */
+int file_pipe(file_t** rd, file_t** wr) {
+    pipe_t* p = pipe_create();
+    if (!p) return -1;
+    file_t* r = file_alloc();
+    file_t* w = r ? file_alloc() : NULL;
+    if (!w) {
+        if (r) file_release(r);
+        pipe_close(p, 0);
+        pipe_close(p, 1);
+        return -1;
+    }
+    r->type  = FILE_PIPE;
+    r->flags = O_RDONLY;
+    r->pipe  = p;
+    w->type  = FILE_PIPE;
+    w->flags = O_WRONLY;
+    w->pipe  = p;
+    *rd = r;
+    *wr = w;
+    return 0;
+}
+
+int fd_pipe(int fds[2]) {
+    file_t *r, *w;
+    if (file_pipe(&r, &w) < 0) return -1;
+    fds[0] = fd_install(r);
+    fds[1] = fds[0] < 0 ? -1 : fd_install(w);
+    if (fds[1] < 0) {
+        if (fds[0] >= 0) get_current()->fds[fds[0]] = NULL;
+        file_put(r);
+        file_put(w);
+        return -1;
+    }
+    return 0;
+}
+
+/* the queue called name, created if flags have O_CREAT */
+int fd_mq_open(const char* name, int flags, u32 depth) {
+    mq_t* q = mq_get(name, depth, flags & O_CREAT);
+    if (!q) return -1;
+    file_t* f = file_alloc();
+    if (!f) {
+        mq_put(q);
+        return -1;
+    }
+    f->type  = FILE_MQ;
+    f->flags = flags & O_ACCMODE;
+    f->mq    = q;
+    int fd = fd_install(f);
+    if (fd < 0) file_put(f);
+    return fd;
+}
+
+mq_t* fd_mq(int fd) {
+    file_t* f = fd_get(fd);
+    return f && f->type == FILE_MQ ? f->mq : NULL;
+}
+
+void fd_close_all(void) {
+    for (int fd = 0; fd < MAX_FDS; fd++)
+        if (get_current()->fds[fd]) fd_close(fd);
+}
+
+/* one line from the keyboard, newline included if it fits */
+static int console_read(char* buf, usize count) {
+    char line[FD_CHUNK];
+    usize max = count < sizeof(line) - 1 ? count : sizeof(line) - 1;
+    int n = tty_read(line, max + 1);
+    if (n < 0) return -1;
+    if ((usize)n < max) line[n++] = '\n';
+    memcpy(buf, line, (usize)n);
+    return n;
+}
+
+static int console_write(int fd, const char* buf, usize count) {
+    char chunk[128];
+    usize done = 0;
+    while (done < count) {
+        usize n = count - done;
+        if (n > sizeof(chunk) - 1) n = sizeof(chunk) - 1;
+        memcpy(chunk, buf + done, n);
+        chunk[n] = '\0';
+        tty_write(chunk, fd == 2 ? COLOUR_LIGHT_RED : COLOUR_WHITE);
+        done += n;
+    }
+    return (int)count;
+}
+
+/* buf may be a user address: copies into it are plain stores that
+ * fault pages in, so nothing here holds a lock while making them */
+int fd_read(int fd, void* buf, usize count) {
+    file_t* f = fd_get(fd);
+    if (!f || !buf || (f->flags & O_ACCMODE) == O_WRONLY) return -1;
+    if (f->type == FILE_CONSOLE) return console_read((char*)buf, count);
+    if (f->type == FILE_PIPE)    return pipe_read(f->pipe, buf, count);
+    if (f->type == FILE_MQ)      return mq_receive(f->mq, buf, count, 0);
+
+    if (f->data) {
+        if (f->pos >= f->size) return 0;
+        if (count > f->size - f->pos) count = f->size - f->pos;
+        memcpy(buf, f->data + f->pos, count);
+        f->pos += (u32)count;
+        return (int)count;
+    }
+
+    char chunk[FD_CHUNK];
+    usize done = 0;
+    while (done < count) {
+        usize want = count - done;
+        if (want > sizeof(chunk)) want = sizeof(chunk);
+        int n = fs_read_inode_at(f->inode, f->pos, chunk, want);
+        if (n < 0) return done ? (int)done : -1;
+        if (n == 0) break;
+        memcpy((char*)buf + done, chunk, (usize)n);
+        f->pos += (u32)n;
+        done   += (usize)n;
+    }
+    return (int)done;
+}
+
+int fd_write(int fd, const void* buf, usize count) {
+    file_t* f = fd_get(fd);
+    if (!f || !buf || (f->flags & O_ACCMODE) == O_RDONLY) return -1;
+    if (f->type == FILE_CONSOLE) return console_write(fd, (const char*)buf, count);
+    if (f->type == FILE_PIPE)    return pipe_write(f->pipe, buf, count);
+    if (f->type == FILE_MQ)      return mq_send(f->mq, buf, count);
+
+    if (f->flags & O_APPEND) f->pos = f->size;
+    if (f->pos >= FILE_MAX_SIZE) return -1;
+    if (count > FILE_MAX_SIZE - f->pos) count = FILE_MAX_SIZE - f->pos;
+    if (f->pos > f->size) memset(f->data + f->size, 0, f->pos - f->size);
+    memcpy(f->data + f->pos, buf, count);
+    f->pos += (u32)count;
+    if (f->pos > f->size) f->size = f->pos;
+    f->dirty = 1;
+    return (int)count;
+}
+
+int fd_seek(int fd, int offset, int whence) {
+    file_t* f = fd_get(fd);
+    if (!f || f->type != FILE_INODE) return -1;
+    int size = f->data ? (int)f->size : fs_size_inode(f->inode);
+    int base;
+    switch (whence) {
+        case SEEK_SET: base = 0;           break;
+        case SEEK_CUR: base = (int)f->pos; break;
+        case SEEK_END: base = size;        break;
+        default:       return -1;
+    }
+    if (base + offset < 0) return -1;
+    f->pos = (u32)(base + offset);
+    return (int)f->pos;
+}
+
+int fd_fstat(int fd, kstat_t* st) {
+    file_t* f = fd_get(fd);
+    if (!f || !st) return -1;
+    if (f->type == FILE_CONSOLE) {
+        st->st_ino     = 0;
+        st->st_mode    = 0x2000 | 0620;     /* character device */
+        st->st_size    = 0;
+        st->st_blksize = FD_CHUNK;
+        return 0;
+    }
+    if (f->type == FILE_PIPE) {
+        st->st_ino     = 0;
+        st->st_mode    = 0x1000 | 0600;     /* FIFO */
+        st->st_size    = pipe_count(f->pipe);
+        st->st_blksize = PIPE_SIZE;
+        return 0;
+    }
+    if (f->type == FILE_MQ) {
+        st->st_ino     = 0;
+        st->st_mode    = 0x1000 | 0600;     /* FIFO, of messages */
+        st->st_size    = mq_count(f->mq);
+        st->st_blksize = MQ_MAX_MSG;
+        return 0;
+    }
+    st->st_ino     = (u32)f->inode;
+    st->st_mode    = (u16)fs_mode_inode(f->inode);
+    st->st_size    = f->data ? f->size : (u32)fs_size_inode(f->inode);
+    st->st_blksize = 1024;
+    return 0;
+}
+
+/* text in a colour: to the screen when fd is the console, or not open
+ * at all as in a kernel thread, else down the fd like any write */
+int fd_puts(int fd, const char* s, u8 colour) {
+    file_t* f = fd_get(fd);
+    usize len = strlen(s);
+    if (!f || f->type == FILE_CONSOLE) {
+        vga_write(s, colour);
+        return (int)len;
+    }
+    return fd_write(fd, s, len);
+}
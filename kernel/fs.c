@@ -1,7 +1,13 @@
 #include "kernel.h"
 #include "ata.h"
+#include "blk.h"
 #include "ext2.h"
 
+#ifndef FS_ROOT_DEV
+#define FS_ROOT_DEV         "hda"       /* make ROOT_DEV=... */
+#endif
+#define FS_FORMAT_SECTORS   131072      /* 64 MiB */
+
 static ext2_fs_t* fs     = NULL;
 static u32        cwd_inode = 2;
 static char       cwd[128]  = "/";
@@ -81,18 +87,35 @@ static void fs_mkdirp(const char* path) {
 
 void fs_init(void) {
     ata_init();
-    ata_disk_t* disk = ata_get_primary();
+
+    /* the first disk that already holds a filesystem, whichever driver
+     * it came from; failing that, only the root disk gets one, and only
+     * if it is big enough: the others may hold someone's data */
+    block_device_t* disk = NULL;
+    for (block_device_t* dev = blk_first(); dev; dev = dev->next)
+        if (ext2_probe(dev, 0)) {
+            disk = dev;
+            break;
+        }
     if (!disk) {
-        vga_write("fs: no disk found, using RAM fallback\n", COLOUR_LIGHT_RED);
-        return;
+        disk = blk_lookup(FS_ROOT_DEV);
+        if (!disk) {
+            vga_write("fs: no " FS_ROOT_DEV " found, using RAM fallback\n", COLOUR_LIGHT_RED);
+            return;
+        }
+        if (disk->sectors < FS_FORMAT_SECTORS) {
+            vga_write("fs: " FS_ROOT_DEV " is too small to format, using RAM fallback\n", COLOUR_LIGHT_RED);
+            return;
+        }
+        vga_write("fs: formatting " FS_ROOT_DEV "...\n", COLOUR_YELLOW);
+        if (ext2_format(disk, 0, FS_FORMAT_SECTORS) != 0) {
+            vga_write("fs: format failed, using RAM fallback\n", COLOUR_LIGHT_RED);
+            return;
+        }
     }
     if (ext2_mount(disk, 0, &fs) != 0) {
-        vga_write("fs: formatting disk...\n", COLOUR_YELLOW);
-        ext2_format(disk, 0, 131072);
-        if (ext2_mount(disk, 0, &fs) != 0) {
-            vga_write("fs: fatal mount failure\n", COLOUR_RED);
-            khang();
-        }
+        vga_write("fs: fatal mount failure\n", COLOUR_RED);
+        khang();
     }
 
     /* ---- standard UNIX directory tree ---- */
@@ -209,6 +232,12 @@ int fs_write(const char* name, const char* data, usize size) {
     return written;
 }
 
+/* writes only reach the drive's cache; this puts them on media */
+int fs_sync(void) {
+    if (!fs) return -1;
+    return ext2_sync(fs);
+}
+
 int fs_chdir(const char* dir) {
     if (!dir || !*dir || !fs) return -1;
 
@@ -329,6 +358,16 @@ int fs_read_inode(int inode_num, char* buf, usize size) {
     return ext2_read_file(fs, &inode, 0, (u32)size, buf);
 }
 
+/* size bytes from offset on; the ELF loader pages programs in this way */
+int fs_read_inode_at(int inode_num, u32 offset, char* buf, usize size) {
+    if (!fs || inode_num < 0) return -1;
+    ext2_inode_t inode;
+    if (ext2_read_inode(fs, (u32)inode_num, &inode) < 0) return -1;
+    if (offset >= inode.size) return 0;
+    if (size > inode.size - offset) size = inode.size - offset;
+    return ext2_read_file(fs, &inode, offset, (u32)size, buf);
+}
+
 int fs_write_inode(int inode_num, const char* buf, usize size) {
     if (!fs || inode_num < 0) return -1;
     ext2_inode_t inode;
@@ -344,3 +383,10 @@ int fs_size_inode(int inode_num) {
     if (ext2_read_inode(fs, (u32)inode_num, &inode) < 0) return -1;
     return (int)inode.size;
 }
+
+int fs_mode_inode(int inode_num) {
+    if (!fs || inode_num < 0) return -1;
+    ext2_inode_t inode;
+    if (ext2_read_inode(fs, (u32)inode_num, &inode) < 0) return -1;
+    return inode.mode;
+}
@@ -0,0 +1,134 @@
+#include "kernel.h"
+#include "smp.h"
+#include "vmm.h"
+#include "futex.h"
+
+/* ---------------------------------------------------------------
+ * waiters sit on the stack of the task that waits, in one of
+ * FUTEX_BUCKETS lists picked by hashing the word's physical address.
+ * the value check and the queueing happen under the bucket lock, and
+ * so does every wakeup, so a futex_wake() after the value changed
+ * always finds the waiter that saw the old value.
+ * --------------------------------------------------------------- */
+
+#define FUTEX_BUCKETS  64              /* power of two */
+
+typedef struct futex_waiter {
+    u32                  key;           /* physical address of the word */
+    process_t*           task;
+    struct futex_waiter* next;
+    volatile u8          woken;
+} futex_waiter_t;
+
+typedef struct {
+    spinlock_t      lock;               /* irqsave */
+    futex_waiter_t* head;
+} futex_bucket_t;
+
+DEFINE_LOCK_CLASS(futex, "spin");
+static futex_bucket_t futex_table[FUTEX_BUCKETS];
+static futex_stat_t   futex_stat;
+
+void futex_init(void) {
+    for (u32 i = 0; i < FUTEX_BUCKETS; i++) {
+        spin_lock_init(&futex_table[i].lock, &lock_class_futex);
+        futex_table[i].head = NULL;
+    }
+    memset(&futex_stat, 0, sizeof(futex_stat));
+}
+
+/* user words go through the current task's page tables; kernel space
+ * is identity mapped */
+static u32 futex_key(u32 addr) {
+    if (addr & 3) return 0;
+    if (addr >= USER_BASE && addr < USER_END) return user_phys(addr);
+    return addr < KERNEL_SPACE_END ? addr : 0;
+}
+
+static futex_bucket_t* futex_bucket(u32 key) {
+    return &futex_table[((key >> 2) * 0x9E3779B1u) >> 26];
+}
+
+int futex_wait(u32* addr, u32 expected, u32 timeout_ms) {
+    u32 key = futex_key((u32)addr);
+    if (!key) return -1;
+    futex_bucket_t* b = futex_bucket(key);
+    futex_waiter_t w = { key, get_current(), NULL, 0 };
+
+    /* the word is paged in by now and nothing pages it out again, so
+     * reading it here cannot fault */
+    u32 flags = spin_lock_irqsave(&b->lock);
+    if (*(volatile u32*)addr != expected) {
+        __atomic_add_fetch(&futex_stat.again, 1, __ATOMIC_RELAXED);
+        spin_unlock_irqrestore(&b->lock, flags);
+        return FUTEX_AGAIN;
+    }
+    futex_waiter_t** pp = &b->head;
+    while (*pp) pp = &(*pp)->next;
+    *pp = &w;
+    __atomic_add_fetch(&futex_stat.waits, 1, __ATOMIC_RELAXED);
+    spin_unlock_irqrestore(&b->lock, flags);
+
+    if (timeout_ms > 0x7FFFFFFF / TIMER_HZ) timeout_ms = 0x7FFFFFFF / TIMER_HZ;
+    u32 end = system_uptime + (timeout_ms * TIMER_HZ + 999) / 1000;
+    while (!w.woken) {
+        if (!timeout_ms) {
+            proc_block();
+            continue;
+        }
+        int left = (int)(end - system_uptime);
+        if (left <= 0) break;
+        proc_block_timeout((u32)left);
+    }
+    if (w.woken) return 0;
+
+    /* timed out, unless a wakeup got in before we took the lock */
+    flags = spin_lock_irqsave(&b->lock);
+    int ret = 0;
+    if (!w.woken) {
+        pp = &b->head;
+        while (*pp != &w) pp = &(*pp)->next;
+        *pp = w.next;
+        __atomic_add_fetch(&futex_stat.timeouts, 1, __ATOMIC_RELAXED);
+        ret = FUTEX_TIMEOUT;
+    }
+    spin_unlock_irqrestore(&b->lock, flags);
+    return ret;
+}
+
+int futex_wake(u32* addr, int n) {
+    u32 key = futex_key((u32)addr);
+    if (!key) return -1;
+    futex_bucket_t* b = futex_bucket(key);
+
+    int woke = 0;
+    u32 flags = spin_lock_irqsave(&b->lock);
+    futex_waiter_t** pp = &b->head;
+    while (*pp && woke < n) {
+        futex_waiter_t* w = *pp;
+        if (w->key != key) {
+            pp = &w->next;
+            continue;
+        }
+        /* the waiter may return as soon as woken is set, so take
+         * everything we need from w before that */
+        process_t* task = w->task;
+        *pp = w->next;
+        w->woken = 1;
+        proc_wake(task);
+        woke++;
+    }
+    __atomic_add_fetch(&futex_stat.wakes, (u32)woke, __ATOMIC_RELAXED);
+    spin_unlock_irqrestore(&b->lock, flags);
+    return woke;
+}
+
+/* counters are bumped atomically under different bucket locks, so a
+ * snapshot taken while futexes are busy may be slightly torn */
+void futex_stats(futex_stat_t* st) {
+    *st = futex_stat;
+}
+
+void futex_stats_reset(void) {
+    memset(&futex_stat, 0, sizeof(futex_stat));
+}
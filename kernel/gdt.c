@@ -0,0 +1,76 @@
+#include "kernel.h"
+#include "idt.h"
+#include "smp.h"
+
+#define GDT_ENTRIES (GDT_PERCPU_FIRST + MAX_CPUS)
+
+typedef struct {
+    u16 limit_low;
+    u16 base_low;
+    u8  base_mid;
+    u8  access;
+    u8  granularity;
+    u8  base_high;
+} __attribute__((packed)) gdt_entry_t;
+
+typedef struct {
+    u16 limit;
+    u32 base;
+} __attribute__((packed)) gdt_ptr_t;
+
+static gdt_entry_t gdt[GDT_ENTRIES];
+static gdt_ptr_t   gdt_ptr;
+
+static void gdt_set(int i, u32 base, u32 limit, u8 access, u8 gran) {
+    gdt[i].limit_low   = limit & 0xFFFF;
+    gdt[i].base_low    = base & 0xFFFF;
+    gdt[i].base_mid    = (base >> 16) & 0xFF;
+    gdt[i].access      = access;
+    gdt[i].granularity = (u8)(((limit >> 16) & 0x0F) | (gran & 0xF0));
+    gdt[i].base_high   = (base >> 24) & 0xFF;
+}
+
+static void gdt_load(u16 gs) {
+    __asm__ volatile (
+        "lgdt %0\n"
+        "movw %1, %%ax\n"
+        "movw %%ax, %%ds\n"
+        "movw %%ax, %%es\n"
+        "movw %%ax, %%fs\n"
+        "movw %%ax, %%ss\n"
+        "movw %w3, %%gs\n"
+        "ljmp %2, $1f\n"
+        "1:\n"
+        : : "m"(gdt_ptr), "i"(GDT_KERNEL_DATA), "i"(GDT_KERNEL_CODE), "r"(gs)
+        : "eax", "memory");
+}
+
+/* GRUB leaves us a GDT we are not supposed to rely on, so install our own
+ * flat 4 GiB code/data segments before the IDT starts pointing at them. */
+void gdt_init(void) {
+    gdt_set(0, 0, 0, 0, 0);
+    gdt_set(1, 0, 0xFFFFF, 0x9A, 0xCF);   /* kernel code */
+    gdt_set(2, 0, 0xFFFFF, 0x92, 0xCF);   /* kernel data */
+    gdt_set(3, 0, 0xFFFFF, 0xFA, 0xCF);   /* user code, DPL 3 */
+    gdt_set(4, 0, 0xFFFFF, 0xF2, 0xCF);   /* user data, DPL 3 */
+
+    gdt_ptr.limit = sizeof(gdt) - 1;
+    gdt_ptr.base  = (u32)&gdt;
+    gdt_load(GDT_KERNEL_DATA);
+}
+
+/* a small byte-granular data segment over one cpu_t, loaded into %gs */
+void gdt_set_percpu(u32 cpu, u32 base) {
+    gdt_set(GDT_PERCPU_FIRST + cpu, base, sizeof(cpu_t) - 1, 0x92, 0x40);
+}
+
+/* 32-bit available TSS; only ss0/esp0 are used, for the way in from ring 3 */
+void gdt_set_tss(u32 cpu, u32 base) {
+    gdt_set(GDT_TSS_FIRST + cpu, base, sizeof(tss_t) - 1, 0x89, 0x00);
+}
+
+/* run on each CPU once its per-CPU segment and TSS are filled in */
+void gdt_load_cpu(u32 cpu) {
+    gdt_load(GDT_PERCPU(cpu));
+    __asm__ volatile ("ltr %w0" : : "r"(GDT_TSS(cpu)));
+}
@@ -0,0 +1,179 @@
+#include "kernel.h"
+#include "idt.h"
+#include "smp.h"
+#include "vmm.h"
+
+#define IDT_ENTRIES   256
+#define ISR_STUBS     (VEC_LOCAL_BASE + VEC_LOCAL_COUNT)
+
+#define PIC1_CMD      0x20
+#define PIC1_DATA     0x21
+#define PIC2_CMD      0xA0
+#define PIC2_DATA     0xA1
+#define PIC_EOI       0x20
+
+typedef struct {
+    u16 offset_low;
+    u16 selector;
+    u8  zero;
+    u8  type_attr;
+    u16 offset_high;
+} __attribute__((packed)) idt_entry_t;
+
+typedef struct {
+    u16 limit;
+    u32 base;
+} __attribute__((packed)) idt_ptr_t;
+
+static idt_entry_t   idt[IDT_ENTRIES];
+static idt_ptr_t     idt_ptr;
+static irq_handler_t irq_handlers[IRQ_COUNT];
+static irq_handler_t local_handlers[VEC_LOCAL_COUNT];
+
+/* boot/isr.asm */
+extern u32 isr_stub_table[ISR_STUBS];
+extern void isr_spurious(void);
+extern void isr_syscall(void);
+
+static const char* exception_names[32] = {
+    "divide error", "debug", "NMI", "breakpoint", "overflow",
+    "bound range", "invalid opcode", "device not available",
+    "double fault", "coprocessor overrun", "invalid TSS",
+    "segment not present", "stack fault", "general protection",
+    "page fault", "reserved", "x87 fault", "alignment check",
+    "machine check", "SIMD fault", "virtualization", "control protection",
+    "reserved", "reserved", "reserved", "reserved", "reserved", "reserved",
+    "hypervisor injection", "VMM communication", "security", "reserved"
+};
+
+static void idt_set(int n, u32 handler, u8 type_attr) {
+    idt[n].offset_low  = handler & 0xFFFF;
+    idt[n].selector    = GDT_KERNEL_CODE;
+    idt[n].zero        = 0;
+    idt[n].type_attr   = type_attr;
+    idt[n].offset_high = (handler >> 16) & 0xFFFF;
+}
+
+/* move the master/slave 8259s to vectors 32-47 so they stop
+ * colliding with CPU exceptions, and start with every line masked */
+static void pic_remap(void) {
+    outb(PIC1_CMD, 0x11);  io_wait();
+    outb(PIC2_CMD, 0x11);  io_wait();
+    outb(PIC1_DATA, IRQ_BASE);      io_wait();
+    outb(PIC2_DATA, IRQ_BASE + 8);  io_wait();
+    outb(PIC1_DATA, 0x04); io_wait();   /* slave on IRQ2 */
+    outb(PIC2_DATA, 0x02); io_wait();
+    outb(PIC1_DATA, 0x01); io_wait();   /* 8086 mode */
+    outb(PIC2_DATA, 0x01); io_wait();
+
+    outb(PIC1_DATA, 0xFB);              /* all masked except cascade */
+    outb(PIC2_DATA, 0xFF);
+}
+
+static void pic_eoi(u8 irq) {
+    if (irq >= 8) outb(PIC2_CMD, PIC_EOI);
+    outb(PIC1_CMD, PIC_EOI);
+}
+
+void irq_unmask(u8 irq) {
+    u16 port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    if (irq >= 8) irq -= 8;
+    outb(port, inb(port) & ~(1 << irq));
+}
+
+void irq_mask(u8 irq) {
+    u16 port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    if (irq >= 8) irq -= 8;
+    outb(port, inb(port) | (1 << irq));
+}
+
+void irq_register(u8 irq, irq_handler_t handler) {
+    if (irq >= IRQ_COUNT) return;
+    irq_handlers[irq] = handler;
+    irq_unmask(irq);
+}
+
+/* vectors raised by this CPU's local APIC rather than the PIC */
+void local_vector_register(u8 vector, irq_handler_t handler) {
+    if (vector < VEC_LOCAL_BASE || vector >= VEC_LOCAL_BASE + VEC_LOCAL_COUNT) return;
+    local_handlers[vector - VEC_LOCAL_BASE] = handler;
+}
+
+void idt_init(void) {
+    memset(idt, 0, sizeof(idt));
+    memset(irq_handlers, 0, sizeof(irq_handlers));
+    memset(local_handlers, 0, sizeof(local_handlers));
+
+    for (int i = 0; i < ISR_STUBS; i++)
+        idt_set(i, isr_stub_table[i], 0x8E);   /* present, ring 0, 32-bit interrupt gate */
+    idt_set(VEC_SPURIOUS, (u32)isr_spurious, 0x8E);
+    idt_set(VEC_SYSCALL, (u32)isr_syscall, 0xEE);    /* DPL 3 */
+
+    pic_remap();
+
+    idt_ptr.limit = sizeof(idt) - 1;
+    idt_ptr.base  = (u32)&idt;
+    idt_load();
+}
+
+/* the table is shared, every CPU just points its IDTR at it */
+void idt_load(void) {
+    __asm__ volatile ("lidt %0" : : "m"(idt_ptr));
+}
+
+static void exception_panic(regs_t* r) {
+    char buf[96];
+    vga_write("\n*** kernel panic: ", COLOUR_DEBUG_FATAL_ERROR);
+    vga_write(exception_names[r->int_no], COLOUR_DEBUG_FATAL_ERROR);
+    snprintf(buf, sizeof(buf), " (vector %u, err %x)\n", r->int_no, r->err_code);
+    vga_write(buf, COLOUR_DEBUG_FATAL_ERROR);
+    snprintf(buf, sizeof(buf), "eip=%x cs=%x eflags=%x pid=%u\n",
+             r->eip, r->cs, r->eflags, proc_get_pid());
+    vga_write(buf, COLOUR_DEBUG_FATAL_ERROR);
+    snprintf(buf, sizeof(buf), "eax=%x ebx=%x ecx=%x edx=%x\n",
+             r->eax, r->ebx, r->ecx, r->edx);
+    vga_write(buf, COLOUR_DEBUG_FATAL_ERROR);
+    interrupts_disable();
+    khang();
+}
+
+/* a fault in user code only takes that task down */
+static void exception_kill(regs_t* r) {
+    char buf[96];
+    snprintf(buf, sizeof(buf), "pid %u: %s at eip %x (err %x), killed\n",
+             proc_get_pid(), exception_names[r->int_no], r->eip, r->err_code);
+    vga_write(buf, COLOUR_LIGHT_RED);
+    proc_exit(128 + (int)r->int_no);
+}
+
+void isr_dispatch(regs_t* r) {
+    if (r->int_no < IRQ_BASE) {
+        if (r->int_no == 14 && page_fault(r) == 0) return;
+        if (r->cs & 3) exception_kill(r);
+        exception_panic(r);
+        return;
+    }
+
+    if (r->int_no == VEC_SYSCALL) {
+        syscall_handle(r);
+        preempt_schedule_irq();
+        return;
+    }
+
+    if (r->int_no >= VEC_LOCAL_BASE) {
+        lapic_eoi();
+        u32 v = r->int_no - VEC_LOCAL_BASE;
+        if (v < VEC_LOCAL_COUNT && local_handlers[v]) local_handlers[v](r);
+        preempt_schedule_irq();
+        return;
+    }
+
+    u8 irq = (u8)(r->int_no - IRQ_BASE);
+    if (irq >= IRQ_COUNT) return;
+
+    /* acknowledge first: the handler may switch to another task
+     * and we must not leave the PIC blocked until we come back */
+    pic_eoi(irq);
+    if (irq_handlers[irq]) irq_handlers[irq](r);
+    preempt_schedule_irq();
+}
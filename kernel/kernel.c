@@ -1,4 +1,9 @@
 #include "kernel.h"
+#include "idt.h"
+#include "smp.h"
+#include "vmm.h"
+#include "futex.h"
+#include "pci.h"
 
 u32 system_uptime = 0;
 
@@ -44,17 +49,39 @@ static void print_boot_banner(void) {
 
 __attribute__((force_align_arg_pointer))
 void kmain(unsigned int magic, unsigned int mb_info_addr) {
-    (void)magic;
-    (void)mb_info_addr;
+    /* multiboot info: flags bit 0 says mem_lower/mem_upper are valid */
+    u32 mem_upper_kb = 0;
+    if (magic == 0x2BADB002 && (*(u32*)mb_info_addr & 1))
+        mem_upper_kb = *(u32*)(mb_info_addr + 8);
 
     mem_init();
     print_boot_banner();
     vga_write("[    0.001] memory initialized\n",    COLOUR_LIGHT_GRAY);
 
+    gdt_init();
+    smp_early_init();
+    idt_init();
+    syscall_init();
+    fd_init();
+    futex_init();
+    tsc_calibrate();
+    vga_write("[    0.002] gdt/idt installed\n",    COLOUR_LIGHT_GRAY);
+
+    vmm_init(mem_upper_kb);
+    char vm_msg[64];
+    snprintf(vm_msg, sizeof(vm_msg), "[    0.003] paging on, %u free page frames\n",
+             page_free_count());
+    vga_write(vm_msg, COLOUR_LIGHT_GRAY);
+
+    pci_init();
+    snprintf(vm_msg, sizeof(vm_msg), "[    0.004] pci: %d devices\n", pci_count());
+    vga_write(vm_msg, COLOUR_LIGHT_GRAY);
+
     fs_init();
     vga_write("[    0.020] filesystem mounted\n",    COLOUR_LIGHT_GRAY);
 
     init_write_sysfiles();
+    userbin_install();
     vga_write("[    0.025] system files written\n",  COLOUR_LIGHT_GRAY);
 
     vfs_init();
@@ -67,8 +94,22 @@ void kmain(unsigned int magic, unsigned int mb_info_addr) {
     vga_write("[    0.040] tty initialized\n",       COLOUR_LIGHT_GRAY);
 
     proc_init();
+    pci_start();
     vga_write("[    0.045] process table ready\n",   COLOUR_LIGHT_GRAY);
 
+    timer_init();
+    vvar_init();
+    interrupts_enable();
+    vga_write("[    0.047] timer running, preemption on\n", COLOUR_LIGHT_GRAY);
+
+    smp_init();
+    char smp_msg[48];
+    snprintf(smp_msg, sizeof(smp_msg), "[    0.048] smp: %u cpus online\n", nr_cpus);
+    vga_write(smp_msg, COLOUR_LIGHT_GRAY);
+
+    keyboard_init();
+    vga_write("[    0.049] keyboard on irq 1\n",    COLOUR_LIGHT_GRAY);
+
     plugins_init();
     vga_write("[    0.050] plugins loaded\n",        COLOUR_LIGHT_GRAY);
 
@@ -1,5 +1,7 @@
 #include "kernel.h"
+#include "idt.h"
 #include "tty.h"
+#include "wait.h"
 
 #define KEY_LEFT_VAL   -30
 #define KEY_RIGHT_VAL  -31
@@ -16,11 +18,23 @@
 #define I8042_SR_OBF  0x01   /* output buffer full  */
 #define I8042_SR_IBF  0x02   /* input  buffer full  */
 
+#define KB_POLL_SPINS  1000   /* status polls before sleeping a tick */
+#define KB_TIMEOUT     (TIMER_HZ / 10)   /* ticks */
+#define KB_SPIN_LIMIT  100000 /* polls, when we cannot sleep */
+
+#define KB_RING_SIZE   64     /* power of two */
+
 static int shift_pressed = 0;
 static int caps_lock     = 0;
 static int ctrl_pressed  = 0;
 static int alt_pressed   = 0;
 
+/* raw scancodes from IRQ1, drained by read_key() */
+static u8            kb_ring[KB_RING_SIZE];
+static volatile u32  kb_head, kb_tail;
+static wait_queue_t  kb_wait = WAIT_QUEUE_INIT;
+static int           kb_irq_on;
+
 /* US QWERTY keymaps */
 static const char keymap_normal[128] = {
     0,   0,  '1','2','3','4','5','6','7','8','9','0','-','=','\b',
@@ -38,20 +52,41 @@ static const char keymap_shift[128] = {
     '*', 0, ' ', 0
 };
 
-static void kb_wait_write(void) {
-    int t = 100000;
-    while (--t && (inb(I8042_STATUS) & I8042_SR_IBF));
-}
-static void kb_wait_read(void) {
-    int t = 100000;
-    while (--t && !(inb(I8042_STATUS) & I8042_SR_OBF));
+/* the controller is slow next to the CPU but fast next to a timer tick:
+ * poll a little, then sleep a tick between polls rather than spin. with
+ * interrupts off no tick comes, so only poll, as long as we always did */
+static void kb_wait_status(u8 mask, u8 want) {
+    int can_sleep = irqs_enabled();
+    int limit = can_sleep ? KB_POLL_SPINS + KB_TIMEOUT : KB_SPIN_LIMIT;
+    for (int i = 0; i < limit; i++) {
+        if ((inb(I8042_STATUS) & mask) == want) return;
+        if (can_sleep && i >= KB_POLL_SPINS) proc_sleep(1);
+    }
 }
+
+static void kb_wait_write(void) { kb_wait_status(I8042_SR_IBF, 0); }
+static void kb_wait_read(void)  { kb_wait_status(I8042_SR_OBF, I8042_SR_OBF); }
 static void kb_flush(void) {
     int t = 32;
     while (--t && (inb(I8042_STATUS) & I8042_SR_OBF))
         inb(I8042_DATA);
 }
 
+static void kb_irq(regs_t* r) {
+    (void)r;
+    while (inb(I8042_STATUS) & I8042_SR_OBF) {
+        u8 sc = inb(I8042_DATA);
+        if (kb_head - kb_tail < KB_RING_SIZE) {   /* full: drop */
+            kb_ring[kb_head & (KB_RING_SIZE - 1)] = sc;
+            kb_head++;
+        }
+    }
+    wake_up(&kb_wait);
+}
+
+/* switch the controller to interrupt mode; readers block in read_key()
+ * until IRQ1 fills the ring. called once interrupts are on, so the
+ * controller handshakes can sleep */
 void keyboard_init(void) {
     kb_wait_write(); outb(I8042_CMD, 0xAD);  /* disable port 1 */
     kb_wait_write(); outb(I8042_CMD, 0xA7);  /* disable port 2 (if any) */
@@ -63,31 +98,39 @@ void keyboard_init(void) {
     u8 cfg = inb(I8042_DATA);
 
     cfg |=  0x01;   /* enable keyboard interrupt */
-    cfg &= ~0x40;   /* disable scan-code translation (keep set-1 raw) */
+    cfg &= ~0x02;   /* no mouse interrupt */
+    cfg |=  0x40;   /* translate to set 1, which the keymaps are */
 
     kb_wait_write(); outb(I8042_CMD, 0x60);
     kb_wait_write(); outb(I8042_DATA, cfg);
 
-    kb_wait_write(); outb(I8042_CMD, 0xAE);
+    kb_wait_write(); outb(I8042_CMD, 0xAE);  /* enable port 1 */
 
-    kb_wait_write(); outb(I8042_DATA, 0xF0);   /* set scan-code set */
-    kb_wait_read();  inb(I8042_DATA);           /* ACK */
-    kb_wait_write(); outb(I8042_DATA, 0x01);   /* set 1 */
-    kb_wait_read();  inb(I8042_DATA);           /* ACK */
-
-    kb_wait_write(); outb(I8042_DATA, 0xF4);
-    kb_wait_read();  inb(I8042_DATA);           /* ACK */
+    kb_irq_on = 1;
+    irq_register(IRQ_KEYBOARD, kb_irq);
 }
 
 int key_available(void) {
+    if (kb_irq_on) return kb_head != kb_tail;
     return (int)(inb(I8042_STATUS) & I8042_SR_OBF);
 }
 
+/* next raw scancode, sleeping on kb_wait until there is one */
+static u8 kb_getsc(void) {
+    if (!kb_irq_on) {
+        while (!key_available()) proc_sleep(1);
+        return inb(I8042_DATA);
+    }
+    wait_event(&kb_wait, kb_head != kb_tail);
+    u8 sc = kb_ring[kb_tail & (KB_RING_SIZE - 1)];
+    kb_tail++;
+    return sc;
+}
+
 int read_key(void) {
     while (1) {
-        while (!key_available()) { /* spin */ }
-
-        u8 sc = inb(I8042_DATA);
+        /* blocking here also earns the shell its interactive boost */
+        u8 sc = kb_getsc();
 
         /* key release */
         if (sc & 0x80) {
@@ -100,9 +143,7 @@ int read_key(void) {
 
         /* extended scan-code prefix (E0 xx) */
         if (sc == 0xE0) {
-            /* wait for the second byte */
-            while (!key_available()) { /* spin */ }
-            u8 ext = inb(I8042_DATA);
+            u8 ext = kb_getsc();   /* second byte */
             if (ext & 0x80) continue;   /* release of extended key — ignore */
             switch (ext) {
                 case 0x48: return KEY_UP_VAL;
@@ -0,0 +1,119 @@
+#include "kernel.h"
+#include "smp.h"
+#include "wait.h"
+
+/* ---------------------------------------------------------------
+ * latency: cyclictest for this kernel. high-priority threads sleep a
+ * tick at a time and time each wakeup from the moment the timer
+ * hardware expired (cpu_t.tick_tsc, back-dated by the tick handlers)
+ * to running again. that covers interrupts held off, the tick itself
+ * and the switch in, so a long non-preemptible stretch anywhere in
+ * the kernel shows up in the max column.
+ * --------------------------------------------------------------- */
+#define LAT_BUCKETS       16      /* <1 us, 1, 2-3, 4-7, ... */
+#define LAT_DEFAULT_LOOPS 200
+#define LAT_MAX_LOOPS     100000
+#define LAT_BAR           40
+
+typedef struct {
+    u32 hist[LAT_BUCKETS];
+    u32 samples;
+    u32 cpu;                /* where it ended up */
+    u64 sum, min, max;      /* TSC cycles */
+} lat_stat_t;
+
+static lat_stat_t   lat_stat[MAX_CPUS];
+static u32          lat_loops;
+static completion_t lat_done;
+
+static u32 lat_bucket(u32 us) {
+    u32 b = us ? 32 - (u32)__builtin_clz(us) : 0;
+    return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+static void lat_thread(void* arg) {
+    lat_stat_t* st = &lat_stat[(u32)arg];
+    process_t* self = get_current();
+
+    proc_sleep(1);          /* start out lined up with a tick */
+    for (u32 i = 0; i < lat_loops; i++) {
+        proc_sleep(1);
+        u64 now = rdtsc();
+        u64 lat = now > self->wake_tsc ? now - self->wake_tsc : 0;
+        st->samples++;
+        st->sum += lat;
+        if (lat < st->min) st->min = lat;
+        if (lat > st->max) st->max = lat;
+        st->hist[lat_bucket((u32)tsc_to_us(lat))]++;
+    }
+    st->cpu = self->cpu;
+    complete(&lat_done);
+}
+
+static void lat_histogram(void) {
+    u32 hist[LAT_BUCKETS];
+    u32 peak = 1;
+    memset(hist, 0, sizeof(hist));
+    for (u32 t = 0; t < MAX_CPUS; t++)
+        for (u32 b = 0; b < LAT_BUCKETS; b++) hist[b] += lat_stat[t].hist[b];
+    for (u32 b = 0; b < LAT_BUCKETS; b++)
+        if (hist[b] > peak) peak = hist[b];
+
+    char buf[96];
+    char label[16];
+    char bar[LAT_BAR + 1];
+    vga_write("         us    count\n", COLOUR_YELLOW);
+    for (u32 b = 0; b < LAT_BUCKETS; b++) {
+        if (!hist[b]) continue;
+        if (b == 0)                    snprintf(label, sizeof(label), "<1");
+        else if (b == LAT_BUCKETS - 1) snprintf(label, sizeof(label), "%u+", 1u << (b - 1));
+        else snprintf(label, sizeof(label), "%u-%u", 1u << (b - 1), (1u << b) - 1);
+        u32 len = (u32)div64_u32((u64)hist[b] * LAT_BAR + peak - 1, peak);
+        memset(bar, '#', len);
+        bar[len] = '\0';
+        snprintf(buf, sizeof(buf), "%11s %8u %s\n", label, hist[b], bar);
+        vga_write(buf, COLOUR_WHITE);
+    }
+}
+
+void latency_run(int argc, char** argv) {
+    int loops   = argc > 1 ? atoi(argv[1]) : LAT_DEFAULT_LOOPS;
+    int threads = argc > 2 ? atoi(argv[2]) : (int)nr_cpus;
+    if (loops < 1) loops = 1;
+    if (loops > LAT_MAX_LOOPS) loops = LAT_MAX_LOOPS;
+    if (threads < 1) threads = 1;
+    if (threads > MAX_CPUS) threads = MAX_CPUS;
+
+    memset(lat_stat, 0, sizeof(lat_stat));
+    for (int i = 0; i < MAX_CPUS; i++) lat_stat[i].min = ~0ULL;
+    init_completion(&lat_done);
+    lat_loops = (u32)loops;
+
+    char buf[96];
+    snprintf(buf, sizeof(buf), "latency: %d threads, %d wakeups each at %u Hz\n",
+             threads, loops, TIMER_HZ);
+    vga_write(buf, COLOUR_WHITE);
+
+    int created = 0;
+    for (; created < threads; created++) {
+        int pid = kthread_create("cyclic", lat_thread, (void*)created);
+        if (pid < 0) break;
+        proc_set_nice((u32)pid, NICE_MIN);
+    }
+    if (created == 0) {
+        vga_write("latency: cannot create threads\n", COLOUR_LIGHT_RED);
+        return;
+    }
+    for (int i = 0; i < created; i++) wait_for_completion(&lat_done);
+
+    vga_write("thread cpu samples   min us   avg us   max us\n", COLOUR_YELLOW);
+    for (int i = 0; i < created; i++) {
+        lat_stat_t* st = &lat_stat[i];
+        u64 avg = st->samples ? div64_u32(st->sum, st->samples) : 0;
+        snprintf(buf, sizeof(buf), "%6d %3u %7u %8u %8u %8u\n",
+                 i, st->cpu, st->samples, (u32)tsc_to_us(st->min),
+                 (u32)tsc_to_us(avg), (u32)tsc_to_us(st->max));
+        vga_write(buf, COLOUR_WHITE);
+    }
+    lat_histogram();
+}
@@ -0,0 +1,70 @@
+#include "kernel.h"
+#include "spinlock.h"
+
+/* boot/linker.ld: every DEFINE_LOCK_CLASS lands between these */
+extern lock_class_t __lock_classes_start[];
+extern lock_class_t __lock_classes_end[];
+
+void lock_stat_contended(lock_class_t* c, u64 cycles) {
+    lock_stat_t* s = &c->stat[this_cpu_id()];
+    s->contentions++;
+    s->spin_cycles += cycles;
+    if (cycles > s->max_spin) s->max_spin = cycles;
+}
+
+void spin_lock_slow(spinlock_t* l) {
+    u64 start = rdtsc();
+    do {
+        while (l->locked) cpu_relax();
+    } while (__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE));
+    lock_stat_contended(l->cls, rdtsc() - start);
+}
+
+void ticket_lock_slow(ticket_lock_t* l, u16 ticket) {
+    u64 start = rdtsc();
+    while ((u16)l->val != ticket) cpu_relax();
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    lock_stat_contended(l->cls, rdtsc() - start);
+}
+
+void mcs_lock_slow(mcs_lock_t* l, mcs_node_t* node, mcs_node_t* prev) {
+    u64 start = rdtsc();
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) cpu_relax();
+    lock_stat_contended(l->cls, rdtsc() - start);
+}
+
+/* a successor swapped itself into the tail but has not linked itself to
+ * us yet; wait for the link, then hand over */
+void mcs_unlock_slow(mcs_node_t* node) {
+    mcs_node_t* next;
+    while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))) cpu_relax();
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+void lockstat_show(void) {
+    char buf[112];
+    vga_write("class         type      acquired  contended     %  avg wait ns  max wait ns\n",
+              COLOUR_YELLOW);
+    for (lock_class_t* c = __lock_classes_start; c < __lock_classes_end; c++) {
+        u32 acq = 0, con = 0;
+        u64 spin = 0, max = 0;
+        for (u32 i = 0; i < MAX_CPUS; i++) {
+            acq  += c->stat[i].acquisitions;
+            con  += c->stat[i].contentions;
+            spin += c->stat[i].spin_cycles;
+            if (c->stat[i].max_spin > max) max = c->stat[i].max_spin;
+        }
+        u32 pct = acq ? (u32)div64_u32((u64)con * 1000, acq) : 0;   /* x10 */
+        u32 avg = con ? (u32)tsc_to_ns(div64_u32(spin, con)) : 0;
+        snprintf(buf, sizeof(buf), "%-13s %-6s %11u %10u %3u.%u %12u %12u\n",
+                 c->name, c->type, acq, con, pct / 10, pct % 10,
+                 avg, (u32)tsc_to_ns(max));
+        vga_write(buf, COLOUR_WHITE);
+    }
+}
+
+void lockstat_reset(void) {
+    for (lock_class_t* c = __lock_classes_start; c < __lock_classes_end; c++)
+        memset(c->stat, 0, sizeof(c->stat));
+}
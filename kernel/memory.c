@@ -1,4 +1,5 @@
 #include "kernel.h"
+#include "spinlock.h"
 
 extern u8 _end;
 
@@ -17,6 +18,11 @@ typedef struct block {
 
 static block_t* heap_start = NULL;
 
+/* every CPU allocates through this one list, so it is the most
+ * contended lock we have: queue waiters instead of letting them fight */
+DEFINE_LOCK_CLASS(heap, "mcs");
+static mcs_lock_t heap_lock = MCS_LOCK_INIT(heap);
+
 /* align helper */
 static inline usize align_up(usize size) {
     return (size + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1);
@@ -45,7 +51,7 @@ void mem_init(void) {
     vga_write(buf, COLOUR_YELLOW);
 }
 
-void* kmalloc(usize size) {
+static void* heap_alloc(usize size) {
     if (size == 0 || heap_start == NULL)
         return NULL;
 
@@ -57,7 +63,6 @@ void* kmalloc(usize size) {
 
         if (current->magic != HEAP_MAGIC) {
             vga_write("kmalloc: heap corruption\n", COLOUR_RED);
-            heap_dump();
             return NULL;
         }
 
@@ -81,11 +86,13 @@ void* kmalloc(usize size) {
 
             current->free = 0;
 
+#ifdef HEAP_DEBUG
             char buf[64];
             snprintf(buf, sizeof(buf),
                      "kmalloc: %u bytes at %x\n",
                      (u32)size, (u32)(current + 1));
             vga_write(buf, COLOUR_LIGHT_GREEN);
+#endif
 
             return (void*)(current + 1);
         }
@@ -94,11 +101,10 @@ void* kmalloc(usize size) {
     }
 
     vga_write("kmalloc: out of memory\n", COLOUR_LIGHT_RED);
-    heap_dump();
     return NULL;
 }
 
-void kfree(void* ptr) {
+static void heap_free(void* ptr) {
     if (!ptr) return;
 
     block_t* block = ((block_t*)ptr) - 1;
@@ -110,10 +116,12 @@ void kfree(void* ptr) {
 
     block->free = 1;
 
+#ifdef HEAP_DEBUG
     char buf[64];
     snprintf(buf, sizeof(buf),
              "kfree: %x\n", (u32)ptr);
     vga_write(buf, COLOUR_LIGHT_BLUE);
+#endif
 
     /* coalesce forward */
     if (block->next && block->next->free) {
@@ -122,26 +130,67 @@ void kfree(void* ptr) {
     }
 }
 
+void* kmalloc(usize size) {
+    mcs_node_t node;
+    u32 flags = mcs_lock_irqsave(&heap_lock, &node);
+    void* p = heap_alloc(size);
+    mcs_unlock_irqrestore(&heap_lock, &node, flags);
+    if (!p && size && heap_start) heap_dump();
+    return p;
+}
+
+void kfree(void* ptr) {
+    mcs_node_t node;
+    u32 flags = mcs_lock_irqsave(&heap_lock, &node);
+    heap_free(ptr);
+    mcs_unlock_irqrestore(&heap_lock, &node, flags);
+}
+
+/* copy a batch of blocks out under the lock, print them with it
+ * dropped: a dump of a big heap is one long screenful of VGA writes
+ * and must not keep every allocator and interrupts off for all of it.
+ * the list is in address order, so each batch picks up at the first
+ * block past the last one printed */
+#define HEAP_DUMP_BATCH 16
+
 static void heap_dump(void) {
     vga_write("=== HEAP DUMP ===\n", COLOUR_YELLOW);
 
-    block_t* current = heap_start;
+    struct { u32 addr; u32 size; int free; } batch[HEAP_DUMP_BATCH];
+    u32 resume = 0;
     int i = 0;
 
-    while (current) {
+    while (1) {
+        mcs_node_t node;
+        int n = 0, corrupt = 0;
+        u32 flags = mcs_lock_irqsave(&heap_lock, &node);
+        block_t* current = heap_start;
+        while (current && (u32)current < resume && current->magic == HEAP_MAGIC)
+            current = current->next;
+        for (; current && n < HEAP_DUMP_BATCH; current = current->next) {
+            if (current->magic != HEAP_MAGIC) {
+                corrupt = 1;
+                break;
+            }
+            batch[n].addr = (u32)current;
+            batch[n].size = (u32)current->size;
+            batch[n].free = current->free;
+            n++;
+        }
+        resume = current ? (u32)current : 0;
+        mcs_unlock_irqrestore(&heap_lock, &node, flags);
 
-        if (current->magic != HEAP_MAGIC) {
+        char buf[64];
+        for (int j = 0; j < n; j++, i++) {
+            snprintf(buf, sizeof(buf),
+                     "block %d: addr=%x size=%u free=%d\n",
+                     i, batch[j].addr, batch[j].size, batch[j].free);
+            vga_write(buf, COLOUR_LIGHT_GRAY);
+        }
+        if (corrupt) {
             vga_write("HEAP CORRUPTION DETECTED\n", COLOUR_RED);
             return;
         }
-
-        char buf[64];
-        snprintf(buf, sizeof(buf),
-                 "block %d: addr=%x size=%u free=%d\n",
-                 i, (u32)current, (u32)current->size, current->free);
-        vga_write(buf, COLOUR_LIGHT_GRAY);
-
-        current = current->next;
-        i++;
+        if (!resume) return;
     }
 }
@@ -0,0 +1,210 @@
+#include "kernel.h"
+#include "vmm.h"
+#include "syscall.h"
+#include "ipc.h"
+
+/* the queues, named or on their way out. mq_list_lock covers the list
+ * and the names, each queue's own lock its slots. message bodies are
+ * copied or remapped with no lock held: buf may be a user address
+ * that faults */
+
+DEFINE_LOCK_CLASS(mq_list, "spin");
+DEFINE_LOCK_CLASS(mq, "spin");
+static spinlock_t mq_list_lock = SPINLOCK_INIT(mq_list);
+static mq_t*      mq_list;
+
+static mq_t* mq_find(const char* name) {
+    for (mq_t* q = mq_list; q; q = q->next)
+        if (q->linked && strcmp(q->name, name) == 0) return q;
+    return NULL;
+}
+
+static void mq_msg_free(mq_msg_t* m) {
+    for (u32 i = 0; i < m->npages; i++)
+        page_free(m->pages[i]);
+    kfree(m->data);
+}
+
+static void mq_free(mq_t* q) {
+    for (u32 i = q->head; i != q->tail; i++)
+        mq_msg_free(&q->msgs[i % q->depth]);
+    kfree(q->msgs);
+    kfree(q);
+}
+
+static mq_t* mq_alloc(const char* name, u32 depth) {
+    mq_t* q = (mq_t*)kmalloc(sizeof(mq_t));
+    if (!q) return NULL;
+    memset(q, 0, sizeof(mq_t));
+    q->msgs = (mq_msg_t*)kmalloc(depth * sizeof(mq_msg_t));
+    if (!q->msgs) {
+        kfree(q);
+        return NULL;
+    }
+    strncpy(q->name, name, IPC_NAME_MAX - 1);
+    spin_lock_init(&q->lock, &lock_class_mq);
+    wait_queue_init(&q->rd_wait);
+    wait_queue_init(&q->wr_wait);
+    q->depth  = depth;
+    q->refs   = 2;                      /* the name and the caller */
+    q->linked = 1;
+    return q;
+}
+
+/* the queue called name, created with room for depth messages (0: the
+ * default) if it does not exist and create is set; a reference for the
+ * caller */
+mq_t* mq_get(const char* name, u32 depth, int create) {
+    if (!name || !name[0] || strlen(name) >= IPC_NAME_MAX) return NULL;
+    if (depth == 0) depth = MQ_DEFAULT_DEPTH;
+    if (depth > MQ_MAX_DEPTH) return NULL;
+
+    u32 flags = spin_lock_irqsave(&mq_list_lock);
+    mq_t* q = mq_find(name);
+    if (q) __atomic_add_fetch(&q->refs, 1, __ATOMIC_RELAXED);
+    spin_unlock_irqrestore(&mq_list_lock, flags);
+    if (q || !create) return q;
+
+    mq_t* made = mq_alloc(name, depth);
+    if (!made) return NULL;
+    flags = spin_lock_irqsave(&mq_list_lock);
+    q = mq_find(name);
+    if (q) {
+        __atomic_add_fetch(&q->refs, 1, __ATOMIC_RELAXED);
+    } else {
+        made->next = mq_list;
+        mq_list    = made;
+    }
+    spin_unlock_irqrestore(&mq_list_lock, flags);
+    if (q) mq_free(made);               /* somebody else got there first */
+    return q ? q : made;
+}
+
+/* the last reference frees the queue and whatever is still in it */
+void mq_put(mq_t* q) {
+    if (__atomic_sub_fetch(&q->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    u32 flags = spin_lock_irqsave(&mq_list_lock);
+    mq_t** pq = &mq_list;
+    while (*pq && *pq != q) pq = &(*pq)->next;
+    if (*pq) *pq = q->next;
+    spin_unlock_irqrestore(&mq_list_lock, flags);
+    mq_free(q);
+}
+
+int mq_unlink(const char* name) {
+    u32 flags = spin_lock_irqsave(&mq_list_lock);
+    mq_t* q = mq_find(name);
+    if (q) q->linked = 0;
+    spin_unlock_irqrestore(&mq_list_lock, flags);
+    if (!q) return -1;
+    mq_put(q);
+    return 0;
+}
+
+/* queue m, waiting for a free slot first */
+static int mq_post(mq_t* q, mq_msg_t* m) {
+    for (;;) {
+        u32 flags = spin_lock_irqsave(&q->lock);
+        if (q->tail - q->head < q->depth) {
+            q->msgs[q->tail % q->depth] = *m;
+            q->tail++;
+            if (m->npages) q->gifted++;
+            else           q->copied++;
+            spin_unlock_irqrestore(&q->lock, flags);
+            wake_up(&q->rd_wait);
+            return (int)m->len;
+        }
+        spin_unlock_irqrestore(&q->lock, flags);
+        wait_event(&q->wr_wait, q->tail - q->head < q->depth);
+    }
+}
+
+int mq_send(mq_t* q, const void* buf, usize len) {
+    if (len > MQ_MAX_MSG) return -1;
+    mq_msg_t m;
+    memset(&m, 0, sizeof(m));
+    m.len  = (u32)len;
+    m.data = kmalloc(len ? len : 1);
+    if (!m.data) return -1;
+    memcpy(m.data, buf, len);
+    return mq_post(q, &m);
+}
+
+/* the pages at addr leave the caller's address space with the
+ * message; reading them again afterwards finds fresh zeroed ones */
+int mq_send_pages(mq_t* q, u32 addr, u32 npages) {
+    if (npages == 0 || npages > MQ_MAX_PAGES || !user_pages_ok(addr, npages)) return -1;
+    mq_msg_t m;
+    memset(&m, 0, sizeof(m));
+    for (; m.npages < npages; m.npages++) {
+        m.pages[m.npages] = user_take_page(addr + m.npages * PAGE_SIZE);
+        if (!m.pages[m.npages]) {
+            /* out of frames faulting one in: put back what we took */
+            for (u32 i = 0; i < m.npages; i++)
+                if (user_give_page(addr + i * PAGE_SIZE, m.pages[i]) < 0) page_free(m.pages[i]);
+            return -1;
+        }
+    }
+    m.len = npages * PAGE_SIZE;
+    return mq_post(q, &m);
+}
+
+/* the oldest message, waiting for one if need be. with remap set, a
+ * message that came as pages is mapped at buf when buf is page aligned
+ * private memory; otherwise, or if it came as a copy, it is copied.
+ * -1 without taking the message if it does not fit in len */
+int mq_receive(mq_t* q, void* buf, usize len, int remap) {
+    mq_msg_t m;
+    for (;;) {
+        wait_event(&q->rd_wait, q->tail != q->head);
+        u32 flags = spin_lock_irqsave(&q->lock);
+        if (q->tail != q->head) {
+            mq_msg_t* first = &q->msgs[q->head % q->depth];
+            if (first->len > len) {
+                spin_unlock_irqrestore(&q->lock, flags);
+                return -1;
+            }
+            m = *first;
+            q->head++;
+            spin_unlock_irqrestore(&q->lock, flags);
+            break;
+        }
+        spin_unlock_irqrestore(&q->lock, flags);
+    }
+    wake_up(&q->wr_wait);
+
+    if (!m.npages) {
+        memcpy(buf, m.data, m.len);
+        kfree(m.data);
+        return (int)m.len;
+    }
+    int map = remap && user_pages_ok((u32)buf, m.npages);
+    for (u32 i = 0; i < m.npages; i++) {
+        u8* dst = (u8*)buf + i * PAGE_SIZE;
+        if (map && user_give_page((u32)dst, m.pages[i]) == 0) continue;
+        memcpy(dst, (void*)m.pages[i], PAGE_SIZE);
+        page_free(m.pages[i]);
+    }
+    return (int)m.len;
+}
+
+u32 mq_count(mq_t* q) {
+    return q->tail - q->head;
+}
+
+/* formatted under the lock and printed after it, since fd may be a
+ * pipe that blocks */
+void mq_show(int fd) {
+    char* text = (char*)kmalloc(IPC_SHOW_MAX);
+    if (!text) return;
+    usize len = 0;
+    u32 flags = spin_lock_irqsave(&mq_list_lock);
+    for (mq_t* q = mq_list; q && len < IPC_SHOW_MAX - 1; q = q->next)
+        len += (usize)snprintf(text + len, IPC_SHOW_MAX - len, "  %-24s %4u/%-4u %5u %8u %8u%s\n",
+                               q->name, q->tail - q->head, q->depth, q->refs,
+                               q->copied, q->gifted, q->linked ? "" : "  unlinked");
+    spin_unlock_irqrestore(&mq_list_lock, flags);
+    fd_puts(fd, "  queue                     msgs/max  refs   copied   gifted\n", COLOUR_YELLOW);
+    if (len) fd_puts(fd, text, COLOUR_WHITE);
+    kfree(text);
+}
@@ -0,0 +1,434 @@
+#include "kernel.h"
+#include "vmm.h"
+#include "spinlock.h"
+#include "smp.h"
+#include "pci.h"
+#include "ata.h"
+#include "blk.h"
+#include "nvme.h"
+
+/* one I/O queue pair per CPU, each with its own lock: a CPU starting
+ * requests only touches its own SQ, and the tail doorbell is written
+ * once for everything the block layer handed over in one go (commit).
+ * completions come in on the one INTx line, so the interrupt looks at
+ * every CQ. as in AHCI, no lock is held across blk_end_request() */
+
+typedef struct nvme_queue {
+    nvme_cmd_t*          sq;
+    volatile nvme_cqe_t* cq;
+    volatile u32*        sq_db;
+    volatile u32*        cq_db;
+    u16                  qid;
+    u16                  sq_tail;
+    u16                  sq_rung;       /* sq_tail at the last doorbell */
+    u16                  cq_head;
+    u8                   phase;         /* what a new entry's phase bit is */
+    u32                  busy;          /* command ids in flight */
+    blk_request_t*       rq[NVME_QDEPTH];
+    u64*                 prps[NVME_QDEPTH];     /* a PRP list page per id */
+    spinlock_t           lock;
+} nvme_queue_t;
+
+typedef struct nvme_ctrl {
+    volatile u32*  regs;
+    u32            stride;              /* bytes between doorbells */
+    u32            timeout;             /* ms, CAP.TO */
+    nvme_queue_t   admin;
+    nvme_queue_t   io[MAX_CPUS];
+    u32            nio;
+    u32            nsid;
+    u8             vwc;                 /* a volatile write cache, which FLUSH empties */
+    char           model[41];
+    block_device_t blk;
+} nvme_ctrl_t;
+
+DEFINE_LOCK_CLASS(nvme_queue, "spin");
+static int nvme_nctrls;                 /* nvme0, nvme1, ... */
+
+#define REG(c, reg)   ((c)->regs[(reg) / 4])
+
+/* poll reg until (reg & mask) == want, up to ms */
+static int nvme_spin(volatile u32* reg, u32 mask, u32 want, u32 ms) {
+    u64 end = rdtsc() + (u64)ms * tsc_khz;
+    while ((*reg & mask) != want)
+        if (rdtsc() > end) return -1;
+    return 0;
+}
+
+/* ============================================================
+ * queues
+ * ============================================================ */
+
+static void nvme_queue_free(nvme_queue_t* q) {
+    for (u32 i = 0; i < NVME_QDEPTH; i++)
+        if (q->prps[i]) page_free((u32)q->prps[i]);
+    if (q->sq) page_free((u32)q->sq);
+    if (q->cq) page_free((u32)q->cq);
+    memset(q, 0, sizeof(*q));
+}
+
+/* a page each for the SQ and CQ, and a PRP list page per command id
+ * if it carries I/O */
+static int nvme_queue_init(nvme_ctrl_t* c, nvme_queue_t* q, u16 qid, int io) {
+    memset(q, 0, sizeof(*q));
+    q->sq = (nvme_cmd_t*)page_alloc();
+    q->cq = (volatile nvme_cqe_t*)page_alloc();
+    if (!q->sq || !q->cq) goto fail;
+    for (u32 i = 0; io && i < NVME_QDEPTH; i++)
+        if (!(q->prps[i] = (u64*)page_alloc())) goto fail;
+    q->qid   = qid;
+    q->phase = 1;
+    q->sq_db = c->regs + (NVME_DOORBELLS + 2u * qid * c->stride) / 4;
+    q->cq_db = c->regs + (NVME_DOORBELLS + (2u * qid + 1) * c->stride) / 4;
+    spin_lock_init(&q->lock, &lock_class_nvme_queue);
+    return 0;
+
+fail:
+    nvme_queue_free(q);
+    return -1;
+}
+
+/* queue a command; the controller sees it at the next nvme_ring() */
+static void nvme_push(nvme_queue_t* q, const nvme_cmd_t* cmd) {
+    memcpy(&q->sq[q->sq_tail], cmd, sizeof(*cmd));
+    q->sq_tail = (u16)((q->sq_tail + 1) % NVME_QSIZE);
+}
+
+static void nvme_ring(nvme_queue_t* q) {
+    if (q->sq_tail == q->sq_rung) return;
+    __sync_synchronize();               /* the commands out before the doorbell */
+    *q->sq_db  = q->sq_tail;
+    q->sq_rung = q->sq_tail;
+}
+
+/* the next completion, if the controller has written one */
+static volatile nvme_cqe_t* nvme_cqe(nvme_queue_t* q) {
+    volatile nvme_cqe_t* e = &q->cq[q->cq_head];
+    return (e->status & 1) == q->phase ? e : NULL;
+}
+
+static void nvme_cqe_pop(nvme_queue_t* q) {
+    if (++q->cq_head == NVME_QSIZE) {
+        q->cq_head = 0;
+        q->phase  ^= 1;
+    }
+}
+
+/* an admin command by polling, only at probe; 0 or -1, and the
+ * command's result dword in *result */
+static int nvme_admin(nvme_ctrl_t* c, nvme_cmd_t* cmd, u32* result) {
+    nvme_queue_t* q = &c->admin;
+    cmd->cid = q->sq_tail;
+    nvme_push(q, cmd);
+    nvme_ring(q);
+
+    u64 end = rdtsc() + (u64)c->timeout * tsc_khz;
+    volatile nvme_cqe_t* e;
+    while (!(e = nvme_cqe(q)))
+        if (rdtsc() > end) return -1;
+    u16 status = e->status >> 1;
+    if (result) *result = e->result;
+    nvme_cqe_pop(q);
+    *q->cq_db = q->cq_head;
+    return status ? -1 : 0;
+}
+
+static int nvme_identify(nvme_ctrl_t* c, u32 nsid, u32 cns, void* page) {
+    nvme_cmd_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADMIN_IDENTIFY;
+    cmd.nsid   = nsid;
+    cmd.prp1   = (u32)page;
+    cmd.cdw10  = cns;
+    return nvme_admin(c, &cmd, NULL);
+}
+
+/* the CQ first, since the SQ names it; both one page, physically
+ * contiguous, and the CQ on interrupt vector 0 (INTx) */
+static int nvme_create_pair(nvme_ctrl_t* c, nvme_queue_t* q) {
+    nvme_cmd_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADMIN_CREATE_CQ;
+    cmd.prp1   = (u32)q->cq;
+    cmd.cdw10  = (NVME_QSIZE - 1) << 16 | q->qid;
+    cmd.cdw11  = NVME_QUEUE_PHYS_CONTIG | NVME_CQ_IRQ_ENABLED;
+    if (nvme_admin(c, &cmd, NULL) < 0) return -1;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADMIN_CREATE_SQ;
+    cmd.prp1   = (u32)q->sq;
+    cmd.cdw10  = (NVME_QSIZE - 1) << 16 | q->qid;
+    cmd.cdw11  = (u32)q->qid << 16 | NVME_QUEUE_PHYS_CONTIG;
+    return nvme_admin(c, &cmd, NULL);
+}
+
+/* ============================================================
+ * I/O
+ * ============================================================ */
+
+/* the bios' pages as PRPs: the first straight into the command, the
+ * rest into the second or, past two, a list. only the first may start
+ * inside a page and only the last end inside one, unless the buffers
+ * run on from each other; the block layer keeps to that for us
+ * (dev->boundary) */
+static int nvme_prp_fill(nvme_cmd_t* cmd, u64* list, bio_t* bios) {
+    u32 n = 0, next = 0;
+    for (bio_t* b = bios; b; b = b->next) {
+        u32 a   = (u32)b->buf;
+        u32 end = a + b->count * ATA_SECTOR_SIZE;
+        if ((a & 3) || end > KERNEL_SPACE_END) return -1;
+        if (n && a == next) {
+            if (a & (PAGE_SIZE - 1)) a = (a & ~(PAGE_SIZE - 1)) + PAGE_SIZE;    /* listed already */
+        } else if (n && ((a | next) & (PAGE_SIZE - 1))) {
+            return -1;
+        }
+        for (; a < end; a = (a & ~(PAGE_SIZE - 1)) + PAGE_SIZE) {
+            if (n > NVME_PRPS) return -1;
+            if (n) list[n - 1] = a;
+            else cmd->prp1 = a;
+            n++;
+        }
+        next = end;
+    }
+    if (n == 2) cmd->prp2 = list[0];
+    else if (n > 2) cmd->prp2 = (u32)list;
+    return 0;
+}
+
+/* into this CPU's SQ; the doorbell waits for nvme_commit() */
+static int nvme_submit(block_device_t* dev, blk_request_t* rq) {
+    nvme_ctrl_t* c = (nvme_ctrl_t*)dev->driver_data;
+
+    /* no volatile cache: a write is on media when it completes */
+    if ((rq->flags & BIO_FLUSH) && !c->vwc) {
+        blk_end_request(dev, rq, 0);
+        return 0;
+    }
+
+    nvme_queue_t* q = &c->io[this_cpu_id() % c->nio];
+    u32 flags = spin_lock_irqsave(&q->lock);
+    u32 free  = ~q->busy;
+    if (!free) {
+        spin_unlock_irqrestore(&q->lock, flags);
+        return BLK_BUSY;
+    }
+    u32 cid = (u32)__builtin_ctz(free);
+
+    nvme_cmd_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cid  = (u16)cid;
+    cmd.nsid = c->nsid;
+    if (rq->flags & BIO_FLUSH) {
+        cmd.opcode = NVME_CMD_FLUSH;
+    } else {
+        if (nvme_prp_fill(&cmd, q->prps[cid], rq->bios) < 0) {
+            spin_unlock_irqrestore(&q->lock, flags);
+            return -1;
+        }
+        cmd.opcode = (rq->flags & BIO_WRITE) ? NVME_CMD_WRITE : NVME_CMD_READ;
+        cmd.cdw10  = rq->lba;
+        cmd.cdw12  = (rq->count - 1) | ((rq->flags & BLK_FUA) ? NVME_RW_FUA : 0);
+    }
+    nvme_push(q, &cmd);
+    q->rq[cid] = rq;
+    q->busy   |= 1u << cid;
+    spin_unlock_irqrestore(&q->lock, flags);
+    return 0;
+}
+
+/* the task may have moved CPU since it queued, so look at every SQ */
+static void nvme_commit(block_device_t* dev) {
+    nvme_ctrl_t* c = (nvme_ctrl_t*)dev->driver_data;
+    for (u32 i = 0; i < c->nio; i++) {
+        nvme_queue_t* q = &c->io[i];
+        u32 flags = spin_lock_irqsave(&q->lock);
+        nvme_ring(q);
+        spin_unlock_irqrestore(&q->lock, flags);
+    }
+}
+
+/* end whatever q's CQ holds, giving the entries back with one write
+ * of the head doorbell */
+static void nvme_reap(nvme_ctrl_t* c, nvme_queue_t* q) {
+    blk_request_t* done_rq[NVME_QDEPTH];
+    int            done_err[NVME_QDEPTH];
+    int n = 0;
+
+    u32 flags = spin_lock_irqsave(&q->lock);
+    volatile nvme_cqe_t* e;
+    while ((e = nvme_cqe(q))) {
+        u32 cid = e->cid;
+        if (cid < NVME_QDEPTH && (q->busy & (1u << cid))) {
+            q->busy      &= ~(1u << cid);
+            done_rq[n]    = q->rq[cid];
+            done_err[n++] = (e->status >> 1) ? -1 : 0;
+        }
+        nvme_cqe_pop(q);
+    }
+    if (n) *q->cq_db = q->cq_head;
+    spin_unlock_irqrestore(&q->lock, flags);
+
+    for (int i = 0; i < n; i++)
+        blk_end_request(&c->blk, done_rq[i], done_err[i]);
+}
+
+static void nvme_poll(block_device_t* dev) {
+    nvme_ctrl_t* c = (nvme_ctrl_t*)dev->driver_data;
+    for (u32 i = 0; i < c->nio; i++) nvme_reap(c, &c->io[i]);
+}
+
+static const blk_ops_t nvme_blk_ops = { nvme_submit, nvme_poll, 1, nvme_commit };
+
+static void nvme_irq(pci_dev_t* dev) {
+    nvme_poll(&((nvme_ctrl_t*)dev->driver_data)->blk);
+}
+
+/* ============================================================
+ * the controller
+ * ============================================================ */
+
+/* clear EN and wait for the controller to say it has stopped, which
+ * drops every queue; then the admin queue, and EN again */
+static int nvme_reset(nvme_ctrl_t* c) {
+    REG(c, NVME_CC) &= ~NVME_CC_EN;
+    if (nvme_spin(&REG(c, NVME_CSTS), NVME_CSTS_RDY, 0, c->timeout) < 0) return -1;
+
+    REG(c, NVME_AQA)     = (NVME_QSIZE - 1) << 16 | (NVME_QSIZE - 1);
+    REG(c, NVME_ASQ)     = (u32)c->admin.sq;
+    REG(c, NVME_ASQ + 4) = 0;
+    REG(c, NVME_ACQ)     = (u32)c->admin.cq;
+    REG(c, NVME_ACQ + 4) = 0;
+    REG(c, NVME_CC)      = NVME_CC_EN | NVME_CC_IOSQES | NVME_CC_IOCQES;
+    if (nvme_spin(&REG(c, NVME_CSTS), NVME_CSTS_RDY | NVME_CSTS_CFS, NVME_CSTS_RDY, c->timeout) < 0)
+        return -1;
+    return 0;
+}
+
+/* IDENTIFY the controller, then its first namespace we can use: one
+ * with 512-byte blocks and no metadata in them */
+static int nvme_identify_all(nvme_ctrl_t* c) {
+    u8* id = (u8*)page_alloc();
+    if (!id) return -1;
+    if (nvme_identify(c, 0, NVME_CNS_CONTROLLER, id) < 0) goto fail;
+
+    memcpy(c->model, id + 24, 40);
+    c->model[40] = '\0';
+    for (int i = 39; i >= 0 && c->model[i] == ' '; i--) c->model[i] = '\0';
+    c->vwc = id[525] & 1;
+
+    /* MDTS: the most one command moves, in minimum-size pages, as a
+     * power of two; 0 is no limit */
+    u32 mpsmin = NVME_CAP_MPSMIN(REG(c, NVME_CAP + 4));
+    c->blk.max_sectors = NVME_MAX_SECTORS;
+    if (id[77] && id[77] < 16) {
+        u32 mdts = (PAGE_SIZE << mpsmin) / ATA_SECTOR_SIZE << id[77];
+        if (mdts < c->blk.max_sectors) c->blk.max_sectors = mdts;
+    }
+
+    u32 nn = *(u32*)(id + 516);
+    for (u32 nsid = 1; nsid <= nn && nsid <= 16; nsid++) {
+        memset(id, 0, PAGE_SIZE);
+        if (nvme_identify(c, nsid, NVME_CNS_NAMESPACE, id) < 0) continue;
+        u32 nsze_lo = *(u32*)id, nsze_hi = *(u32*)(id + 4);
+        u32 lbaf    = *(u32*)(id + 128 + 4 * (id[26] & 0xF));
+        if ((!nsze_lo && !nsze_hi) || ((lbaf >> 16) & 0xFF) != 9 || (lbaf & 0xFFFF)) continue;
+        c->nsid        = nsid;
+        c->blk.sectors = nsze_hi ? 0xFFFFFFFF : nsze_lo;
+        break;
+    }
+    page_free((u32)id);
+    return c->nsid ? 0 : -1;
+
+fail:
+    page_free((u32)id);
+    return -1;
+}
+
+/* a pair for every CPU the MADT lists, or as many as the controller
+ * gives; the APs are not up yet, so the MADT is all there is to go on */
+static u32 nvme_want_queues(void) {
+    u8  apic_ids[MAX_CPUS];
+    u32 lapic = LAPIC_DEFAULT;
+    int n = madt_parse(apic_ids, MAX_CPUS, &lapic);
+    return n > 0 ? (u32)n : 1;
+}
+
+static int nvme_setup_io(nvme_ctrl_t* c, u32 bar_size) {
+    u32 want = nvme_want_queues();
+    nvme_cmd_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADMIN_SET_FEATURES;
+    cmd.cdw10  = NVME_FEAT_NUM_QUEUES;
+    cmd.cdw11  = (want - 1) << 16 | (want - 1);
+    u32 got;
+    if (nvme_admin(c, &cmd, &got) < 0) return -1;
+    if ((got & 0xFFFF) + 1 < want) want = (got & 0xFFFF) + 1;
+    if ((got >> 16) + 1 < want) want = (got >> 16) + 1;
+
+    for (u32 i = 0; i < want; i++) {
+        if (NVME_DOORBELLS + (2 * (i + 1) + 2) * c->stride > bar_size) break;
+        if (nvme_queue_init(c, &c->io[i], (u16)(i + 1), 1) < 0) break;
+        if (nvme_create_pair(c, &c->io[i]) < 0) {
+            nvme_queue_free(&c->io[i]);
+            break;
+        }
+        c->nio++;
+    }
+    return c->nio ? 0 : -1;
+}
+
+static const pci_id_t nvme_ids[] = {
+    { PCI_ANY, PCI_ANY, PCI_CLASS_NVME, 0xFFFFFF },
+    { 0, 0, 0, 0 },
+};
+
+/* BAR0 has to be in the uncached window the kernel maps for MMIO */
+static int nvme_probe(pci_dev_t* dev, const pci_id_t* id) {
+    (void)id;
+    pci_bar_t* bar = &dev->bar[0];
+    if (bar->io || bar->size < NVME_DOORBELLS + 16 || bar->base < MMIO_BASE) return -1;
+
+    nvme_ctrl_t* c = (nvme_ctrl_t*)kmalloc(sizeof(nvme_ctrl_t));
+    if (!c) return -1;
+    memset(c, 0, sizeof(*c));
+    c->regs = (volatile u32*)bar->base;
+    pci_enable(dev, PCI_CMD_MEMORY | PCI_CMD_MASTER);
+
+    u32 cap_lo = REG(c, NVME_CAP), cap_hi = REG(c, NVME_CAP + 4);
+    c->stride  = 4u << NVME_CAP_DSTRD(cap_hi);
+    c->timeout = NVME_CAP_TO(cap_lo);
+    if (!c->timeout) c->timeout = NVME_TIMEOUT;
+    if (!NVME_CAP_CSS_NVM(cap_hi) || NVME_CAP_MPSMIN(cap_hi) || NVME_CAP_MQES(cap_lo) < NVME_QSIZE ||
+        nvme_queue_init(c, &c->admin, 0, 0) < 0) {
+        kfree(c);
+        return -1;
+    }
+    if (nvme_reset(c) < 0 || nvme_identify_all(c) < 0 || nvme_setup_io(c, bar->size) < 0) goto fail;
+
+    snprintf(c->blk.name, BLK_NAME_MAX, "nvme%un%u", nvme_nctrls++, c->nsid);
+    c->blk.depth       = NVME_QDEPTH;
+    c->blk.fua         = 1;
+    c->blk.boundary    = PAGE_SIZE - 1;
+    c->blk.ops         = &nvme_blk_ops;
+    c->blk.driver_data = c;
+    dev->driver_data   = c;
+    c->blk.polled      = pci_irq_register(dev, nvme_irq) < 0;
+    blk_register(&c->blk);
+
+    char line[112];
+    snprintf(line, sizeof(line), "nvme: %s: %s, %u MiB, %u queue pair%s, depth %u%s\n", c->blk.name,
+             c->model, c->blk.sectors / 2048, c->nio, c->nio == 1 ? "" : "s", c->blk.depth,
+             c->vwc ? ", write cache" : "");
+    kprint(line);
+    return 0;
+
+fail:
+    REG(c, NVME_CC) &= ~NVME_CC_EN;
+    nvme_spin(&REG(c, NVME_CSTS), NVME_CSTS_RDY, 0, c->timeout);
+    for (u32 i = 0; i < c->nio; i++) nvme_queue_free(&c->io[i]);
+    nvme_queue_free(&c->admin);
+    kfree(c);
+    return -1;
+}
+
+PCI_DRIVER(nvme, nvme_ids, nvme_probe);
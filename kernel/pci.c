@@ -0,0 +1,324 @@
+#include "kernel.h"
+#include "idt.h"
+#include "spinlock.h"
+#include "pci.h"
+
+/* config space goes through one address/data port pair shared by every
+ * CPU, so each access holds pci_lock across the two. the device table
+ * is filled once by pci_init() and only read after that */
+
+DEFINE_LOCK_CLASS(pci, "spin");
+static spinlock_t pci_lock = SPINLOCK_INIT(pci);
+
+extern const pci_driver_t __pci_drivers_start[];
+extern const pci_driver_t __pci_drivers_end[];
+
+static pci_dev_t pci_devs[PCI_MAX_DEVICES];
+static int       pci_ndevs;
+
+static u32 pci_address(u8 bus, u8 slot, u8 fn, u8 off) {
+    return 0x80000000u | (u32)bus << 16 | (u32)(slot & 31) << 11 | (u32)(fn & 7) << 8 | (off & 0xFC);
+}
+
+static u32 pci_cfg_read(u8 bus, u8 slot, u8 fn, u8 off) {
+    u32 flags = spin_lock_irqsave(&pci_lock);
+    outl(PCI_CONFIG_ADDR, pci_address(bus, slot, fn, off));
+    u32 v = inl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&pci_lock, flags);
+    return v;
+}
+
+static void pci_cfg_write(u8 bus, u8 slot, u8 fn, u8 off, u32 v) {
+    u32 flags = spin_lock_irqsave(&pci_lock);
+    outl(PCI_CONFIG_ADDR, pci_address(bus, slot, fn, off));
+    outl(PCI_CONFIG_DATA, v);
+    spin_unlock_irqrestore(&pci_lock, flags);
+}
+
+u32 pci_read32(pci_dev_t* d, u8 off) {
+    return pci_cfg_read(d->bus, d->slot, d->fn, off);
+}
+
+u16 pci_read16(pci_dev_t* d, u8 off) {
+    return (u16)(pci_read32(d, off) >> ((off & 2) * 8));
+}
+
+u8 pci_read8(pci_dev_t* d, u8 off) {
+    return (u8)(pci_read32(d, off) >> ((off & 3) * 8));
+}
+
+void pci_write32(pci_dev_t* d, u8 off, u32 v) {
+    pci_cfg_write(d->bus, d->slot, d->fn, off, v);
+}
+
+/* narrower writes are read-modify-write of the dword. that is wrong for
+ * registers with write-1-to-clear bits next door (STATUS beside
+ * COMMAND), so pci_enable() writes COMMAND with STATUS zeroed instead */
+void pci_write16(pci_dev_t* d, u8 off, u16 v) {
+    u32 shift = (off & 2) * 8;
+    u32 old   = pci_read32(d, off);
+    pci_write32(d, off, (old & ~(0xFFFFu << shift)) | (u32)v << shift);
+}
+
+void pci_write8(pci_dev_t* d, u8 off, u8 v) {
+    u32 shift = (off & 3) * 8;
+    u32 old   = pci_read32(d, off);
+    pci_write32(d, off, (old & ~(0xFFu << shift)) | (u32)v << shift);
+}
+
+void pci_enable(pci_dev_t* d, u16 cmd_bits) {
+    u16 cmd = pci_read16(d, PCI_COMMAND);
+    if ((cmd & cmd_bits) != cmd_bits)
+        pci_write32(d, PCI_COMMAND, (u32)(cmd | cmd_bits));
+}
+
+u8 pci_find_cap(pci_dev_t* d, u8 id) {
+    if (!(pci_read16(d, PCI_STATUS) & PCI_STATUS_CAPS)) return 0;
+    u8 off = pci_read8(d, PCI_CAP_PTR) & 0xFC;
+    for (int guard = 0; off && guard < 48; guard++) {
+        if (pci_read8(d, off) == id) return off;
+        off = pci_read8(d, off + 1) & 0xFC;
+    }
+    return 0;
+}
+
+/* ============================================================
+ * interrupts
+ * ============================================================ */
+
+/* INTx lines are level triggered and shared, so one handler per line
+ * runs every device's; each clears its own cause. registered at probe
+ * time, before anything can raise them */
+static struct {
+    pci_dev_t*        dev;
+    pci_irq_handler_t handler;
+} pci_irqs[IRQ_COUNT][PCI_IRQ_SHARE];
+
+static void pci_irq(regs_t* r) {
+    u32 irq = r->int_no - IRQ_BASE;
+    for (int i = 0; i < PCI_IRQ_SHARE && pci_irqs[irq][i].handler; i++)
+        pci_irqs[irq][i].handler(pci_irqs[irq][i].dev);
+}
+
+/* lines the ISA devices own: timer, keyboard, cascade, the IDE channels */
+#define PCI_IRQ_RESERVED ((1u << 0) | (1u << 1) | (1u << 2) | (1u << 14) | (1u << 15))
+
+int pci_irq_register(pci_dev_t* d, pci_irq_handler_t handler) {
+    u8 irq = d->irq_line;
+    if (!d->irq_pin || irq >= IRQ_COUNT || (PCI_IRQ_RESERVED & (1u << irq))) return -1;
+    for (int i = 0; i < PCI_IRQ_SHARE; i++) {
+        if (pci_irqs[irq][i].handler) continue;
+        pci_irqs[irq][i].dev     = d;
+        pci_irqs[irq][i].handler = handler;
+        pci_write32(d, PCI_COMMAND, pci_read16(d, PCI_COMMAND) & ~PCI_CMD_INTX_OFF);
+        if (i == 0) irq_register(irq, pci_irq);
+        return 0;
+    }
+    return -1;
+}
+
+int pci_count(void) {
+    return pci_ndevs;
+}
+
+pci_dev_t* pci_get(int index) {
+    return index >= 0 && index < pci_ndevs ? &pci_devs[index] : NULL;
+}
+
+/* ============================================================
+ * enumeration
+ * ============================================================ */
+
+/* a BAR's size is what it will not let us set: write all ones, see
+ * which address bits stick, put it back. decoding is off meanwhile so
+ * the device does not answer at the all-ones address */
+static void pci_size_bars(pci_dev_t* d) {
+    int nbars = d->header == 0 ? PCI_NR_BARS : d->header == 1 ? 2 : 0;
+    u16 cmd   = pci_read16(d, PCI_COMMAND);
+    pci_write32(d, PCI_COMMAND, cmd & ~(PCI_CMD_IO | PCI_CMD_MEMORY));
+
+    for (int i = 0; i < nbars; i++) {
+        u8  off  = (u8)(PCI_BAR0 + i * 4);
+        u32 orig = pci_read32(d, off);
+        pci_write32(d, off, 0xFFFFFFFF);
+        u32 mask = pci_read32(d, off);
+        pci_write32(d, off, orig);
+        if (mask == 0 || mask == 0xFFFFFFFF) continue;
+
+        pci_bar_t* b = &d->bar[i];
+        if (orig & 1) {
+            b->io   = 1;
+            b->base = orig & 0xFFFFFFFC;
+            b->size = (~(mask & 0xFFFFFFFC) + 1) & 0xFFFF;
+            continue;
+        }
+        b->prefetch = (orig >> 3) & 1;
+        b->base     = orig & 0xFFFFFFF0;
+        b->size     = ~(mask & 0xFFFFFFF0) + 1;
+        if (((orig >> 1) & 3) == 2 && i + 1 < nbars) {
+            /* 64-bit: the high half is the next BAR. we only reach the
+             * low 4 GiB, so a BAR placed above it is left at size 0 */
+            b->is64 = 1;
+            if (pci_read32(d, (u8)(off + 4))) b->size = 0;
+            i++;
+        }
+    }
+    pci_write32(d, PCI_COMMAND, cmd);
+}
+
+static void pci_scan_bus(u8 bus, int depth);
+
+static void pci_scan_fn(u8 bus, u8 slot, u8 fn, int depth) {
+    u32 id = pci_cfg_read(bus, slot, fn, PCI_VENDOR_ID);
+    if ((id & 0xFFFF) == 0xFFFF) return;
+
+    u32 classrev = pci_cfg_read(bus, slot, fn, PCI_REVISION);
+    u8  header   = (u8)(pci_cfg_read(bus, slot, fn, PCI_HEADER_TYPE) >> 16) & 0x7F;
+
+    if (pci_ndevs < PCI_MAX_DEVICES) {
+        pci_dev_t* d = &pci_devs[pci_ndevs++];
+        memset(d, 0, sizeof(*d));
+        d->bus      = bus;
+        d->slot     = slot;
+        d->fn       = fn;
+        d->vendor   = (u16)id;
+        d->device   = (u16)(id >> 16);
+        d->class    = classrev >> 8;
+        d->revision = (u8)classrev;
+        d->header   = header;
+        u32 irq     = pci_read32(d, PCI_INTERRUPT_LINE);
+        d->irq_line = (u8)irq;
+        d->irq_pin  = (u8)(irq >> 8);
+        pci_size_bars(d);
+    }
+
+    /* follow PCI-to-PCI bridges to the bus behind them */
+    if ((classrev >> 8) == PCI_CLASS_BRIDGE_PCI && header == 1 && depth < 8) {
+        u8 secondary = (u8)(pci_cfg_read(bus, slot, fn, PCI_SECONDARY_BUS) >> 8);
+        if (secondary > bus) pci_scan_bus(secondary, depth + 1);
+    }
+}
+
+static void pci_scan_bus(u8 bus, int depth) {
+    for (u8 slot = 0; slot < 32; slot++) {
+        u32 id = pci_cfg_read(bus, slot, 0, PCI_VENDOR_ID);
+        if ((id & 0xFFFF) == 0xFFFF) continue;
+        pci_scan_fn(bus, slot, 0, depth);
+        if (!(pci_cfg_read(bus, slot, 0, PCI_HEADER_TYPE) & 0x00800000)) continue;  /* multi-function */
+        for (u8 fn = 1; fn < 8; fn++)
+            pci_scan_fn(bus, slot, fn, depth);
+    }
+}
+
+/* ============================================================
+ * drivers
+ * ============================================================ */
+
+static const pci_id_t* pci_match(const pci_driver_t* drv, pci_dev_t* d) {
+    for (const pci_id_t* id = drv->ids; id && id->vendor; id++) {
+        if (id->vendor != PCI_ANY && id->vendor != d->vendor) continue;
+        if (id->device != PCI_ANY && id->device != d->device) continue;
+        if ((d->class & id->class_mask) != (id->class & id->class_mask)) continue;
+        return id;
+    }
+    return NULL;
+}
+
+static void pci_probe(pci_dev_t* d) {
+    for (const pci_driver_t* drv = __pci_drivers_start; drv < __pci_drivers_end; drv++) {
+        const pci_id_t* id = pci_match(drv, d);
+        if (id && drv->probe && drv->probe(d, id) == 0) {
+            d->driver = drv;
+            return;
+        }
+    }
+}
+
+void pci_init(void) {
+    /* mechanism #1 is there if the address port keeps what we write */
+    u32 flags = spin_lock_irqsave(&pci_lock);
+    u32 saved = inl(PCI_CONFIG_ADDR);
+    outl(PCI_CONFIG_ADDR, 0x80000000);
+    u32 back  = inl(PCI_CONFIG_ADDR);
+    outl(PCI_CONFIG_ADDR, saved);
+    spin_unlock_irqrestore(&pci_lock, flags);
+    if (back != 0x80000000) return;
+
+    pci_scan_bus(0, 0);
+    for (int i = 0; i < pci_ndevs; i++)
+        pci_probe(&pci_devs[i]);
+}
+
+void pci_start(void) {
+    for (int i = 0; i < pci_ndevs; i++) {
+        pci_dev_t* d = &pci_devs[i];
+        if (d->driver && d->driver->start) d->driver->start(d);
+    }
+}
+
+/* ============================================================
+ * lspci
+ * ============================================================ */
+
+static const struct {
+    u32         class;          /* class << 8 | subclass */
+    const char* name;
+} pci_class_names[] = {
+    { 0x0100, "SCSI storage controller" },
+    { 0x0101, "IDE interface" },
+    { 0x0105, "ATA controller" },
+    { 0x0106, "SATA controller" },
+    { 0x0108, "Non-volatile memory controller" },
+    { 0x0180, "Mass storage controller" },
+    { 0x0200, "Ethernet controller" },
+    { 0x0300, "VGA compatible controller" },
+    { 0x0401, "Multimedia audio controller" },
+    { 0x0403, "Audio device" },
+    { 0x0600, "Host bridge" },
+    { 0x0601, "ISA bridge" },
+    { 0x0604, "PCI bridge" },
+    { 0x0680, "Bridge" },
+    { 0x0C03, "USB controller" },
+    { 0x0C05, "SMBus" },
+    { 0x00FF, "Unclassified device" },
+};
+
+static const char* pci_class_name(u32 class) {
+    for (u32 i = 0; i < sizeof(pci_class_names) / sizeof(pci_class_names[0]); i++)
+        if (pci_class_names[i].class == class >> 8) return pci_class_names[i].name;
+    return "Device";
+}
+
+void pci_show(int fd, int verbose) {
+    char line[128];
+    for (int i = 0; i < pci_ndevs; i++) {
+        pci_dev_t* d = &pci_devs[i];
+        snprintf(line, sizeof(line), "%02x:%02x.%u ", d->bus, d->slot, d->fn);
+        fd_puts(fd, line, COLOUR_YELLOW);
+        snprintf(line, sizeof(line), "%s [%06x]: %04x:%04x (rev %02x)",
+                 pci_class_name(d->class), d->class, d->vendor, d->device, d->revision);
+        fd_puts(fd, line, COLOUR_WHITE);
+        if (d->driver) {
+            snprintf(line, sizeof(line), "  %s", d->driver->name);
+            fd_puts(fd, line, COLOUR_LIGHT_GREEN);
+        }
+        fd_puts(fd, "\n", COLOUR_WHITE);
+        if (!verbose) continue;
+
+        if (d->irq_pin) {
+            snprintf(line, sizeof(line), "        INT%c# -> irq %u\n",
+                     'A' + d->irq_pin - 1, d->irq_line);
+            fd_puts(fd, line, COLOUR_LIGHT_GRAY);
+        }
+        for (int b = 0; b < PCI_NR_BARS; b++) {
+            pci_bar_t* bar = &d->bar[b];
+            if (!bar->size) continue;
+            snprintf(line, sizeof(line), "        BAR%d: %s at %08x, %u %s%s%s\n", b,
+                     bar->io ? "I/O ports" : "memory", bar->base,
+                     bar->size >= 1024 ? bar->size / 1024 : bar->size,
+                     bar->size >= 1024 ? "KiB" : "bytes",
+                     bar->is64 ? ", 64-bit" : "", bar->prefetch ? ", prefetchable" : "");
+            fd_puts(fd, line, COLOUR_LIGHT_GRAY);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#include "kernel.h"
+#include "vmm.h"
+#include "pipe.h"
+
+/* data moves straight between the caller's buffer and the ring page,
+ * with no bounce buffer on either side. buf may be a user address;
+ * nothing here holds a lock while touching it */
+
+pipe_t* pipe_create(void) {
+    pipe_t* p = (pipe_t*)kmalloc(sizeof(pipe_t));
+    if (!p) return NULL;
+    memset(p, 0, sizeof(pipe_t));
+    u32 page = page_alloc();
+    if (!page) {
+        kfree(p);
+        return NULL;
+    }
+    p->buf     = (u8*)page;
+    p->readers = 1;
+    p->writers = 1;
+    p->refs    = 2;
+    wait_queue_init(&p->rd_wait);
+    wait_queue_init(&p->wr_wait);
+    return p;
+}
+
+/* whatever is there, up to count; blocks only while nothing is */
+int pipe_read(pipe_t* p, void* buf, usize count) {
+    if (count == 0) return 0;
+    wait_event(&p->rd_wait, p->head != p->tail || p->writers == 0);
+
+    u32 tail  = p->tail;
+    u32 avail = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE) - tail;
+    if (avail == 0) return 0;                       /* EOF */
+    u32 n   = count < avail ? (u32)count : avail;
+    u32 off = tail % PIPE_SIZE;
+    u32 first = n < PIPE_SIZE - off ? n : PIPE_SIZE - off;
+    memcpy(buf, p->buf + off, first);
+    memcpy((u8*)buf + first, p->buf, n - first);
+    __atomic_store_n(&p->tail, tail + n, __ATOMIC_RELEASE);
+    wake_up(&p->wr_wait);
+    return (int)n;
+}
+
+/* all of count unless the last reader goes away first */
+int pipe_write(pipe_t* p, const void* buf, usize count) {
+    usize done = 0;
+    while (done < count) {
+        wait_event(&p->wr_wait, p->head - p->tail < PIPE_SIZE || p->readers == 0);
+        if (p->readers == 0) return done ? (int)done : -1;
+
+        u32 head  = p->head;
+        u32 space = PIPE_SIZE - (head - __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE));
+        u32 n     = count - done < space ? (u32)(count - done) : space;
+        u32 off   = head % PIPE_SIZE;
+        u32 first = n < PIPE_SIZE - off ? n : PIPE_SIZE - off;
+        memcpy(p->buf + off, (const u8*)buf + done, first);
+        memcpy(p->buf, (const u8*)buf + done + first, n - first);
+        __atomic_store_n(&p->head, head + n, __ATOMIC_RELEASE);
+        wake_up(&p->rd_wait);
+        done += n;
+    }
+    return (int)done;
+}
+
+/* the last close of either kind wakes the other side; the last close
+ * of all frees the pipe. refs only drops once our wakeup is done, so
+ * the other side cannot free the pipe under it */
+void pipe_close(pipe_t* p, int write_end) {
+    if (write_end) {
+        if (__atomic_sub_fetch(&p->writers, 1, __ATOMIC_ACQ_REL) == 0)
+            wake_up_all(&p->rd_wait);
+    } else {
+        if (__atomic_sub_fetch(&p->readers, 1, __ATOMIC_ACQ_REL) == 0)
+            wake_up_all(&p->wr_wait);
+    }
+    if (__atomic_sub_fetch(&p->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        page_free((u32)p->buf);
+        kfree(p);
+    }
+}
+
+u32 pipe_count(pipe_t* p) {
+    return p->head - p->tail;
+}
@@ -1,106 +1,812 @@
 #include "kernel.h"
+#include "idt.h"
+#include "process.h"
+#include "smp.h"
+#include "vmm.h"
 extern u32 system_uptime;
-#define MAX_PROCESSES      32
-#define PROCESS_STACK_SIZE 4096
-#define TIME_SLICE         10
-typedef enum {
-    PROC_UNUSED,
-    PROC_READY,
-    PROC_RUNNING,
-    PROC_WAITING,
-    PROC_ZOMBIE
-} process_state_t;
-typedef struct {
-    u32            pid;
-    u32            ppid;
-    process_state_t state;
-    char           name[32];
-    u32            esp;
-    u32            ebp;
-    u32            eip;
-    u32            stack[PROCESS_STACK_SIZE / 4];
-    u32            time_used;
-    u32            priority;
-    u32            uid;
-    u32            gid;
-    u8             is_user;
-} process_t;
-static process_t processes[MAX_PROCESSES];
-static u32 current_pid = 0;
-static u32 next_pid    = 1;
+
+/* tasks are kmalloc'd on demand and found by pid through proc_table;
+ * pid_bitmap says which pids are taken so they can be handed out again.
+ * proc_lock covers both plus every task's ppid/detached/exit_code, and
+ * is taken before any run queue lock. */
+static process_t* proc_table[PID_MAX];
+static u32        pid_bitmap[PID_MAX / 32];
+static u32        last_pid;
+static u32        nr_tasks;
+
+DEFINE_LOCK_CLASS(proc_table, "ticket");
+DEFINE_LOCK_CLASS(runqueue, "ticket");
+static ticket_lock_t proc_lock = TICKET_LOCK_INIT(proc_table);
+
+/* boot/switch.asm */
+extern void switch_to(u32* prev_esp, u32 next_esp);
+
+static void finish_switch(void);
+static int  need_resched(cpu_t* cpu, process_t* cur);
+
+/* ---------------------------------------------------------------
+ * pid allocation and task lifetime
+ * --------------------------------------------------------------- */
+
+/* first free pid after the one handed out last, wrapping past PID_MAX,
+ * so a pid that was just freed is not reused straight away. whole words
+ * of the bitmap are skipped at a time. */
+static int pid_alloc(void) {
+    u32 pid = last_pid + 1;
+    for (u32 scanned = 0; scanned < PID_MAX + 32; ) {
+        if (pid >= PID_MAX) pid = 1;     /* pid 0 is idle's for good */
+        u32 word = pid_bitmap[pid / 32] | ((1u << (pid % 32)) - 1);
+        if (word != 0xFFFFFFFF) {
+            pid = (pid & ~31u) + (u32)__builtin_ctz(~word);
+            pid_bitmap[pid / 32] |= 1u << (pid % 32);
+            last_pid = pid;
+            return (int)pid;
+        }
+        scanned += 32 - pid % 32;
+        pid = (pid | 31) + 1;
+    }
+    return -1;
+}
+
+static void pid_free(u32 pid) {
+    pid_bitmap[pid / 32] &= ~(1u << (pid % 32));
+}
+
+static process_t* proc_lookup(u32 pid) {
+    return pid < PID_MAX ? proc_table[pid] : NULL;
+}
+
+static process_t* proc_alloc(const char* name) {
+    process_t* p = kmalloc(sizeof(process_t));
+    if (!p) return NULL;
+    memset(p, 0, sizeof(process_t));
+
+    p->stack = kmalloc(PROCESS_STACK_SIZE);
+    if (!p->stack) {
+        kfree(p);
+        return NULL;
+    }
+    strncpy(p->name, name, sizeof(p->name) - 1);
+    return p;
+}
+
+/* caller holds proc_lock */
+static void proc_free(process_t* p) {
+    proc_table[p->pid] = NULL;
+    pid_free(p->pid);
+    nr_tasks--;
+    kfree(p->stack);
+    kfree(p);
+}
+
+/* lock the run queue p is on; retries if p migrates while we wait */
+static rq_t* task_rq_lock(process_t* p) {
+    while (1) {
+        rq_t* rq = &cpus[p->cpu].rq;
+        ticket_lock(&rq->lock);
+        if (rq == &cpus[p->cpu].rq) return rq;
+        ticket_unlock(&rq->lock);
+    }
+}
+
+/* free a zombie. its CPU holds the run queue lock until it is fully off
+ * the zombie's stack, so taking that lock once makes the free safe.
+ * caller holds proc_lock. */
+static void proc_reap(process_t* p) {
+    ticket_unlock(&task_rq_lock(p)->lock);
+    proc_free(p);
+}
+
+/* free tasks that exited on this CPU with nobody to reap them; called by
+ * whoever runs here next, never on the dead task's own stack */
+static void reap_dead(cpu_t* cpu) {
+    if (!cpu->dead) return;
+    ticket_lock(&proc_lock);
+    while (cpu->dead) {
+        process_t* p = cpu->dead;
+        cpu->dead = p->sleep_next;
+        proc_free(p);
+    }
+    ticket_unlock(&proc_lock);
+}
+
+/* first code every new task runs: switch_to() "returns" here with
+ * interrupts still off and the run queue still locked */
+static void proc_trampoline(void) {
+    process_t* self = get_current();
+    finish_switch();
+    interrupts_enable();
+    ((void (*)(void*))self->eip)(self->arg);
+    proc_exit(0);
+}
+
+/* lay out the stack so the first switch_to() into this task pops four
+ * zeroed callee-saved registers and returns into proc_trampoline */
+static void proc_build_frame(process_t* proc) {
+    u32* sp = proc->stack + (PROCESS_STACK_SIZE / 4);
+    *--sp = 0;                      /* fake return address for the trampoline */
+    *--sp = (u32)proc_trampoline;
+    *--sp = 0;                      /* ebp */
+    *--sp = 0;                      /* ebx */
+    *--sp = 0;                      /* esi */
+    *--sp = 0;                      /* edi */
+    proc->esp = (u32)sp;
+    proc->ebp = 0;
+}
+
+void cpu_idle(void) {
+    while (1) {
+        __asm__ volatile ("sti; hlt");
+        proc_yield();
+    }
+}
+
+static void idle_loop(void* arg) {
+    (void)arg;
+    cpu_idle();
+}
+
+/* ---------------------------------------------------------------
+ * run queues, all under rq->lock
+ * --------------------------------------------------------------- */
+
+static void rq_enqueue(rq_t* rq, process_t* p) {
+    u32 q = p->prio;
+    p->rq_next = NULL;
+    p->rq_prev = rq->tail[q];
+    if (rq->tail[q]) rq->tail[q]->rq_next = p;
+    else             rq->head[q] = p;
+    rq->tail[q] = p;
+    rq->bitmap |= 1u << q;
+}
+
+static void rq_dequeue(rq_t* rq, process_t* p) {
+    u32 q = p->prio;
+    if (p->rq_prev) p->rq_prev->rq_next = p->rq_next;
+    else            rq->head[q] = p->rq_next;
+    if (p->rq_next) p->rq_next->rq_prev = p->rq_prev;
+    else            rq->tail[q] = p->rq_prev;
+    p->rq_next = p->rq_prev = NULL;
+    if (!rq->head[q]) rq->bitmap &= ~(1u << q);
+}
+
+/* tasks that spend their time asleep (the shell waiting on keys) float up
+ * to MAX_BONUS levels above their static priority, CPU hogs sink as far */
+static void proc_recalc_prio(process_t* p) {
+    int bonus = (int)(p->sleep_avg * MAX_BONUS * 2 / MAX_SLEEP_AVG) - MAX_BONUS;
+    int prio  = (int)p->priority - bonus;
+    if (prio < 0)           prio = 0;
+    if (prio > NR_PRIO - 1) prio = NR_PRIO - 1;
+    p->prio = (u32)prio;
+}
+
+static void class_enqueue(rq_t* rq, process_t* p, int wakeup) {
+    if (p->sched_class == SCHED_FAIR) {
+        fair_enqueue(&rq->fair, p, wakeup);
+    } else {
+        proc_recalc_prio(p);
+        rq_enqueue(rq, p);
+    }
+    rq->nr_running++;
+}
+
+static void class_dequeue(rq_t* rq, process_t* p) {
+    if (p->sched_class == SCHED_FAIR) fair_dequeue(&rq->fair, p);
+    else                              rq_dequeue(rq, p);
+    rq->nr_running--;
+}
+
+/* highest-priority SCHED_PRIO task (FIFO within a level), else the
+ * SCHED_FAIR task with the smallest vruntime */
+static process_t* rq_pick(rq_t* rq) {
+    process_t* p;
+    if (rq->bitmap) {
+        p = rq->head[__builtin_ctz(rq->bitmap)];
+        rq_dequeue(rq, p);
+    } else {
+        p = fair_pick(&rq->fair);
+        if (!p) return NULL;
+    }
+    rq->nr_running--;
+    return p;
+}
+
+static void proc_make_ready(rq_t* rq, process_t* p) {
+    int wakeup = (p->state == PROC_WAITING);
+    if (wakeup) {
+        p->sleep_avg += system_uptime - p->sleep_start;
+        if (p->sleep_avg > MAX_SLEEP_AVG) p->sleep_avg = MAX_SLEEP_AVG;
+    }
+    p->state = PROC_READY;
+    class_enqueue(rq, p, wakeup);
+}
+
+/* bill the running task for the CPU it used since exec_start */
+static void proc_account(rq_t* rq, process_t* p, u64 now) {
+    u64 delta = now - p->exec_start;
+    p->exec_start = now;
+    p->sum_exec  += delta;
+    if (p->sched_class == SCHED_FAIR) fair_charge(&rq->fair, p, delta);
+}
+
+static void sleep_list_remove(rq_t* rq, process_t* p) {
+    process_t** pp = &rq->sleep_list;
+    while (*pp && *pp != p) pp = &(*pp)->sleep_next;
+    if (*pp) *pp = p->sleep_next;
+    p->sleep_next = NULL;
+    p->sleeping   = 0;
+}
+
+/* make p runnable on its run queue. if it should preempt what runs
+ * there, flag it for this CPU or send that CPU an IPI; either way the
+ * switch happens on the way out of the next interrupt. a task that is
+ * not blocked yet keeps the wakeup in wake_pending */
+void proc_wake(process_t* p) {
+    rq_t* rq = task_rq_lock(p);
+    cpu_t* cpu = &cpus[p->cpu];
+    int kick = 0;
+    if (p->state == PROC_WAITING) {
+        if (p->sleeping) sleep_list_remove(rq, p);
+        proc_make_ready(rq, p);
+        if (need_resched(cpu, cpu->current)) {
+            if (cpu == this_cpu()) cpu->need_resched = 1;
+            else                   kick = 1;
+        }
+    } else if (p->state != PROC_ZOMBIE) {
+        p->wake_pending = 1;
+    }
+    ticket_unlock(&rq->lock);
+    if (kick) smp_kick(cpu->id);
+}
+
+/* an idle CPU, if any, to come and steal what was just queued here */
+static void kick_idle_cpu(void) {
+    u32 self = this_cpu()->id;
+    for (u32 i = 0; i < nr_cpus; i++) {
+        if (i != self && cpus[i].online && cpus[i].current == cpus[i].idle) {
+            smp_kick(i);
+            return;
+        }
+    }
+}
+
+/* ---------------------------------------------------------------
+ * creation
+ * --------------------------------------------------------------- */
+
 void proc_init(void) {
-    memset(processes, 0, sizeof(processes));
-    process_t* idle = &processes[0];
-    idle->pid   = 0;
-    idle->state = PROC_READY;
-    strcpy(idle->name, "idle");
-    idle->is_user = 0;
-    proc_create_user("ksh", 0, 1);
+    memset(proc_table, 0, sizeof(proc_table));
+    memset(pid_bitmap, 0, sizeof(pid_bitmap));
+    last_pid = 0;
+
+    /* pid 0: runs only when nothing else can, always has a real frame */
+    cpu_t* cpu = this_cpu();
+    process_t* idle = proc_alloc("idle");
+    if (!idle) {
+        vga_write("proc: cannot allocate the idle task\n", COLOUR_DEBUG_FATAL_ERROR);
+        khang();
+    }
+    idle->state    = PROC_READY;
+    idle->eip      = (u32)idle_loop;
+    idle->priority = NR_PRIO - 1;
+    idle->prio     = NR_PRIO - 1;
+    idle->detached = 1;
+    proc_build_frame(idle);
+    pid_bitmap[0] |= 1;
+    proc_table[0]  = idle;
+    nr_tasks       = 1;
+    cpu->idle      = idle;
+    cpu->current   = idle;
+
+    /* the boot thread becomes ksh; it keeps running on the boot stack and
+     * its saved esp is filled in by the first switch away from it */
+    int ksh = proc_create_user("ksh", 0, 1);
+    process_t* sh = proc_table[ksh];
+    class_dequeue(&cpu->rq, sh);
+    sh->state      = PROC_RUNNING;
+    sh->exec_start = rdtsc();
+    cpu->current   = sh;
+}
+
+/* idle task for an AP; it is not in proc_table, the AP starts on its
+ * stack and never switches into it from scratch */
+process_t* proc_create_idle(u32 cpu) {
+    process_t* idle = proc_alloc("idle");
+    if (!idle) return NULL;
+    idle->state    = PROC_RUNNING;
+    idle->priority = NR_PRIO - 1;
+    idle->prio     = NR_PRIO - 1;
+    idle->detached = 1;
+    idle->cpu      = cpu;
+    cpus[cpu].idle    = idle;
+    cpus[cpu].current = idle;
+    return idle;
 }
+
+/* undo proc_create_idle() for an AP that never came up */
+void proc_free_idle(u32 cpu) {
+    process_t* idle = cpus[cpu].idle;
+    cpus[cpu].idle    = NULL;
+    cpus[cpu].current = NULL;
+    if (!idle) return;
+    kfree(idle->stack);
+    kfree(idle);
+}
+
 int proc_create(const char* name, u64 entry) {
     return proc_create_user(name, (u32)entry, 1);
 }
+
+static int proc_spawn(const char* name, u32 entry, u8 is_user, void* arg, u8 detached) {
+    process_t* proc = proc_alloc(name);
+    if (!proc) return -1;
+
+    u32 flags = ticket_lock_irqsave(&proc_lock);
+    int pid = pid_alloc();
+    if (pid < 0) {
+        ticket_unlock_irqrestore(&proc_lock, flags);
+        kfree(proc->stack);
+        kfree(proc);
+        return -1;
+    }
+    process_t* parent = get_current();
+    cpu_t*     cpu    = this_cpu();
+    int from_idle = (parent == cpu->idle);
+
+    proc->pid      = (u32)pid;
+    proc->ppid     = parent->pid;
+    proc->eip      = entry;
+    proc->arg      = arg;
+    proc->is_user  = is_user;
+    proc->detached = detached;
+    proc->uid      = is_user ? 1000 : 0;
+    proc->cpu      = cpu->id;
+    /* children inherit the creator's nice level, idle's doesn't count */
+    proc->priority    = from_idle ? PRIO_DEFAULT : parent->priority;
+    proc->sleep_avg   = MAX_SLEEP_AVG / 2;   /* start with no bonus either way */
+    proc->sched_class = from_idle ? SCHED_DEFAULT : parent->sched_class;
+    proc_build_frame(proc);
+    proc_table[pid] = proc;
+    nr_tasks++;
+
+    rq_t* rq = &cpu->rq;
+    ticket_lock(&rq->lock);
+    if (proc->sched_class == SCHED_FAIR) fair_place_new(&rq->fair, proc);
+    proc_make_ready(rq, proc);
+    ticket_unlock(&rq->lock);
+    ticket_unlock_irqrestore(&proc_lock, flags);
+
+    kick_idle_cpu();
+    return pid;
+}
+
 int proc_create_user(const char* name, u32 entry, u8 is_user) {
-    if (next_pid >= MAX_PROCESSES) return -1;
-    u32 pid = next_pid++;
-    process_t* proc = &processes[pid];
-    memset(proc, 0, sizeof(process_t));
-    proc->pid     = pid;
-    proc->ppid    = current_pid;
-    proc->state   = PROC_READY;
-    proc->eip     = entry;
-    proc->is_user = is_user;
-    proc->uid     = is_user ? 1000 : 0;
-    strcpy(proc->name, name);
-    u32* stack_top = proc->stack + (PROCESS_STACK_SIZE / 4) - 1;
-    proc->esp = (u32)stack_top;
-    proc->ebp = (u32)stack_top;
-    return (int)pid;
+    return proc_spawn(name, entry, is_user, NULL, 0);
+}
+
+/* a joinable task that starts out in the kernel running fn(arg) and
+ * will drop to ring 3 itself; proc_exec() builds on it */
+int proc_create_task(const char* name, void (*fn)(void*), void* arg) {
+    return proc_spawn(name, (u32)fn, 1, arg, 0);
+}
+
+/* kernel threads are detached: nobody waits for them, they are freed
+ * as soon as they return */
+int kthread_create(const char* name, void (*fn)(void*), void* arg) {
+    return proc_spawn(name, (u32)fn, 0, arg, 1);
+}
+
+/* the same, but left for its creator to reap with proc_wait() */
+int kthread_create_joinable(const char* name, void (*fn)(void*), void* arg) {
+    return proc_spawn(name, (u32)fn, 0, arg, 0);
+}
+
+/* ---------------------------------------------------------------
+ * scheduling
+ * --------------------------------------------------------------- */
+
+/* pull the best queued task off another CPU. we already hold our own
+ * run queue lock, so only try-lock theirs to stay out of lock cycles */
+static process_t* steal_task(cpu_t* self) {
+    for (u32 i = 1; i < nr_cpus; i++) {
+        cpu_t* victim = &cpus[(self->id + i) % nr_cpus];
+        if (!victim->online || victim->rq.nr_running == 0) continue;
+        if (!ticket_trylock(&victim->rq.lock)) continue;
+
+        process_t* p = rq_pick(&victim->rq);
+        if (p) {
+            if (p->sched_class == SCHED_FAIR)
+                fair_migrate(&victim->rq.fair, &self->rq.fair, p);
+            p->cpu = self->id;
+            self->rq.nr_steals++;
+        }
+        ticket_unlock(&victim->rq.lock);
+        if (p) return p;
+    }
+    return NULL;
+}
+
+/* anything but our own run queue lock held here would be carried into
+ * the next task and keep it from ever being preempted */
+static void sched_atomic_bug(cpu_t* cpu, process_t* prev) {
+    char buf[80];
+    snprintf(buf, sizeof(buf), "sched: pid %u switching out with preempt count %u\n",
+             prev->pid, cpu->preempt_count);
+    vga_write(buf, COLOUR_LIGHT_RED);
+    cpu->preempt_count = 1;
+}
+
+/* switch to the next task for this CPU: its own queue first, then one
+ * stolen from a busier CPU, else idle. called with interrupts off and
+ * this CPU's run queue locked; the lock is held across switch_to() and
+ * dropped by whichever task runs next, in finish_switch(). */
+static void __schedule(cpu_t* cpu) {
+    rq_t* rq = &cpu->rq;
+    u64 now = rdtsc();
+    process_t* prev = cpu->current;
+    if (__builtin_expect(cpu->preempt_count != 1, 0)) sched_atomic_bug(cpu, prev);
+    cpu->need_resched = 0;
+    proc_account(rq, prev, now);
+    if (prev->state == PROC_RUNNING) {
+        if (prev != cpu->idle) proc_make_ready(rq, prev);
+        else                   prev->state = PROC_READY;
+    }
+
+    process_t* next = rq_pick(rq);
+    if (!next) next = steal_task(cpu);
+    if (!next) next = cpu->idle;
+    next->state      = PROC_RUNNING;
+    next->time_used  = 0;
+    next->exec_start = now;
+    if (next == prev) {
+        ticket_unlock(&rq->lock);
+        return;
+    }
+
+    rq->nr_switches++;
+    cpu->current = next;
+    cpu->prev    = prev;
+    cpu->tss.esp0 = (u32)(next->stack + PROCESS_STACK_SIZE / 4);
+    mm_switch(next->mm);
+    switch_to(&prev->esp, next->esp);
+    finish_switch();
+}
+
+/* back on some task's stack after switch_to(); the CPU may not be the
+ * one this task last ran on */
+static void finish_switch(void) {
+    cpu_t* cpu = this_cpu();
+    ticket_unlock(&cpu->rq.lock);
+    reap_dead(cpu);
 }
+
+static void schedule(void) {
+    cpu_t* cpu = this_cpu();
+    ticket_lock(&cpu->rq.lock);
+    __schedule(cpu);
+}
+
 void proc_yield(void) {
-    __asm__ volatile ("int $0x20");
+    u32 flags = irq_save();
+    schedule();
+    irq_restore(flags);
 }
-void proc_exit(int code) {
-    (void)code;
-    processes[current_pid].state = PROC_ZOMBIE;
+
+/* preempt_enable() dropped the count to zero with a switch pending */
+void preempt_schedule(void) {
+    if (!irqs_enabled()) return;     /* the interrupt exit will get it */
     proc_yield();
 }
-static void schedule(void) {
-    u32 next  = (current_pid + 1) % MAX_PROCESSES;
-    u32 start = next;
-    do {
-        if (processes[next].state == PROC_READY ||
-            processes[next].state == PROC_RUNNING) {
-            processes[next].state = PROC_RUNNING;
-            current_pid = next;
-            return;
+
+/* last thing an interrupt does before returning to the code it broke
+ * into, which must not hold a spinlock. the task we leave resumes in
+ * here later and unwinds back through isr_common */
+void preempt_schedule_irq(void) {
+    cpu_t* cpu = this_cpu();
+    if (!cpu->need_resched || cpu->preempt_count) return;
+    ticket_lock(&cpu->rq.lock);
+    __schedule(cpu);
+}
+
+void proc_exit(int code) {
+    process_t* self = get_current();
+    fd_close_all();
+    if (self->mm) {
+        mm_t* mm = self->mm;
+        u32 flags = irq_save();
+        self->mm = NULL;
+        mm_switch(NULL);
+        irq_restore(flags);
+        mm_destroy(mm);
+    }
+    interrupts_disable();
+
+    ticket_lock(&proc_lock);
+    self->exit_code = code;
+
+    /* hand our children to idle: zombies are freed now, the live ones
+     * free themselves when they exit */
+    for (u32 i = 1; i < PID_MAX; i++) {
+        process_t* c = proc_table[i];
+        if (!c || c->ppid != self->pid || c == self) continue;
+        if (c->state == PROC_ZOMBIE && !c->detached) {
+            proc_reap(c);
+            continue;
         }
-        next = (next + 1) % MAX_PROCESSES;
-    } while (next != start);
-    current_pid = 0;
-    processes[0].state = PROC_RUNNING;
+        c->ppid     = 0;
+        c->detached = 1;
+    }
+
+    process_t* parent = proc_lookup(self->ppid);
+    int orphan = self->detached || !parent || parent->pid == 0;
+    if (!orphan) proc_wake(parent);
+
+    /* become a zombie under our run queue lock, which __schedule() keeps
+     * until we are off this stack; proc_reap() relies on that */
+    cpu_t* cpu = this_cpu();
+    ticket_lock(&cpu->rq.lock);
+    self->state = PROC_ZOMBIE;
+    if (orphan) {
+        self->sleep_next = cpu->dead;
+        cpu->dead = self;
+    }
+    ticket_unlock(&proc_lock);
+    __schedule(cpu);
+    khang();   /* a zombie is never picked again */
 }
-void timer_handler(void) {
-    system_uptime++;
-    if (processes[current_pid].pid != 0) {
-        processes[current_pid].time_used++;
-        if (processes[current_pid].time_used >= TIME_SLICE) {
-            processes[current_pid].state     = PROC_READY;
-            processes[current_pid].time_used = 0;
-            schedule();
+
+/* wait for child pid (or any child if pid < 0) to exit, free it and
+ * return its pid; -1 if there is no such child to wait for */
+int proc_wait(int pid, int* status) {
+    process_t* self = get_current();
+    while (1) {
+        u32 flags = ticket_lock_irqsave(&proc_lock);
+        int found = 0;
+        for (u32 i = 1; i < PID_MAX; i++) {
+            process_t* c = proc_table[i];
+            if (!c || c->ppid != self->pid || c->detached) continue;
+            if (pid > 0 && c->pid != (u32)pid) continue;
+            found = 1;
+            if (c->state == PROC_ZOMBIE) {
+                int reaped = (int)c->pid;
+                if (status) *status = c->exit_code;
+                proc_reap(c);
+                ticket_unlock_irqrestore(&proc_lock, flags);
+                return reaped;
+            }
         }
+        ticket_unlock_irqrestore(&proc_lock, flags);
+        if (!found) return -1;
+        /* an exit between the unlock and here leaves wake_pending set */
+        proc_block();
     }
 }
+
+/* take the current task off the CPU until someone calls proc_unblock().
+ * returns at once if a wakeup already came in, so callers must recheck
+ * whatever they are waiting for. */
+void proc_block(void) {
+    u32 flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    process_t* self = cpu->current;
+    ticket_lock(&cpu->rq.lock);
+    if (self->wake_pending) {
+        self->wake_pending = 0;
+        ticket_unlock(&cpu->rq.lock);
+    } else {
+        self->state       = PROC_WAITING;
+        self->sleep_start = system_uptime;
+        __schedule(cpu);
+    }
+    irq_restore(flags);
+}
+
+void proc_unblock(u32 pid) {
+    u32 flags = ticket_lock_irqsave(&proc_lock);
+    process_t* p = proc_lookup(pid);
+    if (p) proc_wake(p);
+    ticket_unlock_irqrestore(&proc_lock, flags);
+}
+
+static void sleep_list_insert(rq_t* rq, process_t* p, u32 ticks) {
+    p->wake_tick   = system_uptime + (ticks ? ticks : 1);
+    p->sleep_start = system_uptime;
+    p->state       = PROC_WAITING;
+    p->sleeping    = 1;
+
+    process_t** pp = &rq->sleep_list;
+    while (*pp && (int)((*pp)->wake_tick - p->wake_tick) <= 0)
+        pp = &(*pp)->sleep_next;
+    p->sleep_next = *pp;
+    *pp = p;
+}
+
+/* sleep for at least one timer tick */
+void proc_sleep(u32 ticks) {
+    u32 flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    ticket_lock(&cpu->rq.lock);
+    sleep_list_insert(&cpu->rq, cpu->current, ticks);
+    __schedule(cpu);
+    irq_restore(flags);
+}
+
+/* proc_block() that also gives up after ticks timer ticks; the caller
+ * tells the two apart by rechecking its condition */
+void proc_block_timeout(u32 ticks) {
+    u32 flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    process_t* self = cpu->current;
+    ticket_lock(&cpu->rq.lock);
+    if (self->wake_pending) {
+        self->wake_pending = 0;
+        ticket_unlock(&cpu->rq.lock);
+    } else {
+        sleep_list_insert(&cpu->rq, self, ticks);
+        __schedule(cpu);
+    }
+    irq_restore(flags);
+}
+
+int proc_set_nice(u32 pid, int nice) {
+    if (pid == 0) return -1;
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
+
+    u32 flags = ticket_lock_irqsave(&proc_lock);
+    process_t* p = proc_lookup(pid);
+    if (!p || p->state == PROC_ZOMBIE) {
+        ticket_unlock_irqrestore(&proc_lock, flags);
+        return -1;
+    }
+    rq_t* rq = task_rq_lock(p);
+    int queued = (p->state == PROC_READY);
+    if (queued) class_dequeue(rq, p);
+    p->priority = (u32)(PRIO_DEFAULT + nice);
+    proc_recalc_prio(p);
+    if (queued) class_enqueue(rq, p, 0);
+    ticket_unlock(&rq->lock);
+    ticket_unlock_irqrestore(&proc_lock, flags);
+    return 0;
+}
+
+int proc_set_class(u32 pid, int cls) {
+    if (pid == 0) return -1;
+    if (cls != SCHED_PRIO && cls != SCHED_FAIR) return -1;
+
+    u32 flags = ticket_lock_irqsave(&proc_lock);
+    process_t* p = proc_lookup(pid);
+    if (!p || p->state == PROC_ZOMBIE) {
+        ticket_unlock_irqrestore(&proc_lock, flags);
+        return -1;
+    }
+    rq_t* rq = task_rq_lock(p);
+    if (p->sched_class != cls) {
+        int queued = (p->state == PROC_READY);
+        if (p->state == PROC_RUNNING) proc_account(rq, p, rdtsc());
+        if (queued) class_dequeue(rq, p);
+        p->sched_class = (u8)cls;
+        if (cls == SCHED_FAIR) fair_place_new(&rq->fair, p);
+        if (queued) class_enqueue(rq, p, 0);
+    }
+    ticket_unlock(&rq->lock);
+    ticket_unlock_irqrestore(&proc_lock, flags);
+    return 0;
+}
+
+int proc_get_class(u32 pid) {
+    u32 flags = ticket_lock_irqsave(&proc_lock);
+    process_t* p = proc_lookup(pid);
+    int cls = p ? p->sched_class : SCHED_PRIO;
+    ticket_unlock_irqrestore(&proc_lock, flags);
+    return cls;
+}
+
+u64 proc_get_runtime_us(u32 pid) {
+    u32 flags = ticket_lock_irqsave(&proc_lock);
+    process_t* p = proc_lookup(pid);
+    u64 cycles = 0;
+    if (p) {
+        rq_t* rq = task_rq_lock(p);
+        cycles = p->sum_exec;
+        if (p->state == PROC_RUNNING) cycles += rdtsc() - p->exec_start;
+        ticket_unlock(&rq->lock);
+    }
+    ticket_unlock_irqrestore(&proc_lock, flags);
+    return tsc_to_us(cycles);
+}
+
+int proc_get_nice(u32 pid) {
+    u32 flags = ticket_lock_irqsave(&proc_lock);
+    process_t* p = proc_lookup(pid);
+    int nice = p ? (int)p->priority - PRIO_DEFAULT : 0;
+    ticket_unlock_irqrestore(&proc_lock, flags);
+    return nice;
+}
+
+/* does something queued here deserve this CPU more than cur? */
+static int need_resched(cpu_t* cpu, process_t* cur) {
+    rq_t* rq = &cpu->rq;
+    if (cur == cpu->idle) return rq->nr_running > 0;
+    if (cur->sched_class == SCHED_FAIR)
+        return rq->bitmap || fair_should_preempt(&rq->fair, cur);
+    return rq->bitmap && (u32)__builtin_ctz(rq->bitmap) < cur->prio;
+}
+
+/* per-CPU tick, from the PIT on the BSP and the LAPIC timer elsewhere.
+ * runs with interrupts off and only flags a reschedule; the switch
+ * itself is made by preempt_schedule_irq() on the way out */
+void sched_tick(void) {
+    cpu_t* cpu = this_cpu();
+    rq_t* rq = &cpu->rq;
+    process_t* cur = cpu->current;
+    cpu->ticks++;
+
+    ticket_lock(&rq->lock);
+    while (rq->sleep_list && (int)(system_uptime - rq->sleep_list->wake_tick) >= 0) {
+        process_t* p = rq->sleep_list;
+        rq->sleep_list = p->sleep_next;
+        p->sleep_next  = NULL;
+        p->sleeping    = 0;
+        p->wake_tsc    = cpu->tick_tsc;
+        proc_make_ready(rq, p);
+    }
+
+    int resched = 0;
+    if (cur != cpu->idle) {
+        if (cur->sleep_avg) cur->sleep_avg--;
+        cur->time_used++;
+        /* the fair class gets charged every tick so its preemption
+         * check sees up to date vruntimes */
+        if (cur->sched_class == SCHED_FAIR) proc_account(rq, cur, rdtsc());
+        else if (cur->time_used >= TIME_SLICE) resched = 1;
+    }
+    if (resched || need_resched(cpu, cur)) cpu->need_resched = 1;
+    ticket_unlock(&rq->lock);
+}
+
+/* VEC_RESCHED: another CPU queued work here or wants us to steal */
+void sched_resched_ipi(void) {
+    cpu_t* cpu = this_cpu();
+    ticket_lock(&cpu->rq.lock);
+    if (cpu->current == cpu->idle || need_resched(cpu, cpu->current)) cpu->need_resched = 1;
+    ticket_unlock(&cpu->rq.lock);
+}
+
+/* IRQ0, BSP only: the PIT keeps the global clock */
+void timer_handler(void) {
+    system_uptime++;
+    sched_tick();
+}
+
+#define PROC_LIST_ROW   128     /* one row of ps, name and all */
+#define PROC_LIST_TAIL  96      /* the summary line and the truncated one */
+
+/* what proc_get_list() needs for the tasks there are now, with room for
+ * a few more created before it runs */
+usize proc_list_size(void) {
+    return (nr_tasks + 10) * PROC_LIST_ROW + PROC_LIST_TAIL;
+}
+
+/* rows that do not fit are counted, not written, so the summary and the
+ * truncated line always make it in */
 int proc_get_list(char* buffer, usize size) {
     usize pos = 0;
+    u32   dropped = 0;
     pos += (usize)snprintf(buffer + pos, size - pos,
-                           "  PID PPID STATE     USER COMMAND\n");
+                           "  PID  PPID CPU CLS  PRI  NI STATE     USER COMMAND\n");
     pos += (usize)snprintf(buffer + pos, size - pos,
-                           "--------------------------------\n");
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i].state == PROC_UNUSED) continue;
+                           "--------------------------------------------------\n");
+    u32 flags = ticket_lock_irqsave(&proc_lock);
+    for (u32 i = 0; i < PID_MAX; i++) {
+        process_t* p = proc_table[i];
+        if (!p) continue;
+        if (size - pos < PROC_LIST_ROW + PROC_LIST_TAIL) {
+            dropped++;
+            continue;
+        }
         const char* state_str;
-        switch (processes[i].state) {
+        switch (p->state) {
             case PROC_READY:   state_str = "READY   "; break;
             case PROC_RUNNING: state_str = "RUNNING "; break;
             case PROC_WAITING: state_str = "WAITING "; break;
@@ -108,13 +814,27 @@ int proc_get_list(char* buffer, usize size) {
             default:           state_str = "UNKNOWN "; break;
         }
         pos += (usize)snprintf(buffer + pos, size - pos,
-            "%5d %5d %s %5d %s\n",
-            processes[i].pid,
-            processes[i].ppid,
+            "%5d %5d %3d %s %3d %3d %s %5d %s\n",
+            p->pid,
+            p->ppid,
+            p->cpu,
+            p->sched_class == SCHED_FAIR ? "fair" : "prio",
+            p->prio,
+            (int)p->priority - PRIO_DEFAULT,
             state_str,
-            processes[i].uid,
-            processes[i].name);
+            p->uid,
+            p->name);
     }
+    if (dropped)
+        pos += (usize)snprintf(buffer + pos, size - pos,
+                               "... truncated, %u more not shown\n", dropped);
+    pos += (usize)snprintf(buffer + pos, size - pos,
+                           "%u tasks on %u cpus, pid limit %u\n", nr_tasks, nr_cpus, PID_MAX);
+    ticket_unlock_irqrestore(&proc_lock, flags);
     return (int)pos;
 }
-u32 proc_get_pid(void) { return processes[current_pid].pid; }
+
+u32 proc_get_pid(void) {
+    process_t* p = get_current();
+    return p ? p->pid : 0;
+}
@@ -0,0 +1,196 @@
+#include "kernel.h"
+#include "rbtree.h"
+
+static void rb_rotate_left(rb_node_t* x, rb_root_t* root) {
+    rb_node_t* y = x->right;
+    x->right = y->left;
+    if (y->left) y->left->parent = x;
+    y->parent = x->parent;
+    if (!x->parent)                  root->root        = y;
+    else if (x == x->parent->left)   x->parent->left   = y;
+    else                             x->parent->right  = y;
+    y->left   = x;
+    x->parent = y;
+}
+
+static void rb_rotate_right(rb_node_t* x, rb_root_t* root) {
+    rb_node_t* y = x->left;
+    x->left = y->right;
+    if (y->right) y->right->parent = x;
+    y->parent = x->parent;
+    if (!x->parent)                  root->root        = y;
+    else if (x == x->parent->right)  x->parent->right  = y;
+    else                             x->parent->left   = y;
+    y->right  = x;
+    x->parent = y;
+}
+
+void rb_insert_color(rb_node_t* node, rb_root_t* root) {
+    rb_node_t* parent;
+    while ((parent = node->parent) && parent->color == RB_RED) {
+        rb_node_t* gparent = parent->parent;
+        if (parent == gparent->left) {
+            rb_node_t* uncle = gparent->right;
+            if (uncle && uncle->color == RB_RED) {
+                uncle->color   = RB_BLACK;
+                parent->color  = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->right) {
+                rb_rotate_left(parent, root);
+                node   = parent;
+                parent = node->parent;
+            }
+            parent->color  = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_right(gparent, root);
+        } else {
+            rb_node_t* uncle = gparent->left;
+            if (uncle && uncle->color == RB_RED) {
+                uncle->color   = RB_BLACK;
+                parent->color  = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->left) {
+                rb_rotate_right(parent, root);
+                node   = parent;
+                parent = node->parent;
+            }
+            parent->color  = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_left(gparent, root);
+        }
+    }
+    root->root->color = RB_BLACK;
+}
+
+/* restore the black height after removing a black node; x may be NULL,
+ * which is why its parent is tracked separately */
+static void rb_erase_fixup(rb_node_t* x, rb_node_t* parent, rb_root_t* root) {
+    while (x != root->root && (!x || x->color == RB_BLACK)) {
+        if (x == parent->left) {
+            rb_node_t* w = parent->right;
+            if (w->color == RB_RED) {
+                w->color      = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_left(parent, root);
+                w = parent->right;
+            }
+            if ((!w->left  || w->left->color  == RB_BLACK) &&
+                (!w->right || w->right->color == RB_BLACK)) {
+                w->color = RB_RED;
+                x      = parent;
+                parent = x->parent;
+            } else {
+                if (!w->right || w->right->color == RB_BLACK) {
+                    w->left->color = RB_BLACK;
+                    w->color       = RB_RED;
+                    rb_rotate_right(w, root);
+                    w = parent->right;
+                }
+                w->color      = parent->color;
+                parent->color = RB_BLACK;
+                if (w->right) w->right->color = RB_BLACK;
+                rb_rotate_left(parent, root);
+                x = root->root;
+                break;
+            }
+        } else {
+            rb_node_t* w = parent->left;
+            if (w->color == RB_RED) {
+                w->color      = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_right(parent, root);
+                w = parent->left;
+            }
+            if ((!w->left  || w->left->color  == RB_BLACK) &&
+                (!w->right || w->right->color == RB_BLACK)) {
+                w->color = RB_RED;
+                x      = parent;
+                parent = x->parent;
+            } else {
+                if (!w->left || w->left->color == RB_BLACK) {
+                    w->right->color = RB_BLACK;
+                    w->color        = RB_RED;
+                    rb_rotate_left(w, root);
+                    w = parent->left;
+                }
+                w->color      = parent->color;
+                parent->color = RB_BLACK;
+                if (w->left) w->left->color = RB_BLACK;
+                rb_rotate_right(parent, root);
+                x = root->root;
+                break;
+            }
+        }
+    }
+    if (x) x->color = RB_BLACK;
+}
+
+static void rb_transplant(rb_node_t* u, rb_node_t* v, rb_root_t* root) {
+    if (!u->parent)                 root->root       = v;
+    else if (u == u->parent->left)  u->parent->left  = v;
+    else                            u->parent->right = v;
+    if (v) v->parent = u->parent;
+}
+
+void rb_erase(rb_node_t* node, rb_root_t* root) {
+    rb_node_t* x;
+    rb_node_t* x_parent;
+    int removed_color = node->color;
+
+    if (!node->left) {
+        x        = node->right;
+        x_parent = node->parent;
+        rb_transplant(node, node->right, root);
+    } else if (!node->right) {
+        x        = node->left;
+        x_parent = node->parent;
+        rb_transplant(node, node->left, root);
+    } else {
+        /* splice out the in-order successor and put it where node was */
+        rb_node_t* y = node->right;
+        while (y->left) y = y->left;
+        removed_color = y->color;
+        x = y->right;
+        if (y->parent == node) {
+            x_parent = y;
+        } else {
+            x_parent = y->parent;
+            rb_transplant(y, y->right, root);
+            y->right         = node->right;
+            y->right->parent = y;
+        }
+        rb_transplant(node, y, root);
+        y->left         = node->left;
+        y->left->parent = y;
+        y->color        = node->color;
+    }
+
+    if (removed_color == RB_BLACK && root->root)
+        rb_erase_fixup(x, x_parent, root);
+
+    node->parent = node->left = node->right = NULL;
+}
+
+rb_node_t* rb_first(const rb_root_t* root) {
+    rb_node_t* n = root->root;
+    if (!n) return NULL;
+    while (n->left) n = n->left;
+    return n;
+}
+
+rb_node_t* rb_next(const rb_node_t* node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left) node = node->left;
+        return (rb_node_t*)node;
+    }
+    while (node->parent && node == node->parent->right)
+        node = node->parent;
+    return node->parent;
+}
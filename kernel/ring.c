@@ -0,0 +1,85 @@
+#include "kernel.h"
+#include "smp.h"
+#include "vmm.h"
+#include "syscall.h"
+#include "ring.h"
+
+/* ---------------------------------------------------------------
+ * the kernel side of ring.h. the ring is an ordinary anonymous area
+ * of the task's address space, so ring_enter() reads SQEs and writes
+ * CQEs through the same user mapping the program uses; only the task
+ * that owns the mm ever runs this, so there is nothing to lock.
+ * --------------------------------------------------------------- */
+
+#define RING_SQ_OFF   sizeof(ring_hdr_t)
+
+static u32 ring_cq_off(u32 entries) {
+    return RING_SQ_OFF + entries * sizeof(ring_sqe_t);
+}
+
+static u32 ring_size(u32 entries) {
+    return ring_cq_off(entries) + entries * sizeof(ring_cqe_t);
+}
+
+static int ring_op_ok(u32 op) {
+    return op == SYS_READ || op == SYS_WRITE || op == SYS_OPEN ||
+           op == SYS_CLOSE || op == SYS_FSTAT || op == SYS_GETPID;
+}
+
+/* entries is rounded up to a power of two; returns RING_BASE */
+int ring_setup(u32 entries) {
+    mm_t* mm = get_current()->mm;
+    if (!mm || mm->ring_entries || entries == 0 || entries > RING_MAX_ENTRIES) return -1;
+    u32 n = 1;
+    while (n < entries) n <<= 1;
+
+    u32 end = RING_BASE + ring_size(n);
+    for (vm_area_t* a = mm->areas; a; a = a->next)
+        if (a->start < end && a->end > RING_BASE) return -1;
+    if (mm_add_area(mm, RING_BASE, end, VMA_WRITE, -1, 0, 0, 0) < 0) return -1;
+    mm->ring_entries = n;
+
+    ring_hdr_t* h = (ring_hdr_t*)RING_BASE;
+    h->sq_head = h->sq_tail = 0;
+    h->cq_head = h->cq_tail = 0;
+    h->entries = n;
+    h->sq_off  = RING_SQ_OFF;
+    h->cq_off  = ring_cq_off(n);
+    return (int)RING_BASE;
+}
+
+/* take up to to_submit queued SQEs, run each, post its CQE. stops early
+ * when the SQ is empty or the CQ is full. everything completes before
+ * we return, so min_complete is always met; it is there for when ops
+ * start completing asynchronously */
+int ring_enter(u32 to_submit, u32 min_complete) {
+    (void)min_complete;
+    mm_t* mm = get_current()->mm;
+    if (!mm || !mm->ring_entries) return -1;
+
+    /* sizes come from the mm, never from the user-writable header */
+    u32 n = mm->ring_entries;
+    ring_hdr_t* h    = (ring_hdr_t*)RING_BASE;
+    ring_sqe_t* sqes = (ring_sqe_t*)(RING_BASE + RING_SQ_OFF);
+    ring_cqe_t* cqes = (ring_cqe_t*)(RING_BASE + ring_cq_off(n));
+
+    u32 done = 0;
+    while (done < to_submit) {
+        u32 head = h->sq_head;
+        if (head == h->sq_tail) break;
+        u32 tail = h->cq_tail;
+        if (tail - h->cq_head >= n) break;
+
+        ring_sqe_t sqe = sqes[head & (n - 1)];
+        h->sq_head = head + 1;
+
+        int res = ring_op_ok(sqe.op)
+                ? syscall_dispatch(sqe.op, sqe.arg[0], sqe.arg[1], sqe.arg[2], 0, 0)
+                : -1;
+        cqes[tail & (n - 1)].user_data = sqe.user_data;
+        cqes[tail & (n - 1)].res       = res;
+        __atomic_store_n(&h->cq_tail, tail + 1, __ATOMIC_RELEASE);
+        done++;
+    }
+    return (int)done;
+}
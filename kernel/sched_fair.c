@@ -0,0 +1,111 @@
+#include "kernel.h"
+#include "process.h"
+
+#define NICE_0_WEIGHT        1024
+#define FAIR_LATENCY_NS      20000000ULL   /* a sleeper's credit on wakeup */
+#define FAIR_WAKEUP_GRAN_NS  4000000ULL    /* lead the leftmost must have to preempt */
+
+/* CPU share per nice level, each step is ~1.25x (same table as Linux,
+ * trimmed to our -16..15 nice range) */
+static const u32 nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    /* -16 */ 36291, 29154, 23254, 18705, 14949, 11916, 9548, 7620,
+    /*  -8 */  6100,  4904,  3906,  3121,  2501,  1991, 1586, 1277,
+    /*   0 */  1024,   820,   655,   526,   423,   335,  272,  215,
+    /*   8 */   172,   137,   110,    87,    70,    56,   45,   36,
+};
+
+u32 sched_nice_weight(int nice) {
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
+    return nice_to_weight[nice - NICE_MIN];
+}
+
+u32 fair_weight(const process_t* p) {
+    return sched_nice_weight((int)p->priority - PRIO_DEFAULT);
+}
+
+static void update_min_vruntime(fair_rq_t* fq, process_t* curr) {
+    u64 v = fq->min_vruntime;
+    int have = 0;
+    if (curr && curr->sched_class == SCHED_FAIR && curr->state == PROC_RUNNING) {
+        v = curr->vruntime;
+        have = 1;
+    }
+    if (fq->leftmost) {
+        u64 left = rb_entry(fq->leftmost, process_t, fair_node)->vruntime;
+        if (!have || left < v) v = left;
+    }
+    if (v > fq->min_vruntime) fq->min_vruntime = v;
+}
+
+/* charge delta TSC cycles of CPU, scaled by NICE_0_WEIGHT/weight, so
+ * heavier tasks age more slowly and get picked more often */
+void fair_charge(fair_rq_t* fq, process_t* p, u64 delta) {
+    u64 delta_ns = tsc_to_ns(delta);
+    p->vruntime += div64_u32(delta_ns * NICE_0_WEIGHT, fair_weight(p));
+    update_min_vruntime(fq, p);
+}
+
+void fair_enqueue(fair_rq_t* fq, process_t* p, int wakeup) {
+    if (wakeup) {
+        /* don't let a long sleeper come back owning the CPU, but give
+         * it up to half a latency period of credit */
+        u64 floor = fq->min_vruntime > FAIR_LATENCY_NS / 2 ?
+                    fq->min_vruntime - FAIR_LATENCY_NS / 2 : 0;
+        if (p->vruntime < floor) p->vruntime = floor;
+    }
+
+    rb_node_t** link   = &fq->tree.root;
+    rb_node_t*  parent = NULL;
+    int leftmost = 1;
+    while (*link) {
+        parent = *link;
+        if (p->vruntime < rb_entry(parent, process_t, fair_node)->vruntime) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = 0;
+        }
+    }
+    rb_link_node(&p->fair_node, parent, link);
+    rb_insert_color(&p->fair_node, &fq->tree);
+    if (leftmost) fq->leftmost = &p->fair_node;
+    fq->nr_running++;
+}
+
+void fair_dequeue(fair_rq_t* fq, process_t* p) {
+    if (fq->leftmost == &p->fair_node)
+        fq->leftmost = rb_next(&p->fair_node);
+    rb_erase(&p->fair_node, &fq->tree);
+    fq->nr_running--;
+    update_min_vruntime(fq, NULL);
+}
+
+process_t* fair_pick(fair_rq_t* fq) {
+    if (!fq->leftmost) return NULL;
+    process_t* p = rb_entry(fq->leftmost, process_t, fair_node);
+    fair_dequeue(fq, p);
+    return p;
+}
+
+int fair_should_preempt(fair_rq_t* fq, process_t* curr) {
+    if (!fq->leftmost) return 0;
+    process_t* left = rb_entry(fq->leftmost, process_t, fair_node);
+    return curr->vruntime > left->vruntime + FAIR_WAKEUP_GRAN_NS;
+}
+
+/* new tasks start level with everyone else */
+void fair_place_new(fair_rq_t* fq, process_t* p) {
+    p->vruntime = fq->min_vruntime;
+}
+
+/* vruntime only means something relative to its queue's min_vruntime,
+ * so keep the task's lag when it moves to another CPU */
+void fair_migrate(fair_rq_t* from, fair_rq_t* to, process_t* p) {
+    if (p->vruntime >= from->min_vruntime) {
+        p->vruntime = p->vruntime - from->min_vruntime + to->min_vruntime;
+    } else {
+        u64 credit = from->min_vruntime - p->vruntime;
+        p->vruntime = to->min_vruntime > credit ? to->min_vruntime - credit : 0;
+    }
+}
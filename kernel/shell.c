@@ -1,11 +1,15 @@
 #include "kernel.h"
 #include "shell.h"
+#include "spinlock.h"
+#include "syscall.h"
+#include "ipc.h"
+#include "pci.h"
+#include "blk.h"
 
 #define MAX_ARGS    20
 #define MAX_ALIASES 32
-
-static char* args[MAX_ARGS];
-static int   arg_count = 0;
+#define MAX_STAGES  8
+#define SCRIPT_MAX  4096
 
 typedef struct {
     char name[32];
@@ -18,6 +22,18 @@ static int     logged_in   = 0;
 
 int  shell_logged_in(void) { return logged_in; }
 
+/* builtins print what they produce through here: in colour on the
+ * screen, or down fd 1 when they run as a pipeline stage. errors and
+ * prompts still go straight to the screen */
+static void out(const char* s, u8 colour) {
+    fd_puts(1, s, colour);
+}
+
+static int out_is_screen(void) {
+    kstat_t st;
+    return fd_fstat(1, &st) < 0 || (st.st_mode & 0xF000) == 0x2000;
+}
+
 static void read_string(char* buffer, int max_len, int show_chars) {
     int pos = 0;
     while (1) {
@@ -172,14 +188,20 @@ static void login_prompt(void) {
     khang();
 }
 
-static void parse_command(char* line) {
-    arg_count = 0;
-    char* token = strtok(line, " \t\n");
-    while (token && arg_count < MAX_ARGS - 1) {
-        args[arg_count++] = token;
-        token = strtok(NULL, " \t\n");
+/* split line in place into argv, NULL terminated; returns argc. no
+ * strtok(): pipeline stages parse their words at the same time */
+static int parse_command(char* line, char** argv) {
+    int argc = 0;
+    char* p = line;
+    while (argc < MAX_ARGS - 1) {
+        while (*p == ' ' || *p == '\t' || *p == '\n') p++;
+        if (!*p) break;
+        argv[argc++] = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\n') p++;
+        if (*p) *p++ = '\0';
     }
-    args[arg_count] = NULL;
+    argv[argc] = NULL;
+    return argc;
 }
 
 static char* expand_alias(const char* cmd) {
@@ -204,11 +226,11 @@ static void add_alias(const char* name, const char* value) {
 }
 
 static void list_aliases(void) {
-    if (alias_count == 0) { vga_write("(no aliases)\n", COLOUR_DARK_GRAY); return; }
+    if (alias_count == 0) { out("(no aliases)\n", COLOUR_DARK_GRAY); return; }
     for (int i = 0; i < alias_count; i++) {
         char buf[128];
         snprintf(buf, sizeof(buf), "%s='%s'\n", aliases[i].name, aliases[i].value);
-        vga_write(buf, COLOUR_LIGHT_CYAN);
+        out(buf, COLOUR_LIGHT_CYAN);
     }
 }
 
@@ -230,8 +252,9 @@ static void cmd_cd(char* path) {
 }
 
 static void cmd_ls(int show_all) {
-    char buf[4096];
-    if (fs_list(buf, sizeof(buf)) > 0) {
+    char* buf = (char*)kmalloc(4096);      /* pipeline stages have small stacks */
+    if (!buf) return;
+    if (fs_list(buf, 4096) > 0) {
         /* colour directories differently */
         char* p = buf;
         while (*p) {
@@ -241,28 +264,42 @@ static void cmd_ls(int show_all) {
             int l = strlen(p);
             if (l > 0 && p[l-1] == '/') is_dir = 1;
             if (!show_all && p[0] == '.') { if (nl) { *nl='\n'; p=nl+1; } else break; continue; }
-            vga_write(p, is_dir ? COLOUR_LIGHT_CYAN : COLOUR_WHITE);
-            vga_write("\n", COLOUR_WHITE);
+            out(p, is_dir ? COLOUR_LIGHT_CYAN : COLOUR_WHITE);
+            out("\n", COLOUR_WHITE);
             if (!nl) break;
             *nl = '\n'; p = nl + 1;
         }
     } else {
-        vga_write("(empty)\n", COLOUR_WHITE);
+        out("(empty)\n", COLOUR_WHITE);
     }
+    kfree(buf);
 }
 
+/* cat [file]: with no file, copy stdin when a pipeline gave us one */
 static void cmd_cat(const char* f) {
-    if (!f) { vga_write("Usage: cat <file>\n", COLOUR_LIGHT_RED); return; }
-    char buf[4096];
-    int sz = fs_read(f, buf, sizeof(buf) - 1);
-    if (sz < 0) {
-        char err[96];
-        snprintf(err, sizeof(err), "cat: %s: No such file or directory\n", f);
-        vga_write(err, COLOUR_LIGHT_RED); return;
+    kstat_t st;
+    int fd = 0;
+    if (f) {
+        fd = fd_open(f, O_RDONLY);
+        if (fd < 0) {
+            char err[96];
+            snprintf(err, sizeof(err), "cat: %s: No such file or directory\n", f);
+            vga_write(err, COLOUR_LIGHT_RED); return;
+        }
+    } else if (fd_fstat(0, &st) < 0) {
+        vga_write("Usage: cat <file>\n", COLOUR_LIGHT_RED); return;
     }
-    buf[sz] = '\0';
-    vga_write(buf, COLOUR_WHITE);
-    if (sz > 0 && buf[sz-1] != '\n') vga_write("\n", COLOUR_WHITE);
+
+    char chunk[513];
+    char last = '\n';
+    int n;
+    while ((n = fd_read(fd, chunk, sizeof(chunk) - 1)) > 0) {
+        chunk[n] = '\0';
+        out(chunk, COLOUR_WHITE);
+        last = chunk[n - 1];
+    }
+    if (f) fd_close(fd);
+    if (last != '\n' && out_is_screen()) out("\n", COLOUR_WHITE);
 }
 
 static void cmd_touch(const char* f) {
@@ -271,18 +308,18 @@ static void cmd_touch(const char* f) {
     if (fs_create(f, 1) < 0) vga_write("touch: cannot create file\n", COLOUR_LIGHT_RED);
 }
 
-static void cmd_rm(void) {
+static void cmd_rm(int argc, char** argv) {
     int i_start = 1;
-    for (; i_start < arg_count; i_start++)
-        if (args[i_start][0] != '-') break;
+    for (; i_start < argc; i_start++)
+        if (argv[i_start][0] != '-') break;
 
-    if (i_start >= arg_count) {
+    if (i_start >= argc) {
         vga_write("Usage: rm [-f] <file> [file ...]\n", COLOUR_LIGHT_RED); return;
     }
-    for (int i = i_start; i < arg_count; i++) {
-        if (fs_delete(args[i]) != 0) {
+    for (int i = i_start; i < argc; i++) {
+        if (fs_delete(argv[i]) != 0) {
             char err[96];
-            snprintf(err, sizeof(err), "rm: cannot remove '%s'\n", args[i]);
+            snprintf(err, sizeof(err), "rm: cannot remove '%s'\n", argv[i]);
             vga_write(err, COLOUR_LIGHT_RED);
         }
     }
@@ -294,87 +331,113 @@ static void cmd_mkdir(const char* d) {
     if (fs_mkdir(d) < 0) vga_write("mkdir: cannot create directory\n", COLOUR_LIGHT_RED);
 }
 
-static void cmd_cp(void) {
-    if (arg_count < 3) { vga_write("Usage: cp <src> <dst>\n", COLOUR_LIGHT_RED); return; }
+static void cmd_cp(int argc, char** argv) {
+    if (argc < 3) { vga_write("Usage: cp <src> <dst>\n", COLOUR_LIGHT_RED); return; }
     char buf[4096];
-    int sz = fs_read(args[1], buf, sizeof(buf) - 1);
+    int sz = fs_read(argv[1], buf, sizeof(buf) - 1);
     if (sz < 0) {
-        char err[96]; snprintf(err, sizeof(err), "cp: %s: No such file\n", args[1]);
+        char err[96]; snprintf(err, sizeof(err), "cp: %s: No such file\n", argv[1]);
         vga_write(err, COLOUR_LIGHT_RED); return;
     }
     buf[sz] = '\0';
-    if (fs_write(args[2], buf, (usize)sz) < 0)
+    if (fs_write(argv[2], buf, (usize)sz) < 0)
         vga_write("cp: write failed\n", COLOUR_LIGHT_RED);
 }
 
-static void cmd_mv(void) {
-    if (arg_count < 3) { vga_write("Usage: mv <src> <dst>\n", COLOUR_LIGHT_RED); return; }
+static void cmd_mv(int argc, char** argv) {
+    if (argc < 3) { vga_write("Usage: mv <src> <dst>\n", COLOUR_LIGHT_RED); return; }
     char buf[4096];
-    int sz = fs_read(args[1], buf, sizeof(buf) - 1);
+    int sz = fs_read(argv[1], buf, sizeof(buf) - 1);
     if (sz < 0) {
-        char err[96]; snprintf(err, sizeof(err), "mv: %s: No such file\n", args[1]);
+        char err[96]; snprintf(err, sizeof(err), "mv: %s: No such file\n", argv[1]);
         vga_write(err, COLOUR_LIGHT_RED); return;
     }
     buf[sz] = '\0';
-    if (fs_write(args[2], buf, (usize)sz) < 0) {
+    if (fs_write(argv[2], buf, (usize)sz) < 0) {
         vga_write("mv: write failed\n", COLOUR_LIGHT_RED); return;
     }
-    fs_delete(args[1]);
+    fs_delete(argv[1]);
 }
 
-static void cmd_echo(void) {
+static void cmd_echo(int argc, char** argv) {
     int start = 1, newline = 1;
-    if (arg_count > 1 && strcmp(args[1], "-n") == 0) { newline = 0; start = 2; }
-    for (int i = start; i < arg_count; i++) {
-        vga_write(args[i], COLOUR_WHITE);
-        if (i < arg_count - 1) vga_write(" ", COLOUR_WHITE);
+    if (argc > 1 && strcmp(argv[1], "-n") == 0) { newline = 0; start = 2; }
+    for (int i = start; i < argc; i++) {
+        out(argv[i], COLOUR_WHITE);
+        if (i < argc - 1) out(" ", COLOUR_WHITE);
     }
-    if (newline) vga_write("\n", COLOUR_WHITE);
+    if (newline) out("\n", COLOUR_WHITE);
 }
 
 /* chmod <octal> <file>  e.g.  chmod 755 myscript */
-static void cmd_chmod(void) {
-    if (arg_count < 3) {
+static void cmd_chmod(int argc, char** argv) {
+    if (argc < 3) {
         vga_write("Usage: chmod <mode> <file>\n", COLOUR_LIGHT_RED); return;
     }
-    const char* mstr = args[1];
+    const char* mstr = argv[1];
     u16 mode = 0;
     while (*mstr >= '0' && *mstr <= '7')
         mode = (u16)(mode * 8 + (*mstr++ - '0'));
-    if (fs_chmod(args[2], mode) != 0) {
+    if (fs_chmod(argv[2], mode) != 0) {
         char err[96];
-        snprintf(err, sizeof(err), "chmod: cannot change mode of '%s'\n", args[2]);
+        snprintf(err, sizeof(err), "chmod: cannot change mode of '%s'\n", argv[2]);
+        vga_write(err, COLOUR_LIGHT_RED);
+    }
+}
+
+static void cmd_ipcrm(int argc, char** argv) {
+    int shm = argc > 2 && strcmp(argv[1], "shm") == 0;
+    int mq  = argc > 2 && strcmp(argv[1], "mq") == 0;
+    if (!shm && !mq) {
+        vga_write("Usage: ipcrm <shm|mq> <name>\n", COLOUR_LIGHT_RED);
+        return;
+    }
+    if ((shm ? shm_unlink(argv[2]) : mq_unlink(argv[2])) < 0) {
+        char err[80];
+        snprintf(err, sizeof(err), "ipcrm: no %s named '%s'\n", argv[1], argv[2]);
         vga_write(err, COLOUR_LIGHT_RED);
     }
 }
 
 static void cmd_help(void) {
-    vga_write("kTTY " KTTY_VERSION " ksh built-ins\n", COLOUR_YELLOW);
-    vga_write("  Navigation : cd [dir]  ls [-a]  pwd\n",              COLOUR_WHITE);
-    vga_write("  Files      : cat  touch  rm [-f]  mkdir  cp  mv\n",  COLOUR_WHITE);
-    vga_write("  Text       : echo [-n]  kittywrite <file>\n",        COLOUR_WHITE);
-    vga_write("  System     : ps  sysfetch  uname [-a]  hostname\n",  COLOUR_WHITE);
-    vga_write("  Users      : id  whoami  useradd  userdel  passwd\n",COLOUR_WHITE);
-    vga_write("  Privilege  : sudo <cmd>  sudo -l  sudo -i\n",        COLOUR_WHITE);
-    vga_write("  Shell      : history  alias  unalias  clear  help\n",COLOUR_WHITE);
-    vga_write("  Perms      : chmod <mode> <file>\n",                 COLOUR_WHITE);
-    vga_write("  Session    : exit  logout\n",                        COLOUR_WHITE);
-    vga_write("  Scripts    : ./script.sh (also chmodded files)\n",COLOUR_WHITE);
-    vga_write("  Keys       : Up/Down=history  Left/Right/Home/End\n",COLOUR_WHITE);
-}
-
-static void cmd_uname(void) {
-    if (arg_count > 1 && strcmp(args[1], "-a") == 0)
-        vga_write("kTTY kTTY-" KTTY_VERSION " " KRNEL_VERSION_STR " #1 SMP x86\n", COLOUR_WHITE);
+    out("kTTY " KTTY_VERSION " ksh built-ins\n", COLOUR_YELLOW);
+    out("  Navigation : cd [dir]  ls [-a]  pwd\n",              COLOUR_WHITE);
+    out("  Files      : cat  touch  rm [-f]  mkdir  cp  mv  sync\n", COLOUR_WHITE);
+    out("  Text       : echo [-n]  kittywrite <file>\n",        COLOUR_WHITE);
+    out("  System     : ps  sysfetch  uname [-a]  hostname\n",  COLOUR_WHITE);
+    out("  Locks      : lockstat [-r]\n",                        COLOUR_WHITE);
+    out("  Devices    : lspci [-v]  iostat [-r]\n",              COLOUR_WHITE);
+    out("  Scheduling : nice [-n adj] <cmd>  nice -p <pid> <n>\n", COLOUR_WHITE);
+    out("               sched <prio|fair> <cmd>  sched -p <pid> <cls>\n", COLOUR_WHITE);
+    out("  Users      : id  whoami  useradd  userdel  passwd\n",COLOUR_WHITE);
+    out("  Privilege  : sudo <cmd>  sudo -l  sudo -i\n",        COLOUR_WHITE);
+    out("  Shell      : history  alias  unalias  clear  help\n",COLOUR_WHITE);
+    out("  Pipes      : cmd | cmd | ...  (cat reads the pipe)\n", COLOUR_WHITE);
+    out("  IPC        : ipcs  ipcrm <shm|mq> <name>\n",        COLOUR_WHITE);
+    out("  Perms      : chmod <mode> <file>\n",                 COLOUR_WHITE);
+    out("  Session    : exit  logout\n",                        COLOUR_WHITE);
+    out("  Syscalls   : syscalls [-r]\n",                        COLOUR_WHITE);
+    out("  Benchmarks : bench <ctxsw|fair [n]|smp [threads]|waitq [pairs]|\n", COLOUR_WHITE);
+    out("                      exec [runs]|syscall [calls]|ring [ops]|\n", COLOUR_WHITE);
+    out("                      clock [reads]|futex [threads]|pipe [KiB]|\n", COLOUR_WHITE);
+    out("                      ipc [KiB]|disk [MiB] [disk]|iops [disk] [ops]>\n", COLOUR_WHITE);
+    out("               latency [loops] [threads]\n",     COLOUR_WHITE);
+    out("  Scripts    : ./script.sh (also chmodded files)\n",COLOUR_WHITE);
+    out("  Keys       : Up/Down=history  Left/Right/Home/End\n",COLOUR_WHITE);
+}
+
+static void cmd_uname(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "-a") == 0)
+        out("kTTY kTTY-" KTTY_VERSION " " KRNEL_VERSION_STR " #1 SMP x86\n", COLOUR_WHITE);
     else
-        vga_write("kTTY\n", COLOUR_WHITE);
+        out("kTTY\n", COLOUR_WHITE);
 }
 
 static void cmd_hostname(void) {
     char buf[64];
     get_hostname(buf, sizeof(buf));
-    vga_write(buf, COLOUR_WHITE);
-    vga_write("\n", COLOUR_WHITE);
+    out(buf, COLOUR_WHITE);
+    out("\n", COLOUR_WHITE);
 }
 
 static void cmd_id(void) {
@@ -385,11 +448,11 @@ static void cmd_id(void) {
     snprintf(buf, sizeof(buf),
              "uid=%u(%s) gid=%u(%s) groups=%u(%s)%s\n",
              uid, name, uid, name, uid, name, groups);
-    vga_write(buf, COLOUR_WHITE);
+    out(buf, COLOUR_WHITE);
 }
 
-static void cmd_passwd(void) {
-    const char* target = (arg_count > 1) ? args[1] : user_get_name();
+static void cmd_passwd(int argc, char** argv) {
+    const char* target = (argc > 1) ? argv[1] : user_get_name();
     if (strcmp(target, user_get_name()) != 0 && !user_is_root()) {
         vga_write("passwd: permission denied\n", COLOUR_LIGHT_RED); return;
     }
@@ -409,7 +472,33 @@ static void cmd_passwd(void) {
     vga_write("passwd: Not yet implemented\n", COLOUR_YELLOW);
 }
 
-static void cmd_exec_script(const char* path) {
+/* /bin/<cmd>, if it exists and may be run */
+static int bin_lookup(const char* cmd, char* path, usize size) {
+    if (strchr(cmd, '/')) return 0;
+    snprintf(path, size, "/bin/%s", cmd);
+    return fs_is_executable(path);
+}
+
+/* run an ELF executable in its own task and wait for it. it gets our
+ * fds 0-2, which for a pipeline stage are its pipes, and the console
+ * for any we do not have */
+static void cmd_exec_elf(const char* path, int argc, char** argv) {
+    struct file* io[3];
+    for (int fd = 0; fd < 3; fd++) io[fd] = fd_file(fd);
+    int pid = proc_exec_io(path, argc, argv, io);
+    for (int fd = 0; fd < 3; fd++) file_put(io[fd]);
+    if (pid < 0) {
+        char err[96];
+        snprintf(err, sizeof(err), "ksh: %s: cannot execute\n", path);
+        vga_write(err, COLOUR_LIGHT_RED);
+        return;
+    }
+    int status = 0;
+    proc_wait(pid, &status);
+}
+
+/* argv is what the program sees if path turns out to be an ELF binary */
+static void cmd_exec_script(const char* path, int argc, char** argv) {
     char abs[128];
     if (path[0] == '.' && path[1] == '/') {
         const char* cwd = fs_getcwd();
@@ -428,20 +517,29 @@ static void cmd_exec_script(const char* path) {
         abs[sizeof(abs) - 1] = '\0';
     }
 
-    char buf[4096];
-    int sz = fs_read(abs, buf, sizeof(buf) - 1);
+    char* buf = (char*)kmalloc(SCRIPT_MAX);     /* pipeline stages have small stacks */
+    if (!buf) return;
+    int sz = fs_read(abs, buf, SCRIPT_MAX - 1);
     if (sz < 0) {
         char err[96];
         snprintf(err, sizeof(err), "ksh: %s: No such file or directory\n", path);
-        vga_write(err, COLOUR_LIGHT_RED); return;
+        vga_write(err, COLOUR_LIGHT_RED);
+        kfree(buf);
+        return;
     }
     buf[sz] = '\0';
 
+    if (sz >= 4 && buf[0] == 0x7F && buf[1] == 'E' && buf[2] == 'L' && buf[3] == 'F') {
+        kfree(buf);
+        cmd_exec_elf(abs, argc, argv);
+        return;
+    }
+
     char* p = buf;
     /* skip shebang line if present */
     if (p[0] == '#' && p[1] == '!') {
         char* nl = strchr(p, '\n');
-        if (nl) p = nl + 1; else return;
+        p = nl ? nl + 1 : NULL;
     }
     while (p && *p) {
         char* nl = strchr(p, '\n');
@@ -459,15 +557,16 @@ static void cmd_exec_script(const char* path) {
         if (!nl) break;
         p = nl + 1;
     }
+    kfree(buf);
 }
 
-static void cmd_sudo(void) {
-    if (arg_count < 2) {
+static void cmd_sudo(int argc, char** argv) {
+    if (argc < 2) {
         vga_write("Usage: sudo [-l] <command> [args...]\n", COLOUR_LIGHT_RED);
         return;
     }
 
-    if (strcmp(args[1], "-l") == 0) {
+    if (strcmp(argv[1], "-l") == 0) {
         if (user_is_sudo()) {
             char buf[96];
             snprintf(buf, sizeof(buf),
@@ -484,7 +583,7 @@ static void cmd_sudo(void) {
         return;
     }
 
-    if (strcmp(args[1], "-i") == 0) {
+    if (strcmp(argv[1], "-i") == 0) {
         if (!user_is_sudo() && !user_is_root()) {
             char buf[80];
             snprintf(buf, sizeof(buf),
@@ -529,12 +628,12 @@ static void cmd_sudo(void) {
 
     char subcmd[BUFFER_SIZE];
     subcmd[0] = '\0';
-    for (int i = 1; i < arg_count; i++) {
+    for (int i = 1; i < argc; i++) {
         int l = (int)strlen(subcmd);
         if (i > 1 && l < BUFFER_SIZE - 2) {
             subcmd[l] = ' '; subcmd[l+1] = '\0'; l++;
         }
-        strncpy(subcmd + l, args[i], (usize)(BUFFER_SIZE - l - 1));
+        strncpy(subcmd + l, argv[i], (usize)(BUFFER_SIZE - l - 1));
     }
 
     user_sudo_elevate();
@@ -542,28 +641,130 @@ static void cmd_sudo(void) {
     user_sudo_drop();
 }
 
-static void cmd_useradd(void) {
+/* nice [-n adj] <cmd> | nice -p <pid> <value> | nice */
+static void cmd_nice(int argc, char** argv) {
+    u32 self = proc_get_pid();
+    if (argc == 1) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d\n", proc_get_nice(self));
+        vga_write(buf, COLOUR_WHITE); return;
+    }
+
+    if (strcmp(argv[1], "-p") == 0) {
+        if (argc < 4) {
+            vga_write("Usage: nice -p <pid> <value>\n", COLOUR_LIGHT_RED); return;
+        }
+        u32 pid = (u32)atoi(argv[2]);
+        int val = atoi(argv[3]);
+        if (val < proc_get_nice(pid) && !user_is_root()) {
+            vga_write("nice: cannot set niceness: Permission denied\n", COLOUR_LIGHT_RED); return;
+        }
+        if (proc_set_nice(pid, val) != 0) {
+            char err[64];
+            snprintf(err, sizeof(err), "nice: %s: No such process\n", argv[2]);
+            vga_write(err, COLOUR_LIGHT_RED);
+        }
+        return;
+    }
+
+    int adj = 10, start = 1;
+    if (strcmp(argv[1], "-n") == 0) {
+        if (argc < 4) {
+            vga_write("Usage: nice [-n adj] <command> [args...]\n", COLOUR_LIGHT_RED); return;
+        }
+        adj   = atoi(argv[2]);
+        start = 3;
+    }
+    if (adj < 0 && !user_is_root()) {
+        vga_write("nice: cannot set niceness: Permission denied\n", COLOUR_LIGHT_RED); return;
+    }
+
+    char subcmd[BUFFER_SIZE];
+    subcmd[0] = '\0';
+    for (int i = start; i < argc; i++) {
+        int l = (int)strlen(subcmd);
+        if (i > start && l < BUFFER_SIZE - 2) {
+            subcmd[l] = ' '; subcmd[l+1] = '\0'; l++;
+        }
+        strncpy(subcmd + l, argv[i], (usize)(BUFFER_SIZE - l - 1));
+    }
+
+    int old = proc_get_nice(self);
+    proc_set_nice(self, old + adj);
+    execute_command(subcmd);
+    proc_set_nice(self, old);
+}
+
+/* sched | sched -p <pid> <prio|fair> | sched <prio|fair> <cmd> */
+static int sched_parse_class(const char* name) {
+    if (strcmp(name, "prio") == 0) return SCHED_PRIO;
+    if (strcmp(name, "fair") == 0) return SCHED_FAIR;
+    return -1;
+}
+
+static void cmd_sched(int argc, char** argv) {
+    u32 self = proc_get_pid();
+    if (argc == 1) {
+        vga_write(proc_get_class(self) == SCHED_FAIR ? "fair\n" : "prio\n", COLOUR_WHITE);
+        return;
+    }
+
+    if (strcmp(argv[1], "-p") == 0) {
+        int cls = (argc >= 4) ? sched_parse_class(argv[3]) : -1;
+        if (cls < 0) {
+            vga_write("Usage: sched -p <pid> <prio|fair>\n", COLOUR_LIGHT_RED); return;
+        }
+        if (proc_set_class((u32)atoi(argv[2]), cls) != 0) {
+            char err[64];
+            snprintf(err, sizeof(err), "sched: %s: No such process\n", argv[2]);
+            vga_write(err, COLOUR_LIGHT_RED);
+        }
+        return;
+    }
+
+    int cls = sched_parse_class(argv[1]);
+    if (cls < 0 || argc < 3) {
+        vga_write("Usage: sched <prio|fair> <command> [args...]\n", COLOUR_LIGHT_RED); return;
+    }
+
+    char subcmd[BUFFER_SIZE];
+    subcmd[0] = '\0';
+    for (int i = 2; i < argc; i++) {
+        int l = (int)strlen(subcmd);
+        if (i > 2 && l < BUFFER_SIZE - 2) {
+            subcmd[l] = ' '; subcmd[l+1] = '\0'; l++;
+        }
+        strncpy(subcmd + l, argv[i], (usize)(BUFFER_SIZE - l - 1));
+    }
+
+    int old = proc_get_class(self);
+    proc_set_class(self, cls);
+    execute_command(subcmd);
+    proc_set_class(self, old);
+}
+
+static void cmd_useradd(int argc, char** argv) {
     if (!user_is_root()) {
         vga_write("useradd: permission denied\n", COLOUR_LIGHT_RED); return;
     }
     int add_sudo = 0;
     int uarg = 1;
 
-    if (arg_count > 1 && strcmp(args[1], "-G") == 0) {
-        if (arg_count < 3) {
+    if (argc > 1 && strcmp(argv[1], "-G") == 0) {
+        if (argc < 3) {
             vga_write("useradd: -G requires a group name\n", COLOUR_LIGHT_RED); return;
         }
-        if (strcmp(args[2], "sudo") == 0) add_sudo = 1;
+        if (strcmp(argv[2], "sudo") == 0) add_sudo = 1;
         uarg = 3;
     }
 
-    if (arg_count < uarg + 2) {
+    if (argc < uarg + 2) {
         vga_write("Usage: useradd [-G sudo] <user> <password>\n", COLOUR_LIGHT_RED);
         return;
     }
 
-    const char* uname = args[uarg];
-    const char* upass = args[uarg + 1];
+    const char* uname = argv[uarg];
+    const char* upass = argv[uarg + 1];
 
     if (user_add(uname, upass, 0) != 0) {
         vga_write("useradd: failed (user exists?)\n", COLOUR_LIGHT_RED); return;
@@ -576,68 +777,56 @@ static void cmd_useradd(void) {
     vga_write(msg, COLOUR_LIGHT_GREEN);
 }
 
-void execute_command(char* line) {
-    if (!line || !strlen(line)) return;
-
-    while (*line == ' ' || *line == '\t') line++;
-    if (!*line) return;
-
-    history_add(line);
+/* one command, already split into words */
+static void run_command(int argc, char** argv) {
+    if (argc == 0) return;
+    const char* cmd = argv[0];
+    char bin_path[64];
 
-    char* expanded = expand_alias(line);
-    if (expanded) {
-        char copy[BUFFER_SIZE];
-        strncpy(copy, expanded, sizeof(copy) - 1);
-        copy[sizeof(copy) - 1] = '\0';
-        execute_command(copy);
-        return;
-    }
-
-    parse_command(line);
-    if (arg_count == 0) return;
-    const char* cmd = args[0];
-
-    if      (strcmp(cmd, "cd")      == 0) cmd_cd(arg_count > 1 ? args[1] : NULL);
-    else if (strcmp(cmd, "ls")      == 0) cmd_ls(arg_count > 1 && strcmp(args[1], "-a") == 0);
+    if      (strcmp(cmd, "cd")      == 0) cmd_cd(argc > 1 ? argv[1] : NULL);
+    else if (strcmp(cmd, "ls")      == 0) cmd_ls(argc > 1 && strcmp(argv[1], "-a") == 0);
     else if (strcmp(cmd, "ll")      == 0) cmd_ls(0);
     else if (strcmp(cmd, "la")      == 0) cmd_ls(1);
-    else if (strcmp(cmd, "cat")     == 0) cmd_cat(args[1]);
-    else if (strcmp(cmd, "touch")   == 0) cmd_touch(args[1]);
-    else if (strcmp(cmd, "rm")      == 0) cmd_rm();
-    else if (strcmp(cmd, "mkdir")   == 0) cmd_mkdir(args[1]);
-    else if (strcmp(cmd, "cp")      == 0) cmd_cp();
-    else if (strcmp(cmd, "mv")      == 0) cmd_mv();
-    else if (strcmp(cmd, "echo")    == 0) cmd_echo();
-    else if (strcmp(cmd, "chmod")   == 0) cmd_chmod();
+    else if (strcmp(cmd, "cat")     == 0) cmd_cat(argv[1]);
+    else if (strcmp(cmd, "touch")   == 0) cmd_touch(argv[1]);
+    else if (strcmp(cmd, "rm")      == 0) cmd_rm(argc, argv);
+    else if (strcmp(cmd, "mkdir")   == 0) cmd_mkdir(argv[1]);
+    else if (strcmp(cmd, "cp")      == 0) cmd_cp(argc, argv);
+    else if (strcmp(cmd, "mv")      == 0) cmd_mv(argc, argv);
+    else if (strcmp(cmd, "sync")    == 0) {
+        if (fs_sync() < 0) vga_write("sync: could not flush the disk\n", COLOUR_LIGHT_RED);
+    }
+    else if (strcmp(cmd, "echo")    == 0) cmd_echo(argc, argv);
+    else if (strcmp(cmd, "chmod")   == 0) cmd_chmod(argc, argv);
     else if (strcmp(cmd, "clear")   == 0) clear_screen();
     else if (strcmp(cmd, "help")    == 0 || strcmp(cmd, "?") == 0) cmd_help();
     else if (strcmp(cmd, "history") == 0) history_show();
-    else if (strcmp(cmd, "uname")   == 0) cmd_uname();
+    else if (strcmp(cmd, "uname")   == 0) cmd_uname(argc, argv);
     else if (strcmp(cmd, "hostname")== 0) cmd_hostname();
     else if (strcmp(cmd, "id")      == 0) cmd_id();
     else if (strcmp(cmd, "whoami")  == 0) {
-        vga_write(user_get_name(), COLOUR_WHITE);
-        vga_write("\n", COLOUR_WHITE);
+        out(user_get_name(), COLOUR_WHITE);
+        out("\n", COLOUR_WHITE);
     }
     else if (strcmp(cmd, "pwd")     == 0) {
-        vga_write(fs_getcwd(), COLOUR_WHITE);
-        vga_write("\n", COLOUR_WHITE);
+        out(fs_getcwd(), COLOUR_WHITE);
+        out("\n", COLOUR_WHITE);
     }
     else if (strcmp(cmd, "groups")  == 0) {
-        vga_write(user_get_name(), COLOUR_WHITE);
-        if (user_is_sudo()) vga_write(" sudo", COLOUR_WHITE);
-        vga_write("\n", COLOUR_WHITE);
+        out(user_get_name(), COLOUR_WHITE);
+        if (user_is_sudo()) out(" sudo", COLOUR_WHITE);
+        out("\n", COLOUR_WHITE);
     }
     else if (strcmp(cmd, "alias")   == 0) {
-        if (arg_count == 1) list_aliases();
-        else if (arg_count >= 3) add_alias(args[1], args[2]);
+        if (argc == 1) list_aliases();
+        else if (argc >= 3) add_alias(argv[1], argv[2]);
         else vga_write("Usage: alias <name> <value>\n", COLOUR_LIGHT_RED);
     }
     else if (strcmp(cmd, "unalias") == 0) {
-        if (arg_count < 2) vga_write("Usage: unalias <name>\n", COLOUR_LIGHT_RED);
+        if (argc < 2) vga_write("Usage: unalias <name>\n", COLOUR_LIGHT_RED);
         else {
             for (int i = 0; i < alias_count; i++) {
-                if (strcmp(aliases[i].name, args[1]) == 0) {
+                if (strcmp(aliases[i].name, argv[1]) == 0) {
                     if (i < alias_count - 1)
                         memmove(&aliases[i], &aliases[i+1],
                                 (usize)(alias_count-i-1)*sizeof(alias_t));
@@ -648,27 +837,55 @@ void execute_command(char* line) {
         }
     }
     else if (strcmp(cmd, "ps")        == 0) {
-        char buf[1024]; proc_get_list(buf, sizeof(buf)); vga_write(buf, COLOUR_WHITE);
+        usize size = proc_list_size();
+        char* buf  = (char*)kmalloc(size);
+        if (buf) {
+            proc_get_list(buf, size);
+            out(buf, COLOUR_WHITE);
+            kfree(buf);
+        }
+    }
+    else if (strcmp(cmd, "ipcs")      == 0) {
+        shm_show(1);
+        mq_show(1);
+    }
+    else if (strcmp(cmd, "ipcrm")     == 0) cmd_ipcrm(argc, argv);
+    else if (strcmp(cmd, "lspci")     == 0) pci_show(1, argc > 1 && strcmp(argv[1], "-v") == 0);
+    else if (strcmp(cmd, "iostat")    == 0) {
+        if (argc > 1 && strcmp(argv[1], "-r") == 0) blk_reset_stats();
+        else blk_show(1);
     }
     else if (strcmp(cmd, "sysfetch")  == 0) sysfetch_run();
-    else if (strcmp(cmd, "sudo")      == 0) cmd_sudo();
-    else if (strcmp(cmd, "useradd")   == 0) cmd_useradd();
+    else if (strcmp(cmd, "bench")     == 0) bench_run(argc, argv);
+    else if (strcmp(cmd, "latency")   == 0) latency_run(argc, argv);
+    else if (strcmp(cmd, "lockstat")  == 0) {
+        if (argc > 1 && strcmp(argv[1], "-r") == 0) lockstat_reset();
+        else lockstat_show();
+    }
+    else if (strcmp(cmd, "syscalls")  == 0) {
+        if (argc > 1 && strcmp(argv[1], "-r") == 0) syscall_stats_reset();
+        else syscall_stats_show();
+    }
+    else if (strcmp(cmd, "nice")      == 0) cmd_nice(argc, argv);
+    else if (strcmp(cmd, "sched")     == 0) cmd_sched(argc, argv);
+    else if (strcmp(cmd, "sudo")      == 0) cmd_sudo(argc, argv);
+    else if (strcmp(cmd, "useradd")   == 0) cmd_useradd(argc, argv);
     else if (strcmp(cmd, "userdel")   == 0) {
-        if (arg_count < 2)          vga_write("Usage: userdel <user>\n", COLOUR_LIGHT_RED);
+        if (argc < 2)          vga_write("Usage: userdel <user>\n", COLOUR_LIGHT_RED);
         else if (!user_is_root())   vga_write("userdel: permission denied\n", COLOUR_LIGHT_RED);
-        else if (user_del(args[1]) == 0) {
-            char msg[64]; snprintf(msg, sizeof(msg), "userdel: '%s' removed\n", args[1]);
+        else if (user_del(argv[1]) == 0) {
+            char msg[64]; snprintf(msg, sizeof(msg), "userdel: '%s' removed\n", argv[1]);
             vga_write(msg, COLOUR_LIGHT_GREEN);
         } else vga_write("userdel: failed\n", COLOUR_LIGHT_RED);
     }
-    else if (strcmp(cmd, "passwd")    == 0) cmd_passwd();
+    else if (strcmp(cmd, "passwd")    == 0) cmd_passwd(argc, argv);
     else if (strcmp(cmd, "kittywrite")== 0) {
-        if (arg_count < 2) vga_write("Usage: kittywrite <file>\n", COLOUR_LIGHT_RED);
-        else kittywrite(args[1]);
+        if (argc < 2) vga_write("Usage: kittywrite <file>\n", COLOUR_LIGHT_RED);
+        else kittywrite(argv[1]);
     }
     else if (strcmp(cmd, "sh")        == 0 || strcmp(cmd, "source") == 0) {
-        if (arg_count < 2) vga_write("Usage: sh <script>\n", COLOUR_LIGHT_RED);
-        else cmd_exec_script(args[1]);
+        if (argc < 2) vga_write("Usage: sh <script>\n", COLOUR_LIGHT_RED);
+        else cmd_exec_script(argv[1], argc - 1, argv + 1);
     }
     else if (strcmp(cmd, "exit") == 0 || strcmp(cmd, "logout") == 0) {
         /* if user is in a sudo -i session, just drop elevation first */
@@ -691,7 +908,7 @@ void execute_command(char* line) {
             snprintf(err, sizeof(err), "ksh: %s: Permission denied\n", cmd);
             vga_write(err, COLOUR_LIGHT_RED);
         } else {
-            cmd_exec_script(cmd);
+            cmd_exec_script(cmd, argc, argv);
         }
     }
     /* bare name — only run if executable bit is set */
@@ -701,9 +918,13 @@ void execute_command(char* line) {
             snprintf(err, sizeof(err), "ksh: %s: Permission denied\n", cmd);
             vga_write(err, COLOUR_LIGHT_RED);
         } else {
-            cmd_exec_script(cmd);
+            cmd_exec_script(cmd, argc, argv);
         }
     }
+    /* then programs in /bin */
+    else if (bin_lookup(cmd, bin_path, sizeof(bin_path))) {
+        cmd_exec_script(bin_path, argc, argv);
+    }
     else {
         char err[96];
         snprintf(err, sizeof(err), "ksh: %s: command not found\n", cmd);
@@ -711,6 +932,112 @@ void execute_command(char* line) {
     }
 }
 
+/* ---------------------------------------------------------------
+ * pipelines: a | b | c. every stage runs at once in a task of its
+ * own, with fd 0 on the pipe from the stage before and fd 1 on the
+ * pipe to the next, so data streams through a page at a time instead
+ * of going through a file. builtins print through out(), programs
+ * from /bin inherit the fds.
+ * --------------------------------------------------------------- */
+
+typedef struct {
+    char         line[BUFFER_SIZE];
+    struct file* in;                /* a reference each, NULL: none */
+    struct file* out;
+} sh_stage_t;
+
+static void stage_thread(void* arg) {
+    sh_stage_t* st = (sh_stage_t*)arg;
+    if (st->in)  fd_install_file(0, st->in);
+    if (st->out) fd_install_file(1, st->out);
+    char* argv[MAX_ARGS];
+    int argc = parse_command(st->line, argv);
+    run_command(argc, argv);
+    kfree(st);
+    /* exiting closes our ends, which is the next stage's EOF */
+}
+
+static void run_pipeline(char* line) {
+    char* stages[MAX_STAGES];
+    int n = 0;
+    for (char* p = line; p; n++) {
+        if (n == MAX_STAGES) {
+            vga_write("ksh: too many pipeline stages\n", COLOUR_LIGHT_RED); return;
+        }
+        stages[n] = p;
+        p = strchr(p, '|');
+        if (p) *p++ = '\0';
+        char* w = stages[n];
+        while (*w == ' ' || *w == '\t') w++;
+        if (!*w) {
+            vga_write("ksh: syntax error near '|'\n", COLOUR_LIGHT_RED); return;
+        }
+    }
+
+    /* pipe i joins stage i to stage i + 1 */
+    struct file* rd[MAX_STAGES - 1];
+    struct file* wr[MAX_STAGES - 1];
+    int pipes = 0;
+    for (; pipes < n - 1; pipes++)
+        if (file_pipe(&rd[pipes], &wr[pipes]) < 0) break;
+
+    int pids[MAX_STAGES];
+    int started = 0;
+    if (pipes == n - 1) {
+        for (; started < n; started++) {
+            sh_stage_t* st = (sh_stage_t*)kmalloc(sizeof(sh_stage_t));
+            if (!st) break;
+            strncpy(st->line, stages[started], sizeof(st->line) - 1);
+            st->line[sizeof(st->line) - 1] = '\0';
+            st->in  = started > 0     ? file_get(rd[started - 1]) : NULL;
+            st->out = started < n - 1 ? file_get(wr[started])     : NULL;
+            pids[started] = kthread_create_joinable("ksh", stage_thread, st);
+            if (pids[started] < 0) {
+                file_put(st->in);
+                file_put(st->out);
+                kfree(st);
+                break;
+            }
+        }
+    }
+
+    /* the stages hold their own ends now. ours have to go, or the
+     * readers never see EOF; a stage that did not start leaves its
+     * neighbours with EOF or a broken pipe rather than a hang */
+    for (int i = 0; i < pipes; i++) {
+        file_put(rd[i]);
+        file_put(wr[i]);
+    }
+    if (started < n) vga_write("ksh: cannot start pipeline\n", COLOUR_LIGHT_RED);
+    for (int i = 0; i < started; i++) proc_wait(pids[i], NULL);
+}
+
+void execute_command(char* line) {
+    if (!line || !strlen(line)) return;
+
+    while (*line == ' ' || *line == '\t') line++;
+    if (!*line) return;
+
+    history_add(line);
+
+    char* expanded = expand_alias(line);
+    if (expanded) {
+        char copy[BUFFER_SIZE];
+        strncpy(copy, expanded, sizeof(copy) - 1);
+        copy[sizeof(copy) - 1] = '\0';
+        execute_command(copy);
+        return;
+    }
+
+    if (strchr(line, '|')) {
+        run_pipeline(line);
+        return;
+    }
+    char* argv[MAX_ARGS];
+    int argc = parse_command(line, argv);
+    run_command(argc, argv);
+}
+
 void shell_init(void) {
     add_alias("..",   "cd ..");
     add_alias("...",  "cd ../..");
@@ -0,0 +1,141 @@
+#include "kernel.h"
+#include "smp.h"
+#include "vmm.h"
+#include "syscall.h"
+#include "ipc.h"
+
+/* the segments, named or on their way out; shm_lock covers the list
+ * and the names, refs are atomics so a mapping can drop one without it */
+
+DEFINE_LOCK_CLASS(shm, "spin");
+static spinlock_t shm_lock = SPINLOCK_INIT(shm);
+static shm_t*     shm_list;
+
+static shm_t* shm_find(const char* name) {
+    for (shm_t* s = shm_list; s; s = s->next)
+        if (s->linked && strcmp(s->name, name) == 0) return s;
+    return NULL;
+}
+
+static void shm_free(shm_t* s) {
+    for (u32 i = 0; i < s->npages; i++)
+        page_free(s->frames[i]);
+    kfree(s->frames);
+    kfree(s);
+}
+
+static shm_t* shm_alloc(const char* name, u32 size) {
+    shm_t* s = (shm_t*)kmalloc(sizeof(shm_t));
+    if (!s) return NULL;
+    memset(s, 0, sizeof(shm_t));
+    strncpy(s->name, name, IPC_NAME_MAX - 1);
+    s->frames = (u32*)kmalloc(((size + PAGE_SIZE - 1) / PAGE_SIZE) * sizeof(u32));
+    if (!s->frames) {
+        kfree(s);
+        return NULL;
+    }
+    for (; s->npages < (size + PAGE_SIZE - 1) / PAGE_SIZE; s->npages++) {
+        s->frames[s->npages] = page_alloc();
+        if (!s->frames[s->npages]) {
+            shm_free(s);
+            return NULL;
+        }
+    }
+    s->refs   = 2;                      /* the name and the caller */
+    s->linked = 1;
+    return s;
+}
+
+/* the segment called name, created size bytes big (zeroed) if it does
+ * not exist and create is set; a reference for the caller */
+shm_t* shm_get(const char* name, u32 size, int create) {
+    if (!name || !name[0] || strlen(name) >= IPC_NAME_MAX) return NULL;
+
+    u32 flags = spin_lock_irqsave(&shm_lock);
+    shm_t* s = shm_find(name);
+    if (s) __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+    spin_unlock_irqrestore(&shm_lock, flags);
+    if (s || !create || size == 0 || size > SHM_MAX_SIZE) return s;
+
+    /* zeroing the frames can take a while, so not under the lock */
+    shm_t* made = shm_alloc(name, size);
+    if (!made) return NULL;
+    flags = spin_lock_irqsave(&shm_lock);
+    s = shm_find(name);
+    if (s) {
+        __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+    } else {
+        made->next = shm_list;
+        shm_list   = made;
+    }
+    spin_unlock_irqrestore(&shm_lock, flags);
+    if (s) shm_free(made);              /* somebody else got there first */
+    return s ? s : made;
+}
+
+void shm_put(shm_t* s) {
+    if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    u32 flags = spin_lock_irqsave(&shm_lock);
+    shm_t** ps = &shm_list;
+    while (*ps && *ps != s) ps = &(*ps)->next;
+    if (*ps) *ps = s->next;
+    spin_unlock_irqrestore(&shm_lock, flags);
+    shm_free(s);
+}
+
+u32 shm_frame(shm_t* s, u32 index) {
+    return index < s->npages ? s->frames[index] : 0;
+}
+
+/* drop the name; mappings keep the frames until they go */
+int shm_unlink(const char* name) {
+    u32 flags = spin_lock_irqsave(&shm_lock);
+    shm_t* s = shm_find(name);
+    if (s) s->linked = 0;
+    spin_unlock_irqrestore(&shm_lock, flags);
+    if (!s) return -1;
+    shm_put(s);
+    return 0;
+}
+
+/* map the whole segment into the current task between SHM_BASE and
+ * SHM_END; pages come in on first touch like any other area */
+int shm_map(const char* name, u32 size, int flags) {
+    mm_t* mm = get_current()->mm;
+    if (!mm) return -1;
+    shm_t* s = shm_get(name, size, flags & O_CREAT);
+    if (!s) return -1;
+
+    u32 len   = s->npages * PAGE_SIZE;
+    u32 start = mm_find_gap(mm, SHM_BASE, SHM_END, len);
+    u32 vma   = (flags & O_ACCMODE) == O_RDONLY ? 0 : VMA_WRITE;
+    if (!start || mm_add_shm(mm, start, start + len, vma, s) < 0) {
+        shm_put(s);
+        return -1;
+    }
+    __atomic_add_fetch(&s->maps, 1, __ATOMIC_RELAXED);
+    return (int)start;
+}
+
+int shm_unmap(u32 addr) {
+    mm_t* mm = get_current()->mm;
+    if (!mm || addr < SHM_BASE || addr >= SHM_END) return -1;
+    return mm_remove_area(mm, addr);
+}
+
+/* formatted under the lock and printed after it, since fd may be a
+ * pipe that blocks */
+void shm_show(int fd) {
+    char* text = (char*)kmalloc(IPC_SHOW_MAX);
+    if (!text) return;
+    usize len = 0;
+    u32 flags = spin_lock_irqsave(&shm_lock);
+    for (shm_t* s = shm_list; s && len < IPC_SHOW_MAX - 1; s = s->next)
+        len += (usize)snprintf(text + len, IPC_SHOW_MAX - len, "  %-24s %6u KiB %5u %5u%s\n",
+                               s->name, s->npages * (PAGE_SIZE / 1024), s->refs, s->maps,
+                               s->linked ? "" : "  unlinked");
+    spin_unlock_irqrestore(&shm_lock, flags);
+    fd_puts(fd, "  segment                        size  refs  maps\n", COLOUR_YELLOW);
+    if (len) fd_puts(fd, text, COLOUR_WHITE);
+    kfree(text);
+}
@@ -0,0 +1,230 @@
+#include "kernel.h"
+#include "idt.h"
+#include "smp.h"
+#include "vmm.h"
+
+#define LAPIC_ID          0x020
+#define LAPIC_TPR         0x080
+#define LAPIC_EOI         0x0B0
+#define LAPIC_SVR         0x0F0
+#define LAPIC_ICR_LO      0x300
+#define LAPIC_ICR_HI      0x310
+#define LAPIC_LVT_TIMER   0x320
+#define LAPIC_TIMER_INIT  0x380
+#define LAPIC_TIMER_CUR   0x390
+#define LAPIC_TIMER_DIV   0x3E0
+
+#define SVR_ENABLE        0x100
+#define ICR_INIT          0x00000500
+#define ICR_STARTUP       0x00000600
+#define ICR_PENDING       0x00001000
+#define ICR_ASSERT        0x00004000
+#define LVT_MASKED        0x00010000
+#define LVT_PERIODIC      0x00020000
+#define TIMER_DIV_16      0x3
+
+#define AP_BOOT_TIMEOUT_US 100000
+
+_Static_assert(__builtin_offsetof(cpu_t, self)    == PERCPU_SELF,    "percpu.h");
+_Static_assert(__builtin_offsetof(cpu_t, current) == PERCPU_CURRENT, "percpu.h");
+_Static_assert(__builtin_offsetof(cpu_t, id)      == PERCPU_ID,      "percpu.h");
+_Static_assert(__builtin_offsetof(cpu_t, preempt_count) == PERCPU_PREEMPT, "percpu.h");
+_Static_assert(__builtin_offsetof(cpu_t, need_resched)  == PERCPU_RESCHED, "percpu.h");
+/* isr.asm finds the per-CPU segment from the TSS selector in TR */
+_Static_assert(GDT_PERCPU(0) - GDT_TSS(0) == 8 * MAX_CPUS, "isr.asm");
+
+cpu_t cpus[MAX_CPUS];
+u32   nr_cpus = 1;
+
+static volatile u32* lapic;
+static u32           lapic_timer_count;   /* LAPIC timer ticks per TIMER_HZ tick */
+static volatile u32  ap_booting;
+
+/* boot/ap_start.asm */
+extern u8 ap_trampoline_start[];
+extern u8 ap_trampoline_end[];
+extern u8 ap_stack_slot[];
+extern u8 ap_entry_slot[];
+
+/* where a trampoline symbol ends up once copied to AP_TRAMPOLINE */
+#define AP_RELOC(sym) ((u32*)(AP_TRAMPOLINE + (u32)((sym) - ap_trampoline_start)))
+
+static u32 lapic_read(u32 reg) {
+    return lapic[reg / 4];
+}
+
+static void lapic_write(u32 reg, u32 val) {
+    lapic[reg / 4] = val;
+    (void)lapic[LAPIC_ID / 4];    /* wait for the write to land */
+}
+
+static void udelay(u32 us) {
+    u64 end = rdtsc() + div64_u32((u64)us * tsc_khz, 1000);
+    while (rdtsc() < end) cpu_relax();
+}
+
+static int cpu_has_apic(void) {
+    u32 a = 1, b, c, d;
+    __asm__ volatile ("cpuid" : "+a"(a), "=b"(b), "=c"(c), "=d"(d));
+    return (d >> 9) & 1;
+}
+
+u32 lapic_id(void) {
+    return lapic ? lapic_read(LAPIC_ID) >> 24 : 0;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void lapic_enable(void) {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, SVR_ENABLE | VEC_SPURIOUS);
+}
+
+static void lapic_icr(u32 apic_id, u32 low) {
+    while (lapic_read(LAPIC_ICR_LO) & ICR_PENDING) cpu_relax();
+    lapic_write(LAPIC_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, low);
+}
+
+void lapic_send_ipi(u32 apic_id, u8 vector) {
+    u32 flags = irq_save();
+    lapic_icr(apic_id, vector);
+    irq_restore(flags);
+}
+
+/* poke another CPU into its scheduler, e.g. an idle one that has just
+ * been handed work */
+void smp_kick(u32 cpu) {
+    if (cpu >= nr_cpus || cpu == this_cpu()->id) return;
+    lapic_send_ipi(cpus[cpu].apic_id, VEC_RESCHED);
+}
+
+/* count LAPIC timer ticks over one scheduler tick; the bus clock is the
+ * same on every CPU so the BSP does this once for everyone */
+static void lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    udelay(1000000 / TIMER_HZ);
+    lapic_timer_count = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+/* the PIT only interrupts the BSP, the APs tick off their own LAPIC */
+static void lapic_timer_start(void) {
+    lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, VEC_LAPIC_TIMER | LVT_PERIODIC);
+    lapic_write(LAPIC_TIMER_INIT, lapic_timer_count);
+}
+
+/* the count reloads as the interrupt fires, so what it has run down
+ * since is our interrupt latency */
+static void lapic_timer_irq(regs_t* r) {
+    (void)r;
+    u32 late = lapic_timer_count - lapic_read(LAPIC_TIMER_CUR);
+    u64 per_tick = div64_u32((u64)tsc_khz * 1000, TIMER_HZ);
+    this_cpu()->tick_tsc = rdtsc() - div64_u32((u64)late * per_tick, lapic_timer_count);
+    sched_tick();
+}
+
+static void resched_irq(regs_t* r) {
+    (void)r;
+    sched_resched_ipi();
+}
+
+/* set up cpus[] and point this CPU's %gs at cpus[0]; needs gdt_init() */
+void smp_early_init(void) {
+    memset(cpus, 0, sizeof(cpus));
+    for (u32 i = 0; i < MAX_CPUS; i++) {
+        cpus[i].self = &cpus[i];
+        cpus[i].id   = i;
+        ticket_lock_init(&cpus[i].rq.lock, &lock_class_runqueue);
+        cpus[i].tss.ss0        = GDT_KERNEL_DATA;
+        cpus[i].tss.iomap_base = sizeof(tss_t);    /* no I/O bitmap */
+        gdt_set_percpu(i, (u32)&cpus[i]);
+        gdt_set_tss(i, (u32)&cpus[i].tss);
+    }
+    cpus[0].online = 1;
+    gdt_load_cpu(0);
+}
+
+/* first C code on an AP, running on its idle task's stack */
+static void ap_main(void) {
+    cpu_t* cpu = &cpus[ap_booting];
+    vmm_init_cpu();
+    gdt_load_cpu(cpu->id);
+    idt_load();
+    syscall_init();
+    lapic_enable();
+    lapic_timer_start();
+
+    cpu->idle->exec_start = rdtsc();
+    cpu->online = 1;
+    cpu_idle();
+}
+
+static int ap_start(u32 cpu, u8 apic_id) {
+    process_t* idle = proc_create_idle(cpu);
+    if (!idle) return -1;
+
+    cpus[cpu].apic_id = apic_id;
+    ap_booting = cpu;
+    *AP_RELOC(ap_stack_slot) = (u32)(idle->stack + PROCESS_STACK_SIZE / 4);
+    *AP_RELOC(ap_entry_slot) = (u32)ap_main;
+
+    /* INIT, then the STARTUP IPI twice as the MP spec asks; its vector
+     * is the page number of the trampoline */
+    lapic_icr(apic_id, ICR_INIT | ICR_ASSERT);
+    udelay(10000);
+    for (int i = 0; i < 2 && !cpus[cpu].online; i++) {
+        lapic_icr(apic_id, ICR_STARTUP | (AP_TRAMPOLINE >> 12));
+        udelay(200);
+    }
+
+    for (u32 waited = 0; !cpus[cpu].online && waited < AP_BOOT_TIMEOUT_US; waited += 100)
+        udelay(100);
+    if (cpus[cpu].online) return 0;
+
+    /* given up on: INIT again parks it waiting for a STARTUP that never
+     * comes, so it is off the idle stack before that is freed */
+    lapic_icr(apic_id, ICR_INIT | ICR_ASSERT);
+    udelay(10000);
+    cpus[cpu].online  = 0;
+    cpus[cpu].apic_id = 0;
+    ap_booting = 0;
+    proc_free_idle(cpu);
+    return -1;
+}
+
+/* find the other CPUs in the MADT and bring them up one at a time; they
+ * start out idle and pick up work by stealing it */
+void smp_init(void) {
+    if (!cpu_has_apic()) return;
+
+    u8  apic_ids[MAX_CPUS];
+    u32 base = LAPIC_DEFAULT;
+    int n = madt_parse(apic_ids, MAX_CPUS, &base);
+
+    lapic = (volatile u32*)base;
+    lapic_enable();
+    cpus[0].apic_id = lapic_id();
+    lapic_timer_calibrate();
+    local_vector_register(VEC_LAPIC_TIMER, lapic_timer_irq);
+    local_vector_register(VEC_RESCHED, resched_irq);
+
+    memcpy((void*)AP_TRAMPOLINE, ap_trampoline_start,
+           (usize)(ap_trampoline_end - ap_trampoline_start));
+
+    for (int i = 0; i < n && nr_cpus < MAX_CPUS; i++) {
+        if (apic_ids[i] == cpus[0].apic_id) continue;
+        if (ap_start(nr_cpus, apic_ids[i]) < 0) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "smp: cpu with apic id %u did not start\n", apic_ids[i]);
+            vga_write(buf, COLOUR_LIGHT_RED);
+            break;
+        }
+        nr_cpus++;
+    }
+}
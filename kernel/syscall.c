@@ -1,26 +1,313 @@
 #include "kernel.h"
+#include "idt.h"
+#include "smp.h"
+#include "vmm.h"
+#include "syscall.h"
+#include "futex.h"
+#include "ipc.h"
 
-u64 syscall(u64 num, u64 a1, u64 a2, u64 a3, u64 a4, u64 a5) {
-    (void)a2; (void)a3; (void)a4; (void)a5; /* unused */
-
-    switch (num) {
-        case 0:
-            proc_exit((int)a1);
-            break;
-        case 1:
-            /* safe 64 to 32-bit pointer conversion */
-            {
-                u32 ptr = (u32)a1;
-                kprint((const char*)ptr);
-                return strlen((const char*)ptr);
-            }
-        default:
-            break;
-    }
+#define MSR_SYSENTER_CS   0x174
+#define MSR_SYSENTER_ESP  0x175
+#define MSR_SYSENTER_EIP  0x176
+
+#define CPUID_SEP         (1u << 11)
+
+typedef int (*syscall_fn_t)(u32 a, u32 b, u32 c);
+
+/* per CPU so the hot path needs no atomics; only touched with
+ * interrupts off. cycles run from entry to return, sleeps included */
+typedef struct {
+    u32 calls;
+    u64 cycles;
+} syscall_stat_t;
+
+static syscall_stat_t syscall_stats[MAX_CPUS][NR_SYSCALLS];
+static int            sysenter_ok;
+
+/* boot/isr.asm */
+extern void sysenter_entry(void);
+
+static inline void wrmsr(u32 msr, u32 lo, u32 hi) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"(lo), "d"(hi));
+}
+
+/* ---------------------------------------------------------------
+ * the calls. arguments are raw register values; pointers are checked
+ * against the caller's address space before anything touches them
+ * --------------------------------------------------------------- */
+
+static int sys_exit(u32 code, u32 b, u32 c) {
+    (void)b; (void)c;
+    proc_exit((int)code);
+    return 0;
+}
+
+static int sys_read(u32 fd, u32 buf, u32 count) {
+    if (!user_range_ok(buf, count, 1)) return -1;
+    return fd_read((int)fd, (void*)buf, count);
+}
+
+static int sys_write(u32 fd, u32 buf, u32 count) {
+    if (!user_range_ok(buf, count, 0)) return -1;
+    return fd_write((int)fd, (const void*)buf, count);
+}
+
+static int sys_open(u32 path, u32 flags, u32 c) {
+    (void)c;
+    char kpath[128];
+    if (user_strncpy(kpath, path, sizeof(kpath)) < 0) return -1;
+    return fd_open(kpath, (int)flags);
+}
+
+static int sys_close(u32 fd, u32 b, u32 c) {
+    (void)b; (void)c;
+    return fd_close((int)fd);
+}
 
+static int sys_yield(u32 a, u32 b, u32 c) {
+    (void)a; (void)b; (void)c;
+    proc_yield();
     return 0;
 }
 
+static int sys_sleep(u32 ms, u32 b, u32 c) {
+    (void)b; (void)c;
+    if (ms > 0x7FFFFFFF / TIMER_HZ) ms = 0x7FFFFFFF / TIMER_HZ;
+    u32 ticks = (ms * TIMER_HZ + 999) / 1000;
+    if (ticks) proc_sleep(ticks);
+    else       proc_yield();
+    return 0;
+}
+
+static int sys_getpid(u32 a, u32 b, u32 c) {
+    (void)a; (void)b; (void)c;
+    return (int)proc_get_pid();
+}
+
+static int sys_fstat(u32 fd, u32 st, u32 c) {
+    (void)c;
+    if (!user_range_ok(st, sizeof(kstat_t), 1)) return -1;
+    return fd_fstat((int)fd, (kstat_t*)st);
+}
+
+static int sys_ring_setup(u32 entries, u32 b, u32 c) {
+    (void)b; (void)c;
+    return ring_setup(entries);
+}
+
+static int sys_ring_enter(u32 to_submit, u32 min_complete, u32 c) {
+    (void)c;
+    return ring_enter(to_submit, min_complete);
+}
+
+static int sys_clock_ns(u32 ns, u32 b, u32 c) {
+    (void)b; (void)c;
+    if (!user_range_ok(ns, sizeof(u64), 1)) return -1;
+    *(u64*)ns = clock_ns();
+    return 0;
+}
+
+static int sys_futex_wait(u32 addr, u32 expected, u32 timeout_ms) {
+    if (!user_range_ok(addr, 4, 0)) return -1;
+    return futex_wait((u32*)addr, expected, timeout_ms);
+}
+
+static int sys_futex_wake(u32 addr, u32 n, u32 c) {
+    (void)c;
+    if (!user_range_ok(addr, 4, 0)) return -1;
+    return futex_wake((u32*)addr, n > 0x7FFFFFFF ? 0x7FFFFFFF : (int)n);
+}
+
+static int sys_pipe(u32 fds, u32 b, u32 c) {
+    (void)b; (void)c;
+    if (!user_range_ok(fds, 2 * sizeof(int), 1)) return -1;
+    return fd_pipe((int*)fds);
+}
+
+static int sys_shm_map(u32 name, u32 size, u32 flags) {
+    char kname[IPC_NAME_MAX];
+    if (user_strncpy(kname, name, sizeof(kname)) < 0) return -1;
+    return shm_map(kname, size, (int)flags);
+}
+
+static int sys_shm_unmap(u32 addr, u32 b, u32 c) {
+    (void)b; (void)c;
+    return shm_unmap(addr);
+}
+
+static int sys_shm_unlink(u32 name, u32 b, u32 c) {
+    (void)b; (void)c;
+    char kname[IPC_NAME_MAX];
+    if (user_strncpy(kname, name, sizeof(kname)) < 0) return -1;
+    return shm_unlink(kname);
+}
+
+static int sys_mq_open(u32 name, u32 flags, u32 depth) {
+    char kname[IPC_NAME_MAX];
+    if (user_strncpy(kname, name, sizeof(kname)) < 0) return -1;
+    return fd_mq_open(kname, (int)flags, depth);
+}
+
+static int sys_mq_send_pages(u32 fd, u32 buf, u32 npages) {
+    mq_t* q = fd_mq((int)fd);
+    if (!q) return -1;
+    return mq_send_pages(q, buf, npages);
+}
+
+static int sys_mq_receive(u32 fd, u32 buf, u32 len) {
+    mq_t* q = fd_mq((int)fd);
+    if (!q || !user_range_ok(buf, len, 1)) return -1;
+    return mq_receive(q, (void*)buf, len, 1);
+}
+
+static int sys_mq_unlink(u32 name, u32 b, u32 c) {
+    (void)b; (void)c;
+    char kname[IPC_NAME_MAX];
+    if (user_strncpy(kname, name, sizeof(kname)) < 0) return -1;
+    return mq_unlink(kname);
+}
+
+static const syscall_fn_t syscall_table[NR_SYSCALLS] = {
+    [SYS_EXIT]       = sys_exit,
+    [SYS_READ]       = sys_read,
+    [SYS_WRITE]      = sys_write,
+    [SYS_OPEN]       = sys_open,
+    [SYS_CLOSE]      = sys_close,
+    [SYS_YIELD]      = sys_yield,
+    [SYS_SLEEP]      = sys_sleep,
+    [SYS_GETPID]     = sys_getpid,
+    [SYS_FSTAT]      = sys_fstat,
+    [SYS_RING_SETUP] = sys_ring_setup,
+    [SYS_RING_ENTER] = sys_ring_enter,
+    [SYS_CLOCK_NS]   = sys_clock_ns,
+    [SYS_FUTEX_WAIT] = sys_futex_wait,
+    [SYS_FUTEX_WAKE] = sys_futex_wake,
+    [SYS_PIPE]       = sys_pipe,
+    [SYS_SHM_MAP]    = sys_shm_map,
+    [SYS_SHM_UNMAP]  = sys_shm_unmap,
+    [SYS_SHM_UNLINK] = sys_shm_unlink,
+    [SYS_MQ_OPEN]    = sys_mq_open,
+    [SYS_MQ_SEND_PAGES] = sys_mq_send_pages,
+    [SYS_MQ_RECEIVE] = sys_mq_receive,
+    [SYS_MQ_UNLINK]  = sys_mq_unlink,
+};
+
+static const char* syscall_names[NR_SYSCALLS] = {
+    [SYS_EXIT]       = "exit",
+    [SYS_READ]       = "read",
+    [SYS_WRITE]      = "write",
+    [SYS_OPEN]       = "open",
+    [SYS_CLOSE]      = "close",
+    [SYS_YIELD]      = "yield",
+    [SYS_SLEEP]      = "sleep",
+    [SYS_GETPID]     = "getpid",
+    [SYS_FSTAT]      = "fstat",
+    [SYS_RING_SETUP] = "ring_setup",
+    [SYS_RING_ENTER] = "ring_enter",
+    [SYS_CLOCK_NS]   = "clock_ns",
+    [SYS_FUTEX_WAIT] = "futex_wait",
+    [SYS_FUTEX_WAKE] = "futex_wake",
+    [SYS_PIPE]       = "pipe",
+    [SYS_SHM_MAP]    = "shm_map",
+    [SYS_SHM_UNMAP]  = "shm_unmap",
+    [SYS_SHM_UNLINK] = "shm_unlink",
+    [SYS_MQ_OPEN]    = "mq_open",
+    [SYS_MQ_SEND_PAGES] = "mq_sendpages",
+    [SYS_MQ_RECEIVE] = "mq_receive",
+    [SYS_MQ_UNLINK]  = "mq_unlink",
+};
+
+int syscall_dispatch(u32 num, u32 a, u32 b, u32 c, u32 d, u32 e) {
+    (void)d; (void)e;           /* nothing takes more than three yet */
+    if (num >= NR_SYSCALLS || !syscall_table[num]) return -1;
+    return syscall_table[num](a, b, c);
+}
+
+/* both entry paths land here with interrupts off and the caller's
+ * registers in r; the call itself runs with them on */
+void syscall_handle(regs_t* r) {
+    u32 num = r->eax;
+    if (num >= NR_SYSCALLS) {
+        r->eax = (u32)-1;
+        return;
+    }
+    syscall_stats[this_cpu_id()][num].calls++;
+    u64 start = rdtsc();
+    interrupts_enable();
+    r->eax = (u32)syscall_dispatch(num, r->ebx, r->ecx, r->edx, r->esi, r->edi);
+    interrupts_disable();
+    syscall_stats[this_cpu_id()][num].cycles += rdtsc() - start;
+}
+
+/* sysenter_entry has built an int 0x80 style frame, minus the return
+ * address, which the caller left on top of its stack */
+void sysenter_dispatch(regs_t* r) {
+    interrupts_enable();
+    if (!user_range_ok(r->useresp, 4, 0)) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "pid %u: bad sysenter stack %x, killed\n",
+                 proc_get_pid(), r->useresp);
+        vga_write(buf, COLOUR_LIGHT_RED);
+        proc_exit(128 + 14);
+    }
+    r->eip      = *(u32*)r->useresp;
+    r->useresp += 4;
+    interrupts_disable();
+    syscall_handle(r);
+    preempt_schedule_irq();
+}
+
+/* per CPU: SYSENTER takes its stack from an MSR, which we point at
+ * this CPU's tss.esp0 so the entry code can load the running task's
+ * kernel stack from there */
+void syscall_init(void) {
+    u32 a = 1, b, c, d;
+    __asm__ volatile ("cpuid" : "+a"(a), "=b"(b), "=c"(c), "=d"(d));
+    if (!(d & CPUID_SEP)) return;
+
+    wrmsr(MSR_SYSENTER_CS,  GDT_KERNEL_CODE, 0);
+    wrmsr(MSR_SYSENTER_ESP, (u32)&this_cpu()->tss.esp0, 0);
+    wrmsr(MSR_SYSENTER_EIP, (u32)sysenter_entry, 0);
+    sysenter_ok = 1;
+}
+
+int syscall_sysenter_ok(void) {
+    return sysenter_ok;
+}
+
+/* calls to syscall num and the cycles they took, summed over CPUs */
+void syscall_stat(u32 num, u32* calls, u64* cycles) {
+    *calls  = 0;
+    *cycles = 0;
+    if (num >= NR_SYSCALLS) return;
+    for (u32 i = 0; i < MAX_CPUS; i++) {
+        *calls  += syscall_stats[i][num].calls;
+        *cycles += syscall_stats[i][num].cycles;
+    }
+}
+
+void syscall_stats_show(void) {
+    char buf[80];
+    vga_write("syscall         calls     avg cycles    avg ns\n", COLOUR_YELLOW);
+    for (u32 n = 0; n < NR_SYSCALLS; n++) {
+        u32 calls;
+        u64 cycles;
+        syscall_stat(n, &calls, &cycles);
+        u64 avg = calls ? div64_u32(cycles, calls) : 0;
+        snprintf(buf, sizeof(buf), "%-12s %8u %14u %9u\n",
+                 syscall_names[n], calls, (u32)avg, (u32)tsc_to_ns(avg));
+        vga_write(buf, COLOUR_WHITE);
+    }
+    snprintf(buf, sizeof(buf), "entry: int 0x80%s\n", sysenter_ok ? ", sysenter" : "");
+    vga_write(buf, COLOUR_WHITE);
+}
+
+void syscall_stats_reset(void) {
+    u32 flags = irq_save();
+    memset(syscall_stats, 0, sizeof(syscall_stats));
+    irq_restore(flags);
+}
+
 void kprint(const char* str) {
     vga_write(str, 0x0F);  /* print with default white color */
 }
@@ -0,0 +1,72 @@
+#include "kernel.h"
+#include "idt.h"
+#include "smp.h"
+
+#define PIT_CH0       0x40
+#define PIT_CH2       0x42
+#define PIT_CMD       0x43
+#define PIT_GATE      0x61
+#define PIT_FREQ      1193182
+#define CALIBRATE_MS  10
+
+u32 tsc_khz = 0;
+
+static u16 pit_divisor;
+
+/* ch0 counts down from pit_divisor and raises IRQ0 as it wraps, so
+ * what it has counted off since then is how late we are getting here */
+static u64 pit_irq_delay(void) {
+    outb(PIT_CMD, 0x00);                              /* latch ch0 */
+    u16 count = inb(PIT_CH0);
+    count |= (u16)inb(PIT_CH0) << 8;
+    u32 ticks = count <= pit_divisor ? pit_divisor - count : 0;
+    return div64_u32((u64)ticks * tsc_khz * 1000, PIT_FREQ);
+}
+
+static void timer_irq(regs_t* r) {
+    (void)r;
+    u64 tsc = rdtsc() - pit_irq_delay();
+    this_cpu()->tick_tsc = tsc;
+    timer_handler();
+    vvar_tick(tsc);
+}
+
+/* count TSC cycles across a 10 ms one-shot on PIT channel 2 (the speaker
+ * channel, polled through port 0x61 so no interrupt is needed). kmain
+ * does this early so drivers can time out before the timer runs */
+void tsc_calibrate(void) {
+    u16 count = PIT_FREQ / (1000 / CALIBRATE_MS);
+
+    outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);   /* gate on, speaker off */
+    outb(PIT_CMD, 0xB0);                              /* ch2, lo/hi, mode 0 */
+    outb(PIT_CH2, count & 0xFF);
+    outb(PIT_CH2, (count >> 8) & 0xFF);
+
+    u64 start = rdtsc();
+    while (!(inb(PIT_GATE) & 0x20)) { /* spin */ }
+    u64 end = rdtsc();
+
+    tsc_khz = (u32)div64_u32(end - start, CALIBRATE_MS);
+    if (tsc_khz == 0) tsc_khz = 1;
+}
+
+void timer_init(void) {
+    if (!tsc_khz) tsc_calibrate();
+
+    /* mode 2 rather than the square wave: it counts down once per
+     * period, which pit_irq_delay() relies on */
+    pit_divisor = PIT_FREQ / TIMER_HZ;
+    outb(PIT_CMD, 0x34);                              /* ch0, lo/hi, mode 2 */
+    outb(PIT_CH0, pit_divisor & 0xFF);
+    outb(PIT_CH0, (pit_divisor >> 8) & 0xFF);
+
+    irq_register(IRQ_TIMER, timer_irq);
+}
+
+u64 tsc_to_us(u64 cycles) {
+    return div64_u32(cycles * 1000, tsc_khz);
+}
+
+u64 tsc_to_ns(u64 cycles) {
+    return div64_u32(cycles * 1000000, tsc_khz);
+}
@@ -5,6 +5,8 @@
 struct tty ttys[MAX_TTYS];
 int current_tty = 0;
 
+DEFINE_LOCK_CLASS(tty_input, "spin");
+
 static void tty_save_screen(struct tty* t) {
     volatile u16* vga = (volatile u16*)VIDEO_MEMORY;
     for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
@@ -24,6 +26,8 @@ void tty_init(void) {
         ttys[i].id       = i;
         ttys[i].in_head  = 0;
         ttys[i].in_tail  = 0;
+        spin_lock_init(&ttys[i].in_lock, &lock_class_tty_input);
+        wait_queue_init(&ttys[i].in_wait);
         ttys[i].cursor_x = 0;
         ttys[i].cursor_y = 0;
         ttys[i].active   = (i == 0);
@@ -56,9 +60,13 @@ void tty_write(const char* str, u8 color) {
 
 int tty_getc(void) {
     struct tty* t = &ttys[current_tty];
-    if (t->in_head == t->in_tail) return 0;
-    int c = (u8)t->input_buf[t->in_tail];
-    t->in_tail = (t->in_tail + 1) % TTY_BUF_SIZE;
+    u32 flags = spin_lock_irqsave(&t->in_lock);
+    int c = 0;
+    if (t->in_head != t->in_tail) {
+        c = (u8)t->input_buf[t->in_tail];
+        t->in_tail = (t->in_tail + 1) % TTY_BUF_SIZE;
+    }
+    spin_unlock_irqrestore(&t->in_lock, flags);
     return c;
 }
 
@@ -68,7 +76,7 @@ int tty_read(char* buf, usize size) {
     while (i < size - 1) {
         /* block until a character arrives */
         int c;
-        while ((c = tty_getc()) == 0) { /* spin */ }
+        wait_event(&ttys[current_tty].in_wait, (c = tty_getc()) != 0);
         if (c == '\n' || c == '\r') { break; }
         buf[i++] = (char)c;
     }
@@ -78,8 +86,12 @@ int tty_read(char* buf, usize size) {
 
 void tty_feed_key(int key) {
     struct tty* t = &ttys[current_tty];
+    u32 flags = spin_lock_irqsave(&t->in_lock);
     int next = (t->in_head + 1) % TTY_BUF_SIZE;
-    if (next == t->in_tail) return;  /* buffer full, drop */
-    t->input_buf[t->in_head] = (char)(key & 0xFF);
-    t->in_head = next;
+    if (next != t->in_tail) {        /* buffer full, drop */
+        t->input_buf[t->in_head] = (char)(key & 0xFF);
+        t->in_head = next;
+    }
+    spin_unlock_irqrestore(&t->in_lock, flags);
+    wake_up(&t->in_wait);
 }
@@ -0,0 +1,44 @@
+#include "kernel.h"
+
+/* the programs under user/, linked in by the Makefile as raw images
+ * (objcopy -I binary), and written to /bin on every boot so the disk
+ * always has the ones this kernel was built with */
+
+#define USERBIN(name)                                           \
+    extern const u8 _binary_##name##_start[];                   \
+    extern const u8 _binary_##name##_end[];
+
+USERBIN(true)
+USERBIN(hello)
+USERBIN(nullsys)
+USERBIN(ringbench)
+USERBIN(uptime)
+USERBIN(clockbench)
+USERBIN(ipcbench)
+
+static const struct {
+    const char* path;
+    const u8*   start;
+    const u8*   end;
+} user_bins[] = {
+    { "/bin/true",  _binary_true_start,  _binary_true_end },
+    { "/bin/hello", _binary_hello_start, _binary_hello_end },
+    { "/bin/nullsys", _binary_nullsys_start, _binary_nullsys_end },
+    { "/bin/ringbench", _binary_ringbench_start, _binary_ringbench_end },
+    { "/bin/uptime", _binary_uptime_start, _binary_uptime_end },
+    { "/bin/clockbench", _binary_clockbench_start, _binary_clockbench_end },
+    { "/bin/ipcbench", _binary_ipcbench_start, _binary_ipcbench_end },
+};
+
+void userbin_install(void) {
+    for (u32 i = 0; i < sizeof(user_bins) / sizeof(user_bins[0]); i++) {
+        usize size = (usize)(user_bins[i].end - user_bins[i].start);
+        if (fs_write(user_bins[i].path, (const char*)user_bins[i].start, size) != (int)size) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "userbin: could not write %s\n", user_bins[i].path);
+            vga_write(buf, COLOUR_LIGHT_RED);
+            continue;
+        }
+        fs_chmod(user_bins[i].path, 0755);
+    }
+}
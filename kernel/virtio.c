@@ -0,0 +1,190 @@
+#include "kernel.h"
+#include "vmm.h"
+#include "pci.h"
+#include "virtio.h"
+
+/* ============================================================
+ * the legacy PCI transport
+ * ============================================================ */
+
+int virtio_pci_init(virtio_dev_t* vdev, pci_dev_t* pci) {
+    if (!pci->bar[0].io || pci->bar[0].size < VIRTIO_PCI_CONFIG) return -1;
+    vdev->pci      = pci;
+    vdev->io       = (u16)pci->bar[0].base;
+    vdev->features = 0;
+    pci_enable(pci, PCI_CMD_IO | PCI_CMD_MASTER);
+    virtio_reset(vdev);
+    outb(vdev->io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK);
+    outb(vdev->io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+    return 0;
+}
+
+u32 virtio_negotiate(virtio_dev_t* vdev, u32 wanted) {
+    vdev->features = inl(vdev->io + VIRTIO_PCI_HOST_FEATURES) & wanted;
+    outl(vdev->io + VIRTIO_PCI_GUEST_FEATURES, vdev->features);
+    return vdev->features;
+}
+
+void virtio_ready(virtio_dev_t* vdev) {
+    u16 port = vdev->io + VIRTIO_PCI_STATUS;
+    outb(port, inb(port) | VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_reset(virtio_dev_t* vdev) {
+    outb(vdev->io + VIRTIO_PCI_STATUS, 0);
+}
+
+void virtio_fail(virtio_dev_t* vdev) {
+    u16 port = vdev->io + VIRTIO_PCI_STATUS;
+    outb(port, inb(port) | VIRTIO_STATUS_FAILED);
+}
+
+u8 virtio_isr(virtio_dev_t* vdev) {
+    return inb(vdev->io + VIRTIO_PCI_ISR);
+}
+
+u32 virtio_config32(virtio_dev_t* vdev, u32 off) {
+    return inl((u16)(vdev->io + VIRTIO_PCI_CONFIG + off));
+}
+
+/* ============================================================
+ * split virtqueues
+ * ============================================================ */
+
+/* the other side's event index: the ring entry right after the last */
+#define VQ_USED_EVENT(vq)   (*(volatile u16*)&(vq)->avail->ring[(vq)->size])
+#define VQ_AVAIL_EVENT(vq)  (*(volatile u16*)&(vq)->used->ring[(vq)->size])
+
+/* whether moving the index from old to new went past event */
+static int vring_need_event(u16 event, u16 new_idx, u16 old_idx) {
+    return (u16)(new_idx - event - 1) < (u16)(new_idx - old_idx);
+}
+
+/* the legacy layout: descriptors, then the available ring, then the
+ * used ring from the next page. the size is the device's, we cannot
+ * pick it. kmalloc memory is below FRAMES_START, identity mapped and
+ * contiguous, which the device needs the whole block to be */
+int virtq_init(virtq_t* vq, virtio_dev_t* vdev, u16 index) {
+    outw(vdev->io + VIRTIO_PCI_QUEUE_SEL, index);
+    u16 size = inw(vdev->io + VIRTIO_PCI_QUEUE_SIZE);
+    if (!size || size > VIRTQ_MAX_SIZE || inl(vdev->io + VIRTIO_PCI_QUEUE_PFN)) return -1;
+
+    u32 used_off = (size * sizeof(vring_desc_t) + 2 * (3 + size) + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1);
+    u32 bytes    = used_off + 2 * 3 + size * sizeof(vring_used_elem_t);
+    u8* raw      = (u8*)kmalloc(bytes + VRING_ALIGN - 1);
+    vq->cookies  = (void**)kmalloc(size * sizeof(void*));
+    if (!raw || !vq->cookies) {
+        kfree(raw);
+        kfree(vq->cookies);
+        vq->raw     = NULL;
+        vq->cookies = NULL;
+        return -1;
+    }
+    u8* ring = (u8*)(((u32)raw + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1));
+    memset(ring, 0, bytes);
+
+    vq->vdev      = vdev;
+    vq->raw       = raw;
+    vq->index     = index;
+    vq->size      = size;
+    vq->desc      = (vring_desc_t*)ring;
+    vq->avail     = (vring_avail_t*)(ring + size * sizeof(vring_desc_t));
+    vq->used      = (vring_used_t*)(ring + used_off);
+    vq->free_head = 0;
+    vq->nfree     = size;
+    vq->last_used = 0;
+    vq->kicked    = 0;
+    for (u16 i = 0; i < size; i++)
+        vq->desc[i].next = (u16)(i + 1);
+
+    outl(vdev->io + VIRTIO_PCI_QUEUE_PFN, (u32)ring / VRING_ALIGN);
+    return 0;
+}
+
+/* give the queue's memory back; the device has to have been reset
+ * first, or it may still be reading and writing the rings */
+void virtq_free(virtq_t* vq) {
+    if (!vq->raw) return;
+    outw(vq->vdev->io + VIRTIO_PCI_QUEUE_SEL, vq->index);
+    outl(vq->vdev->io + VIRTIO_PCI_QUEUE_PFN, 0);
+    kfree(vq->raw);
+    kfree(vq->cookies);
+    memset(vq, 0, sizeof(*vq));
+}
+
+/* chain nout device-readable then nin device-writable buffers off the
+ * free list and make the chain available; -1 if there are not enough
+ * descriptors left, and nothing was added. the device is not told
+ * until virtq_kick(), so a batch costs one notify */
+int virtq_add(virtq_t* vq, const virtq_buf_t* bufs, u32 nout, u32 nin, void* cookie) {
+    u32 n = nout + nin;
+    if (!n || n > vq->nfree) return -1;
+
+    u16 head = vq->free_head, i = head;
+    for (u32 k = 0; k < n; k++) {
+        vring_desc_t* d = &vq->desc[i];
+        d->addr  = (u32)bufs[k].addr;
+        d->len   = bufs[k].len;
+        d->flags = (u16)((k >= nout ? VRING_DESC_F_WRITE : 0) | (k + 1 < n ? VRING_DESC_F_NEXT : 0));
+        i = d->next;
+    }
+    vq->free_head     = i;
+    vq->nfree        -= (u16)n;
+    vq->cookies[head] = cookie;
+
+    u16 idx = vq->avail->idx;
+    vq->avail->ring[idx % vq->size] = head;
+    __atomic_store_n(&vq->avail->idx, (u16)(idx + 1), __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* notify the device of what was added since the last kick, unless it
+ * has said (avail_event, or NO_NOTIFY without event indexes) that it
+ * is still working through the ring and will see it anyway */
+void virtq_kick(virtq_t* vq) {
+    __sync_synchronize();               /* the new idx out before we read its event */
+    u16 new_idx = vq->avail->idx;
+    u16 old_idx = vq->kicked;
+    if (new_idx == old_idx) return;
+    vq->kicked = new_idx;
+
+    int need;
+    if (vq->vdev->features & VIRTIO_RING_F_EVENT_IDX)
+        need = vring_need_event(VQ_AVAIL_EVENT(vq), new_idx, old_idx);
+    else
+        need = !(*(volatile u16*)&vq->used->flags & VRING_USED_F_NO_NOTIFY);
+    if (need) outw(vq->vdev->io + VIRTIO_PCI_QUEUE_NOTIFY, vq->index);
+}
+
+/* the next chain the device has finished, its descriptors back on the
+ * free list; the cookie it was added with, or NULL if none is ready */
+void* virtq_get(virtq_t* vq, u32* len) {
+    if (vq->last_used == __atomic_load_n(&vq->used->idx, __ATOMIC_ACQUIRE)) return NULL;
+    vring_used_elem_t* e = &vq->used->ring[vq->last_used % vq->size];
+    u16 head = (u16)e->id;
+    if (len) *len = e->len;
+
+    u16 i = head, n = 1;
+    while (vq->desc[i].flags & VRING_DESC_F_NEXT) {
+        i = vq->desc[i].next;
+        n++;
+    }
+    vq->desc[i].next = vq->free_head;
+    vq->free_head    = head;
+    vq->nfree       += n;
+    vq->last_used++;
+    return vq->cookies[head];
+}
+
+/* ask for an interrupt at the next completion, and no sooner: while
+ * the driver is still reaping, the device need not raise another.
+ * a completion that raced in before the ask would not interrupt, so
+ * say whether to go round again */
+int virtq_enable_cb(virtq_t* vq) {
+    if (vq->vdev->features & VIRTIO_RING_F_EVENT_IDX)
+        VQ_USED_EVENT(vq) = vq->last_used;
+    else
+        vq->avail->flags = 0;
+    __sync_synchronize();
+    return vq->last_used != __atomic_load_n(&vq->used->idx, __ATOMIC_ACQUIRE);
+}
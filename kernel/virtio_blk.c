@@ -0,0 +1,215 @@
+#include "kernel.h"
+#include "vmm.h"
+#include "spinlock.h"
+#include "pci.h"
+#include "ata.h"
+#include "blk.h"
+#include "virtio.h"
+
+/* virtio-blk: one virtqueue, and a request on it is a chain of the
+ * header (type and sector), the data, and a status byte the device
+ * writes last. the lock covers the queue, busy and the scratch chain;
+ * like AHCI's it is never held across blk_end_request() */
+
+#define VIRTIO_BLK_F_SIZE_MAX   (1u << 1)
+#define VIRTIO_BLK_F_SEG_MAX    (1u << 2)
+#define VIRTIO_BLK_F_RO         (1u << 5)
+#define VIRTIO_BLK_F_FLUSH      (1u << 9)
+
+#define VIRTIO_BLK_CFG_CAPACITY 0x00    /* u64, 512-byte sectors */
+#define VIRTIO_BLK_CFG_SIZE_MAX 0x08
+#define VIRTIO_BLK_CFG_SEG_MAX  0x0C
+
+#define VIRTIO_BLK_T_IN         0
+#define VIRTIO_BLK_T_OUT        1
+#define VIRTIO_BLK_T_FLUSH      4
+#define VIRTIO_BLK_S_OK         0
+
+#define VBLK_MAX_DEPTH          32
+
+typedef struct {
+    u32 type;                           /* the header the device reads */
+    u32 reserved;
+    u64 sector;
+    u8  status;                         /* and the byte it writes */
+    blk_request_t* rq;
+} vblk_req_t;
+
+typedef struct {
+    virtio_dev_t   vdev;
+    virtq_t        vq;
+    spinlock_t     lock;
+    vblk_req_t*    reqs;                /* one per request in flight */
+    u32            slots;
+    u32            busy;
+    virtq_buf_t*   bufs;                /* max_bios + 2, built under the lock */
+    block_device_t blk;
+} vblk_t;
+
+DEFINE_LOCK_CLASS(vblk, "spin");
+static int vblk_ndisks;
+
+/* device-readable first: the header, and the data if it is a write */
+static int vblk_submit(block_device_t* dev, blk_request_t* rq) {
+    vblk_t* vb    = (vblk_t*)dev->driver_data;
+    int     write = (rq->flags & BIO_WRITE) != 0;
+
+    /* without F_FLUSH the device has no cache to flush: writes are
+     * already on media when they complete */
+    if ((rq->flags & BIO_FLUSH) && !(vb->vdev.features & VIRTIO_BLK_F_FLUSH)) {
+        blk_end_request(dev, rq, 0);
+        return 0;
+    }
+
+    u32 flags = spin_lock_irqsave(&vb->lock);
+    u32 free  = vb->slots & ~vb->busy;
+    if (!free) {
+        spin_unlock_irqrestore(&vb->lock, flags);
+        return BLK_BUSY;
+    }
+    u32 slot = (u32)__builtin_ctz(free);
+    vblk_req_t* r = &vb->reqs[slot];
+    r->type     = (rq->flags & BIO_FLUSH) ? VIRTIO_BLK_T_FLUSH : write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    r->reserved = 0;
+    r->sector   = rq->lba;
+    r->status   = 0xFF;
+    r->rq       = rq;
+
+    u32 n = 0;
+    vb->bufs[n].addr  = r;
+    vb->bufs[n++].len = 16;
+    for (bio_t* bio = rq->bios; bio && !(rq->flags & BIO_FLUSH); bio = bio->next) {
+        if ((u32)bio->buf + bio->count * ATA_SECTOR_SIZE > KERNEL_SPACE_END) {
+            spin_unlock_irqrestore(&vb->lock, flags);
+            return -1;
+        }
+        vb->bufs[n].addr  = bio->buf;
+        vb->bufs[n++].len = bio->count * ATA_SECTOR_SIZE;
+    }
+    vb->bufs[n].addr  = &r->status;
+    vb->bufs[n++].len = 1;
+
+    u32 nout = write ? n - 1 : 1;
+    if (virtq_add(&vb->vq, vb->bufs, nout, n - nout, r) < 0) {
+        spin_unlock_irqrestore(&vb->lock, flags);
+        return BLK_BUSY;
+    }
+    vb->busy |= 1u << slot;
+    virtq_kick(&vb->vq);
+    spin_unlock_irqrestore(&vb->lock, flags);
+    return 0;
+}
+
+/* take everything off the used ring, then ask for the next interrupt;
+ * what finished in between is picked up by going round again */
+static void vblk_reap(vblk_t* vb) {
+    blk_request_t *ok = NULL, *failed = NULL;
+    u32 flags = spin_lock_irqsave(&vb->lock);
+    do {
+        vblk_req_t* r;
+        while ((r = (vblk_req_t*)virtq_get(&vb->vq, NULL))) {
+            vb->busy &= ~(1u << (r - vb->reqs));
+            blk_request_t** list = r->status == VIRTIO_BLK_S_OK ? &ok : &failed;
+            r->rq->next = *list;
+            *list = r->rq;
+        }
+    } while (virtq_enable_cb(&vb->vq));
+    spin_unlock_irqrestore(&vb->lock, flags);
+
+    while (ok) {
+        blk_request_t* next = ok->next;
+        blk_end_request(&vb->blk, ok, 0);
+        ok = next;
+    }
+    while (failed) {
+        blk_request_t* next = failed->next;
+        blk_end_request(&vb->blk, failed, -1);
+        failed = next;
+    }
+}
+
+static void vblk_poll(block_device_t* dev) {
+    vblk_reap((vblk_t*)dev->driver_data);
+}
+
+static const blk_ops_t vblk_ops = { vblk_submit, vblk_poll, 1, NULL };
+
+/* reading the ISR lowers the line, which may be shared */
+static void vblk_irq(pci_dev_t* dev) {
+    vblk_t* vb = (vblk_t*)dev->driver_data;
+    if (virtio_isr(&vb->vdev) & VIRTIO_ISR_QUEUE) vblk_reap(vb);
+}
+
+static const pci_id_t vblk_ids[] = {
+    { VIRTIO_VENDOR, VIRTIO_DEV_BLK_LEGACY, 0, 0 },
+    { 0, 0, 0, 0 },
+};
+
+static int vblk_probe(pci_dev_t* dev, const pci_id_t* id) {
+    (void)id;
+    vblk_t* vb = (vblk_t*)kmalloc(sizeof(vblk_t));
+    if (!vb) return -1;
+    memset(vb, 0, sizeof(*vb));
+    if (virtio_pci_init(&vb->vdev, dev) < 0) {
+        kfree(vb);
+        return -1;
+    }
+
+    u32 features = virtio_negotiate(&vb->vdev, VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX |
+                                    VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH | VIRTIO_RING_F_EVENT_IDX);
+    if ((features & VIRTIO_BLK_F_RO) || virtq_init(&vb->vq, &vb->vdev, 0) < 0) goto fail;
+
+    /* a request takes the header, the status and a descriptor per bio;
+     * the ring holds at least three of the smallest at once */
+    u32 max_bios = vb->vq.size - 2u;
+    if (features & VIRTIO_BLK_F_SEG_MAX) {
+        u32 seg_max = virtio_config32(&vb->vdev, VIRTIO_BLK_CFG_SEG_MAX);
+        if (seg_max && seg_max < max_bios) max_bios = seg_max;
+    }
+    if (max_bios > BLK_MAX_BIOS) max_bios = BLK_MAX_BIOS;
+    u32 depth = vb->vq.size / 3u;
+    if (depth > VBLK_MAX_DEPTH) depth = VBLK_MAX_DEPTH;
+    if (!max_bios || !depth) goto fail;
+
+    vb->reqs = (vblk_req_t*)kmalloc(depth * sizeof(vblk_req_t));
+    vb->bufs = (virtq_buf_t*)kmalloc((max_bios + 2) * sizeof(virtq_buf_t));
+    if (!vb->reqs || !vb->bufs) goto fail;
+    vb->slots = depth == 32 ? ~0u : (1u << depth) - 1;
+    spin_lock_init(&vb->lock, &lock_class_vblk);
+
+    u32 cap_hi = virtio_config32(&vb->vdev, VIRTIO_BLK_CFG_CAPACITY + 4);
+    vb->blk.sectors     = cap_hi ? 0xFFFFFFFF : virtio_config32(&vb->vdev, VIRTIO_BLK_CFG_CAPACITY);
+    vb->blk.max_sectors = BLK_MAX_SECTORS;
+    if (features & VIRTIO_BLK_F_SIZE_MAX) {
+        u32 size_max = virtio_config32(&vb->vdev, VIRTIO_BLK_CFG_SIZE_MAX) / ATA_SECTOR_SIZE;
+        if (size_max && size_max < vb->blk.max_sectors) vb->blk.max_sectors = size_max;
+    }
+    vb->blk.max_bios    = max_bios;
+    vb->blk.depth       = depth;
+    vb->blk.ops         = &vblk_ops;
+    vb->blk.driver_data = vb;
+    vb->blk.polled      = pci_irq_register(dev, vblk_irq) < 0;
+    snprintf(vb->blk.name, BLK_NAME_MAX, "vd%c", 'a' + vblk_ndisks++);
+    dev->driver_data = vb;
+
+    virtio_ready(&vb->vdev);
+    blk_register(&vb->blk);
+
+    char line[96];
+    snprintf(line, sizeof(line), "virtio-blk: %s, %u MiB, ring %u, depth %u%s\n", vb->blk.name,
+             vb->blk.sectors / 2048, vb->vq.size, depth,
+             (features & VIRTIO_RING_F_EVENT_IDX) ? ", event index" : "");
+    kprint(line);
+    return 0;
+
+fail:
+    virtio_reset(&vb->vdev);
+    virtq_free(&vb->vq);
+    virtio_fail(&vb->vdev);
+    kfree(vb->reqs);
+    kfree(vb->bufs);
+    kfree(vb);
+    return -1;
+}
+
+PCI_DRIVER(virtio_blk, vblk_ids, vblk_probe);
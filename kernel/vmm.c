@@ -0,0 +1,388 @@
+#include "kernel.h"
+#include "smp.h"
+#include "vmm.h"
+#include "vvar.h"
+#include "ipc.h"
+
+#define CR0_WP   0x00010000
+#define CR0_PG   0x80000000
+#define CR4_PSE  0x00000010
+
+#define PDE_INDEX(va) ((va) >> 22)
+#define PTE_INDEX(va) (((va) >> 12) & 0x3FF)
+
+mm_stat_t mm_last_exit;
+
+/* kernel space and the MMIO window; every page directory starts as a
+ * copy of this, user space is left empty */
+static u32 kernel_pgdir[1024] __attribute__((aligned(PAGE_SIZE)));
+
+/* ---------------------------------------------------------------
+ * page frames: one bit per 4 KiB frame between the end of the heap
+ * and the top of RAM (or of kernel space, whichever is lower)
+ * --------------------------------------------------------------- */
+
+DEFINE_LOCK_CLASS(page_alloc, "spin");
+static spinlock_t frame_lock = SPINLOCK_INIT(page_alloc);
+static u32 frame_bitmap[KERNEL_SPACE_END / PAGE_SIZE / 32];   /* set = in use */
+static u32 frame_first, frame_limit;    /* frame numbers, [first, limit) */
+static u32 frame_next;
+static u32 frames_free;
+
+static inline u32 read_cr0(void) { u32 v; __asm__ volatile ("mov %%cr0, %0" : "=r"(v)); return v; }
+static inline u32 read_cr2(void) { u32 v; __asm__ volatile ("mov %%cr2, %0" : "=r"(v)); return v; }
+static inline u32 read_cr3(void) { u32 v; __asm__ volatile ("mov %%cr3, %0" : "=r"(v)); return v; }
+static inline u32 read_cr4(void) { u32 v; __asm__ volatile ("mov %%cr4, %0" : "=r"(v)); return v; }
+static inline void write_cr0(u32 v) { __asm__ volatile ("mov %0, %%cr0" : : "r"(v) : "memory"); }
+static inline void write_cr3(u32 v) { __asm__ volatile ("mov %0, %%cr3" : : "r"(v) : "memory"); }
+static inline void write_cr4(u32 v) { __asm__ volatile ("mov %0, %%cr4" : : "r"(v) : "memory"); }
+
+/* a zeroed frame, or 0 when we are out */
+u32 page_alloc(void) {
+    u32 flags = spin_lock_irqsave(&frame_lock);
+    u32 n = frame_limit - frame_first;
+    u32 found = 0;
+    for (u32 i = 0; i < n && !found; i++) {
+        u32 f = frame_next++;
+        if (frame_next >= frame_limit) frame_next = frame_first;
+        if (!(frame_bitmap[f / 32] & (1u << (f % 32)))) {
+            frame_bitmap[f / 32] |= 1u << (f % 32);
+            frames_free--;
+            found = f;
+        }
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+    if (!found) return 0;
+    memset((void*)(found * PAGE_SIZE), 0, PAGE_SIZE);
+    return found * PAGE_SIZE;
+}
+
+void page_free(u32 phys) {
+    u32 f = phys / PAGE_SIZE;
+    if (f < frame_first || f >= frame_limit) return;
+    u32 flags = spin_lock_irqsave(&frame_lock);
+    if (frame_bitmap[f / 32] & (1u << (f % 32))) {
+        frame_bitmap[f / 32] &= ~(1u << (f % 32));
+        frames_free++;
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+u32 page_free_count(void) {
+    return frames_free;
+}
+
+/* turn paging on for the calling CPU with the kernel page directory */
+void vmm_init_cpu(void) {
+    write_cr4(read_cr4() | CR4_PSE);
+    write_cr3((u32)kernel_pgdir);
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+}
+
+/* mem_upper_kb is the multiboot figure, RAM above 1 MiB; 0 if GRUB
+ * did not tell us */
+void vmm_init(u32 mem_upper_kb) {
+    for (u32 i = 0; i < PDE_INDEX(KERNEL_SPACE_END); i++)
+        kernel_pgdir[i] = (i << 22) | PTE_PS | PTE_WRITE | PTE_PRESENT;
+    for (u32 i = PDE_INDEX(MMIO_BASE); i < 1024; i++)
+        kernel_pgdir[i] = (i << 22) | PTE_PS | PTE_PCD | PTE_PWT | PTE_WRITE | PTE_PRESENT;
+
+    u32 top = mem_upper_kb ? 0x100000 + mem_upper_kb * 1024 : 0x4000000;
+    if (top > KERNEL_SPACE_END || top < 0x100000) top = KERNEL_SPACE_END;
+    frame_first = FRAMES_START / PAGE_SIZE;
+    frame_limit = top > FRAMES_START ? top / PAGE_SIZE : frame_first;
+    frame_next  = frame_first;
+    frames_free = frame_limit - frame_first;
+    memset(frame_bitmap, 0, sizeof(frame_bitmap));
+
+    vmm_init_cpu();
+}
+
+/* ---------------------------------------------------------------
+ * address spaces
+ * --------------------------------------------------------------- */
+
+static int mm_map(mm_t* mm, u32 va, u32 phys, u32 flags);
+
+/* user space starts out empty apart from the vvar page */
+mm_t* mm_create(void) {
+    mm_t* mm = (mm_t*)kmalloc(sizeof(mm_t));
+    if (!mm) return NULL;
+    memset(mm, 0, sizeof(mm_t));
+    u32 pd = page_alloc();
+    if (!pd) {
+        kfree(mm);
+        return NULL;
+    }
+    mm->pgdir = (u32*)pd;
+    memcpy(mm->pgdir, kernel_pgdir, sizeof(kernel_pgdir));
+    for (u32 i = PDE_INDEX(USER_BASE); i < PDE_INDEX(USER_END); i++)
+        mm->pgdir[i] = 0;
+    if (mm_map(mm, VVAR_BASE, vvar_phys(), PTE_SHARED | PTE_USER | PTE_PRESENT) < 0) {
+        page_free(pd);
+        kfree(mm);
+        return NULL;
+    }
+    return mm;
+}
+
+/* the caller must already be off this page directory */
+void mm_destroy(mm_t* mm) {
+    for (u32 i = PDE_INDEX(USER_BASE); i < PDE_INDEX(USER_END); i++) {
+        if (!(mm->pgdir[i] & PTE_PRESENT)) continue;
+        u32* pt = (u32*)(mm->pgdir[i] & PAGE_MASK);
+        for (u32 j = 0; j < 1024; j++)
+            if ((pt[j] & (PTE_PRESENT | PTE_SHARED)) == PTE_PRESENT)
+                page_free(pt[j] & PAGE_MASK);
+        page_free((u32)pt);
+    }
+    page_free((u32)mm->pgdir);
+
+    while (mm->areas) {
+        vm_area_t* a = mm->areas;
+        mm->areas = a->next;
+        if (a->shm) shm_put(a->shm);
+        kfree(a);
+    }
+    mm_last_exit.rss      = mm->rss;
+    mm_last_exit.pt_pages = mm->pt_pages;
+    mm_last_exit.faults   = mm->faults;
+    mm_last_exit.vsize    = mm->vsize;
+    kfree(mm);
+}
+
+int mm_add_area(mm_t* mm, u32 start, u32 end, u32 flags,
+                int inode, u32 seg_vaddr, u32 seg_off, u32 seg_filesz) {
+    start &= PAGE_MASK;
+    end    = (end + PAGE_SIZE - 1) & PAGE_MASK;
+    if (start < USER_BASE || end > USER_END || start >= end) return -1;
+
+    vm_area_t* a = (vm_area_t*)kmalloc(sizeof(vm_area_t));
+    if (!a) return -1;
+    a->start      = start;
+    a->end        = end;
+    a->flags      = flags;
+    a->inode      = inode;
+    a->seg_vaddr  = seg_vaddr;
+    a->seg_off    = seg_off;
+    a->seg_filesz = seg_filesz;
+    a->shm        = NULL;
+    a->next       = mm->areas;
+    mm->areas     = a;
+    mm->vsize    += end - start;
+    return 0;
+}
+
+/* an area over shm's frames; it takes over the caller's reference */
+int mm_add_shm(mm_t* mm, u32 start, u32 end, u32 flags, shm_t* shm) {
+    if (mm_add_area(mm, start, end, flags, -1, 0, 0, 0) < 0) return -1;
+    mm->areas->shm = shm;               /* mm_add_area() pushes on the front */
+    return 0;
+}
+
+/* unmap the area that starts at start and forget it. its own frames
+ * go back, shared ones stay with their owner */
+int mm_remove_area(mm_t* mm, u32 start) {
+    vm_area_t** pa = &mm->areas;
+    while (*pa && (*pa)->start != start) pa = &(*pa)->next;
+    vm_area_t* a = *pa;
+    if (!a) return -1;
+    *pa = a->next;
+
+    for (u32 va = a->start; va < a->end; va += PAGE_SIZE) {
+        u32 pde = mm->pgdir[PDE_INDEX(va)];
+        if (!(pde & PTE_PRESENT)) continue;
+        u32* pte = &((u32*)(pde & PAGE_MASK))[PTE_INDEX(va)];
+        if (!(*pte & PTE_PRESENT)) continue;
+        if (!(*pte & PTE_SHARED)) page_free(*pte & PAGE_MASK);
+        *pte = 0;
+        mm->rss--;
+        __asm__ volatile ("invlpg (%0)" : : "r"(va) : "memory");
+    }
+    mm->vsize -= a->end - a->start;
+    if (a->shm) shm_put(a->shm);
+    kfree(a);
+    return 0;
+}
+
+/* the lowest page aligned run of size bytes in [lo, hi) that no area
+ * touches, or 0 */
+u32 mm_find_gap(mm_t* mm, u32 lo, u32 hi, u32 size) {
+    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+    if (size == 0 || size > hi - lo) return 0;
+    u32 start = lo;
+    while (start <= hi - size) {
+        vm_area_t* a = mm->areas;
+        while (a && (a->end <= start || a->start >= start + size)) a = a->next;
+        if (!a) return start;
+        start = a->end;
+    }
+    return 0;
+}
+
+/* NULL means a kernel task, which runs on the kernel page directory */
+void mm_switch(mm_t* mm) {
+    u32 pd = mm ? (u32)mm->pgdir : (u32)kernel_pgdir;
+    if (read_cr3() != pd) write_cr3(pd);
+}
+
+static int mm_map(mm_t* mm, u32 va, u32 phys, u32 flags) {
+    u32* pde = &mm->pgdir[PDE_INDEX(va)];
+    if (!(*pde & PTE_PRESENT)) {
+        u32 pt = page_alloc();
+        if (!pt) return -1;
+        *pde = pt | PTE_USER | PTE_WRITE | PTE_PRESENT;
+        mm->pt_pages++;
+    }
+    u32* pt = (u32*)(*pde & PAGE_MASK);
+    pt[PTE_INDEX(va)] = phys | flags;
+    __asm__ volatile ("invlpg (%0)" : : "r"(va) : "memory");
+    return 0;
+}
+
+/* fill one page from every area that covers it: without page-aligned
+ * segments the end of .text and the start of .data can share a page */
+static int mm_fault_in(mm_t* mm, u32 page) {
+    for (vm_area_t* a = mm->areas; a; a = a->next) {
+        if (!a->shm || page < a->start || page >= a->end) continue;
+        u32 pte = PTE_SHARED | PTE_USER | PTE_PRESENT;
+        if (a->flags & VMA_WRITE) pte |= PTE_WRITE;
+        if (mm_map(mm, page, shm_frame(a->shm, (page - a->start) / PAGE_SIZE), pte) < 0)
+            return -1;
+        mm->rss++;
+        mm->faults++;
+        return 0;
+    }
+
+    u32 phys = page_alloc();
+    if (!phys) return -1;
+
+    u32 pte = PTE_USER | PTE_PRESENT;
+    for (vm_area_t* a = mm->areas; a; a = a->next) {
+        if (page < a->start || page >= a->end) continue;
+        if (a->flags & VMA_WRITE) pte |= PTE_WRITE;
+        if (a->inode < 0) continue;
+        u32 lo = a->seg_vaddr > page ? a->seg_vaddr : page;
+        u32 hi = a->seg_vaddr + a->seg_filesz;
+        if (hi > page + PAGE_SIZE) hi = page + PAGE_SIZE;
+        if (lo >= hi) continue;
+        int want = (int)(hi - lo);
+        if (fs_read_inode_at(a->inode, a->seg_off + (lo - a->seg_vaddr),
+                             (char*)(phys + (lo - page)), (usize)want) != want) {
+            page_free(phys);
+            return -1;
+        }
+    }
+    if (mm_map(mm, page, phys, pte) < 0) {
+        page_free(phys);
+        return -1;
+    }
+    mm->rss++;
+    mm->faults++;
+    return 0;
+}
+
+/* may the current task's syscall hand the kernel [addr, addr + len)?
+ * only checks it is inside its areas; pages still come in on touch */
+int user_range_ok(u32 addr, u32 len, int write) {
+    process_t* p = get_current();
+    mm_t* mm = p ? p->mm : NULL;
+    if (!mm || addr < USER_BASE || addr >= USER_END || len > USER_END - addr) return 0;
+    if (len == 0) return 1;
+
+    u32 end = addr + len;
+    for (u32 page = addr & PAGE_MASK; page < end; page += PAGE_SIZE) {
+        vm_area_t* a = mm->areas;
+        while (a && (page < a->start || page >= a->end)) a = a->next;
+        if (!a || (write && !(a->flags & VMA_WRITE))) return 0;
+    }
+    return 1;
+}
+
+/* copy a NUL-terminated string in from user space; its length, or -1
+ * if it leaves the task's areas or does not fit in size */
+int user_strncpy(char* dst, u32 src, usize size) {
+    for (usize i = 0; i < size; i++) {
+        if ((i == 0 || ((src + i) & ~PAGE_MASK) == 0) && !user_range_ok(src + i, 1, 0))
+            return -1;
+        dst[i] = *(const char*)(src + i);
+        if (!dst[i]) return (int)i;
+    }
+    return -1;
+}
+
+/* the physical address behind a user address of the current task,
+ * paging it in first; 0 if it is outside the task's areas */
+u32 user_phys(u32 addr) {
+    if (!user_range_ok(addr, 1, 0)) return 0;
+    (void)*(volatile u8*)addr;
+    mm_t* mm = get_current()->mm;
+    u32 pde = mm->pgdir[PDE_INDEX(addr)];
+    if (!(pde & PTE_PRESENT)) return 0;
+    u32 pte = ((u32*)(pde & PAGE_MASK))[PTE_INDEX(addr)];
+    if (!(pte & PTE_PRESENT)) return 0;
+    return (pte & PAGE_MASK) | (addr & ~PAGE_MASK);
+}
+
+/* npages whole pages at addr that are the task's own to give away:
+ * writable, and not shared memory */
+int user_pages_ok(u32 addr, u32 npages) {
+    if ((addr & ~PAGE_MASK) || npages == 0 || npages > (USER_END - USER_BASE) / PAGE_SIZE) return 0;
+    if (!user_range_ok(addr, npages * PAGE_SIZE, 1)) return 0;
+    for (vm_area_t* a = get_current()->mm->areas; a; a = a->next)
+        if (a->shm && a->start < addr + npages * PAGE_SIZE && a->end > addr) return 0;
+    return 1;
+}
+
+/* unmap the page at addr and hand its frame to the caller, or 0. the
+ * next touch of addr faults in a fresh one, as if it were never used */
+u32 user_take_page(u32 addr) {
+    if (!user_pages_ok(addr, 1)) return 0;
+    (void)*(volatile u8*)addr;
+    mm_t* mm = get_current()->mm;
+    u32 pde = mm->pgdir[PDE_INDEX(addr)];
+    if (!(pde & PTE_PRESENT)) return 0;
+    u32* pte = &((u32*)(pde & PAGE_MASK))[PTE_INDEX(addr)];
+    if ((*pte & (PTE_PRESENT | PTE_SHARED)) != PTE_PRESENT) return 0;
+    u32 phys = *pte & PAGE_MASK;
+    *pte = 0;
+    mm->rss--;
+    __asm__ volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+    return phys;
+}
+
+/* map the frame phys at addr in place of whatever page was there,
+ * which is freed; the task owns phys from here on */
+int user_give_page(u32 addr, u32 phys) {
+    if (!user_pages_ok(addr, 1)) return -1;
+    mm_t* mm = get_current()->mm;
+    u32 old = 0;
+    u32 pde = mm->pgdir[PDE_INDEX(addr)];
+    if (pde & PTE_PRESENT) old = ((u32*)(pde & PAGE_MASK))[PTE_INDEX(addr)];
+    if (mm_map(mm, addr, phys, PTE_USER | PTE_WRITE | PTE_PRESENT) < 0) return -1;
+    if (old & PTE_PRESENT) page_free(old & PAGE_MASK);
+    else                   mm->rss++;
+    return 0;
+}
+
+/* vector 14. returns 0 once the missing page is in, -1 for a fault
+ * nobody can fix, which the caller turns into a kill or a panic */
+int page_fault(regs_t* r) {
+    u32 addr = read_cr2();
+    process_t* p = get_current();
+    mm_t* mm = p ? p->mm : NULL;
+    if (!mm || addr < USER_BASE || addr >= USER_END) return -1;
+    if (r->err_code & PF_PRESENT) return -1;
+
+    vm_area_t* a = mm->areas;
+    while (a && (addr < a->start || addr >= a->end)) a = a->next;
+    if (!a) return -1;
+    if ((r->err_code & PF_WRITE) && !(a->flags & VMA_WRITE)) return -1;
+
+    /* paging in reads the disk, which may sleep; only the task that
+     * owns mm ever faults on it, so nothing else needs locking */
+    if (r->eflags & 0x200) interrupts_enable();
+    int ret = mm_fault_in(mm, addr & PAGE_MASK);
+    interrupts_disable();
+    return ret;
+}
@@ -0,0 +1,42 @@
+#include "kernel.h"
+#include "vmm.h"
+#include "vvar.h"
+
+/* a whole page of its own: it is mapped into user space, so nothing
+ * else may share it */
+static union {
+    vvar_t v;
+    u8     page[PAGE_SIZE];
+} vvar_page __attribute__((aligned(PAGE_SIZE)));
+
+/* after timer_init(), which calibrates the TSC */
+void vvar_init(void) {
+    vvar_t* v = &vvar_page.v;
+    v->hz          = TIMER_HZ;
+    v->tsc_khz     = tsc_khz;
+    v->tick_ns     = 1000000000u / TIMER_HZ;
+    v->tick_cycles = tsc_khz * (1000 / TIMER_HZ);
+    u64 now = rdtsc();
+    v->tick_tsc_lo = (u32)now;
+    v->tick_tsc_hi = (u32)(now >> 32);
+    v->ticks       = system_uptime;
+}
+
+/* IRQ0 on the BSP, the only writer */
+void vvar_tick(u64 tsc) {
+    vvar_t* v = &vvar_page.v;
+    __atomic_store_n(&v->seq, v->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    v->ticks       = system_uptime;
+    v->tick_tsc_lo = (u32)tsc;
+    v->tick_tsc_hi = (u32)(tsc >> 32);
+    __atomic_store_n(&v->seq, v->seq + 1, __ATOMIC_RELEASE);
+}
+
+u32 vvar_phys(void) {
+    return (u32)&vvar_page;
+}
+
+u64 clock_ns(void) {
+    return vvar_clock_ns(&vvar_page.v);
+}
@@ -0,0 +1,120 @@
+#include "kernel.h"
+#include "smp.h"
+#include "wait.h"
+
+DEFINE_LOCK_CLASS(waitqueue, "spin");
+
+#define COMPLETION_ALL 0xFFFFFFFFu
+
+void wait_queue_init(wait_queue_t* wq) {
+    spin_lock_init(&wq->lock, &lock_class_waitqueue);
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+/* queue the current task on wq unless it already is. the caller checks
+ * its condition after this and only then blocks */
+void prepare_to_wait(wait_queue_t* wq, wait_entry_t* w) {
+    u32 flags = spin_lock_irqsave(&wq->lock);
+    if (!w->queued) {
+        w->task   = get_current();
+        w->next   = NULL;
+        w->queued = 1;
+        if (wq->tail) wq->tail->next = w;
+        else          wq->head = w;
+        wq->tail = w;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+/* take w off wq if a wake_up() has not already done so */
+void finish_wait(wait_queue_t* wq, wait_entry_t* w) {
+    u32 flags = spin_lock_irqsave(&wq->lock);
+    if (w->queued) {
+        wait_entry_t* prev = NULL;
+        wait_entry_t* e = wq->head;
+        while (e && e != w) {
+            prev = e;
+            e = e->next;
+        }
+        if (e) {
+            if (prev) prev->next = w->next;
+            else      wq->head   = w->next;
+            if (wq->tail == w) wq->tail = prev;
+        }
+        w->queued = 0;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+/* the entry lives on the waiter's stack and the waiter cannot get past
+ * finish_wait() while we hold the lock, so the task stays valid until
+ * proc_wake() is done with it */
+static wait_entry_t* wake_one(wait_queue_t* wq) {
+    wait_entry_t* w = wq->head;
+    if (!w) return NULL;
+    wq->head = w->next;
+    if (!wq->head) wq->tail = NULL;
+    w->queued = 0;
+    proc_wake(w->task);
+    return w;
+}
+
+int wake_up(wait_queue_t* wq) {
+    u32 flags = spin_lock_irqsave(&wq->lock);
+    int n = wake_one(wq) ? 1 : 0;
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return n;
+}
+
+int wake_up_all(wait_queue_t* wq) {
+    u32 flags = spin_lock_irqsave(&wq->lock);
+    int n = 0;
+    while (wake_one(wq)) n++;
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return n;
+}
+
+/* ---------------------------------------------------------------
+ * completions
+ * --------------------------------------------------------------- */
+
+void init_completion(completion_t* c) {
+    c->done = 0;
+    wait_queue_init(&c->wait);
+}
+
+/* consume one completion if there is one */
+static int completion_try(completion_t* c) {
+    u32 d = c->done;
+    while (d) {
+        if (d == COMPLETION_ALL) return 1;
+        if (__atomic_compare_exchange_n(&c->done, &d, d - 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return 1;
+    }
+    return 0;
+}
+
+void complete(completion_t* c) {
+    u32 d = c->done;
+    while (d != COMPLETION_ALL &&
+           !__atomic_compare_exchange_n(&c->done, &d, d + 1, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    wake_up(&c->wait);
+}
+
+void complete_all(completion_t* c) {
+    __atomic_store_n(&c->done, COMPLETION_ALL, __ATOMIC_RELEASE);
+    wake_up_all(&c->wait);
+}
+
+void wait_for_completion(completion_t* c) {
+    wait_event(&c->wait, completion_try(c));
+}
+
+/* 0 if ticks went by without a complete() */
+int wait_for_completion_timeout(completion_t* c, u32 ticks) {
+    return wait_event_timeout(&c->wait, completion_try(c), ticks);
+}
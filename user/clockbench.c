@@ -0,0 +1,20 @@
+#include "ulib.h"
+
+/* clockbench <vvar|sys> [reads]: read the clock over and over, from
+ * the vvar page or through SYS_CLOCK_NS. exits with the average cost
+ * of a read in TSC cycles, or -1 if the clock ever went backwards,
+ * which is how "bench clock" gets the number back */
+int main(int argc, char** argv) {
+    int sys   = argc > 1 && argv[1][0] == 's';
+    int reads = argc > 2 ? atoi(argv[2]) : 10000;
+    if (reads < 1) reads = 1;
+
+    unsigned long long last = 0;
+    unsigned start = rdtsc32();
+    for (int i = 0; i < reads; i++) {
+        unsigned long long now = sys ? clock_ns_sys() : clock_ns();
+        if (now < last) return -1;
+        last = now;
+    }
+    return (int)((rdtsc32() - start) / (unsigned)reads);
+}
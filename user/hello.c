@@ -0,0 +1,22 @@
+#include "ulib.h"
+
+/* 256 KiB of bss that is never touched past the first page, so
+ * "bench exec" can show resident staying far below virtual size */
+static volatile char scratch[256 * 1024];
+
+int main(int argc, char** argv) {
+    scratch[0] = 1;
+    print("hello from ring 3, pid ");
+    char num[12];
+    int i = sizeof(num) - 1, pid = getpid();
+    num[i] = '\0';
+    do num[--i] = (char)('0' + pid % 10); while ((pid /= 10) && i > 0);
+    print(num + i);
+    print(":");
+    for (int a = 0; a < argc; a++) {
+        print(" ");
+        print(argv[a]);
+    }
+    print("\n");
+    return scratch[0] - 1;
+}
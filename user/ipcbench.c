@@ -0,0 +1,99 @@
+#include "ulib.h"
+
+/* ipcbench <pipe|mq|pages|shm> <send|recv> [KiB]: one of a pair that
+ * streams KiB of a known byte pattern from sender to receiver, 16 KiB
+ * at a time, through
+ *   pipe   the pipe "bench ipc" put on the sender's fd 1 and the
+ *          receiver's fd 0
+ *   mq     the "ipcbench" queue, copied in by write(), out by read()
+ *   pages  the same queue, the pages themselves handed over
+ *   shm    a ring in the "ipcbench" segment, with a futex on each index
+ * the receiver checks every byte and exits with the microseconds from
+ * its first chunk to its last, or -1 if anything went wrong */
+
+#define NAME    "ipcbench"
+#define CHUNK   (16 * 1024)
+#define RING    (64 * 1024)             /* shm data, after a page of indices */
+
+typedef struct {
+    volatile unsigned head;             /* bytes ever written */
+    volatile unsigned tail;             /* bytes ever read */
+} shm_ring_t;
+
+static unsigned char buf[CHUNK] __attribute__((aligned(4096)));
+
+static void fill(unsigned char* p, unsigned off, unsigned n) {
+    for (unsigned i = 0; i < n; i++) p[i] = (unsigned char)(off + i);
+}
+
+static int same(const unsigned char* p, unsigned off, unsigned n) {
+    for (unsigned i = 0; i < n; i++)
+        if (p[i] != (unsigned char)(off + i)) return 0;
+    return 1;
+}
+
+static int send_shm(shm_ring_t* r, unsigned bytes) {
+    unsigned char* data = (unsigned char*)r + 4096;
+    for (unsigned sent = 0; sent < bytes; sent += CHUNK) {
+        unsigned tail;
+        while (sent - (tail = r->tail) > RING - CHUNK)
+            if (futex_wait(&r->tail, tail, 1000) == FUTEX_TIMEOUT) return -1;
+        fill(data + sent % RING, sent, CHUNK);
+        __atomic_store_n(&r->head, sent + CHUNK, __ATOMIC_RELEASE);
+        futex_wake(&r->head, 1);
+    }
+    return 0;
+}
+
+static int recv_shm(shm_ring_t* r, unsigned bytes, unsigned long long* start) {
+    unsigned char* data = (unsigned char*)r + 4096;
+    for (unsigned got = 0; got < bytes; got += CHUNK) {
+        unsigned head;
+        while ((head = r->head) == got)
+            if (futex_wait(&r->head, head, 1000) == FUTEX_TIMEOUT) return -1;
+        if (!got) *start = clock_ns();
+        if (!same(data + got % RING, got, CHUNK)) return -1;
+        __atomic_store_n(&r->tail, got + CHUNK, __ATOMIC_RELEASE);
+        futex_wake(&r->tail, 1);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) return -1;
+    char mode = argv[1][0];             /* p(ipe), m(q), p(a)ges, s(hm) */
+    if (mode == 'p' && argv[1][1] == 'a') mode = 'g';
+    int      send  = argv[2][0] == 's';
+    unsigned bytes = (unsigned)(argc > 3 ? atoi(argv[3]) : 1024) * 1024 / CHUNK * CHUNK;
+
+    int fd = send ? 1 : 0;
+    shm_ring_t* ring = 0;
+    if (mode == 'm' || mode == 'g') fd = mq_open(NAME, send ? O_WRONLY : O_RDONLY, 0);
+    if (mode == 's') ring = (shm_ring_t*)shm_map(NAME, 0, O_RDWR);
+    if (fd < 0 || (mode == 's' && !ring)) return -1;
+
+    if (send) {
+        if (mode == 's') return send_shm(ring, bytes);
+        for (unsigned sent = 0; sent < bytes; sent += CHUNK) {
+            fill(buf, sent, CHUNK);
+            int n = mode == 'g' ? mq_send_pages(fd, buf, CHUNK / 4096)
+                                : write(fd, buf, CHUNK);
+            if (n != CHUNK) return -1;
+        }
+        return 0;
+    }
+
+    unsigned long long start = 0;
+    if (mode == 's') {
+        if (recv_shm(ring, bytes, &start) < 0) return -1;
+    } else {
+        for (unsigned got = 0; got < bytes; ) {
+            int n = mode == 'g' ? mq_receive(fd, buf, CHUNK)
+                                : read(fd, buf, CHUNK);
+            if (n <= 0 || !same(buf, got, (unsigned)n)) return -1;
+            if (!got) start = clock_ns();
+            got += (unsigned)n;
+        }
+    }
+    return (int)udiv64(clock_ns() - start, 1000, 0);
+}
@@ -0,0 +1,18 @@
+#include "ulib.h"
+
+/* nullsys <int|sysenter> [calls]: getpid over and over through one
+ * entry method. exits with the average round trip in TSC cycles,
+ * which is how "bench syscall" gets the number back */
+int main(int argc, char** argv) {
+    int fast  = argc > 1 && argv[1][0] == 's';
+    int calls = argc > 2 ? atoi(argv[2]) : 10000;
+    if (calls < 1) calls = 1;
+
+    unsigned start = rdtsc32();
+    if (fast) {
+        for (int i = 0; i < calls; i++) sysenter3(SYS_GETPID, 0, 0, 0);
+    } else {
+        for (int i = 0; i < calls; i++) syscall3(SYS_GETPID, 0, 0, 0);
+    }
+    return (int)((rdtsc32() - start) / (unsigned)calls);
+}
@@ -0,0 +1,38 @@
+#include "ulib.h"
+
+#define BATCH 32
+
+/* ringbench <sys|ring> [ops]: fstat on stdout ops times, either one
+ * system call each or BATCH at a time through the submission ring.
+ * exits with the average cost per op in TSC cycles, or -1 if any op
+ * failed, which is how "bench ring" gets the number back */
+int main(int argc, char** argv) {
+    int batched = argc > 1 && argv[1][0] == 'r';
+    int ops     = argc > 2 ? atoi(argv[2]) : 10000;
+    if (ops < 1) ops = 1;
+    struct stat st;
+
+    if (!batched) {
+        unsigned start = rdtsc32();
+        for (int i = 0; i < ops; i++)
+            if (fstat(1, &st) < 0) return -1;
+        return (int)((rdtsc32() - start) / (unsigned)ops);
+    }
+
+    ring_hdr_t* h = ring_setup(BATCH);
+    if (!h) return -1;
+    unsigned start = rdtsc32();
+    for (int done = 0; done < ops; ) {
+        int n = ops - done < BATCH ? ops - done : BATCH;
+        for (int i = 0; i < n; i++)
+            ring_sqe(h, SYS_FSTAT, 1, (unsigned)&st, 0, (unsigned)(done + i));
+        if (ring_enter((unsigned)n, (unsigned)n) != n) return -1;
+        ring_cqe_t* cqe;
+        while ((cqe = ring_cqe(h))) {
+            if (cqe->res < 0) return -1;
+            ring_cqe_seen(h);
+        }
+        done += n;
+    }
+    return (int)((rdtsc32() - start) / (unsigned)ops);
+}
@@ -0,0 +1,7 @@
+#include "ulib.h"
+
+/* does nothing, successfully: the smallest thing exec can run */
+int main(int argc, char** argv) {
+    (void)argc; (void)argv;
+    return 0;
+}
@@ -0,0 +1,194 @@
+#ifndef ULIB_H
+#define ULIB_H
+
+#include "syscall.h"
+#include "ring.h"
+#include "vvar.h"
+
+/* the whole of libc for the programs in user/: an entry point and the
+ * system calls, see include/syscall.h for the register conventions */
+
+static inline int syscall3(int num, int a, int b, int c) {
+    int ret;
+    __asm__ volatile ("int $0x80"
+                      : "=a"(ret) : "a"(num), "b"(a), "c"(b), "d"(c) : "memory");
+    return ret;
+}
+
+/* the same call through SYSENTER: the kernel returns to 1: with esp
+ * just past the return address we pushed */
+static inline int sysenter3(int num, int a, int b, int c) {
+    int ret;
+    __asm__ volatile ("pushl %%ebp\n"
+                      "pushl $1f\n"
+                      "movl %%esp, %%ebp\n"
+                      "sysenter\n"
+                      "1:\n"
+                      "popl %%ebp\n"
+                      : "=a"(ret), "+c"(b), "+d"(c)
+                      : "a"(num), "b"(a) : "memory");
+    return ret;
+}
+
+static inline void __attribute__((noreturn)) exit(int code) {
+    syscall3(SYS_EXIT, code, 0, 0);
+    for (;;) ;
+}
+
+static inline int read(int fd, void* buf, unsigned n)        { return syscall3(SYS_READ, fd, (int)buf, (int)n); }
+static inline int write(int fd, const void* buf, unsigned n) { return syscall3(SYS_WRITE, fd, (int)buf, (int)n); }
+static inline int open(const char* path, int flags)          { return syscall3(SYS_OPEN, (int)path, flags, 0); }
+static inline int close(int fd)                               { return syscall3(SYS_CLOSE, fd, 0, 0); }
+static inline int getpid(void)                                { return syscall3(SYS_GETPID, 0, 0, 0); }
+static inline int pipe(int fds[2])                            { return syscall3(SYS_PIPE, (int)fds, 0, 0); }
+
+/* mirrors kstat_t */
+struct stat {
+    unsigned       st_ino;
+    unsigned short st_mode;
+    unsigned       st_size;
+    unsigned       st_blksize;
+};
+
+static inline int fstat(int fd, struct stat* st)              { return syscall3(SYS_FSTAT, fd, (int)st, 0); }
+
+static inline int futex_wait(volatile unsigned* addr, unsigned expected, unsigned timeout_ms) {
+    return syscall3(SYS_FUTEX_WAIT, (int)addr, (int)expected, (int)timeout_ms);
+}
+
+static inline int futex_wake(volatile unsigned* addr, int n) {
+    return syscall3(SYS_FUTEX_WAKE, (int)addr, n, 0);
+}
+
+/* named shared memory and message queues, see include/ipc.h.
+ * shm_map() returns where the segment landed, or 0 */
+static inline void* shm_map(const char* name, unsigned size, int flags) {
+    int r = syscall3(SYS_SHM_MAP, (int)name, (int)size, flags);
+    return r == -1 ? 0 : (void*)r;
+}
+
+static inline int shm_unmap(void* addr)          { return syscall3(SYS_SHM_UNMAP, (int)addr, 0, 0); }
+static inline int shm_unlink(const char* name)   { return syscall3(SYS_SHM_UNLINK, (int)name, 0, 0); }
+static inline int mq_unlink(const char* name)    { return syscall3(SYS_MQ_UNLINK, (int)name, 0, 0); }
+
+static inline int mq_open(const char* name, int flags, unsigned depth) {
+    return syscall3(SYS_MQ_OPEN, (int)name, flags, (int)depth);
+}
+
+/* write() and read() send and receive copies; these hand over whole
+ * pages instead, which leave the sender and, where buf allows, are
+ * mapped into the receiver */
+static inline int mq_send_pages(int fd, void* buf, unsigned npages) {
+    return syscall3(SYS_MQ_SEND_PAGES, fd, (int)buf, (int)npages);
+}
+
+static inline int mq_receive(int fd, void* buf, unsigned len) {
+    return syscall3(SYS_MQ_RECEIVE, fd, (int)buf, (int)len);
+}
+
+/* nanoseconds since boot: clock_ns() reads the vvar page, clock_ns_sys()
+ * asks the kernel for the same clock */
+static inline unsigned long long clock_ns(void) {
+    return vvar_clock_ns((const vvar_t*)VVAR_BASE);
+}
+
+static inline unsigned long long clock_ns_sys(void) {
+    unsigned long long ns = 0;
+    syscall3(SYS_CLOCK_NS, (int)&ns, 0, 0);
+    return ns;
+}
+
+/* ring.h from this side: set it up once, then queue calls with
+ * ring_sqe(), hand them over with ring_enter() and reap CQEs with
+ * ring_cqe() */
+static inline ring_hdr_t* ring_setup(unsigned entries) {
+    int r = syscall3(SYS_RING_SETUP, (int)entries, 0, 0);
+    return r == -1 ? 0 : (ring_hdr_t*)r;
+}
+
+static inline int ring_enter(unsigned to_submit, unsigned min_complete) {
+    return syscall3(SYS_RING_ENTER, (int)to_submit, (int)min_complete, 0);
+}
+
+/* queue one system call for the next ring_enter(); -1 if the SQ is full */
+static inline int ring_sqe(ring_hdr_t* h, unsigned op, unsigned a, unsigned b,
+                                   unsigned c, unsigned user_data) {
+    unsigned tail = h->sq_tail;
+    if (tail - h->sq_head >= h->entries) return -1;
+    ring_sqe_t* sqe = (ring_sqe_t*)((char*)h + h->sq_off) + (tail & (h->entries - 1));
+    sqe->op        = op;
+    sqe->arg[0]    = a;
+    sqe->arg[1]    = b;
+    sqe->arg[2]    = c;
+    sqe->user_data = user_data;
+    __atomic_store_n(&h->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* the oldest unreaped CQE, or 0; ring_cqe_seen() hands its slot back */
+static inline ring_cqe_t* ring_cqe(ring_hdr_t* h) {
+    unsigned head = h->cq_head;
+    if (head == __atomic_load_n(&h->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+    return (ring_cqe_t*)((char*)h + h->cq_off) + (head & (h->entries - 1));
+}
+
+static inline void ring_cqe_seen(ring_hdr_t* h) {
+    h->cq_head = h->cq_head + 1;
+}
+
+static inline unsigned strlen(const char* s) {
+    unsigned n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+static inline int print(const char* s) {
+    return write(1, s, strlen(s));
+}
+
+/* 64/32 division, quotient below 2^32, without libgcc */
+static inline unsigned udiv64(unsigned long long n, unsigned d, unsigned* rem) {
+    unsigned q, r;
+    __asm__ ("divl %3" : "=a"(q), "=d"(r) : "A"(n), "rm"(d));
+    if (rem) *rem = r;
+    return q;
+}
+
+static inline int print_uint(unsigned n) {
+    char num[12];
+    int i = sizeof(num) - 1;
+    num[i] = '\0';
+    do num[--i] = (char)('0' + n % 10); while ((n /= 10) && i > 0);
+    return print(num + i);
+}
+
+static inline int atoi(const char* s) {
+    int n = 0;
+    while (*s >= '0' && *s <= '9') n = n * 10 + (*s++ - '0');
+    return n;
+}
+
+static inline unsigned rdtsc32(void) {
+    unsigned lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+int main(int argc, char** argv);
+
+/* the kernel starts us with argc, then argv[], on the stack */
+__asm__ (
+    ".globl _start\n"
+    "_start:\n"
+    "    movl (%esp), %eax\n"
+    "    leal 4(%esp), %edx\n"
+    "    pushl %edx\n"
+    "    pushl %eax\n"
+    "    call main\n"
+    "    movl %eax, %ebx\n"
+    "    xorl %eax, %eax\n"         /* SYS_EXIT */
+    "    int $0x80\n"
+    "1:  jmp 1b\n"
+);
+
+#endif /* ULIB_H */
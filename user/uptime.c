@@ -0,0 +1,27 @@
+#include "ulib.h"
+
+/* uptime: time since boot, read from the vvar page without entering
+ * the kernel */
+int main(int argc, char** argv) {
+    (void)argc; (void)argv;
+    unsigned ms;
+    unsigned sec = udiv64(clock_ns(), 1000000000u, &ms);
+    ms /= 1000000;
+
+    print("up ");
+    if (sec >= 3600) {
+        print_uint(sec / 3600);
+        print("h ");
+    }
+    if (sec >= 60) {
+        print_uint(sec / 60 % 60);
+        print("m ");
+    }
+    print_uint(sec % 60);
+    print(".");
+    if (ms < 100) print("0");
+    if (ms < 10) print("0");
+    print_uint(ms);
+    print("s\n");
+    return 0;
+}